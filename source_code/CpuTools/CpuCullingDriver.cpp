@@ -0,0 +1,517 @@
+//--------------------------------------------------------------------------------------
+// File: CpuCullingDriver.cpp
+//
+// A command line driver of the CPU culling reference on the synthetic scene of CpuTestScene.
+// Usage: CpuCullingDriver <command> [-option value]..., README.md lists the commands.
+//--------------------------------------------------------------------------------------
+#include "CpuTestScene.h"
+#include "CpuCullingBenchmark.h"
+#include "CpuLightCulling.h"
+#include "CpuLightPass.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+// The options of all commands.
+struct DriverOptions
+{
+	uint uWidth;
+	uint uHeight;
+	uint uLightNum;
+	float fRadiusScale;		// Lights have radiuses up to this scale.
+	uint uSpotNum;			// The last lights are spot and capsule lights (AddTestLightShapes).
+	uint uCapsuleNum;
+	uint uBoxNum;			// Boxes in front of the scene (AddTestBoxes).
+	float fOffset;			// Units the camera and the lights are moved along x and z (MoveTestScene).
+	uint uDepthDim;
+	uint uCoarseTileFactor;	// Coarse tiles of uCoarseTileFactor*uCoarseTileFactor tiles, 1 culls tiles against all lights.
+	uint uSubdivision;		// TileSubdivision*.
+	uint uTileTest;			// LightTileTest*.
+	bool bUseDepthBins;		// Depth bin culling (2.5D culling).
+	bool bSelectDiagonals;	// Select the diagonal of every tile by its depth samples.
+	bool bUseLightOcclusion;	// Reject lights behind the depth pyramid before culling.
+	bool bUseLightScatter;	// Bin lights to tiles before culling.
+	uint uIterations;		// Runs averaged by a benchmark.
+	uint uThreadNum;		// Threads of the scheduler, 1 runs everything on the calling thread and 0 uses all hardware threads.
+	uint uPixelStep;		// Brute-force checks test every uPixelStep-th pixel in both directions.
+};
+
+struct DriverCommand
+{
+	const char* pName;
+	const char* pDescription;
+	int(*pRun)(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler);
+};
+
+static const char* const CullingKernelNames[] = { "reference", "scalar", "simd", "bvh" };
+
+// Set up a culler with the depth buffer of the scene.
+static void InitCuller(CpuLightCuller& culler, uint uSubdivision, const DriverOptions& options, const CpuTestScene& scene,
+	CpuTaskScheduler* const pScheduler)
+{
+	culler.Init(uSubdivision);
+	culler.SetScheduler(pScheduler);
+	culler.SetCoarseTileFactor(options.uCoarseTileFactor);
+	culler.SetTileTest(options.uTileTest);
+	culler.SetDepthBinCulling(options.bUseDepthBins);
+	culler.SetDiagonalSelection(options.bSelectDiagonals);
+	culler.SetLightOcclusion(options.bUseLightOcclusion);
+	culler.SetLightScatter(options.bUseLightScatter);
+	culler.SetLightShapes(scene.shapes.empty() ? nullptr : scene.shapes.data());
+	culler.SetDepthBuffer(scene.depth.data(), scene.uWidth, scene.uHeight);
+	culler.SetDepthPlanes(scene.depthPlanes.data(), (uint)scene.depthPlanes.size());
+}
+
+// Set up a culler like InitCuller and run it, and a light pass with the lists of the culler and the G-buffer of the scene.
+static void InitLightPass(CpuLightPass& pass, CpuLightCuller& culler, const DriverOptions& options, CpuTestScene& scene,
+	CpuTaskScheduler* const pScheduler)
+{
+	InitTestGBuffer(scene);
+	InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+	culler.Run(scene.cullingData, scene.viewData, scene.lights.data());
+	pass.SetScheduler(pScheduler);
+	pass.SetGBuffer(GetTestGBuffer(scene));
+	pass.SetLightTables(culler);
+}
+
+// Run every kernel and compare its lists with the reference kernel, and return the number of kernels which differ.
+static int RunKernels(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	CpuLightCuller reference;
+	InitCuller(reference, options.uSubdivision, options, scene, pScheduler);
+	reference.Run(scene.cullingData, scene.viewData, scene.lights.data());
+
+	int iMismatchedKernels = 0;
+	for (uint k = CpuCullingKernel_Reference; k <= CpuCullingKernel_Bvh; k++)
+	{
+		CpuLightCuller culler;
+		InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+		culler.SetKernel((CpuCullingKernelType)k);
+		culler.Run(scene.cullingData, scene.viewData, scene.lights.data());
+		uint uMismatched = CpuLightCuller::CountMismatchedPackedClusters(reference.GetLightListBuffer().data(),
+			reference.GetPackedIndexBuffer().data(), culler.GetLightListBuffer().data(), culler.GetPackedIndexBuffer().data(),
+			reference.GetClusterNum());
+		bool bMatched = uMismatched == 0 && culler.GetCounterBuffer() == reference.GetCounterBuffer();
+		printf("%-9s %8.2f ms  %10llu plane tests  %9llu lights  %u mismatched clusters%s\n", CullingKernelNames[k],
+			culler.GetStats().dTime*1e3, culler.GetStats().uPlaneTests, culler.GetStats().uLightIndices, uMismatched,
+			bMatched ? "" : "  MISMATCH");
+		iMismatchedKernels += bMatched ? 0 : 1;
+	}
+	printf("SIMD kernels: %s\n", GetCullingKernelName());
+	return iMismatchedKernels;
+}
+
+// Average culling runs of every kernel (BenchmarkCulling).
+static int RunCulling(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	for (uint k = CpuCullingKernel_Reference; k <= CpuCullingKernel_Bvh; k++)
+	{
+		CpuLightCuller culler;
+		InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+		culler.SetKernel((CpuCullingKernelType)k);
+		CpuCullingBenchmark result = BenchmarkCulling(culler, scene.cullingData, scene.viewData, scene.lights.data(), options.uIterations);
+		printf("%-9s %8.2f ms (build %.2f ms, pyramid %.2f ms, scatter %.2f ms)  %10llu plane tests  %9llu lights"
+			"  %u occluded lights  %llu scatter pairs  %u overflowing clusters  %u truncated clusters\n", CullingKernelNames[k],
+			result.dTime*1e3, result.dBuildTime*1e3, result.dPyramidTime*1e3, result.dScatterTime*1e3, result.uPlaneTests,
+			result.uLightIndices, result.uOccludedLights, result.uScatterPairs, culler.GetStats().overflow.overflowClusters,
+			culler.GetStats().overflow.truncatedClusters);
+	}
+	return 0;
+}
+
+// Compare index lists and bitmasks with every kernel: the culling time, and the time to walk the lights of all clusters.
+static int RunLightTable(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	for (uint k = CpuCullingKernel_Reference; k <= CpuCullingKernel_Bvh; k++)
+	{
+		CpuLightCuller culler;
+		InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+		culler.SetKernel((CpuCullingKernelType)k);
+		CpuLightTableBenchmark list = BenchmarkLightTable(culler, CpuLightTable_IndexList, scene.cullingData, scene.viewData,
+			scene.lights.data(), options.uIterations);
+		uint uOverflowClusters = culler.GetStats().overflow.overflowClusters;
+		CpuLightTableBenchmark mask = BenchmarkLightTable(culler, CpuLightTable_Bitmask, scene.cullingData, scene.viewData,
+			scene.lights.data(), options.uIterations);
+		printf("%-9s lists %8.2f ms  walk %6.2f ms  %10llu lights  %5.2f MB  %u overflowing clusters\n", CullingKernelNames[k],
+			list.dCullTime*1e3, list.dWalkTime*1e3, list.uVisitedLights, list.uTableBytes / 1e6, uOverflowClusters);
+		printf("%-9s masks %8.2f ms  walk %6.2f ms  %10llu lights  %5.2f MB\n", "", mask.dCullTime*1e3, mask.dWalkTime*1e3,
+			mask.uVisitedLights, mask.uTableBytes / 1e6);
+	}
+	return 0;
+}
+
+// Compare the lights in the order of the scene and in Morton order: the culling time, and the cache lines of the light
+// buffer read by the lists of clusters and tiles. Return 1 if the orders visit different lights.
+static int RunLightOrder(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	CpuLightOrderBenchmark results[2];
+	for (uint uMorton = 0; uMorton < 2; uMorton++)
+	{
+		CpuLightCuller culler;
+		InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+		CpuLightOrderBenchmark& result = results[uMorton];
+		result = BenchmarkLightOrder(culler, uMorton != 0, scene.cullingData, scene.viewData, scene.lights.data(), options.uIterations);
+		printf("%-7s %8.2f ms  walk %6.2f ms  %10llu lights  %9llu cluster lines  %9llu tile lines\n",
+			uMorton ? "morton" : "scene", result.dCullTime*1e3, result.dWalkTime*1e3, result.uVisitedLights, result.uCacheLines,
+			result.uTileCacheLines);
+	}
+	return results[0].uVisitedLights == results[1].uVisitedLights && results[0].uChecksum == results[1].uChecksum ? 0 : 1;
+}
+
+// Check every pattern with and without depth bins against the lights which reach every pixel by brute force, and return
+// the number of configurations which miss lights.
+static int RunCoverage(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	static const char* const PatternNames[] = { "quad", "diagonal", "anti-diagonal", "center" };
+	int iMissingConfigurations = 0;
+	for (uint uPattern = 0; uPattern < TileSubdivisionPatternNum; uPattern++)
+	{
+		for (uint uBins = 0; uBins < 2; uBins++)
+		{
+			CpuLightCuller culler;
+			InitCuller(culler, uPattern, options, scene, pScheduler);
+			culler.SetDepthBinCulling(uBins != 0);
+			culler.Run(scene.cullingData, scene.viewData, scene.lights.data());
+			unsigned long long uMissed = culler.CountMissedPairs(scene.lights.data(), options.uPixelStep);
+			printf("%-13s%-6s %10llu light-pixel pairs  %llu missed pairs\n", PatternNames[uPattern], uBins ? "+bins" : "",
+				culler.GetStats().uLightPixelPairs, uMissed);
+			iMissingConfigurations += uMissed ? 1 : 0;
+		}
+	}
+	return iMissingConfigurations;
+}
+
+// Compare the light-versus-tile tests: the culling time, and the light-pixel pairs and false positives of the light pass.
+static int RunTileTests(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	static const char* const TileTestNames[] = { "planes", "aabb", "cone" };
+	for (uint uTileTest = 0; uTileTest < LightTileTestNum; uTileTest++)
+	{
+		CpuLightCuller culler;
+		InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+		CpuTileTestBenchmark result = BenchmarkTileTest(culler, uTileTest, scene.cullingData, scene.viewData, scene.lights.data(),
+			options.uIterations);
+		printf("%-6s %8.2f ms  %9llu lights  %10llu light-pixel pairs  %10llu false positives  %6u in the worst tile\n",
+			TileTestNames[uTileTest], result.dTime*1e3, result.uLightIndices, result.uLightPixelPairs, result.uFalsePositivePairs,
+			result.uWorstTileFalsePositives);
+	}
+	return 0;
+}
+
+// Cull with and without the tile plane table, and return the number of clusters whose lists with the table miss lights of
+// the lists without it. Both create the planes of a tile with the same math, so the lists should also match.
+static int RunTilePlanes(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	CpuLightCuller cullers[2];
+	for (uint uTable = 0; uTable < 2; uTable++)
+	{
+		CpuLightCuller& culler = cullers[uTable];
+		InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+		culler.SetTilePlaneTable(uTable != 0);
+		culler.Run(scene.cullingData, scene.viewData, scene.lights.data());
+		printf("%-8s %8.2f ms  %10llu plane tests  %9llu lights  %u table builds\n", uTable ? "table" : "clusters",
+			culler.GetStats().dTime*1e3, culler.GetStats().uPlaneTests, culler.GetStats().uLightIndices,
+			culler.GetStats().uTilePlaneBuilds);
+	}
+	const CpuLightCuller& base = cullers[0];
+	const CpuLightCuller& table = cullers[1];
+	uint uUncovered = CpuLightCuller::CountUncoveredClusters(table.GetClusteredBuffer().data(), table.GetCounterBuffer().data(),
+		base.GetClusteredBuffer().data(), base.GetCounterBuffer().data(), base.GetClusterNum());
+	uint uMismatched = CpuLightCuller::CountMismatchedClusters(table.GetClusteredBuffer().data(), table.GetCounterBuffer().data(),
+		base.GetClusteredBuffer().data(), base.GetCounterBuffer().data(), base.GetClusterNum());
+	printf("%u uncovered clusters  %u mismatched clusters\n", uUncovered, uMismatched);
+	return (int)uUncovered;
+}
+
+// Run an incremental culler through an idle frame, a frame with edited lights and a frame with a changed depth rectangle,
+// compare every frame with a full run, and return the number of frames which differ.
+static int RunIncremental(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	static const char* const FrameNames[] = { "first", "idle", "lights", "depth" };
+	CpuLightCuller incremental;
+	InitCuller(incremental, options.uSubdivision, options, scene, pScheduler);
+	incremental.SetIncremental(true);
+	int iMismatchedFrames = 0;
+	for (uint uFrame = 0; uFrame < 4; uFrame++)
+	{
+		if (uFrame == 2)
+		{
+			// Move and grow every 16th light.
+			for (size_t i = 0; i < scene.lights.size(); i += 16)
+			{
+				scene.lights[i].pos.x += 1.0f;
+				scene.lights[i].radius *= 1.5f;
+			}
+		}
+		else if (uFrame == 3)
+		{
+			// Move a quarter of the screen to the depth of the center pixel.
+			float fDepth = scene.depth[(scene.uHeight / 2)*scene.uWidth + scene.uWidth / 2];
+			for (uint y = scene.uHeight / 4; y < scene.uHeight / 2; y++)
+			{
+				std::fill_n(&scene.depth[y*scene.uWidth + scene.uWidth / 4], scene.uWidth / 2, fDepth);
+			}
+		}
+		incremental.Run(scene.cullingData, scene.viewData, scene.lights.data());
+		CpuLightCuller full;
+		InitCuller(full, options.uSubdivision, options, scene, pScheduler);
+		full.Run(scene.cullingData, scene.viewData, scene.lights.data());
+		uint uMismatched = CpuLightCuller::CountMismatchedPackedClusters(full.GetLightListBuffer().data(),
+			full.GetPackedIndexBuffer().data(), incremental.GetLightListBuffer().data(), incremental.GetPackedIndexBuffer().data(),
+			full.GetClusterNum());
+		bool bMatched = uMismatched == 0 && incremental.GetCounterBuffer() == full.GetCounterBuffer();
+		const CpuCullingStats& stats = incremental.GetStats();
+		printf("%-6s %8.2f ms (full %8.2f ms)  %-7s  %5u dirty tiles  %5u dirty lights  %u mismatched clusters%s\n",
+			FrameNames[uFrame], stats.dTime*1e3, full.GetStats().dTime*1e3, stats.incremental.bPatched ? "patched" : "rebuilt",
+			stats.incremental.uDirtyTiles, stats.incremental.uDirtyLights, uMismatched, bMatched ? "" : "  MISMATCH");
+		iMismatchedFrames += bMatched ? 0 : 1;
+	}
+	return iMismatchedFrames;
+}
+
+// Run every overflow policy, print its overflow statistics, and return the number of policies which lose lights: lights
+// missed by clusters that are not clamped, lists truncated because the packed light indexes are full, or lights dropped by
+// a policy which keeps all lights.
+static int RunOverflow(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	static const char* const PolicyNames[] = { "clamp", "spill", "split" };
+	int iMissingPolicies = 0;
+	for (uint uPolicy = 0; uPolicy < LightOverflowPolicyNum; uPolicy++)
+	{
+		CpuLightCuller culler;
+		InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+		culler.SetOverflowPolicy(uPolicy);
+		culler.Run(scene.cullingData, scene.viewData, scene.lights.data());
+		const CpuCullingStats& stats = culler.GetStats();
+		unsigned long long uMissed = culler.CountMissedPairs(scene.lights.data(), options.uPixelStep);
+		printf("%-6s %8.2f ms  %5u overflowing clusters (max %4u lights)  %6u dropped  %6u spilled  %5u split  %u truncated"
+			"  %llu missed pairs  %u/%u packed slots (%.1f per cluster)\n", PolicyNames[uPolicy], stats.dTime*1e3,
+			stats.overflow.overflowClusters, stats.overflow.maxClusterLights, stats.overflow.droppedLights,
+			stats.overflow.spilledLights, stats.overflow.splitClusters, stats.overflow.truncatedClusters, uMissed,
+			stats.overflow.requiredIndexes, culler.GetPackedIndexCapacity(),
+			(double)culler.GetPackedIndexCapacity() / culler.GetClusterNum());
+		bool bDropped = uPolicy != LightOverflowClamp && stats.overflow.droppedLights > 0;
+		iMissingPolicies += uMissed || stats.overflow.truncatedClusters || bDropped ? 1 : 0;
+	}
+	return iMissingPolicies;
+}
+
+// Compare the shape tests of spot and capsule lights with their bounding spheres: the lights of every type in the lists,
+// and the light-pixel pairs and false positives of the light pass.
+static int RunLightShapes(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	for (uint uShapes = 0; uShapes < 2; uShapes++)
+	{
+		CpuLightCuller culler;
+		InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+		CpuLightShapeBenchmark result = BenchmarkLightShapes(culler, uShapes != 0, scene.cullingData, scene.viewData,
+			scene.lights.data(), options.uIterations);
+		printf("%-7s %8.2f ms  %9llu lights (%llu point, %llu spot, %llu capsule)  %10llu light-pixel pairs  %10llu false positives\n",
+			uShapes ? "shapes" : "spheres", result.dTime*1e3, result.uLightIndices, result.typeIndices[LightTypePoint],
+			result.typeIndices[LightTypeSpot], result.typeIndices[LightTypeCapsule], result.uLightPixelPairs, result.uFalsePositivePairs);
+	}
+	return 0;
+}
+
+// Report the quality of the lists of per tile culling and of the triangle pattern, with waves of 8x4 pixels (32 lanes),
+// and return the number of reports whose pairs differ from CountFalsePositives.
+static int RunCullingQuality(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	uint uSubdivisions[2] = { TileSubdivisionQuad, options.uSubdivision };
+	const char* const pNames[2] = { "PerTileCullingCS", "PerTriangleCullingCS" };
+	int iMismatchedReports = 0;
+	for (uint i = 0; i < 2; i++)
+	{
+		CpuLightCuller culler;
+		InitCuller(culler, uSubdivisions[i], options, scene, pScheduler);
+		CpuCullingQualityBenchmark result = BenchmarkCullingQuality(culler, uSubdivisions[i], 8, 4, scene.cullingData,
+			scene.viewData, scene.lights.data(), options.uIterations);
+		printf("%s", FormatCullingQuality(pNames[i], result).c_str());
+		CpuFalsePositiveStats stats;
+		culler.CountFalsePositives(scene.lights.data(), stats);
+		bool bMatched = result.quality.uLightPixelPairs == stats.uLightPixelPairs &&
+			result.quality.uFalsePositivePairs == stats.uFalsePositivePairs;
+		iMismatchedReports += bMatched ? 0 : 1;
+		if (!bMatched)
+		{
+			printf("MISMATCH: %llu light-pixel pairs and %llu false positives in CountFalsePositives\n", stats.uLightPixelPairs,
+				stats.uFalsePositivePairs);
+		}
+	}
+	return iMismatchedReports;
+}
+
+// Compare view-space lights with transforming the lights in every cluster with every kernel: the light transforms of a run
+// and the estimated ALU of the transforms of the GPU culling stages. Returns the number of kernels whose lists differ.
+static int RunLightTransforms(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	int iMismatchedKernels = 0;
+	for (uint k = CpuCullingKernel_Reference; k <= CpuCullingKernel_Bvh; k++)
+	{
+		CpuLightCuller cullers[2];
+		for (uint uViewSpace = 0; uViewSpace < 2; uViewSpace++)
+		{
+			CpuLightCuller& culler = cullers[uViewSpace];
+			InitCuller(culler, options.uSubdivision, options, scene, pScheduler);
+			culler.SetKernel((CpuCullingKernelType)k);
+			CpuLightTransformBenchmark result = BenchmarkLightTransforms(culler, uViewSpace != 0, scene.cullingData,
+				scene.viewData, scene.lights.data(), options.uIterations);
+			printf("%-9s %-7s %8.2f ms  %9llu lights  %10llu transforms  %11llu GPU ops\n", uViewSpace ? "" : CullingKernelNames[k],
+				uViewSpace ? "view" : "cluster", result.dTime*1e3, result.uLightIndices, result.uLightTransforms,
+				result.uGpuTransformOps);
+		}
+		uint uMismatched = CpuLightCuller::CountMismatchedPackedClusters(cullers[0].GetLightListBuffer().data(),
+			cullers[0].GetPackedIndexBuffer().data(), cullers[1].GetLightListBuffer().data(), cullers[1].GetPackedIndexBuffer().data(),
+			cullers[0].GetClusterNum());
+		if (uMismatched != 0)
+		{
+			printf("MISMATCH: %u clusters differ with view-space lights\n", uMismatched);
+			iMismatchedKernels++;
+		}
+	}
+	return iMismatchedKernels;
+}
+
+// Compare every policy of shading tiers with the full GGX of every pair: the pairs of every tier, the estimated ALU of the
+// BRDFs on the GPU, and the error of the image (BenchmarkShadingTiers). Returns the number of policies whose ALU is over the
+// full GGX, or whose image differs with the fixed policy.
+static int RunShadingTiers(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	static const char* const PolicyNames[] = { "fixed", "distance", "intensity" };
+	CpuLightCuller culler;
+	CpuLightPass pass;
+	InitLightPass(pass, culler, options, scene, pScheduler);
+	int iFailedPolicies = 0;
+	for (uint uPolicy = 0; uPolicy < ShadingTierPolicyNum; uPolicy++)
+	{
+		CpuShadingTierBenchmark result = BenchmarkShadingTiers(pass, uPolicy, scene.viewData, scene.lights.data(),
+			scene.shapes.data(), options.uIterations);
+		bool bPassed = result.uAluOps <= result.uReferenceAluOps &&
+			(uPolicy != ShadingTierPolicyFixed || (result.uAluOps == result.uReferenceAluOps && result.diff.dRmsError == 0.0));
+		printf("%-9s %8.2f ms  %9llu %9llu %9llu tier pairs  %5.1f%% of the full GGX ALU  RMS error %.2g  max relative error %.2g%s\n",
+			PolicyNames[uPolicy], result.dTime*1e3, result.tierPairs[ShadingTierFull], result.tierPairs[ShadingTierFast],
+			result.tierPairs[ShadingTierLambertBlinn], result.uReferenceAluOps ? 100.0*result.uAluOps / result.uReferenceAluOps : 0.0,
+			result.diff.dRmsError, result.diff.fMaxRelativeError, bPassed ? "" : "  FAILED");
+		iFailedPolicies += bPassed ? 0 : 1;
+	}
+	return iFailedPolicies;
+}
+
+// Compare the positions of pixels reconstructed from view rays and with InvPV, and the images of view-space and world-space
+// lighting (BenchmarkViewSpaceLighting).
+static int RunReconstruction(const DriverOptions& options, CpuTestScene& scene, CpuTaskScheduler* const pScheduler)
+{
+	CpuLightCuller culler;
+	CpuLightPass pass;
+	InitLightPass(pass, culler, options, scene, pScheduler);
+	CpuReconstructionBenchmark result = BenchmarkViewSpaceLighting(pass, scene.viewData, scene.lights.data(), scene.shapes.data(),
+		options.uIterations);
+	printf("view rays %8.2f ms  max error %.3g (relative %.3g)  RMS error %.3g  %u ops\n", result.dTime*1e3,
+		result.dViewRayMaxError, result.dViewRayMaxRelativeError, result.dViewRayRmsError, result.uViewRayOps);
+	printf("InvPV     %8.2f ms  max error %.3g (relative %.3g)  RMS error %.3g  %u ops\n", result.dReferenceTime*1e3,
+		result.dInvPVMaxError, result.dInvPVMaxRelativeError, result.dInvPVRmsError, result.uInvPVOps);
+	printf("image     max relative error %.3g  RMS error %.3g  %u pixels over %g\n", result.diff.fMaxRelativeError,
+		result.diff.dRmsError, result.diff.uPixelsOverTolerance, CpuLightPassTolerance);
+	return 0;
+}
+
+static const DriverCommand DriverCommands[] =
+{
+	{ "kernels", "compare the lists of every culling kernel with the reference kernel", RunKernels },
+	{ "culling", "time every culling kernel (BenchmarkCulling)", RunCulling },
+	{ "table", "compare index lists and bitmasks with every kernel (BenchmarkLightTable)", RunLightTable },
+	{ "coverage", "find lights missing from the lists of their pixels by brute force (CountMissedPairs)", RunCoverage },
+	{ "tiletests", "compare the false positives of the light-versus-tile tests (BenchmarkTileTest)", RunTileTests },
+	{ "order", "compare lights in the order of the scene and in Morton order (BenchmarkLightOrder)", RunLightOrder },
+	{ "planes", "check that the lists with the tile plane table cover the lists without it (SetTilePlaneTable)", RunTilePlanes },
+	{ "overflow", "compare the overflow policies of lists over PerClusterMaxLight (SetOverflowPolicy)", RunOverflow },
+	{ "shapes", "compare the shape tests of spot and capsule lights with their bounding spheres (BenchmarkLightShapes)", RunLightShapes },
+	{ "quality", "report list lengths, false positives and wasted GGX of per tile and per triangle culling (BenchmarkCullingQuality)",
+		RunCullingQuality },
+	{ "transforms", "compare view-space lights with transforms in every cluster (BenchmarkLightTransforms)", RunLightTransforms },
+	{ "tiers", "compare the policies of shading tiers with the full GGX (BenchmarkShadingTiers)", RunShadingTiers },
+	{ "reconstruction", "compare view-ray and InvPV positions of pixels (BenchmarkViewSpaceLighting)", RunReconstruction },
+	{ "incremental", "compare idle and edited frames of an incremental culler with full runs (SetIncremental)", RunIncremental },
+};
+
+static void PrintUsage()
+{
+	printf("Usage: CpuCullingDriver <command> [-option value]...\nCommands:\n");
+	for (const DriverCommand& command : DriverCommands)
+	{
+		printf("  %-14s %s\n", command.pName, command.pDescription);
+	}
+	printf("Options: -width (1920) -height (1080) -lights (2048) -radius (4) -spots (0) -capsules (0) -boxes (0) -offset (0)\n"
+		"  -slices (8) -coarse (1) -pattern (%u, TileSubdivision*) -tiletest (%u, LightTileTest*) -depthbins (%u) -diagonals (%u)\n"
+		"  -occlusion (%u) -scatter (%u) -iterations (5) -threads (1, 0 uses all hardware threads) -step (1)\n", TileSubdivision,
+		LightTileTest, UseDepthBinCulling ? 1 : 0, UseTileDiagonalSelection ? 1 : 0, UseLightOcclusion ? 1 : 0,
+		UseLightScatter ? 1 : 0);
+}
+
+int main(int argc, char** argv)
+{
+	DriverOptions options = { 1920, 1080, 2048, 4.0f, 0, 0, 0, 0.0f, 8, 1, TileSubdivision, LightTileTest, UseDepthBinCulling,
+		UseTileDiagonalSelection, UseLightOcclusion, UseLightScatter, 5, 1, 1 };
+	const DriverCommand* pCommand = nullptr;
+	for (const DriverCommand& command : DriverCommands)
+	{
+		if (argc > 1 && strcmp(argv[1], command.pName) == 0)
+		{
+			pCommand = &command;
+		}
+	}
+	if (!pCommand)
+	{
+		PrintUsage();
+		return 1;
+	}
+	for (int i = 2; i + 1 < argc; i += 2)
+	{
+		const char* pOption = argv[i];
+		const char* pValue = argv[i + 1];
+		if (strcmp(pOption, "-width") == 0) options.uWidth = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-height") == 0) options.uHeight = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-lights") == 0) options.uLightNum = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-radius") == 0) options.fRadiusScale = (float)atof(pValue);
+		else if (strcmp(pOption, "-spots") == 0) options.uSpotNum = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-capsules") == 0) options.uCapsuleNum = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-boxes") == 0) options.uBoxNum = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-offset") == 0) options.fOffset = (float)atof(pValue);
+		else if (strcmp(pOption, "-slices") == 0) options.uDepthDim = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-coarse") == 0) options.uCoarseTileFactor = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-pattern") == 0) options.uSubdivision = std::min((uint)atoi(pValue), (uint)TileSubdivisionPatternNum - 1);
+		else if (strcmp(pOption, "-tiletest") == 0) options.uTileTest = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-depthbins") == 0) options.bUseDepthBins = atoi(pValue) != 0;
+		else if (strcmp(pOption, "-diagonals") == 0) options.bSelectDiagonals = atoi(pValue) != 0;
+		else if (strcmp(pOption, "-occlusion") == 0) options.bUseLightOcclusion = atoi(pValue) != 0;
+		else if (strcmp(pOption, "-scatter") == 0) options.bUseLightScatter = atoi(pValue) != 0;
+		else if (strcmp(pOption, "-iterations") == 0) options.uIterations = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-threads") == 0) options.uThreadNum = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-step") == 0) options.uPixelStep = (uint)atoi(pValue);
+		else
+		{
+			printf("Unknown option %s\n", pOption);
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	CpuTestScene scene;
+	InitTestScene(scene, options.uWidth, options.uHeight, options.uLightNum, options.fRadiusScale, options.uDepthDim);
+	if (options.fOffset != 0.0f)
+	{
+		MoveTestScene(scene, options.fOffset);
+	}
+	AddTestLightShapes(scene, options.uSpotNum, options.uCapsuleNum, options.fRadiusScale);
+	AddTestBoxes(scene, options.uBoxNum);
+	CpuTaskScheduler scheduler;
+	if (options.uThreadNum != 1)
+	{
+		scheduler.Init(options.uThreadNum);
+	}
+	printf("%s: %ux%u, %ux%u tiles of %.2fx%.2f pixels, %u lights (radius %g), %u slices, pattern %u\n", pCommand->pName,
+		options.uWidth, options.uHeight, scene.cullingData.widthDim, scene.cullingData.heightDim, scene.cullingData.tileSizeX,
+		scene.cullingData.tileSizeY, options.uLightNum, options.fRadiusScale, options.uDepthDim, options.uSubdivision);
+	return pCommand->pRun(options, scene, options.uThreadNum != 1 ? &scheduler : nullptr);
+}
@@ -0,0 +1,112 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightPassGolden.cpp
+//
+// Writes a golden image of the CPU light pass on the synthetic scene of CpuTestScene to a PFM file, and compares it with
+// a reference image (another golden or a GPU capture of the same scene) within CpuLightPassTolerance.
+// Usage: CpuLightPassGolden <image.pfm> [-option value]..., the exit code is the number of pixels over the tolerance.
+//--------------------------------------------------------------------------------------
+#include "CpuTestScene.h"
+#include "CpuLightCulling.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+static void PrintUsage()
+{
+	printf("Usage: CpuLightPassGolden <image.pfm> [-option value]...\n"
+		"Options: -width (1920) -height (1080) -lights (2048) -radius (4) -spots (0) -capsules (0) -pattern (%u, TileSubdivision*)\n"
+		"  -policy (%u, ShadingTierPolicy*) -kernel (simd, or scalar) -reference (a PFM image to compare with)\n",
+		TileSubdivision, ShadingTierPolicy);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		PrintUsage();
+		return 1;
+	}
+	const char* pImageName = argv[1];
+	const char* pReferenceName = nullptr;
+	uint uWidth = 1920, uHeight = 1080, uLightNum = 2048, uSpotNum = 0, uCapsuleNum = 0;
+	uint uSubdivision = TileSubdivision, uPolicy = ShadingTierPolicy;
+	float fRadiusScale = 4.0f;
+	CpuLightPassKernelType kernel = CpuLightPassKernel_Simd;
+	for (int i = 2; i + 1 < argc; i += 2)
+	{
+		const char* pOption = argv[i];
+		const char* pValue = argv[i + 1];
+		if (strcmp(pOption, "-width") == 0) uWidth = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-height") == 0) uHeight = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-lights") == 0) uLightNum = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-radius") == 0) fRadiusScale = (float)atof(pValue);
+		else if (strcmp(pOption, "-spots") == 0) uSpotNum = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-capsules") == 0) uCapsuleNum = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-pattern") == 0) uSubdivision = std::min((uint)atoi(pValue), (uint)TileSubdivisionPatternNum - 1);
+		else if (strcmp(pOption, "-policy") == 0) uPolicy = (uint)atoi(pValue);
+		else if (strcmp(pOption, "-kernel") == 0) kernel = strcmp(pValue, "scalar") == 0 ? CpuLightPassKernel_Scalar : CpuLightPassKernel_Simd;
+		else if (strcmp(pOption, "-reference") == 0) pReferenceName = pValue;
+		else
+		{
+			printf("Unknown option %s\n", pOption);
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	CpuTestScene scene;
+	InitTestScene(scene, uWidth, uHeight, uLightNum, fRadiusScale, 8);
+	if (uSpotNum + uCapsuleNum > 0)
+	{
+		uSpotNum = std::min(uSpotNum, uLightNum);
+		uCapsuleNum = std::min(uCapsuleNum, uLightNum - uSpotNum);
+		AddTestLightShapes(scene, uSpotNum, uCapsuleNum, fRadiusScale);
+	}
+	InitTestGBuffer(scene);
+
+	CpuLightCuller culler;
+	culler.Init(uSubdivision);
+	culler.SetDepthBuffer(scene.depth.data(), scene.uWidth, scene.uHeight);
+	culler.SetDepthPlanes(scene.depthPlanes.data(), (uint)scene.depthPlanes.size());
+	culler.SetLightShapes(scene.shapes.data());
+	culler.Run(scene.cullingData, scene.viewData, scene.lights.data());
+
+	CpuLightPass pass;
+	pass.SetKernel(kernel);
+	pass.SetShadingTierPolicy(uPolicy);
+	pass.SetGBuffer(GetTestGBuffer(scene));
+	pass.SetLightTables(culler);
+	uint uPixelNum = uWidth*uHeight;
+	std::vector<float> color(uPixelNum * 3);
+	float* const pColor[3] = { &color[0], &color[uPixelNum], &color[uPixelNum * 2] };
+	pass.Render(scene.viewData, scene.lights.data(), scene.shapes.data(), pColor);
+	const float* const pImage[3] = { pColor[0], pColor[1], pColor[2] };
+	if (!CpuLightPass::WriteLightPassImage(pImageName, pImage, uWidth, uHeight))
+	{
+		printf("Failed to write %s\n", pImageName);
+		return 1;
+	}
+	printf("%s: %ux%u, %u lights (%u spot, %u capsule), pattern %u, policy %u, %s kernel, %.2f ms\n", pImageName, uWidth,
+		uHeight, uLightNum, uSpotNum, uCapsuleNum, uSubdivision, pass.GetShadingTierPolicy(),
+		kernel == CpuLightPassKernel_Scalar ? "scalar" : GetLightPassKernelName(), pass.GetStats().dTime*1e3);
+	if (!pReferenceName)
+	{
+		return 0;
+	}
+
+	std::vector<float> reference;
+	uint uReferenceWidth = 0, uReferenceHeight = 0;
+	if (!CpuLightPass::ReadLightPassImage(pReferenceName, reference, uReferenceWidth, uReferenceHeight) ||
+		uReferenceWidth != uWidth || uReferenceHeight != uHeight)
+	{
+		printf("Failed to read %s, or it isn't %ux%u\n", pReferenceName, uWidth, uHeight);
+		return 1;
+	}
+	const float* const pReference[3] = { &reference[0], &reference[uPixelNum], &reference[uPixelNum * 2] };
+	CpuLightPassImageDifference diff;
+	CpuLightPass::CompareLightPassImages(pImage, pReference, uPixelNum, diff, CpuLightPassTolerance);
+	printf("%s: max error %g, max relative error %g, RMS error %g, %u pixels over %g\n", pReferenceName, diff.fMaxError,
+		diff.fMaxRelativeError, diff.dRmsError, diff.uPixelsOverTolerance, CpuLightPassTolerance);
+	return (int)std::min(diff.uPixelsOverTolerance, 255u);
+}
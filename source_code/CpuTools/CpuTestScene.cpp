@@ -0,0 +1,320 @@
+//--------------------------------------------------------------------------------------
+// File: CpuTestScene.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuTestScene.h"
+#include "CpuLightShape.h"
+#include <cmath>
+#include <random>
+#include <utility>
+#include <algorithm>
+
+// The seeds of the lights, the light shapes, the boxes and the G-buffer, every scene of the same size has the same content.
+#define TestSceneLightSeed 1
+#define TestSceneShapeSeed 7
+#define TestSceneGBufferSeed 3
+#define TestSceneBoxSeed 11
+
+// Brace initialization doesn't work with XMFLOAT4X4, so matrices are copied from arrays.
+static float4x4 CreateMatrix(const float values[4][4])
+{
+	float4x4 result;
+	for (uint i = 0; i < 4; i++)
+	{
+		for (uint j = 0; j < 4; j++)
+		{
+			result.m[i][j] = values[i][j];
+		}
+	}
+	return result;
+}
+
+static float4x4 MultiplyMatrix(const float4x4& a, const float4x4& b)
+{
+	float4x4 result;
+	for (uint i = 0; i < 4; i++)
+	{
+		for (uint j = 0; j < 4; j++)
+		{
+			float sum = 0.0f;
+			for (uint k = 0; k < 4; k++)
+			{
+				sum += a.m[i][k] * b.m[k][j];
+			}
+			result.m[i][j] = sum;
+		}
+	}
+	return result;
+}
+
+// ViewData stores the matrices transposed for HLSL.
+static float4x4 TransposeMatrix(const float4x4& a)
+{
+	float4x4 result;
+	for (uint i = 0; i < 4; i++)
+	{
+		for (uint j = 0; j < 4; j++)
+		{
+			result.m[i][j] = a.m[j][i];
+		}
+	}
+	return result;
+}
+
+// Gauss-Jordan elimination with partial pivoting in double precision.
+static float4x4 InvertMatrix(const float4x4& a)
+{
+	double rows[4][8];
+	for (uint i = 0; i < 4; i++)
+	{
+		for (uint j = 0; j < 4; j++)
+		{
+			rows[i][j] = a.m[i][j];
+			rows[i][j + 4] = i == j ? 1.0 : 0.0;
+		}
+	}
+	for (uint c = 0; c < 4; c++)
+	{
+		uint uPivot = c;
+		for (uint r = c + 1; r < 4; r++)
+		{
+			if (fabs(rows[r][c]) > fabs(rows[uPivot][c]))
+			{
+				uPivot = r;
+			}
+		}
+		for (uint j = 0; j < 8; j++)
+		{
+			std::swap(rows[c][j], rows[uPivot][j]);
+		}
+		double pivot = rows[c][c];
+		for (uint j = 0; j < 8; j++)
+		{
+			rows[c][j] /= pivot;
+		}
+		for (uint r = 0; r < 4; r++)
+		{
+			if (r != c)
+			{
+				double factor = rows[r][c];
+				for (uint j = 0; j < 8; j++)
+				{
+					rows[r][j] -= factor*rows[c][j];
+				}
+			}
+		}
+	}
+	float4x4 result;
+	for (uint i = 0; i < 4; i++)
+	{
+		for (uint j = 0; j < 4; j++)
+		{
+			result.m[i][j] = (float)rows[i][j + 4];
+		}
+	}
+	return result;
+}
+
+// The matrices of ViewData which depend on the view matrix, like CameraManager.
+static void UpdateViewData(CpuTestScene& scene)
+{
+	const float screenToProj[4][4] = { { 2.0f / scene.uWidth, 0.0f, 0.0f, 0.0f }, { 0.0f, -2.0f / scene.uHeight, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f, 0.0f }, { -1.0f, 1.0f, 0.0f, 1.0f } };
+	float4x4 projInv = InvertMatrix(scene.proj);
+	float4x4 viewInv = InvertMatrix(scene.view);
+	scene.viewData.MVP = TransposeMatrix(MultiplyMatrix(scene.view, scene.proj));
+	scene.viewData.InvPV = TransposeMatrix(MultiplyMatrix(MultiplyMatrix(CreateMatrix(screenToProj), projInv), viewInv));
+	scene.viewData.ProjInv = TransposeMatrix(projInv);
+	scene.viewData.View = TransposeMatrix(scene.view);
+	scene.viewData.Proj = TransposeMatrix(scene.proj);
+}
+
+void InitTestScene(CpuTestScene& scene, uint uWidth, uint uHeight, uint uLightNum, float fRadiusScale, uint uDepthDim)
+{
+	scene.uWidth = uWidth;
+	scene.uHeight = uHeight;
+	scene.fNearZ = 0.1f;
+	scene.fFarZ = 1000.0f;
+
+	// A left-handed perspective projection, and a camera at (0, 0, -20) turned 0.3 radians around y.
+	float fov = 3.14f*0.45f;
+	float yScale = 1.0f / tanf(fov / 2.0f);
+	float xScale = yScale / ((float)uWidth / uHeight);
+	float zRange = scene.fFarZ - scene.fNearZ;
+	const float proj[4][4] = { { xScale, 0.0f, 0.0f, 0.0f }, { 0.0f, yScale, 0.0f, 0.0f }, { 0.0f, 0.0f, scene.fFarZ / zRange, 1.0f },
+		{ 0.0f, 0.0f, -scene.fNearZ*scene.fFarZ / zRange, 0.0f } };
+	float angle = 0.3f;
+	const float rotation[4][4] = { { cosf(angle), 0.0f, -sinf(angle), 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f },
+		{ sinf(angle), 0.0f, cosf(angle), 0.0f }, { 0.0f, 0.0f, 0.0f, 1.0f } };
+	const float translation[4][4] = { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f },
+		{ 0.0f, 0.0f, 20.0f, 1.0f } };
+	scene.proj = CreateMatrix(proj);
+	scene.view = MultiplyMatrix(CreateMatrix(translation), CreateMatrix(rotation));
+	UpdateViewData(scene);
+	scene.viewData.CamPos = { 0.0f, 0.0f, -20.0f };
+
+	// Pillars 97 pixels wide in every third column, a wall behind them, and the sky in the top eighth of the image.
+	scene.depth.resize(uWidth*uHeight);
+	for (uint y = 0; y < uHeight; y++)
+	{
+		for (uint x = 0; x < uWidth; x++)
+		{
+			float viewZ = 40.0f + 30.0f*(float)y / uHeight;
+			if ((x / 97) % 3 == 0)
+			{
+				viewZ = 12.0f + (x % 97)*0.05f;
+			}
+			if (y < uHeight / 8)
+			{
+				viewZ = scene.fFarZ;
+			}
+			scene.depth[x + y*uWidth] = (viewZ*scene.proj.m[2][2] + scene.proj.m[3][2]) / viewZ;
+		}
+	}
+
+	// Exponential depth planes like main.cpp.
+	scene.depthPlanes.resize(uDepthDim + 1);
+	for (uint i = 0; i <= uDepthDim; i++)
+	{
+		float viewZ = scene.fNearZ*powf(scene.fFarZ / scene.fNearZ, (float)i / uDepthDim);
+		scene.depthPlanes[i] = (viewZ*scene.proj.m[2][2] + scene.proj.m[3][2]) / viewZ;
+	}
+
+	ClusteredData& cd = scene.cullingData;
+	cd.widthDim = GetTileNum(uWidth);
+	cd.heightDim = GetTileNum(uHeight);
+	cd.depthDim = uDepthDim;
+	cd.lightNum = uLightNum;
+	cd.spotLightNum = 0;
+	cd.capsuleLightNum = 0;
+	cd.tileSizeX = uWidth*(1 / (float)cd.widthDim);
+	cd.tileSizeY = uHeight*(1 / (float)cd.heightDim);
+
+	std::mt19937 random(TestSceneLightSeed);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	scene.lights.resize(uLightNum);
+	for (PointLight& light : scene.lights)
+	{
+		light.pos.x = uniform(random)*80.0f - 40.0f;
+		light.pos.y = uniform(random)*40.0f - 20.0f;
+		light.pos.z = uniform(random)*80.0f - 10.0f;
+		light.color.x = uniform(random);
+		light.color.y = uniform(random);
+		light.color.z = uniform(random);
+		light.radius = uniform(random)*fRadiusScale;
+	}
+}
+
+void MoveTestScene(CpuTestScene& scene, float fOffset)
+{
+	const float translation[4][4] = { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f },
+		{ -fOffset, 0.0f, -fOffset, 1.0f } };
+	scene.view = MultiplyMatrix(CreateMatrix(translation), scene.view);
+	UpdateViewData(scene);
+	float4x4 viewInv = InvertMatrix(scene.view);
+	scene.viewData.CamPos = { viewInv.m[3][0], viewInv.m[3][1], viewInv.m[3][2] };
+	for (PointLight& light : scene.lights)
+	{
+		light.pos.x += fOffset;
+		light.pos.z += fOffset;
+	}
+}
+
+void AddTestLightShapes(CpuTestScene& scene, uint uSpotNum, uint uCapsuleNum, float fRadiusScale)
+{
+	std::mt19937 random(TestSceneShapeSeed);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	uint uLightNum = (uint)scene.lights.size();
+	uSpotNum = std::min(uSpotNum, uLightNum);
+	uCapsuleNum = std::min(uCapsuleNum, uLightNum - uSpotNum);
+	uint uOffset = uLightNum - uSpotNum - uCapsuleNum;
+	scene.shapes.resize(uSpotNum + uCapsuleNum);
+	for (uint i = uOffset; i < uLightNum; i++)
+	{
+		float3 pos = scene.lights[i].pos;
+		float3 color = scene.lights[i].color;
+		LightShape& shape = scene.shapes[i - uOffset];
+		if (i < uOffset + uSpotNum)
+		{
+			float3 dir;
+			dir.x = uniform(random)*2.0f - 1.0f;
+			dir.y = uniform(random)*2.0f - 1.0f;
+			dir.z = uniform(random)*2.0f - 1.0f;
+			float length = sqrtf(dir.x*dir.x + dir.y*dir.y + dir.z*dir.z);
+			dir = { dir.x / length, dir.y / length, dir.z / length };
+			float fAngle = 0.1f + uniform(random)*1.7f;
+			float fRange = (0.3f + uniform(random))*fRadiusScale*1.5f;
+			scene.lights[i] = CreateSpotLight(pos, dir, fRange, fAngle, color, shape);
+		}
+		else
+		{
+			float3 end;
+			end.x = pos.x + (uniform(random)*2.0f - 1.0f)*fRadiusScale;
+			end.y = pos.y + (uniform(random)*2.0f - 1.0f)*fRadiusScale;
+			end.z = pos.z + (uniform(random)*2.0f - 1.0f)*fRadiusScale;
+			float fRange = (0.2f + uniform(random))*fRadiusScale*0.5f;
+			scene.lights[i] = CreateCapsuleLight(pos, end, fRange, color, shape);
+		}
+	}
+	scene.cullingData.spotLightNum = uSpotNum;
+	scene.cullingData.capsuleLightNum = uCapsuleNum;
+}
+
+void AddTestBoxes(CpuTestScene& scene, uint uBoxNum)
+{
+	std::mt19937 random(TestSceneBoxSeed);
+	for (uint i = 0; i < uBoxNum; i++)
+	{
+		uint uLeft = random() % scene.uWidth;
+		uint uTop = random() % scene.uHeight;
+		uint uRight = std::min(uLeft + 1 + (uint)(random() % 48), scene.uWidth);
+		uint uBottom = std::min(uTop + 1 + (uint)(random() % 48), scene.uHeight);
+		float viewZ = 5.0f + (float)(random() % 5500) / 100.0f;
+		float depth = (viewZ*scene.proj.m[2][2] + scene.proj.m[3][2]) / viewZ;
+		for (uint y = uTop; y < uBottom; y++)
+		{
+			for (uint x = uLeft; x < uRight; x++)
+			{
+				scene.depth[x + y*scene.uWidth] = std::min(scene.depth[x + y*scene.uWidth], depth);
+			}
+		}
+	}
+}
+
+void InitTestGBuffer(CpuTestScene& scene)
+{
+	std::mt19937 random(TestSceneGBufferSeed);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	uint uPixelNum = scene.uWidth*scene.uHeight;
+	for (std::vector<float>& plane : scene.gbuffer)
+	{
+		plane.resize(uPixelNum);
+	}
+	for (uint i = 0; i < uPixelNum; i++)
+	{
+		for (uint c = 0; c < 3; c++)
+		{
+			scene.gbuffer[c][i] = uniform(random);
+			scene.gbuffer[3 + c][i] = uniform(random)*2.0f - 1.0f;
+			scene.gbuffer[6 + c][i] = uniform(random);
+		}
+		scene.gbuffer[9][i] = 0.05f + uniform(random)*0.95f;
+	}
+}
+
+CpuGBuffer GetTestGBuffer(const CpuTestScene& scene)
+{
+	CpuGBuffer gbuffer;
+	for (uint c = 0; c < 3; c++)
+	{
+		gbuffer.pAlbedo[c] = scene.gbuffer[c].data();
+		gbuffer.pNormal[c] = scene.gbuffer[3 + c].data();
+	}
+	for (uint c = 0; c < 4; c++)
+	{
+		gbuffer.pSpecularGloss[c] = scene.gbuffer[6 + c].data();
+	}
+	gbuffer.pDepth = scene.depth.data();
+	gbuffer.uWidth = scene.uWidth;
+	gbuffer.uHeight = scene.uHeight;
+	return gbuffer;
+}
@@ -0,0 +1,42 @@
+//--------------------------------------------------------------------------------------
+// File: CpuTestScene.h
+//
+// A synthetic scene for the headless tools and tests, since the FBX scenes of the app need the FBX SDK and D3D12.
+// The camera looks down a street of pillars 12 units away, a wall from 40 to 70 units and the sky at the far plane.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <vector>
+#include "ShaderTypeDefine.h"
+#include "ClusteredCommon.h"
+#include "CameraCommon.h"
+#include "CpuLightPass.h"
+
+struct CpuTestScene
+{
+	uint uWidth;
+	uint uHeight;
+	float fNearZ;
+	float fFarZ;
+	float4x4 view;					// The view and projection matrices in DirectXMath layout (row vectors, not transposed).
+	float4x4 proj;
+	ViewData viewData;
+	ClusteredData cullingData;
+	std::vector<float> depth;		// Post-projection depth of every pixel.
+	std::vector<float> depthPlanes;	// depthDim+1 exponential depth planes in post-projection depth.
+	std::vector<PointLight> lights;
+	std::vector<LightShape> shapes;	// The shapes of the spot and capsule lights, the last lights of the light array.
+	std::vector<float> gbuffer[10];	// Planes of the albedo, the world-space normal and the specular-gloss of every pixel.
+};
+
+// Create a scene of uWidth*uHeight pixels with uLightNum point lights of radiuses up to fRadiusScale, and uDepthDim slices.
+// The tile numbers are rounded up like LightClusteredManager (GetTileNum).
+void InitTestScene(CpuTestScene& scene, uint uWidth, uint uHeight, uint uLightNum, float fRadiusScale, uint uDepthDim);
+// Move the camera and the lights by fOffset units along x and z, so the view-space scene doesn't change.
+void MoveTestScene(CpuTestScene& scene, float fOffset);
+// Replace the last uSpotNum+uCapsuleNum lights by spot and capsule lights at the positions of the lights they replace.
+void AddTestLightShapes(CpuTestScene& scene, uint uSpotNum, uint uCapsuleNum, float fRadiusScale);
+// Draw uBoxNum rectangles of 1 to 48 pixels per side in front of the scene, so depth edges fall on any row and column.
+void AddTestBoxes(CpuTestScene& scene, uint uBoxNum);
+// Fill the G-buffer with random materials and normals.
+void InitTestGBuffer(CpuTestScene& scene);
+CpuGBuffer GetTestGBuffer(const CpuTestScene& scene);
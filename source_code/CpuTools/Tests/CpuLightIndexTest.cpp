@@ -0,0 +1,181 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightIndexTest.cpp
+//
+// Round trips of packed light indexes (CpuLightIndex.h) in the layout of the culling shaders and the light passes.
+//--------------------------------------------------------------------------------------
+#include "CpuLightIndex.h"
+#include "CpuShaderMath.h"
+#include "CpuTest.h"
+#include <vector>
+#include <algorithm>
+
+// Words around a list keep this value, so stores past the slots of a list are detected.
+#define UnusedWord 0xdeadbeefu
+
+// The value of a slot outside of the written range.
+static uint GetUnusedSlot(uint uSlot)
+{
+	return GetPackedLightIndex(UnusedWord, uSlot);
+}
+
+// Pack indexes from uSlot, and check that they unpack to the same indexes and that the slots around them don't change.
+static void CheckRoundTrip(const std::vector<uint>& indexes, uint uSlot)
+{
+	uint uNum = (uint)indexes.size();
+	uint uSlotNum = uSlot + uNum + 4;
+	std::vector<uint> words(GetLightIndexWordNum(uSlotNum), UnusedWord);
+	PackLightIndexes(indexes.data(), uNum, words.data(), uSlot);
+
+	std::vector<uint> unpacked(uNum);
+	UnpackLightIndexes(words.data(), uSlot, uNum, unpacked.data());
+	CpuCheck(unpacked == indexes);
+	for (uint i = 0; i < uNum; i++)
+	{
+		CpuCheck(LoadLightIndex(words.data(), uSlot + i) == indexes[i]);
+	}
+	for (uint i = 0; i < uSlotNum; i++)
+	{
+		if (i < uSlot || i >= uSlot + uNum)
+		{
+			CpuCheck(LoadLightIndex(words.data(), i) == GetUnusedSlot(i));
+		}
+	}
+}
+
+static void TestRoundTrips()
+{
+	// Even and odd lengths from the first and the second 16-bit slot of a word.
+	for (uint uSlot = 0; uSlot < 4; uSlot++)
+	{
+		for (uint uNum : { 0u, 1u, 2u, 3u, 4u, 5u, 7u, 8u, 255u, 256u })
+		{
+			std::vector<uint> indexes(uNum);
+			for (uint i = 0; i < uNum; i++)
+			{
+				indexes[i] = (i * 37 + uSlot) % MaxLightNum;
+			}
+			CheckRoundTrip(indexes, uSlot);
+		}
+	}
+
+	// The largest indexes, the last light and the largest 16-bit index, in both halves of a word.
+	CheckRoundTrip({ MaxLightNum - 1 }, 0);
+	CheckRoundTrip({ MaxLightNum - 1 }, 1);
+	CheckRoundTrip({ 0xffff, 0, 0xffff }, 0);
+	CheckRoundTrip({ 0xffff, 0, 0xffff }, 1);
+	CheckRoundTrip({ MaxLightNum - 1, 0xffff, MaxLightNum - 1, 0xffff, 1 }, 1);
+
+	// A 16-bit store keeps the other half of its word.
+	if (UseLightIndex16)
+	{
+		std::vector<uint> words(2, UnusedWord);
+		StoreLightIndex(words.data(), 1, 0xffff);
+		CpuCheck(LoadLightIndex(words.data(), 0) == GetUnusedSlot(0));
+		CpuCheck(LoadLightIndex(words.data(), 1) == 0xffff);
+		CpuCheck(words[GetLightIndexWord(2)] == UnusedWord);
+	}
+}
+
+// Pack a split list like CpuLightCuller::PackLists: the header, the near lights after it, and the far lights written
+// backwards from the end of the list. A slot between the lists is left unused, like lights in only one of the lists.
+static ClusteredList PackSplitList(const std::vector<uint>& nearLights, const std::vector<uint>& farLights, float fSplitZ,
+	uint uOffset, std::vector<uint>& words)
+{
+	uint uSize = ClusteredSplitHeaderSize + (uint)(nearLights.size() + farLights.size()) + 1;
+	words.assign(GetLightIndexWordNum(uOffset + GetLightListStride(uSize)), UnusedWord);
+	PackLightIndexes(nearLights.data(), (uint)nearLights.size(), words.data(), uOffset + ClusteredSplitHeaderSize);
+	for (uint i = 0; i < farLights.size(); i++)
+	{
+		StoreLightIndex(words.data(), uOffset + uSize - 1 - i, farLights[i]);
+	}
+	StoreSplitListHeader(words.data(), uOffset, fSplitZ, (uint)nearLights.size(), (uint)farLights.size());
+	ClusteredList list;
+	list.offset = uOffset;
+	list.lightNum = uSize | ClusteredListSplitBit;
+	return list;
+}
+
+static void TestSplitLists()
+{
+	// The header round trip, the split depth takes a whole word and the counts take the largest 16-bit values.
+	std::vector<uint> words(GetLightIndexWordNum(ClusteredSplitHeaderSize + 2), UnusedWord);
+	float fSplitZ = 0.9837f;
+	StoreSplitListHeader(words.data(), 2, fSplitZ, 0xffff, 1);
+	float fLoadedZ;
+	uint uNearNum, uFarNum;
+	LoadSplitListHeader(words.data(), 2, fLoadedZ, uNearNum, uFarNum);
+	CpuCheck(AsUint(fLoadedZ) == AsUint(fSplitZ));
+	CpuCheck(uNearNum == 0xffff);
+	CpuCheck(uFarNum == 1);
+	CpuCheck(LoadLightIndex(words.data(), 0) == GetUnusedSlot(0));
+	CpuCheck(LoadLightIndex(words.data(), 1) == GetUnusedSlot(1));
+
+	// 12 lights: points [0, 4), spots [4, 8) and capsules [8, 12), the lists are ordered by type.
+	ClusteredData cd = {};
+	cd.lightNum = 12;
+	cd.spotLightNum = 4;
+	cd.capsuleLightNum = 4;
+	std::vector<uint> nearLights = { 1, 3, 5, 6, 9, 10, 11 };
+	std::vector<uint> farLights = { 0, 2, 4, 7, 8 };
+	ClusteredList list = PackSplitList(nearLights, farLights, fSplitZ, 6, words);
+
+	// The near list follows the header.
+	bool bFarList = true;
+	ClusteredList nearList = GetPixelLightList(list, fSplitZ * 0.5f, words.data(), bFarList);
+	CpuCheck(!bFarList);
+	CpuCheck(nearList.offset == list.offset + ClusteredSplitHeaderSize);
+	CpuCheck(nearList.lightNum == nearLights.size());
+	std::vector<uint> unpacked(nearList.lightNum);
+	UnpackLightIndexes(words.data(), nearList.offset, nearList.lightNum, unpacked.data());
+	CpuCheck(unpacked == nearLights);
+
+	// The far list ends at the end of the list, in the reverse order.
+	ClusteredList farList = GetPixelLightList(list, fSplitZ, words.data(), bFarList);
+	CpuCheck(bFarList);
+	CpuCheck(farList.offset + farList.lightNum == list.offset + (list.lightNum & ~ClusteredListSplitBit));
+	CpuCheck(farList.lightNum == farLights.size());
+	unpacked.resize(farList.lightNum);
+	UnpackLightIndexes(words.data(), farList.offset, farList.lightNum, unpacked.data());
+	std::reverse(unpacked.begin(), unpacked.end());
+	CpuCheck(unpacked == farLights);
+
+	// Type ranges of both lists: the near list is ascending, the far list is descending.
+	uint ranges[LightTypeNum][2];
+	GetLightTypeRanges(nearList, false, cd, words.data(), ranges);
+	CpuCheck(ranges[LightTypePoint][0] == 0 && ranges[LightTypePoint][1] == 2);
+	CpuCheck(ranges[LightTypeSpot][0] == 2 && ranges[LightTypeSpot][1] == 4);
+	CpuCheck(ranges[LightTypeCapsule][0] == 4 && ranges[LightTypeCapsule][1] == 7);
+	GetLightTypeRanges(farList, true, cd, words.data(), ranges);
+	CpuCheck(ranges[LightTypeCapsule][0] == 0 && ranges[LightTypeCapsule][1] == 1);
+	CpuCheck(ranges[LightTypeSpot][0] == 1 && ranges[LightTypeSpot][1] == 3);
+	CpuCheck(ranges[LightTypePoint][0] == 3 && ranges[LightTypePoint][1] == 5);
+
+	// A list which isn't split is the list of every pixel.
+	ClusteredList plainList = { 4, 3 };
+	ClusteredList pixelList = GetPixelLightList(plainList, 1.0f, words.data(), bFarList);
+	CpuCheck(!bFarList && pixelList.offset == plainList.offset && pixelList.lightNum == plainList.lightNum);
+}
+
+// The packed light indexes grow when lists don't fit, keep their capacity within the hysteresis, and shrink to the least
+// capacity of PackedAverageLightNum slots per cluster.
+static void TestPackedIndexCapacity()
+{
+	const uint uClusterNum = 100;
+	const uint uMinCapacity = uClusterNum*PackedAverageLightNum;
+	CpuCheck(GetPackedIndexCapacity(0, 0, uClusterNum) == uMinCapacity);
+	CpuCheck(GetPackedIndexCapacity(uMinCapacity, uMinCapacity, uClusterNum) == uMinCapacity);
+	uint uCapacity = GetPackedIndexCapacity(uMinCapacity, uMinCapacity*3 + 1, uClusterNum);
+	CpuCheck(uCapacity >= uMinCapacity*3 + 1 && (!UseLightIndex16 || uCapacity % 2 == 0));
+	CpuCheck(GetPackedIndexCapacity(uCapacity, uCapacity, uClusterNum) == uCapacity);
+	CpuCheck(GetPackedIndexCapacity(uCapacity, uCapacity / 4, uClusterNum) == uCapacity);
+	CpuCheck(GetPackedIndexCapacity(uCapacity, uCapacity / 4 - 1, uClusterNum) < uCapacity);
+	CpuCheck(GetPackedIndexCapacity(uCapacity, 0, uClusterNum) == uMinCapacity);
+}
+
+int main()
+{
+	TestRoundTrips();
+	TestSplitLists();
+	TestPackedIndexCapacity();
+	return FinishTest("CpuLightIndexTest");
+}
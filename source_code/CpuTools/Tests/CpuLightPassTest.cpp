@@ -0,0 +1,98 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightPassTest.cpp
+//
+// The SIMD kernel of the CPU light pass against the scalar kernel, and the PFM round trip of its images.
+//--------------------------------------------------------------------------------------
+#include "CpuTestScene.h"
+#include "CpuLightCulling.h"
+#include "CpuTest.h"
+#include <cstdio>
+#include <cstring>
+
+// CpuLightPassTolerance is the tolerance of golden images against the GPU. The GPU uses rsqrt in normalize, approximate
+// division and exp2/log2 in pow, and the list order of the GPU is not deterministic, so the sums of lights differ in their
+// last bits. A channel matches if |a - b| <= CpuLightPassTolerance*max(|b|, 1) (CompareLightPassImages), and pixels whose
+// lists differ (overflowing clusters, split depths in the last bits) may be over the tolerance.
+// Both CPU kernels keep the operation order of the shaders and read the same lists, so they must match within it with
+// every tile pattern, shading tier policy and lighting space.
+static void TestKernels(CpuTestScene& scene)
+{
+	uint uPixelNum = scene.uWidth*scene.uHeight;
+	std::vector<float> scalar(uPixelNum * 3), simd(uPixelNum * 3);
+	float* const pScalar[3] = { &scalar[0], &scalar[uPixelNum], &scalar[uPixelNum * 2] };
+	float* const pSimd[3] = { &simd[0], &simd[uPixelNum], &simd[uPixelNum * 2] };
+	const float* const pColorA[3] = { pSimd[0], pSimd[1], pSimd[2] };
+	const float* const pColorB[3] = { pScalar[0], pScalar[1], pScalar[2] };
+
+	for (uint uSubdivision : { (uint)TileSubdivisionQuad, (uint)TileSubdivision })
+	{
+		CpuLightCuller culler;
+		culler.Init(uSubdivision);
+		culler.SetDepthBuffer(scene.depth.data(), scene.uWidth, scene.uHeight);
+		culler.SetDepthPlanes(scene.depthPlanes.data(), (uint)scene.depthPlanes.size());
+		culler.SetLightShapes(scene.shapes.data());
+		culler.Run(scene.cullingData, scene.viewData, scene.lights.data());
+
+		CpuLightPass pass;
+		pass.SetGBuffer(GetTestGBuffer(scene));
+		pass.SetLightTables(culler);
+		for (uint uPolicy = 0; uPolicy < ShadingTierPolicyNum; uPolicy++)
+		{
+			for (uint uViewSpace = 0; uViewSpace < 2; uViewSpace++)
+			{
+				pass.SetShadingTierPolicy(uPolicy);
+				pass.SetViewSpaceLighting(uViewSpace != 0);
+				pass.SetKernel(CpuLightPassKernel_Scalar);
+				pass.Render(scene.viewData, scene.lights.data(), scene.shapes.data(), pScalar);
+				unsigned long long uShadedPairs = pass.GetStats().uShadedPairs;
+				pass.SetKernel(CpuLightPassKernel_Simd);
+				pass.Render(scene.viewData, scene.lights.data(), scene.shapes.data(), pSimd);
+
+				CpuLightPassImageDifference diff;
+				CpuLightPass::CompareLightPassImages(pColorA, pColorB, uPixelNum, diff, CpuLightPassTolerance);
+				const unsigned long long* tierPairs = pass.GetStats().tierPairs;
+				printf("pattern %u, policy %u, %s space: %llu shaded pairs (%llu, %llu, %llu by tier), max error %g, "
+					"max relative error %g, %u pixels over %g\n", uSubdivision, uPolicy, uViewSpace ? "view" : "world", uShadedPairs,
+					tierPairs[0], tierPairs[1], tierPairs[2], diff.fMaxError, diff.fMaxRelativeError, diff.uPixelsOverTolerance,
+					CpuLightPassTolerance);
+				// An image without lights would match anything.
+				CpuCheck(uShadedPairs > 0);
+				CpuCheck(pass.GetStats().uShadedPairs == uShadedPairs);
+				CpuCheck(diff.uPixelsOverTolerance == 0);
+			}
+		}
+	}
+}
+
+// An image read back from its PFM file is bitwise equal to the image.
+static void TestImageFiles(const CpuTestScene& scene)
+{
+	uint uPixelNum = scene.uWidth*scene.uHeight;
+	const float* const pColor[3] = { scene.gbuffer[0].data(), scene.gbuffer[4].data(), scene.gbuffer[9].data() };
+	const char* const pFileName = "CpuLightPassTest.pfm";
+	CpuCheck(CpuLightPass::WriteLightPassImage(pFileName, pColor, scene.uWidth, scene.uHeight));
+	std::vector<float> color;
+	uint uWidth = 0, uHeight = 0;
+	CpuCheck(CpuLightPass::ReadLightPassImage(pFileName, color, uWidth, uHeight));
+	CpuCheck(uWidth == scene.uWidth && uHeight == scene.uHeight);
+	if (color.size() == uPixelNum * 3)
+	{
+		for (uint c = 0; c < 3; c++)
+		{
+			CpuCheck(memcmp(&color[uPixelNum*c], pColor[c], uPixelNum * sizeof(float)) == 0);
+		}
+	}
+	remove(pFileName);
+}
+
+int main()
+{
+	// Fractional tiles on both axes.
+	CpuTestScene scene;
+	InitTestScene(scene, 637, 357, 2048, 8.0f, 8);
+	AddTestLightShapes(scene, 512, 512, 8.0f);
+	InitTestGBuffer(scene);
+	TestKernels(scene);
+	TestImageFiles(scene);
+	return FinishTest("CpuLightPassTest");
+}
@@ -0,0 +1,29 @@
+//--------------------------------------------------------------------------------------
+// File: CpuTest.h
+//
+// Checks of the headless tests, a test executable returns the number of failed checks.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <cstdio>
+
+static int g_iFailedChecks = 0;
+
+inline bool ReportCheck(bool bPassed, const char* const pExpression, const char* const pFile, int iLine)
+{
+	if (!bPassed)
+	{
+		printf("%s(%d): check failed: %s\n", pFile, iLine, pExpression);
+		g_iFailedChecks++;
+	}
+	return bPassed;
+}
+
+// Check a condition, and continue the test if it fails.
+#define CpuCheck(condition) ReportCheck((condition), #condition, __FILE__, __LINE__)
+
+// Print the result of a test and return its exit code.
+inline int FinishTest(const char* const pName)
+{
+	printf("%s: %s (%d failed checks)\n", pName, g_iFailedChecks ? "FAILED" : "passed", g_iFailedChecks);
+	return g_iFailedChecks;
+}
@@ -14,7 +14,8 @@ vs_full_out  main(vs_full_in vIn)
 	vs_full_out vOut;
 	vOut.position = mul(vIn.position, gViewCB.MVP);
 
-	vOut.normal = vIn.normal;
+	// The light passes light in view space with UseViewSpaceLighting.
+	vOut.normal = UseViewSpaceLighting ? mul(float4(vIn.normal, 0), gViewCB.View).xyz : vIn.normal;
 	vOut.worldPos = vOut.position / vOut.position.w;
 	vOut.texcoord = vIn.texcoord;
 
@@ -4,17 +4,277 @@
 // Define light culling and light accumulation settings.
 //--------------------------------------------------------------------------------------
 
+#ifndef CLUSTERED_DEFINE
+#define CLUSTERED_DEFINE
 #define TileSize 32
 // The number of threads for light culling.
 #define NumThreadX 8
 #define NumThreadY 8
 #define NUM_THREADS_PER_TILE NumThreadX*NumThreadY
-// The max light number per triangle (or per tile).
+// The max light number per triangle (or per tile) in the groupshared lists of the culling shaders.
 #define PerClusterMaxLight 255
+// Policies for clusters with more than PerClusterMaxLight lights.
+#define LightOverflowClamp 0	// Keep the PerClusterMaxLight most important lights (radius over distance to the cluster).
+#define LightOverflowSpill 1	// Keep all lights, the lights after PerClusterMaxLight spill into the packed list of the cluster.
+#define LightOverflowSplit 2	// Keep all lights in two lists for the near and the far half of the depth range of the cluster.
+#define LightOverflowPolicyNum 3
+// The overflow policy of the culling shaders and LightListScanCS.
+#define LightOverflowPolicy LightOverflowSpill
+// Buckets of light importance for LightOverflowClamp, a bucket is a quarter of a power of 2 of radius over distance.
+#define LightImportanceBucketNum 32
+// A split list (LightOverflowSplit) sets this bit of ClusteredList::lightNum, and its lightNum includes the header.
+#define ClusteredListSplitBit 0x80000000
+// The header of a split list: the post-projection split depth (asuint), the numbers of near and far lights.
+// With 16-bit light indexes the split depth takes the two slots of a uint.
+#define ClusteredSplitHeaderSize (UseLightIndex16 ? 4 : 3)
+// The depth bins of the near and the far half of a cluster, they overlap by a bin on both sides of the split depth.
+#define SplitNearBins 0x0001ffff
+#define SplitFarBins 0xffff8000
 // The max light number for light buffer.
 #define MaxLightNum 2048
+// The average number of lights per cluster reserved in the packed light index buffer, the least capacity of the buffer.
+// The buffer grows when the lists of a frame ask for more slots (GetPackedIndexCapacity), and clusters after the buffer
+// is full store fewer (or no) lights until it grows.
+#define PackedAverageLightNum 16
+// Store light indexes of the packed light index buffer as 16-bit slots, two per uint (the even slot in the low half),
+// which halves the index reads of the light pass. Light indexes must fit in 16 bits (up to 65536 lights).
+// Off by default, a slot is a uint. The headless build defines it with CPU_CULLING_INDEX16.
+#ifndef UseLightIndex16
+#define UseLightIndex16 false
+#endif
+// The number of threads of the prefix sum compute shader.
+#define ScanGroupSize 1024
 
-#define UseTriLightCulling true
+// Subdivision patterns of a tile. Every primitive of a pattern is a cluster, and the culling shaders,
+// the cluster layout and the tile mesh of the light pass are all created from the tables below.
+#define TileSubdivisionQuad 0			// The whole tile (per tile culling).
+#define TileSubdivisionDiagonal 1		// 2 triangles split by the diagonal from the top-right to the bottom-left corner.
+#define TileSubdivisionAntiDiagonal 2	// 2 triangles split by the diagonal from the top-left to the bottom-right corner.
+#define TileSubdivisionCenter 3			// 4 triangles meeting at the center of the tile.
+#define TileSubdivisionPatternNum 4
+// The subdivision pattern of light culling and the light pass.
+#define TileSubdivision TileSubdivisionDiagonal
+#define UseTriLightCulling (TileSubdivision != TileSubdivisionQuad)
+// The max number of primitives (clusters) and mesh triangles of a tile.
+#define TileMaxPrimitiveNum 4
+// The split planes of a tile (the two sides of both diagonals), and all planes of a tile including its 6 frustum planes.
+#define TileSplitPlaneNum 4
+#define TilePlaneNum (6 + TileSplitPlaneNum)
+// The planes of a tile through the camera, its 4 sides (up, right, down and left) and its split planes.
+#define TileSidePlaneNum (4 + TileSplitPlaneNum)
+// The number of clusters of a tile in a depth slice.
+#if TileSubdivision == TileSubdivisionQuad
+#define TilePrimitiveNum 1
+#elif TileSubdivision == TileSubdivisionCenter
+#define TilePrimitiveNum 4
+#else
+#define TilePrimitiveNum 2
+#endif
+// Select the diagonal of every tile from its depth samples (2-triangle patterns only): the tile uses TileSubdivisionDiagonal
+// or TileSubdivisionAntiDiagonal, whichever has the smaller sum of the view-space depth ranges of its two triangles.
+// The choice is a bit per tile (set for TileSubdivisionAntiDiagonal), and the light pass rebuilds the triangles of a tile with it.
+// Off by default, all tiles use the diagonal of TileSubdivision.
+#define UseTileDiagonalSelection false
+#define UseTileDiagonalBits (UseTileDiagonalSelection && TilePrimitiveNum == 2)
+// Tests of lights against the frustum of a tile, the tighter tests run after the 6 planes of the tile.
+// A light passing all planes may still miss the frustum near its edges and corners.
+#define LightTileTestPlanes 0	// Only the planes of the tile.
+#define LightTileTestAabb 1		// The planes, and the view-space AABB of the frustum (a sphere-box distance test).
+#define LightTileTestCone 2		// The planes, and the cone around the frustum from the camera (a sphere-cone test).
+#define LightTileTestNum 3
+// The light-versus-tile test of the culling shaders.
+#define LightTileTest LightTileTestPlanes
+// Incremental culling: a frame only culls again if lights, depth or the camera changed since the last culling. The GPU path
+// only skips whole frames, the CPU reference can also patch the clusters of dirty lights and tiles (SetIncremental).
+#define UseIncrementalCulling false
+// Cameras whose view data differ by more than this (in any matrix element) rebuild all light lists. Smaller differences
+// are the rounding of matrices rebuilt from a camera at rest, and move clusters by about 1e-5 of their distance.
+#define IncrementalCameraThreshold 1e-5f
+// The depth pyramid: level 0 has the min/max depth of every tile (the texels loaded by the culling shaders), and a cell
+// of level i+1 covers 2x2 cells of level i. The culling shaders read the depth range of tiles from level 0. The pyramid
+// stage also selects the diagonal of every tile and builds its depth bins in all slices once, so the culling shaders of
+// every slice and both passes skip the depth texels. Off by default, the culling shaders load the texels of their tile
+// (the lists are the same, and the CPU reference always reads the depth range of tiles from its pyramid).
+#define UseDepthPyramid false
+// Reject lights before culling if their spheres are behind the max depth of the pyramid cells under their screen rects.
+// Off by default (CpuCullingCoverage_Occlusion checks that rejected lights reach no pixel).
+#define UseLightOcclusion false
+// The number of threads of the light occlusion compute shader.
+#define LightOcclusionGroupSize 64
+// Scatter culling: a pass projects every light sphere to a rect of tiles and sets its bit in the light masks of the tiles
+// whose depth range it overlaps, and the culling shaders only test the lights of the mask of their tile.
+// The cost is the number of covered tiles per light instead of all tiles per light. Off by default, the culling shaders
+// test all lights (the lists are the same, the scatter tests of CpuCullingDriver enable it with -scatter 1).
+#define UseLightScatter false
+// The number of threads of the light scatter compute shader.
+#define LightScatterGroupSize 64
+// The words of the light mask of a tile (a bit per light).
+#define TileLightMaskWordNum (MaxLightNum / 32)
+// Upload lights in Morton order of their positions (LightManager), so neighbouring clusters read nearby lights.
+// Light indexes of light lists are slots of the light buffer, LightManager maps them to the indexes of the application.
+// Off by default, lights are uploaded in the order of the application (CpuCullingDriver order compares both).
+#define UseMortonLightOrder false
+// Light types. The light buffer stores the lights of every type in one index range (typed index ranges): point lights first,
+// then spot lights and capsule lights (ClusteredData::spotLightNum and capsuleLightNum). The PointLight of a spot or capsule
+// light is its bounding sphere, and its LightShape is stored in the shape buffer at the index of the light after the first spot light.
+#define LightTypePoint 0
+#define LightTypeSpot 1
+#define LightTypeCapsule 2
+#define LightTypeNum 3
+// Test the cones of spot lights and the capsules of capsule lights against the planes of clusters after their bounding spheres.
+// Light lists are ordered by type, so the light pass loops over the lights of each type without branches.
+#define UseLightShapeTests true
+// Transform lights and light shapes to view space once per frame (LightTransformCS) into the view-space light buffers,
+// and read them in the culling stages instead of transforming every light in every tile. Off by default, the culling
+// stages transform the lights they test (CpuCullingDriver transforms compares both).
+#define UseViewSpaceLights false
+// The number of threads of the light transform compute shader.
+#define LightTransformGroupSize 64
+// Cache the planes of tiles which only depend on the projection and the tile grid (TilePlaneCS). The sides and the split
+// planes of a tile pass through the camera, so the culling shaders only create the front and back planes of a cluster.
+// Without the table, the culling shaders create the same planes (TilePlane.hlsli). Off by default, CpuCullingDriver planes
+// checks that the lists with the table cover the lists without it.
+#define UseTilePlaneTable false
+// Quality tiers of the BRDF of the light passes (Lighting.hlsli), a light-pixel pair is shaded with the tier of the policy.
+#define ShadingTierFull 0			// GGXBRDF: GGX D, Smith G and the Schlick Fresnel with pow.
+#define ShadingTierFast 1			// GGX D, a spherical Gaussian Fresnel and the Kelemen visibility.
+#define ShadingTierLambertBlinn 2	// Lambert and a normalized Blinn-Phong lobe with the peak of the GGX lobe.
+#define ShadingTierNum 3
+// Policies selecting the tier of a pair.
+#define ShadingTierPolicyFixed 0		// Every pair uses ShadingTierFull.
+#define ShadingTierPolicyDistance 1		// Pixels far from the camera use cheaper tiers (ShadingTier*Distance).
+#define ShadingTierPolicyIntensity 2	// Pairs of dim lights use cheaper tiers (ShadingTier*Intensity).
+#define ShadingTierPolicyNum 3
+#define ShadingTierPolicy ShadingTierPolicyFixed
+// The distances from the camera (world units) from which pixels use the fast tier and the Lambert-Blinn tier.
+#define ShadingTierFastDistance 30.0f
+#define ShadingTierLambertDistance 60.0f
+// The light intensities at a pixel (the attenuation times the max channel of the color) below which pairs use the fast
+// tier and the Lambert-Blinn tier.
+#define ShadingTierFastIntensity 0.25f
+#define ShadingTierLambertIntensity 0.05f
+// Reconstruct the positions of pixels in view space from their linear depth and a frustum ray at view-space z = 1, which
+// the tile mesh carries from its vertexes, instead of transforming them by InvPV. The light passes then light in view space
+// with the view-space light buffers (it also needs UseViewSpaceLights), and the G-buffer stores view-space normals.
+// Off by default, the error bound is checked by CpuReconstructionTest.
+#define UseViewRayReconstruction false
+#define UseViewSpaceLighting (UseViewRayReconstruction && UseViewSpaceLights)
+// The number of depth slices of clusters (exponential distribution).
+#define ClusteredDepthNum 8
+// 2.5D culling: lights are rejected unless they overlap the depth bins occupied by pixels of a triangle (or tile).
+// Off by default, the lists are then the lists of the plane tests (CpuCullingDriver coverage checks both).
+#define UseDepthBinCulling false
+// The number of depth bins in a cluster (bits of the occupancy mask).
+#define DepthBinNum 32
+// Pixels this close to the diagonal of a tile (in tile units) mark the depth bins of both triangles.
+#define DepthBinDiagonalTolerance 1e-3f
+
+// The number of primitives (clusters) of a tile, per pattern.
+static const uint TilePatternPrimitiveNum[TileSubdivisionPatternNum] = { 1, 2, 2, 4 };
+// The split planes which contain a primitive, per pattern and primitive (bit j is plane 6+j).
+// Plane 6 and 7: the top-left and bottom-right sides of the diagonal.
+// Plane 8 and 9: the top-right and bottom-left sides of the anti-diagonal.
+static const uint TilePatternSplitPlanes[TileSubdivisionPatternNum*TileMaxPrimitiveNum] =
+{
+	0, 0, 0, 0,
+	0x1, 0x2, 0, 0,
+	0x4, 0x8, 0, 0,
+	0x5, 0x6, 0xa, 0x9
+};
+// The number of triangles in the tile mesh of the light pass, per pattern.
+static const uint TilePatternTriangleNum[TileSubdivisionPatternNum] = { 2, 2, 2, 4 };
+// The primitive (cluster) of a triangle of the tile mesh, per pattern and triangle.
+static const uint TilePatternTrianglePrimitive[TileSubdivisionPatternNum*TileMaxPrimitiveNum] =
+{
+	0, 0, 0, 0,
+	0, 1, 0, 0,
+	0, 1, 0, 0,
+	0, 1, 2, 3
+};
+// The corners of the triangles of the tile mesh in clockwise order, per pattern and triangle.
+// Corner 0~3: top-left, top-right, bottom-left and bottom-right. Corner 4: the center of the tile.
+static const uint TilePatternTriangleCorners[TileSubdivisionPatternNum*TileMaxPrimitiveNum * 3] =
+{
+	0, 1, 2,	1, 3, 2,	0, 0, 0,	0, 0, 0,
+	0, 1, 2,	1, 3, 2,	0, 0, 0,	0, 0, 0,
+	0, 1, 3,	0, 3, 2,	0, 0, 0,	0, 0, 0,
+	0, 1, 4,	1, 3, 4,	3, 2, 4,	2, 0, 4
+};
+// The number of triangles of a tile in the tile mesh.
+#define TileTriangleNum TilePatternTriangleNum[TileSubdivision]
+
+// The split planes of a point (u, v) in a tile, (1, 1) is the bottom-right corner.
+// Bit j is set if the point is inside split plane 6+j, and points within fTolerance of a diagonal are inside both sides.
+inline uint GetTileSplitSides(float u, float v, float fTolerance)
+{
+	uint sides = u + v <= 1.0f + fTolerance ? 0x1 : 0;
+	sides |= u + v >= 1.0f - fTolerance ? 0x2 : 0;
+	sides |= u - v >= -fTolerance ? 0x4 : 0;
+	sides |= u - v <= fTolerance ? 0x8 : 0;
+	return sides;
+}
+// The primitive of a pattern which shades a point (u, v) in a tile, points on a diagonal belong to one side.
+inline uint GetTilePrimitive(uint pattern, float u, float v)
+{
+	uint sides = (u + v < 1.0f ? 0x1 : 0x2) | (u - v > 0.0f ? 0x4 : 0x8);
+	uint primitive = 0;
+	for (uint i = 1; i < TilePatternPrimitiveNum[pattern]; i++)
+	{
+		primitive = (TilePatternSplitPlanes[pattern*TileMaxPrimitiveNum + i] & ~sides) == 0 ? i : primitive;
+	}
+	return primitive;
+}
+// The pattern of a tile with a diagonal bit.
+inline uint GetTileDiagonalPattern(uint diagonalBit)
+{
+	return diagonalBit ? TileSubdivisionAntiDiagonal : TileSubdivisionDiagonal;
+}
+// The number of tiles along a screen axis of pixelNum pixels. It is rounded up, so tiles are at most TileSize pixels and
+// the TileSize*TileSize texels loaded from the first pixel of a tile cover all of its pixels.
+inline uint GetTileNum(uint pixelNum)
+{
+	return (pixelNum + TileSize - 1) / TileSize;
+}
+// The number of words of the diagonal bits of all tiles.
+inline uint GetTileDiagonalWordNum(uint tileNum)
+{
+	return (tileNum + 31) / 32;
+}
+// The number of cells of a level of the depth pyramid along an axis of tileNum tiles.
+inline uint GetDepthPyramidLevelSize(uint tileNum, uint level)
+{
+	return (tileNum + (1u << level) - 1) >> level;
+}
+// The number of levels of the depth pyramid, the last level has one cell.
+inline uint GetDepthPyramidLevelNum(uint widthDim, uint heightDim)
+{
+	uint level = 0;
+	while (GetDepthPyramidLevelSize(widthDim, level) > 1 || GetDepthPyramidLevelSize(heightDim, level) > 1)
+	{
+		level++;
+	}
+	return level + 1;
+}
+// The first cell of a level in the depth pyramid buffer, the offset of level GetDepthPyramidLevelNum() is the number of cells.
+inline uint GetDepthPyramidLevelOffset(uint widthDim, uint heightDim, uint level)
+{
+	uint offset = 0;
+	for (uint i = 0; i < level; i++)
+	{
+		offset += GetDepthPyramidLevelSize(widthDim, i)*GetDepthPyramidLevelSize(heightDim, i);
+	}
+	return offset;
+}
+// The finest level whose cells cover tiles [x0, x1]*[y0, y1] with at most 2x2 cells.
+inline uint GetDepthPyramidCoverLevel(uint x0, uint y0, uint x1, uint y1)
+{
+	uint level = 0;
+	while ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)
+	{
+		level++;
+	}
+	return level;
+}
 // The constant buffer structure for light culling information.
 struct ClusteredData
 {
@@ -24,7 +284,41 @@ struct ClusteredData
 	uint depthDim;
 	float tileSizeX;
 	float tileSizeY;
+	uint spotLightNum;		// Spot lights after the point lights.
+	uint capsuleLightNum;	// Capsule lights after the spot lights.
+	uint packedIndexCapacity;	// Slots of the packed light index buffer (GetPackedIndexCapacity).
 };
+// The first light of a type in the light buffer, the first light of LightTypeNum is lightNum.
+inline uint GetLightTypeOffset(uint lightNum, uint spotLightNum, uint capsuleLightNum, uint type)
+{
+	uint offset = type == LightTypeNum ? lightNum : 0;
+	offset = type == LightTypeCapsule ? lightNum - capsuleLightNum : offset;
+	offset = type == LightTypeSpot ? lightNum - capsuleLightNum - spotLightNum : offset;
+	return offset;
+}
+// The type of light lightIdx in the typed index ranges.
+inline uint GetLightType(uint lightIdx, uint lightNum, uint spotLightNum, uint capsuleLightNum)
+{
+	uint type = lightIdx >= GetLightTypeOffset(lightNum, spotLightNum, capsuleLightNum, LightTypeSpot) ? LightTypeSpot : LightTypePoint;
+	return lightIdx >= GetLightTypeOffset(lightNum, spotLightNum, capsuleLightNum, LightTypeCapsule) ? LightTypeCapsule : type;
+}
+// The shading tier of a light-pixel pair with a policy (ShadingTierPolicy*), from the distance of the pixel to the camera
+// and the intensity of the light at the pixel.
+inline uint SelectShadingTier(uint policy, float viewDistance, float intensity)
+{
+	uint tier = ShadingTierFull;
+	if (policy == ShadingTierPolicyDistance)
+	{
+		tier = viewDistance >= ShadingTierFastDistance ? ShadingTierFast : tier;
+		tier = viewDistance >= ShadingTierLambertDistance ? ShadingTierLambertBlinn : tier;
+	}
+	else if (policy == ShadingTierPolicyIntensity)
+	{
+		tier = intensity < ShadingTierFastIntensity ? ShadingTierFast : tier;
+		tier = intensity < ShadingTierLambertIntensity ? ShadingTierLambertBlinn : tier;
+	}
+	return tier;
+}
 // The point light data structure.
 struct PointLight
 {
@@ -33,13 +327,102 @@ struct PointLight
 	float3  pos;
 	float3 color;
 };
-// A data structure for an element of light indexed buffer.
+// The shape of a spot or capsule light in world space.
+// A spot light lights the points within range of its apex inside its cone, a capsule light lights the points within range of its segment.
+struct LightShape
+{
+	float3 origin;	// The apex of a spot light, or the center of the segment of a capsule light.
+	float range;
+	float3 axis;	// The unit direction of a spot light, or the half segment from the center to an end of a capsule light.
+	float cosAngle;	// The cosine of the half angle of a spot light.
+	float sinAngle;	// The sine of the half angle of a spot light.
+};
+// A light of the view-space light buffer, the view-space center and the radius of its PointLight.
+// The shapes of spot and capsule lights are transformed to the view-space shape buffer in the layout of LightShape.
+struct ViewLight
+{
+	float3 center;
+	float radius;
+};
+// The planes of a tile which only depend on the projection (UseTilePlaneTable). The planes pass through the camera, so a
+// plane is its unit normal. The corners are the rays through the near vertexes of the frustum (0~3) at view-space z = 1.
+struct TilePlanes
+{
+	float3 sides[TileSidePlaneNum];
+	float3 corners[4];
+};
+// A cell of the depth pyramid, the min/max post-projection depth.
+struct DepthBounds
+{
+	float zMin;
+	float zMax;
+};
+// A fixed-size light list of a cluster (the layout of the CPU reference before packing).
 struct ClusteredBuffer
 {
 	uint lightIdxs[PerClusterMaxLight];
 };
+// The light list of a cluster in the packed light index buffer.
+struct ClusteredList
+{
+	uint offset;	// The slot of the first light index (the exclusive prefix sum of list strides).
+	uint lightNum;	// The number of stored light indexes.
+};
+// The uint of the packed light index buffer holding a slot, and the light index in a slot of that uint.
+inline uint GetLightIndexWord(uint slot)
+{
+	return UseLightIndex16 ? slot / 2 : slot;
+}
+inline uint GetPackedLightIndex(uint word, uint slot)
+{
+	return UseLightIndex16 ? (word >> ((slot & 1) * 16)) & 0xffff : word;
+}
+// The number of uints of the packed light index buffer for slotNum slots.
+inline uint GetLightIndexWordNum(uint slotNum)
+{
+	return UseLightIndex16 ? (slotNum + 1) / 2 : slotNum;
+}
+// The slots taken by a list of size slots. Lists of 16-bit indexes start at even slots, so two lists never share a uint.
+inline uint GetLightListStride(uint size)
+{
+	return UseLightIndex16 ? (size + 1) & ~1u : size;
+}
+// The capacity of the packed light index buffer for the slots the lists of a frame ask for (requiredIndexes).
+// A buffer which is too small grows with a quarter of headroom, and a buffer 4 times larger than the lists shrinks, so
+// the capacity isn't resized every frame. It never shrinks below PackedAverageLightNum slots per cluster.
+inline uint GetPackedIndexCapacity(uint capacity, uint requiredIndexes, uint clusterNum)
+{
+	uint minCapacity = clusterNum*PackedAverageLightNum;
+	if (requiredIndexes > capacity || requiredIndexes < capacity / 4)
+	{
+		capacity = GetLightListStride(requiredIndexes + requiredIndexes / 4);
+	}
+	return capacity > minCapacity ? capacity : minCapacity;
+}
+// The light list of a pixel at post-projection depth z in a split list, whose header is (splitZ, nearNum, farNum).
+// Near lights follow the header, and far lights end at the end of the list.
+inline ClusteredList GetSplitLightList(ClusteredList list, float z, float splitZ, uint nearNum, uint farNum)
+{
+	ClusteredList pixelList;
+	uint listSize = list.lightNum & ~ClusteredListSplitBit;
+	pixelList.offset = z < splitZ ? list.offset + ClusteredSplitHeaderSize : list.offset + listSize - farNum;
+	pixelList.lightNum = z < splitZ ? nearNum : farNum;
+	return pixelList;
+}
+// Overflow statistics of a frame, reduced by LightListScanCS.
+struct LightOverflowStats
+{
+	uint overflowClusters;	// Clusters with more than PerClusterMaxLight lights.
+	uint maxClusterLights;	// The max light number of a cluster.
+	uint droppedLights;		// Lights not stored (clamped, or lost because the packed light indexes are full).
+	uint spilledLights;		// Lights stored after PerClusterMaxLight (LightOverflowSpill and LightOverflowSplit).
+	uint splitClusters;		// Clusters stored as split lists.
+	uint truncatedClusters;	// Clusters that lost lights because the packed light indexes are full.
+	uint requiredIndexes;	// Slots all lists ask for, the packed light indexes grow to fit them (GetPackedIndexCapacity).
+};
 // A constant buffer structure for light information.
 struct LightCB
 {
 	PointLight lights[1024];
-};
\ No newline at end of file
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,631 @@
+//--------------------------------------------------------------------------------------
+// File: CpuCullingBenchmark.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuCullingBenchmark.h"
+#include "CpuLightOrder.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <numeric>
+#include <cstdio>
+
+#define CpuCacheLineSize 64
+// ALU of a light transform: a point by a 4x4 matrix (16 mads) and the divide by w (a reciprocal and 3 muls).
+#define CpuLightTransformOps 20
+// ALU of a pair of every shading tier, counted from GGXBRDF, GGXFastBRDF and LambertBlinnBRDF (a transcendental counts
+// as one op, pow as three: log2, mul and exp2).
+static const uint CpuShadingTierOps[ShadingTierNum] = { 77, 71, 40 };
+// ALU of the position and the view vector of a pixel with InvPV: a point by a 4x4 matrix (16 mads), the divide by w
+// (a reciprocal and 3 muls) and the vector to the camera (3 subs).
+#define CpuInvPVReconstructionOps 23
+// ALU of the position and the view vector of a pixel with a view ray: the interpolation of the ray (2 per component), the
+// linear depth (a sub, a reciprocal and a mul) and the scale of the ray (3 muls), the vector to the camera is a negation.
+#define CpuViewRayReconstructionOps 12
+
+// Walk packed light indexes like LightPassPS.
+static void WalkLightLists(const CpuLightCuller& culler, unsigned long long& uVisited, unsigned long long& uChecksum)
+{
+	const std::vector<ClusteredList>& lists = culler.GetLightListBuffer();
+	const std::vector<uint>& indexes = culler.GetPackedIndexBuffer();
+	for (const ClusteredList& list : lists)
+	{
+		for (uint i = 0; i < list.lightNum; i++)
+		{
+			uChecksum += LoadLightIndex(indexes.data(), list.offset + i);
+		}
+		uVisited += list.lightNum;
+	}
+}
+
+// Walk set bits of light bitmasks, a cluster always reads all of its words.
+static void WalkLightMasks(const CpuLightCuller& culler, unsigned long long& uVisited, unsigned long long& uChecksum)
+{
+	const std::vector<uint>& masks = culler.GetLightMaskBuffer();
+	uint uWordNum = culler.GetMaskWordNum();
+	for (uint uCluster = 0; uCluster < culler.GetClusterNum(); uCluster++)
+	{
+		const uint* pMask = masks.data() + uCluster*uWordNum;
+		for (uint uWord = 0; uWord < uWordNum; uWord++)
+		{
+			uint uBits = pMask[uWord];
+			while (uBits)
+			{
+				uChecksum += uWord*CpuLightMaskWordBits + FirstBitLow(uBits);
+				uVisited++;
+				uBits &= uBits - 1;
+			}
+		}
+	}
+}
+
+CpuCullingBenchmark BenchmarkCulling(CpuLightCuller& culler, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations)
+{
+	CpuCullingBenchmark result;
+	memset(&result, 0, sizeof(result));
+	if (uIterations == 0)
+	{
+		return result;
+	}
+
+	for (uint i = 0; i < uIterations; i++)
+	{
+		culler.Run(cullingData, viewData, pLights);
+		result.dTime += culler.GetStats().dTime;
+		result.dBuildTime += culler.GetStats().dBuildTime;
+		result.dPyramidTime += culler.GetStats().occlusion.dPyramidTime;
+		result.dScatterTime += culler.GetStats().scatter.dTime;
+	}
+	result.dTime /= uIterations;
+	result.dBuildTime /= uIterations;
+	result.dPyramidTime /= uIterations;
+	result.dScatterTime /= uIterations;
+	result.uPlaneTests = culler.GetStats().uPlaneTests;
+	result.uLightIndices = culler.GetStats().uLightIndices;
+	result.uOccludedLights = culler.GetStats().occlusion.uOccludedLights;
+	result.uScatterPairs = culler.GetStats().scatter.uPairs;
+	return result;
+}
+
+CpuSubdivisionBenchmark BenchmarkSubdivision(CpuLightCuller& culler, uint uSubdivision, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations)
+{
+	CpuSubdivisionBenchmark result;
+	memset(&result, 0, sizeof(result));
+	if (uIterations == 0)
+	{
+		return result;
+	}
+
+	uint uOldSubdivision = culler.GetSubdivision();
+	culler.Init(uSubdivision);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		culler.Run(cullingData, viewData, pLights);
+		result.dTime += culler.GetStats().dTime;
+	}
+	result.dTime /= uIterations;
+	result.uPlaneTests = culler.GetStats().uPlaneTests;
+	result.uLightIndices = culler.GetStats().uLightIndices;
+	result.uLightPixelPairs = culler.GetStats().uLightPixelPairs;
+	result.uClusterNum = culler.GetClusterNum();
+	culler.Init(uOldSubdivision);
+
+	std::vector<TileMeshVertex> vertexes;
+	std::vector<uint> indexes;
+	BuildTileMesh(uSubdivision, cullingData.widthDim, cullingData.heightDim, vertexes, indexes);
+	result.uVertexNum = (uint)vertexes.size();
+	result.uTriangleNum = (uint)indexes.size() / 3;
+	return result;
+}
+
+CpuTileTestBenchmark BenchmarkTileTest(CpuLightCuller& culler, uint uTileTest, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations)
+{
+	CpuTileTestBenchmark result;
+	memset(&result, 0, sizeof(result));
+	if (uIterations == 0)
+	{
+		return result;
+	}
+
+	uint uOldTileTest = culler.GetTileTest();
+	culler.SetTileTest(uTileTest);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		culler.Run(cullingData, viewData, pLights);
+		result.dTime += culler.GetStats().dTime;
+	}
+	result.dTime /= uIterations;
+	result.uLightIndices = culler.GetStats().uLightIndices;
+	result.uLightPixelPairs = culler.GetStats().uLightPixelPairs;
+	result.uTileTestRemovedPairs = culler.GetStats().uTileTestRemovedPairs;
+
+	CpuFalsePositiveStats falsePositives;
+	culler.CountFalsePositives(pLights, falsePositives);
+	result.uFalsePositivePairs = falsePositives.uFalsePositivePairs;
+	for (uint uTileFalsePositives : falsePositives.tileFalsePositives)
+	{
+		result.uWorstTileFalsePositives = std::max(result.uWorstTileFalsePositives, uTileFalsePositives);
+	}
+	culler.SetTileTest(uOldTileTest);
+	return result;
+}
+
+CpuLightShapeBenchmark BenchmarkLightShapes(CpuLightCuller& culler, bool bUseShapeTests, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations)
+{
+	CpuLightShapeBenchmark result;
+	memset(&result, 0, sizeof(result));
+	if (uIterations == 0)
+	{
+		return result;
+	}
+
+	bool bOldShapeTests = culler.IsLightShapeTests();
+	culler.SetLightShapeTests(bUseShapeTests);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		culler.Run(cullingData, viewData, pLights);
+		result.dTime += culler.GetStats().dTime;
+	}
+	result.dTime /= uIterations;
+	result.uLightIndices = culler.GetStats().uLightIndices;
+	result.uLightPixelPairs = culler.GetStats().uLightPixelPairs;
+	result.uShapeRemovedPairs = culler.GetStats().uShapeRemovedPairs;
+
+	// Both halves of a split list are counted.
+	const std::vector<ClusteredList>& lists = culler.GetLightListBuffer();
+	const std::vector<uint>& indexes = culler.GetPackedIndexBuffer();
+	auto countLights = [&](uint uBegin, uint uNum)
+	{
+		for (uint i = uBegin; i < uBegin + uNum; i++)
+		{
+			uint uLightIdx = LoadLightIndex(indexes.data(), i);
+			result.typeIndices[GetLightType(uLightIdx, cullingData.lightNum, cullingData.spotLightNum, cullingData.capsuleLightNum)]++;
+		}
+	};
+	for (const ClusteredList& list : lists)
+	{
+		if (list.lightNum & ClusteredListSplitBit)
+		{
+			float fSplitZ;
+			uint uNearNum, uFarNum;
+			LoadSplitListHeader(indexes.data(), list.offset, fSplitZ, uNearNum, uFarNum);
+			countLights(list.offset + ClusteredSplitHeaderSize, uNearNum);
+			countLights(list.offset + (list.lightNum & ~ClusteredListSplitBit) - uFarNum, uFarNum);
+		}
+		else
+		{
+			countLights(list.offset, list.lightNum);
+		}
+	}
+
+	CpuFalsePositiveStats falsePositives;
+	culler.CountFalsePositives(pLights, falsePositives);
+	result.uFalsePositivePairs = falsePositives.uFalsePositivePairs;
+	culler.SetLightShapeTests(bOldShapeTests);
+	return result;
+}
+
+CpuLightTransformBenchmark BenchmarkLightTransforms(CpuLightCuller& culler, bool bUseViewSpaceLights, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations)
+{
+	CpuLightTransformBenchmark result;
+	memset(&result, 0, sizeof(result));
+	if (uIterations == 0)
+	{
+		return result;
+	}
+
+	bool bOldViewSpaceLights = culler.IsViewSpaceLights();
+	culler.SetViewSpaceLights(bUseViewSpaceLights);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		culler.Run(cullingData, viewData, pLights);
+		result.dTime += culler.GetStats().dTime;
+	}
+	result.dTime /= uIterations;
+	result.uLightIndices = culler.GetStats().uLightIndices;
+	result.uLightTransforms = culler.GetStats().uLightTransforms;
+
+	// LightTransformCS runs once, the transforms in clusters run in both the count and the write pass.
+	unsigned long long uGpuTransforms = bUseViewSpaceLights ? cullingData.lightNum : result.uLightTransforms * 2;
+	result.uGpuTransformOps = uGpuTransforms * CpuLightTransformOps;
+	culler.SetViewSpaceLights(bOldViewSpaceLights);
+	return result;
+}
+
+CpuLightTableBenchmark BenchmarkLightTable(CpuLightCuller& culler, CpuLightTableType table, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations)
+{
+	CpuLightTableBenchmark result;
+	memset(&result, 0, sizeof(result));
+	if (uIterations == 0)
+	{
+		return result;
+	}
+
+	CpuLightTableType oldTable = culler.GetLightTable();
+	culler.SetLightTable(table);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		culler.Run(cullingData, viewData, pLights);
+		result.dCullTime += culler.GetStats().dTime;
+
+		unsigned long long uVisited = 0;
+		unsigned long long uChecksum = 0;
+		auto begin = std::chrono::high_resolution_clock::now();
+		if (table == CpuLightTable_Bitmask)
+		{
+			WalkLightMasks(culler, uVisited, uChecksum);
+		}
+		else
+		{
+			WalkLightLists(culler, uVisited, uChecksum);
+		}
+		result.dWalkTime += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+		result.uVisitedLights = uVisited;
+		result.uChecksum = uChecksum;
+	}
+	result.dCullTime /= uIterations;
+	result.dWalkTime /= uIterations;
+
+	if (table == CpuLightTable_Bitmask)
+	{
+		result.uTableBytes = culler.GetLightMaskBuffer().size()*sizeof(uint);
+	}
+	else
+	{
+		// The counter buffer is also needed by the GPU to build lists.
+		result.uTableBytes = culler.GetLightListBuffer().size()*sizeof(ClusteredList) +
+			culler.GetPackedIndexBuffer().size()*sizeof(uint) + culler.GetCounterBuffer().size()*sizeof(int);
+	}
+	culler.SetLightTable(oldTable);
+	return result;
+}
+
+CpuLightOrderBenchmark BenchmarkLightOrder(CpuLightCuller& culler, bool bMortonOrder, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations)
+{
+	CpuLightOrderBenchmark result;
+	memset(&result, 0, sizeof(result));
+	if (uIterations == 0)
+	{
+		return result;
+	}
+
+	// The light buffer of LightManager, order maps slots to the given light indexes.
+	std::vector<uint> order(cullingData.lightNum);
+	if (bMortonOrder)
+	{
+		ComputeMortonOrder(pLights, cullingData.lightNum, sizeof(PointLight), offsetof(PointLight, pos), order);
+	}
+	else
+	{
+		std::iota(order.begin(), order.end(), 0);
+	}
+	std::vector<PointLight> lights(cullingData.lightNum);
+	for (uint i = 0; i < cullingData.lightNum; i++)
+	{
+		lights[i] = pLights[order[i]];
+	}
+
+	// The index ranges of a cluster, a split list has a near and a far range after its header.
+	const std::vector<ClusteredList>& lists = culler.GetLightListBuffer();
+	const std::vector<uint>& indexes = culler.GetPackedIndexBuffer();
+	auto getRanges = [&](uint uCluster, ClusteredList ranges[2])
+	{
+		ClusteredList list = lists[uCluster];
+		ranges[0] = list;
+		ranges[1].offset = 0;
+		ranges[1].lightNum = 0;
+		if (list.lightNum & ClusteredListSplitBit)
+		{
+			float fSplitZ;
+			uint uNearNum, uFarNum;
+			LoadSplitListHeader(indexes.data(), list.offset, fSplitZ, uNearNum, uFarNum);
+			ranges[0].offset = list.offset + ClusteredSplitHeaderSize;
+			ranges[0].lightNum = uNearNum;
+			ranges[1].offset = list.offset + (list.lightNum & ~ClusteredListSplitBit) - uFarNum;
+			ranges[1].lightNum = uFarNum;
+		}
+	};
+
+	for (uint i = 0; i < uIterations; i++)
+	{
+		culler.Run(cullingData, viewData, lights.data());
+		result.dCullTime += culler.GetStats().dTime;
+
+		unsigned long long uVisited = 0;
+		unsigned long long uChecksum = 0;
+		double dRadiusSum = 0.0;
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (uint uCluster = 0; uCluster < culler.GetClusterNum(); uCluster++)
+		{
+			ClusteredList ranges[2];
+			getRanges(uCluster, ranges);
+			for (const ClusteredList& range : ranges)
+			{
+				for (uint j = 0; j < range.lightNum; j++)
+				{
+					uint uSlot = LoadLightIndex(indexes.data(), range.offset + j);
+					dRadiusSum += lights[uSlot].radius;
+					uChecksum += order[uSlot];
+				}
+				uVisited += range.lightNum;
+			}
+		}
+		result.dWalkTime += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+		result.uVisitedLights = uVisited;
+		result.uChecksum = uChecksum;
+		result.dRadiusSum = dRadiusSum;
+	}
+	result.dCullTime /= uIterations;
+	result.dWalkTime /= uIterations;
+
+	// Cache lines of the last run, clusters of a tile are its primitives in all depth slices.
+	uint uTileNum = cullingData.widthDim*cullingData.heightDim;
+	uint uPrimitiveNum = culler.GetClusterNum() / (uTileNum*cullingData.depthDim);
+	std::vector<uint> clusterLines;
+	std::vector<uint> tileLines;
+	for (uint uTile = 0; uTile < uTileNum; uTile++)
+	{
+		tileLines.clear();
+		for (uint uSlice = 0; uSlice < cullingData.depthDim; uSlice++)
+		{
+			for (uint p = 0; p < uPrimitiveNum; p++)
+			{
+				ClusteredList ranges[2];
+				getRanges((uTile + uSlice*uTileNum)*uPrimitiveNum + p, ranges);
+				clusterLines.clear();
+				for (const ClusteredList& range : ranges)
+				{
+					for (uint j = 0; j < range.lightNum; j++)
+					{
+						clusterLines.push_back(LoadLightIndex(indexes.data(), range.offset + j) * sizeof(PointLight) / CpuCacheLineSize);
+					}
+				}
+				std::sort(clusterLines.begin(), clusterLines.end());
+				clusterLines.erase(std::unique(clusterLines.begin(), clusterLines.end()), clusterLines.end());
+				result.uCacheLines += clusterLines.size();
+				tileLines.insert(tileLines.end(), clusterLines.begin(), clusterLines.end());
+			}
+		}
+		std::sort(tileLines.begin(), tileLines.end());
+		result.uTileCacheLines += std::unique(tileLines.begin(), tileLines.end()) - tileLines.begin();
+	}
+	return result;
+}
+
+CpuCullingQualityBenchmark BenchmarkCullingQuality(CpuLightCuller& culler, uint uSubdivision, uint uWaveWidth, uint uWaveHeight,
+	const ClusteredData& cullingData, const ViewData& viewData, const PointLight* const pLights, uint uIterations)
+{
+	CpuCullingQualityBenchmark result;
+	memset(&result, 0, sizeof(result));
+	if (uIterations == 0)
+	{
+		return result;
+	}
+
+	uint uOldSubdivision = culler.GetSubdivision();
+	culler.Init(uSubdivision);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		culler.Run(cullingData, viewData, pLights);
+		result.dTime += culler.GetStats().dTime;
+	}
+	result.dTime /= uIterations;
+
+	culler.MeasureQuality(pLights, uWaveWidth, uWaveHeight, result.quality);
+	const CpuCullingQuality& quality = result.quality;
+	result.dFalsePositiveRatio = quality.uLightPixelPairs ? (double)quality.uFalsePositivePairs / quality.uLightPixelPairs : 0.0;
+	result.dClusterFalsePositiveRatio = quality.uClusterLights ?
+		(double)(quality.uClusterLights - quality.uCoveredLights) / quality.uClusterLights : 0.0;
+	result.dWastedGgxRatio = quality.uGgxLanes ? (double)quality.uWastedGgxLanes / quality.uGgxLanes : 0.0;
+	culler.Init(uOldSubdivision);
+	return result;
+}
+
+std::string FormatCullingQuality(const char* const pName, const CpuCullingQualityBenchmark& benchmark)
+{
+	const CpuCullingQuality& quality = benchmark.quality;
+	char line[256];
+	std::string text;
+	snprintf(line, sizeof(line), "%s: cull %.3fms, false positives %.1f%% of pairs, %.1f%% of cluster lights, wasted GGX %.1f%% of %llu lanes\n",
+		pName, benchmark.dTime*1000.0, benchmark.dFalsePositiveRatio*100.0, benchmark.dClusterFalsePositiveRatio*100.0,
+		benchmark.dWastedGgxRatio*100.0, quality.uGgxLanes);
+	text.append(line);
+
+	// The header is the first length of every bucket.
+	text.append("  lights    ");
+	for (uint b = 0; b < CpuListLengthBucketNum; b++)
+	{
+		snprintf(line, sizeof(line), " %9u%s", b == 0 ? 0 : 1u << (b - 1), b + 1 == CpuListLengthBucketNum ? "+" : " ");
+		text.append(line);
+	}
+	text.append("\n");
+	auto appendRow = [&](const char* pRow, const unsigned long long* pCounts)
+	{
+		snprintf(line, sizeof(line), "  %-10s", pRow);
+		text.append(line);
+		for (uint b = 0; b < CpuListLengthBucketNum; b++)
+		{
+			snprintf(line, sizeof(line), " %9llu ", pCounts[b]);
+			text.append(line);
+		}
+		text.append("\n");
+	};
+	unsigned long long clusterLengths[CpuListLengthBucketNum];
+	unsigned long long coveredLengths[CpuListLengthBucketNum];
+	for (uint b = 0; b < CpuListLengthBucketNum; b++)
+	{
+		clusterLengths[b] = quality.clusterLengths[b];
+		coveredLengths[b] = quality.coveredLengths[b];
+	}
+	appendRow("clusters", clusterLengths);
+	appendRow("covered", coveredLengths);
+	appendRow("pixels", quality.pixelLengths);
+	return text;
+}
+
+CpuShadingTierBenchmark BenchmarkShadingTiers(CpuLightPass& pass, uint uPolicy, const ViewData& viewData,
+	const PointLight* const pLights, const LightShape* const pShapes, uint uIterations)
+{
+	CpuShadingTierBenchmark result;
+	memset(&result, 0, sizeof(result));
+	const CpuGBuffer& gbuffer = pass.GetGBuffer();
+	if (uIterations == 0 || gbuffer.uWidth == 0 || gbuffer.uHeight == 0)
+	{
+		return result;
+	}
+
+	uint uPixelNum = gbuffer.uWidth*gbuffer.uHeight;
+	std::vector<float> reference(uPixelNum * 3), color(uPixelNum * 3);
+	float* const pReference[3] = { &reference[0], &reference[uPixelNum], &reference[uPixelNum * 2] };
+	float* const pColor[3] = { &color[0], &color[uPixelNum], &color[uPixelNum * 2] };
+
+	uint uOldPolicy = pass.GetShadingTierPolicy();
+	pass.SetShadingTierPolicy(ShadingTierPolicyFixed);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		pass.Render(viewData, pLights, pShapes, pReference);
+		result.dReferenceTime += pass.GetStats().dTime;
+	}
+	result.dReferenceTime /= uIterations;
+	result.uReferenceAluOps = pass.GetStats().uShadedPairs * CpuShadingTierOps[ShadingTierFull];
+
+	pass.SetShadingTierPolicy(uPolicy);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		pass.Render(viewData, pLights, pShapes, pColor);
+		result.dTime += pass.GetStats().dTime;
+	}
+	result.dTime /= uIterations;
+	for (uint uTier = 0; uTier < ShadingTierNum; uTier++)
+	{
+		result.tierPairs[uTier] = pass.GetStats().tierPairs[uTier];
+		result.uAluOps += result.tierPairs[uTier] * CpuShadingTierOps[uTier];
+	}
+
+	const float* const pColorA[3] = { pColor[0], pColor[1], pColor[2] };
+	const float* const pColorB[3] = { pReference[0], pReference[1], pReference[2] };
+	CpuLightPass::CompareLightPassImages(pColorA, pColorB, uPixelNum, result.diff);
+	pass.SetShadingTierPolicy(uOldPolicy);
+	return result;
+}
+
+CpuReconstructionBenchmark BenchmarkViewSpaceLighting(CpuLightPass& pass, const ViewData& viewData,
+	const PointLight* const pLights, const LightShape* const pShapes, uint uIterations)
+{
+	CpuReconstructionBenchmark result;
+	memset(&result, 0, sizeof(result));
+	const CpuGBuffer gbuffer = pass.GetGBuffer();
+	if (uIterations == 0 || gbuffer.uWidth == 0 || gbuffer.uHeight == 0)
+	{
+		return result;
+	}
+	result.uViewRayOps = CpuViewRayReconstructionOps;
+	result.uInvPVOps = CpuInvPVReconstructionOps;
+
+	// The positions of all pixels against exact positions, the view-ray positions in view space and the InvPV positions
+	// in world space (the view is rigid, so distances are equal in both spaces).
+	uint uPixelNum = gbuffer.uWidth*gbuffer.uHeight;
+	const float4x4& proj = viewData.Proj;
+	const float4x4& view = viewData.View;
+	const float4x4& m = viewData.InvPV;
+	CpuViewRays rays;
+	GetLightPassViewRays(viewData, gbuffer.uWidth, gbuffer.uHeight, rays);
+	for (uint py = 0; py < gbuffer.uHeight; py++)
+	{
+		for (uint px = 0; px < gbuffer.uWidth; px++)
+		{
+			float p[4] = { (float)px + 0.5f, (float)py + 0.5f, gbuffer.pDepth[px + py*gbuffer.uWidth], 1.0f };
+			double zv = (double)proj.m[2][3] / ((double)p[2] - proj.m[2][2]);
+			double ndcX = (double)p[0] * 2.0 / gbuffer.uWidth - 1.0;
+			double ndcY = 1.0 - (double)p[1] * 2.0 / gbuffer.uHeight;
+			double exactView[3] = { zv*(ndcX - proj.m[0][2]) / proj.m[0][0], zv*(ndcY - proj.m[1][2]) / proj.m[1][1], zv };
+			double exactWorld[3];
+			for (uint r = 0; r < 3; r++)
+			{
+				exactWorld[r] = 0.0;
+				for (uint c = 0; c < 3; c++)
+				{
+					exactWorld[r] += (exactView[c] - view.m[c][3])*view.m[c][r];
+				}
+			}
+
+			float fViewDepth = GetLightPassViewDepth(viewData, p[2]);
+			float w = p[0] * m.m[3][0] + p[1] * m.m[3][1] + p[2] * m.m[3][2] + p[3] * m.m[3][3];
+			double dRayError = 0.0;
+			double dInvPVError = 0.0;
+			for (uint c = 0; c < 3; c++)
+			{
+				float fRayPos = (rays.origin[c] + p[0] * rays.dx[c] + p[1] * rays.dy[c])*fViewDepth;
+				float fWorldPos = (p[0] * m.m[c][0] + p[1] * m.m[c][1] + p[2] * m.m[c][2] + p[3] * m.m[c][3]) / w;
+				dRayError += (fRayPos - exactView[c])*(fRayPos - exactView[c]);
+				dInvPVError += (fWorldPos - exactWorld[c])*(fWorldPos - exactWorld[c]);
+			}
+			double dDistance = std::sqrt(exactView[0] * exactView[0] + exactView[1] * exactView[1] + exactView[2] * exactView[2]);
+			result.dViewRayRmsError += dRayError;
+			result.dInvPVRmsError += dInvPVError;
+			dRayError = std::sqrt(dRayError);
+			dInvPVError = std::sqrt(dInvPVError);
+			result.dViewRayMaxError = std::max(result.dViewRayMaxError, dRayError);
+			result.dInvPVMaxError = std::max(result.dInvPVMaxError, dInvPVError);
+			if (dDistance > 0.0)
+			{
+				result.dViewRayMaxRelativeError = std::max(result.dViewRayMaxRelativeError, dRayError / dDistance);
+				result.dInvPVMaxRelativeError = std::max(result.dInvPVMaxRelativeError, dInvPVError / dDistance);
+			}
+		}
+	}
+	result.dViewRayRmsError = std::sqrt(result.dViewRayRmsError / uPixelNum);
+	result.dInvPVRmsError = std::sqrt(result.dInvPVRmsError / uPixelNum);
+
+	// The normals of the G-buffer in view space.
+	std::vector<float> viewNormals(uPixelNum * 3);
+	for (uint i = 0; i < uPixelNum; i++)
+	{
+		CpuFloat4 normal = { gbuffer.pNormal[0][i], gbuffer.pNormal[1][i], gbuffer.pNormal[2][i], 0.0f };
+		normal = Mul(normal, view);
+		viewNormals[i] = normal.x;
+		viewNormals[uPixelNum + i] = normal.y;
+		viewNormals[uPixelNum * 2 + i] = normal.z;
+	}
+	CpuGBuffer viewGBuffer = gbuffer;
+	for (uint c = 0; c < 3; c++)
+	{
+		viewGBuffer.pNormal[c] = &viewNormals[uPixelNum*c];
+	}
+
+	std::vector<float> reference(uPixelNum * 3), color(uPixelNum * 3);
+	float* const pReference[3] = { &reference[0], &reference[uPixelNum], &reference[uPixelNum * 2] };
+	float* const pColor[3] = { &color[0], &color[uPixelNum], &color[uPixelNum * 2] };
+
+	bool bOldViewSpaceLighting = pass.IsViewSpaceLighting();
+	pass.SetViewSpaceLighting(false);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		pass.Render(viewData, pLights, pShapes, pReference);
+		result.dReferenceTime += pass.GetStats().dTime;
+	}
+	result.dReferenceTime /= uIterations;
+
+	pass.SetViewSpaceLighting(true);
+	pass.SetGBuffer(viewGBuffer);
+	for (uint i = 0; i < uIterations; i++)
+	{
+		pass.Render(viewData, pLights, pShapes, pColor);
+		result.dTime += pass.GetStats().dTime;
+	}
+	result.dTime /= uIterations;
+
+	const float* const pColorA[3] = { pColor[0], pColor[1], pColor[2] };
+	const float* const pColorB[3] = { pReference[0], pReference[1], pReference[2] };
+	CpuLightPass::CompareLightPassImages(pColorA, pColorB, uPixelNum, result.diff);
+	pass.SetGBuffer(gbuffer);
+	pass.SetViewSpaceLighting(bOldViewSpaceLighting);
+	return result;
+}
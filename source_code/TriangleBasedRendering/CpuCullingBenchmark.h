@@ -0,0 +1,198 @@
+//--------------------------------------------------------------------------------------
+// File: CpuCullingBenchmark.h
+//
+// Benchmarks of CpuLightCuller. They time culling runs and walk the culling results like the
+// shading loop of the light pass, so different light tables can be compared on the same inputs.
+// Subdivision patterns are compared by the size of their light lists and the vertex cost of their tile meshes.
+// Tile tests are compared by their culling time and the false positive pairs left for the light pass.
+// Light orders are compared by the cache lines of the light buffer touched by the light lists of clusters.
+// Light scatter is compared with gathering by BenchmarkCulling with SetLightScatter on and off.
+// Shape tests of spot and capsule lights are compared with their bounding spheres by the lights of every type in the lists.
+// Per tile and per triangle culling are compared by BenchmarkCullingQuality: histograms of list lengths, false positives
+// against the exact light coverage of the depth buffer, and the GGX evaluations waves of the light pass waste.
+// View-space lights are compared with transforming lights in every cluster by BenchmarkLightTransforms, with the depth
+// buffers and the tile grids of 1080p and 4K, since the transforms without view-space lights grow with the clusters.
+// Shading tiers are compared with the full GGX of every pair by BenchmarkShadingTiers: the pairs of every tier of a policy,
+// the estimated ALU of their BRDFs, and the error of the image against the image of ShadingTierPolicyFixed.
+// View-ray reconstruction is compared with InvPV by BenchmarkViewSpaceLighting: the distance of the positions of both to
+// exact positions, the estimated ALU of a pixel, and the image of view-space lighting against world-space lighting.
+// Runs of a benchmark have the same inputs, so an incremental culler (SetIncremental) times idle runs after the first one.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include "CpuLightCulling.h"
+#include "CpuLightPass.h"
+#include "TileMesh.h"
+#include <string>
+
+// The average cost of culling runs.
+struct CpuCullingBenchmark
+{
+	double dTime;						// Average seconds of CpuLightCuller::Run().
+	double dBuildTime;					// Average seconds spent building the SoA light buffer and the light BVH.
+	double dPyramidTime;				// Average seconds spent building the depth pyramid and testing light occlusion.
+	unsigned long long uPlaneTests;		// Light-plane and node-plane tests of a run.
+	unsigned long long uLightIndices;	// Lights written to all clusters in a run.
+	uint uOccludedLights;				// Lights rejected by the light occlusion test in a run.
+	double dScatterTime;				// Average seconds spent binning lights to tiles (light scatter).
+	unsigned long long uScatterPairs;	// Light-tile pairs of the bins in a run (light scatter).
+};
+
+// The cost of a light table.
+struct CpuLightTableBenchmark
+{
+	double dCullTime;					// Average seconds of CpuLightCuller::Run().
+	double dWalkTime;					// Average seconds to walk the lights of all clusters.
+	unsigned long long uVisitedLights;	// The number of lights visited by a walk.
+	unsigned long long uChecksum;		// The sum of visited light indexes, equal tables have equal checksums.
+	size_t uTableBytes;					// The size of the buffers read by the shading loop.
+};
+
+// The light lists and the tile mesh of a subdivision pattern.
+struct CpuSubdivisionBenchmark
+{
+	double dTime;						// Average seconds of CpuLightCuller::Run().
+	unsigned long long uPlaneTests;		// Light-plane and node-plane tests of a run.
+	unsigned long long uLightIndices;	// Lights written to all clusters in a run.
+	unsigned long long uLightPixelPairs;	// Lights shaded by all pixels (the light list of the cluster of every pixel).
+	uint uClusterNum;					// Clusters of a run (TilePatternPrimitiveNum per tile in every slice).
+	uint uVertexNum;					// Vertexes of the tile mesh.
+	uint uTriangleNum;					// Triangles of the tile mesh, the light pass runs the GS once per triangle.
+};
+
+// The culling cost and the false positives of a light-versus-tile test.
+struct CpuTileTestBenchmark
+{
+	double dTime;						// Average seconds of CpuLightCuller::Run().
+	unsigned long long uLightIndices;	// Lights written to all clusters in a run.
+	unsigned long long uLightPixelPairs;	// Lights in the clusters of all pixels (loop iterations of LightPassPS).
+	unsigned long long uTileTestRemovedPairs;	// Pairs removed by the tile test after the planes.
+	unsigned long long uFalsePositivePairs;	// Pairs whose light doesn't reach the pixel (GGX evaluations skipped at run time).
+	uint uWorstTileFalsePositives;		// False positive pairs of the worst tile.
+};
+
+// The cost of reading lights in a light buffer order.
+struct CpuLightOrderBenchmark
+{
+	double dCullTime;					// Average seconds of CpuLightCuller::Run().
+	double dWalkTime;					// Average seconds to read the lights of all clusters from the light buffer.
+	unsigned long long uVisitedLights;	// The number of lights read by a walk.
+	unsigned long long uChecksum;		// The sum of visited light indexes in the given order, equal for both orders.
+	double dRadiusSum;					// The sum of radiuses of visited lights, read from the light buffer.
+	unsigned long long uCacheLines;		// Cache lines of the light buffer read by all clusters (a line per cluster once).
+	unsigned long long uTileCacheLines;	// Cache lines read by all tiles, clusters of a tile share lines.
+};
+
+// Run the culler uIterations times with its current settings (e.g. kernels or coarse tiles).
+CpuCullingBenchmark BenchmarkCulling(CpuLightCuller& culler, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations);
+
+// The lists of spot and capsule lights culled by their shapes or by their bounding spheres.
+struct CpuLightShapeBenchmark
+{
+	double dTime;						// Average seconds of CpuLightCuller::Run().
+	unsigned long long uLightIndices;	// Lights written to all clusters in a run.
+	unsigned long long typeIndices[LightTypeNum];	// Lights of every type (LightType*) in the packed lists of a run.
+	unsigned long long uLightPixelPairs;	// Lights in the clusters of all pixels (loop iterations of the light passes).
+	unsigned long long uShapeRemovedPairs;	// Pairs removed by the shape tests after the bounding spheres.
+	unsigned long long uFalsePositivePairs;	// Pairs whose light doesn't reach the pixel.
+};
+
+// The quality of the light lists of a subdivision pattern (MeasureQuality of the last run).
+struct CpuCullingQualityBenchmark
+{
+	double dTime;						// Average seconds of CpuLightCuller::Run().
+	CpuCullingQuality quality;
+	double dFalsePositiveRatio;			// False positive pairs over light-pixel pairs.
+	double dClusterFalsePositiveRatio;	// Lights which reach no pixel of their clusters over the lights of clusters.
+	double dWastedGgxRatio;				// Wasted GGX lanes over the GGX lanes of waves.
+};
+
+// The transforms of lights to view space with view-space lights or in every cluster.
+struct CpuLightTransformBenchmark
+{
+	double dTime;						// Average seconds of CpuLightCuller::Run().
+	unsigned long long uLightIndices;	// Lights written to all clusters in a run.
+	unsigned long long uLightTransforms;	// Light centers transformed to view space in a run.
+	unsigned long long uGpuTransformOps;	// Estimated ALU of the transforms of the GPU culling stages of a frame.
+};
+
+// The shading tiers of a light pass policy against the full GGX of every pair.
+struct CpuShadingTierBenchmark
+{
+	double dTime;						// Average seconds of CpuLightPass::Render() with the policy.
+	double dReferenceTime;				// Average seconds of CpuLightPass::Render() with ShadingTierPolicyFixed.
+	unsigned long long tierPairs[ShadingTierNum];	// Shaded pairs of every tier (ShadingTier*) of a pass.
+	unsigned long long uAluOps;			// Estimated ALU of the BRDFs of a pass on the GPU.
+	unsigned long long uReferenceAluOps;	// Estimated ALU of the BRDFs of a pass with ShadingTierPolicyFixed.
+	CpuLightPassImageDifference diff;	// The image of the policy against the image of ShadingTierPolicyFixed.
+};
+
+// The positions of pixels reconstructed from view rays and linear depth (view-space lighting) or with InvPV.
+struct CpuReconstructionBenchmark
+{
+	double dTime;						// Average seconds of CpuLightPass::Render() with view-space lighting.
+	double dReferenceTime;				// Average seconds of CpuLightPass::Render() with world-space lighting (InvPV).
+	double dViewRayMaxError;			// The max distance of a view-ray position to the exact position.
+	double dViewRayRmsError;			// The root mean square of the distances of view-ray positions.
+	double dViewRayMaxRelativeError;	// The max distance of a view-ray position over its distance to the camera.
+	double dInvPVMaxError;				// The max distance of an InvPV position to the exact position.
+	double dInvPVRmsError;				// The root mean square of the distances of InvPV positions.
+	double dInvPVMaxRelativeError;		// The max distance of an InvPV position over its distance to the camera.
+	uint uViewRayOps;					// Estimated ALU of the position and the view vector of a pixel with view rays.
+	uint uInvPVOps;						// Estimated ALU of the position and the view vector of a pixel with InvPV.
+	CpuLightPassImageDifference diff;	// The image of view-space lighting against the image of world-space lighting.
+};
+
+// Run the culler uIterations times with a subdivision pattern (TileSubdivision*), and build the tile mesh of the pattern.
+// Other settings are taken from the culler, the subdivision pattern is restored after. With diagonal selection, both
+// 2-triangle patterns select diagonals per tile, so compare them (or measure the selection) with SetDiagonalSelection.
+CpuSubdivisionBenchmark BenchmarkSubdivision(CpuLightCuller& culler, uint uSubdivision, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations);
+
+// Run the culler uIterations times with a tile test (LightTileTest*), and count false positives of the last run.
+// Other settings are taken from the culler, the tile test is restored after.
+CpuTileTestBenchmark BenchmarkTileTest(CpuLightCuller& culler, uint uTileTest, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations);
+
+// Run the culler uIterations times with shape tests on or off (SetLightShapeTests), and count the lights of every type and
+// the false positives of the last run. The shapes must be set (SetLightShapes) and the culler must use index lists.
+// Other settings are taken from the culler, the shape tests are restored after.
+CpuLightShapeBenchmark BenchmarkLightShapes(CpuLightCuller& culler, bool bUseShapeTests, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations);
+
+// Run the culler uIterations times with view-space lights on or off (SetViewSpaceLights), and count the transforms of
+// the last run. Without view-space lights, the count and write passes of the GPU both transform every candidate light, so
+// the ALU estimate counts the transforms of the clusters twice. Other settings are taken from the culler, the view-space
+// lights are restored after.
+CpuLightTransformBenchmark BenchmarkLightTransforms(CpuLightCuller& culler, bool bUseViewSpaceLights, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations);
+
+// Run the culler uIterations times with a light table, and walk all clusters after every run.
+// The depth buffer, depth planes, kernel and scheduler are taken from the culler, the light table is restored after.
+CpuLightTableBenchmark BenchmarkLightTable(CpuLightCuller& culler, CpuLightTableType table, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations);
+
+// Run the culler uIterations times on lights in Morton order (bMortonOrder) or in the given order, and read the lights of
+// all clusters after every run like LightPassPS. The culler must use index lists.
+CpuLightOrderBenchmark BenchmarkLightOrder(CpuLightCuller& culler, bool bMortonOrder, const ClusteredData& cullingData,
+	const ViewData& viewData, const PointLight* const pLights, uint uIterations);
+
+// Run the culler uIterations times with a subdivision pattern (TileSubdivisionQuad for PerTileCullingCS, the others for
+// PerTriangleCullingCS), and measure the lists of the last run with waves of uWaveWidth*uWaveHeight pixels (8x4 for 32 lanes,
+// 8x8 for 64 lanes). The culler must use index lists. Other settings are taken from the culler, the pattern is restored after.
+CpuCullingQualityBenchmark BenchmarkCullingQuality(CpuLightCuller& culler, uint uSubdivision, uint uWaveWidth, uint uWaveHeight,
+	const ClusteredData& cullingData, const ViewData& viewData, const PointLight* const pLights, uint uIterations);
+// Render the light pass uIterations times with ShadingTierPolicyFixed and uIterations times with a policy of shading tiers
+// (ShadingTierPolicy*), and compare the images of the last runs. The G-buffer, the light tables, the kernel and the
+// scheduler are taken from the pass, the policy is restored after.
+CpuShadingTierBenchmark BenchmarkShadingTiers(CpuLightPass& pass, uint uPolicy, const ViewData& viewData,
+	const PointLight* const pLights, const LightShape* const pShapes, uint uIterations);
+// Render the light pass uIterations times with world-space lighting and uIterations times with view-space lighting, and
+// compare the images of the last runs. The G-buffer of the pass has world-space normals, and view-space lighting reads
+// them transformed by View like AdvancedShadingVS. The positions of all pixels are compared with exact positions computed
+// in double precision from Proj and View (a perspective projection and a rigid view). The light tables, the kernel and
+// the scheduler are taken from the pass, the G-buffer and the lighting space are restored after.
+CpuReconstructionBenchmark BenchmarkViewSpaceLighting(CpuLightPass& pass, const ViewData& viewData,
+	const PointLight* const pLights, const LightShape* const pShapes, uint uIterations);
+// Format the ratios and the histograms of a quality benchmark as lines of text, a column per histogram bucket.
+std::string FormatCullingQuality(const char* const pName, const CpuCullingQualityBenchmark& benchmark);
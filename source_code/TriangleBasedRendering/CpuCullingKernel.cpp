@@ -0,0 +1,346 @@
+//--------------------------------------------------------------------------------------
+// File: CpuCullingKernel.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuCullingKernel.h"
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__AVX2__)
+#define CULLING_KERNEL_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_KERNEL_SSE 1
+#include <emmintrin.h>
+#endif
+
+void CpuLightSoA::Build(const PointLight * const pLights, uint uLightNum, const float4x4& view, const uint * const pVisibility)
+{
+	m_uLightNum = uLightNum;
+	m_blocks.resize((uLightNum + CpuLightBlockSize - 1) / CpuLightBlockSize);
+
+	for (uint uBlock = 0; uBlock < m_blocks.size(); uBlock++)
+	{
+		CpuLightBlock& block = m_blocks[uBlock];
+		for (uint uLane = 0; uLane < CpuLightBlockSize; uLane++)
+		{
+			uint uIdx = uBlock*CpuLightBlockSize + uLane;
+			if (uIdx < uLightNum && (pVisibility == nullptr || (pVisibility[uIdx / 32] & (1u << (uIdx % 32)))))
+			{
+				CpuFloat4 center = TransformToView(pLights[uIdx].pos, view);
+				block.x[uLane] = center.x;
+				block.y[uLane] = center.y;
+				block.z[uLane] = center.z;
+				block.radius[uLane] = pLights[uIdx].radius;
+			}
+			else
+			{
+				// "r < -FLT_MAX" is always false, so the padding lanes (and invisible lights) are culled.
+				block.x[uLane] = 0.0f;
+				block.y[uLane] = 0.0f;
+				block.z[uLane] = 0.0f;
+				block.radius[uLane] = -FLT_MAX;
+			}
+		}
+	}
+}
+
+// Append the lights of a block according to a lane mask, the lowest bit is the first light.
+static inline void AppendMask(uint uMask, uint uBase, uint* const pList, uint& uNum)
+{
+	while (uMask)
+	{
+		uint uLane = FirstBitLow(uMask);
+		pList[uNum++] = uBase + uLane;
+		uMask &= uMask - 1;
+	}
+}
+
+// Combine the lane mask of the frustum and the lane masks of split planes into the lane masks of primitives.
+static inline void GetPrimitiveMasks(uint uPattern, uint uInsideMask, const uint sideMasks[TileSplitPlaneNum], uint primitiveMasks[TileMaxPrimitiveNum])
+{
+	for (uint i = 0; i < TileMaxPrimitiveNum; i++)
+	{
+		uint uMask = i < TilePatternPrimitiveNum[uPattern] ? uInsideMask : 0;
+		uint uSplitPlanes = TilePatternSplitPlanes[uPattern*TileMaxPrimitiveNum + i];
+		for (uint j = 0; j < TileSplitPlaneNum; j++)
+		{
+			uMask &= (uSplitPlanes & (1u << j)) ? sideMasks[j] : 0xffffffff;
+		}
+		primitiveMasks[i] = uMask;
+	}
+}
+
+void CullLightBlockScalar(const CpuLightBlock& block, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint primitiveMasks[TileMaxPrimitiveNum])
+{
+	uint uSplitPlanes = GetTilePatternSplitPlanes(uPattern);
+	uint uInsideMask = 0;
+	uint sideMasks[TileSplitPlaneNum] = {};
+	for (uint uLane = 0; uLane < CpuLightBlockSize; uLane++)
+	{
+		CpuFloat4 center = { block.x[uLane], block.y[uLane], block.z[uLane], 1.0f };
+		float radius = block.radius[uLane];
+		bool bInside = true;
+		for (uint j = 0; j < 6; j++)
+		{
+			bInside = bInside && GetSignedDistanceFromPlane(center, planes[j]) < radius;
+		}
+		if (!bInside)
+		{
+			continue;
+		}
+		uInsideMask |= 1u << uLane;
+		// Split planes use r <= L.radius like the middle planes of PerTriangleCullingCS.
+		for (uint j = 0; j < TileSplitPlaneNum; j++)
+		{
+			if ((uSplitPlanes & (1u << j)) && GetSignedDistanceFromPlane(center, planes[6 + j]) <= radius)
+			{
+				sideMasks[j] |= 1u << uLane;
+			}
+		}
+	}
+	GetPrimitiveMasks(uPattern, uInsideMask, sideMasks, primitiveMasks);
+}
+
+// The block test of a kernel (CullLightBlock or CullLightBlockScalar).
+typedef void (*CullBlockFunc)(const CpuLightBlock&, const CpuFloat4[TilePlaneNum], uint, uint[TileMaxPrimitiveNum]);
+
+// Test all blocks, and append the lights of lane masks to the lists of primitives.
+static inline void CullBlocksWith(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum], CullBlockFunc cullBlock)
+{
+	uint uPrimitiveNum = TilePatternPrimitiveNum[uPattern];
+	for (uint i = 0; i < uPrimitiveNum; i++)
+	{
+		listNums[i] = 0;
+	}
+	const CpuLightBlock* pBlocks = lights.GetBlocks();
+	for (uint uBlock = 0; uBlock < lights.GetBlockNum(); uBlock++)
+	{
+		uint primitiveMasks[TileMaxPrimitiveNum];
+		cullBlock(pBlocks[uBlock], planes, uPattern, primitiveMasks);
+		for (uint i = 0; i < uPrimitiveNum; i++)
+		{
+			AppendMask(primitiveMasks[i], uBlock*CpuLightBlockSize, pLists[i], listNums[i]);
+		}
+	}
+}
+
+void CullLightBlocksScalar(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum])
+{
+	CullBlocksWith(lights, planes, uPattern, pLists, listNums, CullLightBlockScalar);
+}
+
+void CullLightBlocks(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum])
+{
+	CullBlocksWith(lights, planes, uPattern, pLists, listNums, CullLightBlock);
+}
+
+// Gather the lights of a list into blocks, and append the lights of lane masks in the order of the list.
+static inline void CullListWith(const CpuLightSoA& lights, const uint* const pList, uint uNum, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum], CullBlockFunc cullBlock)
+{
+	uint uPrimitiveNum = TilePatternPrimitiveNum[uPattern];
+	for (uint i = 0; i < uPrimitiveNum; i++)
+	{
+		listNums[i] = 0;
+	}
+	const CpuLightBlock* pBlocks = lights.GetBlocks();
+	CpuLightBlock block;
+	for (uint uBegin = 0; uBegin < uNum; uBegin += CpuLightBlockSize)
+	{
+		uint uCount = std::min(uNum - uBegin, (uint)CpuLightBlockSize);
+		for (uint uLane = 0; uLane < CpuLightBlockSize; uLane++)
+		{
+			if (uLane >= uCount)
+			{
+				// "r < -FLT_MAX" is always false, so the padding lanes are culled.
+				block.x[uLane] = 0.0f;
+				block.y[uLane] = 0.0f;
+				block.z[uLane] = 0.0f;
+				block.radius[uLane] = -FLT_MAX;
+				continue;
+			}
+			uint uLightIdx = pList[uBegin + uLane];
+			const CpuLightBlock& src = pBlocks[uLightIdx / CpuLightBlockSize];
+			uint uSrcLane = uLightIdx % CpuLightBlockSize;
+			block.x[uLane] = src.x[uSrcLane];
+			block.y[uLane] = src.y[uSrcLane];
+			block.z[uLane] = src.z[uSrcLane];
+			block.radius[uLane] = src.radius[uSrcLane];
+		}
+		uint primitiveMasks[TileMaxPrimitiveNum];
+		cullBlock(block, planes, uPattern, primitiveMasks);
+		for (uint i = 0; i < uPrimitiveNum; i++)
+		{
+			uint uMask = primitiveMasks[i];
+			while (uMask)
+			{
+				pLists[i][listNums[i]++] = pList[uBegin + FirstBitLow(uMask)];
+				uMask &= uMask - 1;
+			}
+		}
+	}
+}
+
+void CullLightListScalar(const CpuLightSoA& lights, const uint* const pList, uint uNum, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum])
+{
+	CullListWith(lights, pList, uNum, planes, uPattern, pLists, listNums, CullLightBlockScalar);
+}
+
+void CullLightList(const CpuLightSoA& lights, const uint* const pList, uint uNum, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum])
+{
+	CullListWith(lights, pList, uNum, planes, uPattern, pLists, listNums, CullLightBlock);
+}
+
+// OR the lane masks of blocks into the words of light bitmasks, every word is written once.
+static inline void CullBlocksToMask(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pMasks[TileMaxPrimitiveNum], CullBlockFunc cullBlock)
+{
+	const uint uBlockPerWord = CpuLightMaskWordBits / CpuLightBlockSize;
+	const CpuLightBlock* pBlocks = lights.GetBlocks();
+	uint uBlockNum = lights.GetBlockNum();
+	uint uWordNum = GetLightMaskWordNum(lights.GetLightNum());
+	uint uPrimitiveNum = TilePatternPrimitiveNum[uPattern];
+	for (uint uWord = 0; uWord < uWordNum; uWord++)
+	{
+		uint words[TileMaxPrimitiveNum] = {};
+		uint uBlockEnd = std::min((uWord + 1)*uBlockPerWord, uBlockNum);
+		for (uint uBlock = uWord*uBlockPerWord; uBlock < uBlockEnd; uBlock++)
+		{
+			uint primitiveMasks[TileMaxPrimitiveNum];
+			cullBlock(pBlocks[uBlock], planes, uPattern, primitiveMasks);
+			uint uShift = (uBlock % uBlockPerWord)*CpuLightBlockSize;
+			for (uint i = 0; i < uPrimitiveNum; i++)
+			{
+				words[i] |= primitiveMasks[i] << uShift;
+			}
+		}
+		for (uint i = 0; i < uPrimitiveNum; i++)
+		{
+			pMasks[i][uWord] = words[i];
+		}
+	}
+}
+
+void CullLightBlocksMaskScalar(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pMasks[TileMaxPrimitiveNum])
+{
+	CullBlocksToMask(lights, planes, uPattern, pMasks, CullLightBlockScalar);
+}
+
+void CullLightBlocksMask(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pMasks[TileMaxPrimitiveNum])
+{
+	CullBlocksToMask(lights, planes, uPattern, pMasks, CullLightBlock);
+}
+
+#if defined(CULLING_KERNEL_AVX2)
+
+// dot(eqn.xyz, p.xyz) + eqn.w for 8 lights.
+static inline __m256 PlaneDistance8(const CpuFloat4& plane, __m256 x, __m256 y, __m256 z)
+{
+	__m256 d = _mm256_mul_ps(_mm256_set1_ps(plane.x), x);
+	d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.y), y));
+	d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.z), z));
+	return _mm256_add_ps(d, _mm256_set1_ps(plane.w));
+}
+
+void CullLightBlock(const CpuLightBlock& block, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint primitiveMasks[TileMaxPrimitiveNum])
+{
+	__m256 x = _mm256_loadu_ps(block.x);
+	__m256 y = _mm256_loadu_ps(block.y);
+	__m256 z = _mm256_loadu_ps(block.z);
+	__m256 radius = _mm256_loadu_ps(block.radius);
+
+	// r[j] < L.radius for the 6 planes of the frustum.
+	__m256 inside = _mm256_cmp_ps(PlaneDistance8(planes[0], x, y, z), radius, _CMP_LT_OQ);
+	for (uint j = 1; j < 6; j++)
+	{
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(PlaneDistance8(planes[j], x, y, z), radius, _CMP_LT_OQ));
+	}
+	uint uInsideMask = (uint)_mm256_movemask_ps(inside);
+	// r[j] <= L.radius for the split planes of the pattern.
+	uint uSplitPlanes = uInsideMask ? GetTilePatternSplitPlanes(uPattern) : 0;
+	uint sideMasks[TileSplitPlaneNum];
+	for (uint j = 0; j < TileSplitPlaneNum; j++)
+	{
+		sideMasks[j] = (uSplitPlanes & (1u << j)) ? (uint)_mm256_movemask_ps(_mm256_cmp_ps(PlaneDistance8(planes[6 + j], x, y, z), radius, _CMP_LE_OQ)) : 0;
+	}
+	GetPrimitiveMasks(uPattern, uInsideMask, sideMasks, primitiveMasks);
+}
+
+const char* GetCullingKernelName()
+{
+	return "AVX2";
+}
+
+#elif defined(CULLING_KERNEL_SSE)
+
+// dot(eqn.xyz, p.xyz) + eqn.w for 4 lights.
+static inline __m128 PlaneDistance4(const CpuFloat4& plane, __m128 x, __m128 y, __m128 z)
+{
+	__m128 d = _mm_mul_ps(_mm_set1_ps(plane.x), x);
+	d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.y), y));
+	d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.z), z));
+	return _mm_add_ps(d, _mm_set1_ps(plane.w));
+}
+
+void CullLightBlock(const CpuLightBlock& block, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint primitiveMasks[TileMaxPrimitiveNum])
+{
+	uint uSplitPlanes = GetTilePatternSplitPlanes(uPattern);
+	uint uInsideMask = 0;
+	uint sideMasks[TileSplitPlaneNum] = {};
+	// Two halves of a block.
+	for (uint uHalf = 0; uHalf < CpuLightBlockSize; uHalf += 4)
+	{
+		__m128 x = _mm_loadu_ps(block.x + uHalf);
+		__m128 y = _mm_loadu_ps(block.y + uHalf);
+		__m128 z = _mm_loadu_ps(block.z + uHalf);
+		__m128 radius = _mm_loadu_ps(block.radius + uHalf);
+
+		// r[j] < L.radius for the 6 planes of the frustum.
+		__m128 inside = _mm_cmplt_ps(PlaneDistance4(planes[0], x, y, z), radius);
+		for (uint j = 1; j < 6; j++)
+		{
+			inside = _mm_and_ps(inside, _mm_cmplt_ps(PlaneDistance4(planes[j], x, y, z), radius));
+		}
+		uint uMask = (uint)_mm_movemask_ps(inside);
+		uInsideMask |= uMask << uHalf;
+		if (uMask == 0)
+		{
+			continue;
+		}
+		// r[j] <= L.radius for the split planes of the pattern.
+		for (uint j = 0; j < TileSplitPlaneNum; j++)
+		{
+			if (uSplitPlanes & (1u << j))
+			{
+				sideMasks[j] |= (uint)_mm_movemask_ps(_mm_cmple_ps(PlaneDistance4(planes[6 + j], x, y, z), radius)) << uHalf;
+			}
+		}
+	}
+	GetPrimitiveMasks(uPattern, uInsideMask, sideMasks, primitiveMasks);
+}
+
+const char* GetCullingKernelName()
+{
+	return "SSE";
+}
+
+#else
+
+void CullLightBlock(const CpuLightBlock& block, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint primitiveMasks[TileMaxPrimitiveNum])
+{
+	CullLightBlockScalar(block, planes, uPattern, primitiveMasks);
+}
+
+const char* GetCullingKernelName()
+{
+	return "Scalar";
+}
+
+#endif
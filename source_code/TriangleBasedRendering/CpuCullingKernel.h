@@ -0,0 +1,111 @@
+//--------------------------------------------------------------------------------------
+// File: CpuCullingKernel.h
+//
+// A SIMD kernel for the sphere-versus-prism test of light culling.
+// Lights are transformed to view space once and transposed into SoA blocks of 8 lights,
+// then the kernel tests 8 lights (AVX2) or 4 lights (SSE) per instruction against the planes of a tile.
+// The split planes of a tile are only tested if a primitive of the subdivision pattern uses them.
+// Without SSE, a scalar loop is used.
+//
+// The kernel uses the same operation order as GetSignedDistanceFromPlane, so its lists are equal to
+// the lists of CpuLightCuller's reference path. Build without FMA contraction (e.g. -ffp-contract=off)
+// to keep this property when AVX2/FMA is enabled.
+// The instruction set is selected at compile time: /arch:AVX2 (or -mavx2) enables the 8-wide path.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <vector>
+#include "ShaderTypeDefine.h"
+#include "ClusteredCommon.h"
+#include "CpuShaderMath.h"
+
+// The number of lights in a SoA block.
+#define CpuLightBlockSize 8
+// The number of lights in a word of a light bitmask, a word holds the lane masks of 4 blocks.
+#define CpuLightMaskWordBits 32
+
+// The number of words in the light bitmask of a cluster, bit i of word i/32 is light i.
+inline uint GetLightMaskWordNum(uint uLightNum)
+{
+	return (uLightNum + CpuLightMaskWordBits - 1) / CpuLightMaskWordBits;
+}
+
+// 8 lights in view space.
+struct CpuLightBlock
+{
+	float x[CpuLightBlockSize];
+	float y[CpuLightBlockSize];
+	float z[CpuLightBlockSize];
+	float radius[CpuLightBlockSize];
+};
+
+// A light buffer in SoA blocks, the unused lanes of the last block never pass culling.
+class CpuLightSoA
+{
+public:
+	// Transform lights to view space and transpose them into blocks.
+	// Lights whose bits are clear in pVisibility (bit i of word i/32 is light i) are culled like the unused lanes.
+	void Build(const PointLight* const pLights, uint uLightNum, const float4x4& view, const uint* const pVisibility = nullptr);
+
+	const CpuLightBlock* GetBlocks() const { return m_blocks.empty() ? nullptr : &m_blocks[0]; }
+	uint GetBlockNum() const { return (uint)m_blocks.size(); }
+	uint GetLightNum() const { return m_uLightNum; }
+
+private:
+	std::vector<CpuLightBlock> m_blocks;
+	uint m_uLightNum = 0;
+};
+
+// The split planes used by the primitives of a subdivision pattern (bit j is plane 6+j).
+inline uint GetTilePatternSplitPlanes(uint uPattern)
+{
+	uint uPlanes = 0;
+	for (uint i = 0; i < TilePatternPrimitiveNum[uPattern]; i++)
+	{
+		uPlanes |= TilePatternSplitPlanes[uPattern*TileMaxPrimitiveNum + i];
+	}
+	return uPlanes;
+}
+
+// The number of planes tested per light for a subdivision pattern.
+inline uint GetTilePatternPlaneNum(uint uPattern)
+{
+	return 6 + CountBits(GetTilePatternSplitPlanes(uPattern));
+}
+
+// Test all lights against the planes of a tile subdivided by a pattern (TileSubdivision*).
+// A light is in primitive i if it passes planes[0~5] and the split planes of the primitive (TilePatternSplitPlanes),
+// so TileSubdivisionQuad (per tile culling) only uses planes[0~5].
+// pLists[i] is the list of primitive i and needs space for GetLightNum() indexes, lights are written in ascending order.
+void CullLightBlocks(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum]);
+
+// Test one block, and return a lane mask per primitive (the lowest bit is the first lane).
+void CullLightBlock(const CpuLightBlock& block, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint primitiveMasks[TileMaxPrimitiveNum]);
+
+// Same as CullLightBlocks without SIMD instructions.
+void CullLightBlocksScalar(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum]);
+
+// Same as CullLightBlock without SIMD instructions.
+void CullLightBlockScalar(const CpuLightBlock& block, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint primitiveMasks[TileMaxPrimitiveNum]);
+
+// Same as CullLightBlocks, but only test the lights in pList (e.g. the list of a parent cluster).
+// Lights are gathered into blocks, and written in the order of pList.
+void CullLightList(const CpuLightSoA& lights, const uint* const pList, uint uNum, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum]);
+
+// Same as CullLightList without SIMD instructions.
+void CullLightListScalar(const CpuLightSoA& lights, const uint* const pList, uint uNum, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum]);
+
+// Same as CullLightBlocks, but write light bitmasks instead of lists.
+// pMasks[i] needs GetLightMaskWordNum(GetLightNum()) words, only the primitives of the pattern are written.
+void CullLightBlocksMask(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pMasks[TileMaxPrimitiveNum]);
+
+// Same as CullLightBlocksMask without SIMD instructions.
+void CullLightBlocksMaskScalar(const CpuLightSoA& lights, const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint* const pMasks[TileMaxPrimitiveNum]);
+
+// The instruction set of CullLightBlocks: "AVX2", "SSE" or "Scalar".
+const char* GetCullingKernelName();
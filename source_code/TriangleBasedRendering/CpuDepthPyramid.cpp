@@ -0,0 +1,212 @@
+//--------------------------------------------------------------------------------------
+// File: CpuDepthPyramid.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuDepthPyramid.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__AVX2__)
+#define DEPTH_PYRAMID_AVX 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DEPTH_PYRAMID_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Reduce TileSize contiguous texels into fMin and fMax.
+static inline void ReduceRow(const float* const pRow, float& fMin, float& fMax)
+{
+#if DEPTH_PYRAMID_AVX
+	__m256 vMin = _mm256_set1_ps(fMin);
+	__m256 vMax = _mm256_set1_ps(fMax);
+	for (uint i = 0; i < TileSize; i += 8)
+	{
+		__m256 v = _mm256_loadu_ps(pRow + i);
+		vMin = _mm256_min_ps(vMin, v);
+		vMax = _mm256_max_ps(vMax, v);
+	}
+	__m128 vMin4 = _mm_min_ps(_mm256_castps256_ps128(vMin), _mm256_extractf128_ps(vMin, 1));
+	__m128 vMax4 = _mm_max_ps(_mm256_castps256_ps128(vMax), _mm256_extractf128_ps(vMax, 1));
+#elif DEPTH_PYRAMID_SSE
+	__m128 vMin4 = _mm_set1_ps(fMin);
+	__m128 vMax4 = _mm_set1_ps(fMax);
+	for (uint i = 0; i < TileSize; i += 4)
+	{
+		__m128 v = _mm_loadu_ps(pRow + i);
+		vMin4 = _mm_min_ps(vMin4, v);
+		vMax4 = _mm_max_ps(vMax4, v);
+	}
+#endif
+#if DEPTH_PYRAMID_AVX || DEPTH_PYRAMID_SSE
+	vMin4 = _mm_min_ps(vMin4, _mm_movehl_ps(vMin4, vMin4));
+	vMin4 = _mm_min_ss(vMin4, _mm_shuffle_ps(vMin4, vMin4, 1));
+	vMax4 = _mm_max_ps(vMax4, _mm_movehl_ps(vMax4, vMax4));
+	vMax4 = _mm_max_ss(vMax4, _mm_shuffle_ps(vMax4, vMax4, 1));
+	fMin = _mm_cvtss_f32(vMin4);
+	fMax = _mm_cvtss_f32(vMax4);
+#else
+	for (uint i = 0; i < TileSize; i++)
+	{
+		fMin = std::min(fMin, pRow[i]);
+		fMax = std::max(fMax, pRow[i]);
+	}
+#endif
+}
+
+void CpuDepthPyramid::Build(const float * const pDepth, uint uDepthWidth, uint uDepthHeight, const ClusteredData & cullingData,
+	CpuTaskScheduler * const pScheduler)
+{
+	m_uWidth = cullingData.widthDim;
+	m_uHeight = cullingData.heightDim;
+	m_fTileSizeX = cullingData.tileSizeX;
+	m_fTileSizeY = cullingData.tileSizeY;
+	m_uLevelNum = GetDepthPyramidLevelNum(m_uWidth, m_uHeight);
+	m_cells.resize(GetDepthPyramidLevelOffset(m_uWidth, m_uHeight, m_uLevelNum));
+
+	// Every row of tiles writes its own cells.
+	auto buildRow = [&](uint y, uint)
+	{
+		for (uint x = 0; x < m_uWidth; x++)
+		{
+			BuildTile(x, y, pDepth, uDepthWidth, uDepthHeight);
+		}
+	};
+	if (pScheduler)
+	{
+		pScheduler->ParallelFor(m_uHeight, buildRow);
+	}
+	else
+	{
+		for (uint y = 0; y < m_uHeight; y++)
+		{
+			buildRow(y, 0);
+		}
+	}
+
+	// Upper levels are small, a 1920x1080 pyramid has 510 cells above level 0.
+	for (uint uLevel = 1; uLevel < m_uLevelNum; uLevel++)
+	{
+		uint uSrcOffset = GetDepthPyramidLevelOffset(m_uWidth, m_uHeight, uLevel - 1);
+		uint uDstOffset = GetDepthPyramidLevelOffset(m_uWidth, m_uHeight, uLevel);
+		uint uSrcWidth = GetLevelWidth(uLevel - 1);
+		uint uSrcHeight = GetLevelHeight(uLevel - 1);
+		for (uint y = 0; y < GetLevelHeight(uLevel); y++)
+		{
+			for (uint x = 0; x < GetLevelWidth(uLevel); x++)
+			{
+				DepthBounds bounds = { FLT_MAX, 0.0f };
+				for (uint k = 0; k < 4; k++)
+				{
+					uint uSrcX = x * 2 + (k & 1);
+					uint uSrcY = y * 2 + (k >> 1);
+					if (uSrcX < uSrcWidth && uSrcY < uSrcHeight)
+					{
+						const DepthBounds& src = m_cells[uSrcOffset + uSrcX + uSrcY*uSrcWidth];
+						bounds.zMin = std::min(bounds.zMin, src.zMin);
+						bounds.zMax = std::max(bounds.zMax, src.zMax);
+					}
+				}
+				m_cells[uDstOffset + x + y*GetLevelWidth(uLevel)] = bounds;
+			}
+		}
+	}
+}
+
+void CpuDepthPyramid::BuildTile(uint uTileX, uint uTileY, const float * const pDepth, uint uDepthWidth, uint uDepthHeight)
+{
+	float x = m_fTileSizeX*uTileX;
+	float y = m_fTileSizeY*uTileY;
+
+	// The texels of a tile are the texels of LoadTileDepth in CpuLightCuller, and texels outside of the texture are 0.
+	// Columns are contiguous unless float rounding skips a texel, then the tile is reduced without SIMD.
+	uint columns[TileSize];
+	bool bContiguous = true;
+	for (uint i = 0; i < TileSize; i++)
+	{
+		columns[i] = (uint)(x + 0.5f + (float)i);
+		bContiguous = bContiguous && columns[i] == columns[0] + i;
+	}
+	bContiguous = bContiguous && columns[TileSize - 1] < uDepthWidth;
+
+	float fMin = FLT_MAX;
+	float fMax = 0.0f;
+	for (uint i = 0; i < TileSize; i++)
+	{
+		uint uRow = (uint)(y + 0.5f + (float)i);
+		if (uRow >= uDepthHeight)
+		{
+			fMin = 0.0f;
+			continue;
+		}
+		const float* pRow = pDepth + uRow*uDepthWidth;
+		if (bContiguous)
+		{
+			ReduceRow(pRow + columns[0], fMin, fMax);
+			continue;
+		}
+		for (uint j = 0; j < TileSize; j++)
+		{
+			float depth = columns[j] < uDepthWidth ? pRow[columns[j]] : 0.0f;
+			fMin = std::min(fMin, depth);
+			fMax = std::max(fMax, depth);
+		}
+	}
+	DepthBounds& bounds = m_cells[uTileX + uTileY*m_uWidth];
+	bounds.zMin = fMin;
+	bounds.zMax = fMax;
+}
+
+bool CpuDepthPyramid::IsSphereOccluded(const CpuFloat4 & center, float fRadius, const ViewData & viewData) const
+{
+	// Spheres crossing the near plane have no screen rect.
+	CpuFloat4 nearPos = { 0.0f, 0.0f, 0.0f, 1.0f };
+	float fSphereNearZ = center.z - fRadius;
+	if (m_cells.empty() || !(fSphereNearZ > DivideByW(Mul(nearPos, viewData.ProjInv)).z))
+	{
+		return false;
+	}
+
+	// All corners of the view-space AABB of the sphere are in front of the camera.
+	uint x0, y0, x1, y1;
+	GetSphereTileRect(center, fRadius, viewData, x0, y0, x1, y1);
+
+	uint uLevel = GetDepthPyramidCoverLevel(x0, y0, x1, y1);
+	float fZMax = 0.0f;
+	for (uint y = y0 >> uLevel; y <= y1 >> uLevel; y++)
+	{
+		for (uint x = x0 >> uLevel; x <= x1 >> uLevel; x++)
+		{
+			fZMax = std::max(fZMax, GetBounds(uLevel, x, y).zMax);
+		}
+	}
+	CpuFloat4 farPos = { 0.0f, 0.0f, fZMax, 1.0f };
+	return fSphereNearZ > DivideByW(Mul(farPos, viewData.ProjInv)).z;
+}
+
+bool CpuDepthPyramid::GetSphereTileRect(const CpuFloat4 & center, float fRadius, const ViewData & viewData, uint & x0, uint & y0, uint & x1, uint & y1) const
+{
+	// The screen rect of the sphere from the 8 corners of its view-space AABB.
+	float rectMin[2] = { FLT_MAX, FLT_MAX };
+	float rectMax[2] = { -FLT_MAX, -FLT_MAX };
+	for (uint k = 0; k < 8; k++)
+	{
+		CpuFloat4 corner = { center.x + ((k & 1) ? fRadius : -fRadius), center.y + ((k & 2) ? fRadius : -fRadius),
+			center.z + ((k & 4) ? fRadius : -fRadius), 1.0f };
+		CpuFloat4 projPos = DivideByW(Mul(corner, viewData.Proj));
+		rectMin[0] = std::min(rectMin[0], projPos.x);
+		rectMin[1] = std::min(rectMin[1], projPos.y);
+		rectMax[0] = std::max(rectMax[0], projPos.x);
+		rectMax[1] = std::max(rectMax[1], projPos.y);
+	}
+	// Projected positions to tiles, y is flipped.
+	float fTileMinX = std::floor((rectMin[0] * 0.5f + 0.5f)*m_uWidth);
+	float fTileMaxX = std::floor((rectMax[0] * 0.5f + 0.5f)*m_uWidth);
+	float fTileMinY = std::floor((0.5f - rectMax[1] * 0.5f)*m_uHeight);
+	float fTileMaxY = std::floor((0.5f - rectMin[1] * 0.5f)*m_uHeight);
+	x0 = (uint)std::min(std::max(fTileMinX, 0.0f), (float)(m_uWidth - 1));
+	x1 = (uint)std::min(std::max(fTileMaxX, 0.0f), (float)(m_uWidth - 1));
+	y0 = (uint)std::min(std::max(fTileMinY, 0.0f), (float)(m_uHeight - 1));
+	y1 = (uint)std::min(std::max(fTileMaxY, 0.0f), (float)(m_uHeight - 1));
+	return fTileMaxX >= 0.0f && fTileMaxY >= 0.0f && fTileMinX < (float)m_uWidth && fTileMinY < (float)m_uHeight;
+}
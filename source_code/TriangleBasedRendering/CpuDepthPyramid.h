@@ -0,0 +1,57 @@
+//--------------------------------------------------------------------------------------
+// File: CpuDepthPyramid.h
+//
+// A CPU reference of the depth pyramid (DepthPyramidCS and DepthPyramidReduceCS) and of the light occlusion test
+// (LightOcclusionCS). Level 0 has the min/max depth of the TileSize*TileSize texels loaded by every tile of the culling
+// shaders, so its bounds are equal to ldsZMin/ldsZMax. A cell of level i+1 covers 2x2 cells of level i, and cells at the
+// right or bottom edge cover fewer cells. The buffer has the layout of gDepthPyramidUAV (GetDepthPyramidLevelOffset).
+//
+// Rows of tiles are reduced with AVX (8 texels) or SSE (4 texels) per instruction. Depth values are non-negative,
+// so the float min/max is equal to the uint min/max of the shaders.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <vector>
+#include "ShaderTypeDefine.h"
+#include "ClusteredCommon.h"
+#include "CameraCommon.h"
+#include "CpuShaderMath.h"
+#include "CpuTaskScheduler.h"
+
+class CpuDepthPyramid
+{
+public:
+	// Build all levels for the tiles of cullingData, pScheduler can be nullptr to build on the calling thread.
+	void Build(const float* const pDepth, uint uDepthWidth, uint uDepthHeight, const ClusteredData& cullingData,
+		CpuTaskScheduler* const pScheduler);
+
+	uint GetLevelNum() const { return m_uLevelNum; }
+	uint GetLevelWidth(uint uLevel) const { return GetDepthPyramidLevelSize(m_uWidth, uLevel); }
+	uint GetLevelHeight(uint uLevel) const { return GetDepthPyramidLevelSize(m_uHeight, uLevel); }
+	// The bounds of cell (x, y) of a level, a cell of level 0 is a tile.
+	const DepthBounds& GetBounds(uint uLevel, uint x, uint y) const
+	{
+		return m_cells[GetDepthPyramidLevelOffset(m_uWidth, m_uHeight, uLevel) + x + y*GetLevelWidth(uLevel)];
+	}
+	// The bounds of a tile.
+	const DepthBounds& GetTileBounds(uint uTileX, uint uTileY) const { return m_cells[uTileX + uTileY*m_uWidth]; }
+	// All cells of all levels (gDepthPyramidUAV).
+	const std::vector<DepthBounds>& GetBuffer() const { return m_cells; }
+
+	// Is a view-space light sphere behind the max depth of all cells under its screen rect (LightOcclusionCS)?
+	// The rect is covered by at most 2x2 cells of the finest possible level. Spheres crossing the near plane are never occluded.
+	bool IsSphereOccluded(const CpuFloat4& center, float fRadius, const ViewData& viewData) const;
+	// Get the tiles [x0, x1]x[y0, y1] under a view-space sphere whose view-space AABB is in front of the camera
+	// (GetSphereTileRect of the shaders), and return false if the rect misses all tiles.
+	bool GetSphereTileRect(const CpuFloat4& center, float fRadius, const ViewData& viewData, uint& x0, uint& y0, uint& x1, uint& y1) const;
+
+private:
+	// Reduce the texels of a tile into level 0.
+	void BuildTile(uint uTileX, uint uTileY, const float* const pDepth, uint uDepthWidth, uint uDepthHeight);
+
+	uint m_uWidth = 0;
+	uint m_uHeight = 0;
+	uint m_uLevelNum = 0;
+	float m_fTileSizeX = 0.0f;
+	float m_fTileSizeY = 0.0f;
+	std::vector<DepthBounds> m_cells;
+};
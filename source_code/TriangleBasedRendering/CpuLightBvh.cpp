@@ -0,0 +1,314 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightBvh.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuLightBvh.h"
+#include <algorithm>
+#include <cfloat>
+
+// The maximum depth of the tree, splits are balanced so this is enough for 2^32 lights.
+#define BvhMaxDepth 64
+
+// The number of lights in the left child, a multiple of CpuLightBlockSize.
+static inline uint GetLeftNum(uint uNum)
+{
+	return (uNum + CpuLightBlockSize * 2 - 1) / (CpuLightBlockSize * 2) * CpuLightBlockSize;
+}
+
+// The number of nodes of a subtree with uNum lights.
+static inline uint GetSubtreeNodeNum(uint uNum)
+{
+	return (uNum + CpuLightBlockSize - 1) / CpuLightBlockSize * 2 - 1;
+}
+
+static void RunTasks(CpuTaskScheduler* const pScheduler, uint uTaskNum, const CpuTaskScheduler::Task& task)
+{
+	if (pScheduler)
+	{
+		pScheduler->ParallelFor(uTaskNum, task);
+		return;
+	}
+	for (uint i = 0; i < uTaskNum; i++)
+	{
+		task(i, 0);
+	}
+}
+
+CpuLightBvh::CpuLightBvh()
+{
+	m_uLightNum = 0;
+}
+
+void CpuLightBvh::Build(const CpuLightSoA & lights, CpuTaskScheduler * const pScheduler)
+{
+	// Copy lights out of blocks, nth_element reads them in random order.
+	m_uLightNum = lights.GetLightNum();
+	m_lights.resize(m_uLightNum);
+	m_order.resize(m_uLightNum);
+	for (uint i = 0; i < m_uLightNum; i++)
+	{
+		const CpuLightBlock& block = lights.GetBlocks()[i / CpuLightBlockSize];
+		uint uLane = i % CpuLightBlockSize;
+		CpuFloat4 light = { block.x[uLane], block.y[uLane], block.z[uLane], block.radius[uLane] };
+		m_lights[i] = light;
+		m_order[i] = i;
+	}
+	m_blocks.resize((m_uLightNum + CpuLightBlockSize - 1) / CpuLightBlockSize);
+	m_nodes.resize(m_uLightNum > 0 ? GetSubtreeNodeNum(m_uLightNum) : 0);
+	if (m_uLightNum == 0)
+	{
+		return;
+	}
+
+	// Split the top levels until there are enough subtrees for all threads.
+	uint uThreadNum = pScheduler ? pScheduler->GetThreadNum() : 1;
+	std::vector<BuildTask> tasks(1);
+	tasks[0].uNode = 0;
+	tasks[0].uBegin = 0;
+	tasks[0].uEnd = m_uLightNum;
+	uint uNextNode = 1;
+	std::vector<BuildTask> splitTasks, nextTasks;
+	while (tasks.size() < uThreadNum * 4)
+	{
+		splitTasks.clear();
+		nextTasks.clear();
+		for (const auto& task : tasks)
+		{
+			if (task.uEnd - task.uBegin <= CpuLightBlockSize)
+			{
+				nextTasks.push_back(task);
+				continue;
+			}
+			// Children are allocated in pairs, uNextNode is the left child.
+			BuildTask split = task;
+			split.uNextNode = uNextNode;
+			splitTasks.push_back(split);
+
+			uint uMid = task.uBegin + GetLeftNum(task.uEnd - task.uBegin);
+			BuildTask left = { uNextNode, task.uBegin, uMid, 0 };
+			BuildTask right = { uNextNode + 1, uMid, task.uEnd, 0 };
+			nextTasks.push_back(left);
+			nextTasks.push_back(right);
+			uNextNode += 2;
+		}
+		if (splitTasks.empty())
+		{
+			break;
+		}
+		RunTasks(pScheduler, (uint)splitTasks.size(), [&](uint uTask, uint)
+		{
+			const BuildTask& task = splitTasks[uTask];
+			SplitNode(task.uNode, task.uBegin, task.uEnd, task.uNextNode);
+		});
+		tasks.swap(nextTasks);
+	}
+
+	// Every subtree owns a range of nodes, so subtrees can be built on any thread.
+	for (auto& task : tasks)
+	{
+		task.uNextNode = uNextNode;
+		uNextNode += GetSubtreeNodeNum(task.uEnd - task.uBegin) - 1;
+	}
+	RunTasks(pScheduler, (uint)tasks.size(), [&](uint uTask, uint)
+	{
+		BuildTask& task = tasks[uTask];
+		BuildSubtree(task.uNode, task.uBegin, task.uEnd, task.uNextNode);
+	});
+}
+
+void CpuLightBvh::SplitNode(uint uNode, uint uBegin, uint uEnd, uint uLeft)
+{
+	CpuBvhNode& node = m_nodes[uNode];
+	float centerMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float centerMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (uint j = 0; j < 3; j++)
+	{
+		node.boundsMin[j] = FLT_MAX;
+		node.boundsMax[j] = -FLT_MAX;
+	}
+	for (uint i = uBegin; i < uEnd; i++)
+	{
+		const CpuFloat4& light = m_lights[m_order[i]];
+		float center[3] = { light.x, light.y, light.z };
+		for (uint j = 0; j < 3; j++)
+		{
+			node.boundsMin[j] = std::min(node.boundsMin[j], center[j] - light.w);
+			node.boundsMax[j] = std::max(node.boundsMax[j], center[j] + light.w);
+			centerMin[j] = std::min(centerMin[j], center[j]);
+			centerMax[j] = std::max(centerMax[j], center[j]);
+		}
+	}
+	node.uOffset = uLeft;
+	node.uCount = 0;
+
+	// Split at the median of the longest axis of light centers.
+	uint uAxis = 0;
+	for (uint j = 1; j < 3; j++)
+	{
+		if (centerMax[j] - centerMin[j] > centerMax[uAxis] - centerMin[uAxis])
+		{
+			uAxis = j;
+		}
+	}
+	uint uMid = uBegin + GetLeftNum(uEnd - uBegin);
+	std::nth_element(m_order.begin() + uBegin, m_order.begin() + uMid, m_order.begin() + uEnd, [&](uint a, uint b)
+	{
+		return (&m_lights[a].x)[uAxis] < (&m_lights[b].x)[uAxis];
+	});
+}
+
+void CpuLightBvh::MakeLeaf(uint uNode, uint uBegin, uint uEnd)
+{
+	CpuBvhNode& node = m_nodes[uNode];
+	CpuLightBlock& block = m_blocks[uBegin / CpuLightBlockSize];
+	for (uint j = 0; j < 3; j++)
+	{
+		node.boundsMin[j] = FLT_MAX;
+		node.boundsMax[j] = -FLT_MAX;
+	}
+	for (uint uLane = 0; uLane < CpuLightBlockSize; uLane++)
+	{
+		if (uBegin + uLane >= uEnd)
+		{
+			// "r < -FLT_MAX" is always false, so the padding lanes are culled.
+			block.x[uLane] = 0.0f;
+			block.y[uLane] = 0.0f;
+			block.z[uLane] = 0.0f;
+			block.radius[uLane] = -FLT_MAX;
+			continue;
+		}
+		const CpuFloat4& light = m_lights[m_order[uBegin + uLane]];
+		block.x[uLane] = light.x;
+		block.y[uLane] = light.y;
+		block.z[uLane] = light.z;
+		block.radius[uLane] = light.w;
+		float center[3] = { light.x, light.y, light.z };
+		for (uint j = 0; j < 3; j++)
+		{
+			node.boundsMin[j] = std::min(node.boundsMin[j], center[j] - light.w);
+			node.boundsMax[j] = std::max(node.boundsMax[j], center[j] + light.w);
+		}
+	}
+	node.uOffset = uBegin;
+	node.uCount = uEnd - uBegin;
+}
+
+void CpuLightBvh::BuildSubtree(uint uNode, uint uBegin, uint uEnd, uint & uNextNode)
+{
+	if (uEnd - uBegin <= CpuLightBlockSize)
+	{
+		MakeLeaf(uNode, uBegin, uEnd);
+		return;
+	}
+	uint uLeft = uNextNode;
+	uNextNode += 2;
+	SplitNode(uNode, uBegin, uEnd, uLeft);
+	uint uMid = uBegin + GetLeftNum(uEnd - uBegin);
+	BuildSubtree(uLeft, uBegin, uMid, uNextNode);
+	BuildSubtree(uLeft + 1, uMid, uEnd, uNextNode);
+}
+
+bool CpuLightBvh::TestNode(const CpuBvhNode & node, const CpuFloat4 planes[TilePlaneNum]) const
+{
+	CpuFloat4 center = { (node.boundsMin[0] + node.boundsMax[0])*0.5f, (node.boundsMin[1] + node.boundsMax[1])*0.5f,
+		(node.boundsMin[2] + node.boundsMax[2])*0.5f, 1.0f };
+	float extent[3] = { (node.boundsMax[0] - node.boundsMin[0])*0.5f, (node.boundsMax[1] - node.boundsMin[1])*0.5f,
+		(node.boundsMax[2] - node.boundsMin[2])*0.5f };
+	for (uint j = 0; j < 6; j++)
+	{
+		// A light passes a plane if its sphere has a point behind the plane, so the node is culled
+		// only if the whole AABB is in front of the plane. The tolerance covers the rounding of
+		// the box and keeps the test conservative.
+		float r = fabsf(planes[j].x)*extent[0] + fabsf(planes[j].y)*extent[1] + fabsf(planes[j].z)*extent[2];
+		float d = GetSignedDistanceFromPlane(center, planes[j]);
+		float tolerance = (fabsf(d) + r + fabsf(planes[j].w))*1e-5f;
+		if (d - r > tolerance)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+template<typename VisitLeaf>
+unsigned long long CpuLightBvh::Traverse(const CpuFloat4 planes[TilePlaneNum], uint uPattern, VisitLeaf visitLeaf) const
+{
+	if (m_nodes.empty())
+	{
+		return 0;
+	}
+
+	// The split planes of the primitives split the tile, so a node always passes one of them.
+	// Nodes only use the 6 planes of the frustum.
+	uint uPlaneNum = GetTilePatternPlaneNum(uPattern);
+	unsigned long long uTests = 0;
+	uint stack[BvhMaxDepth];
+	uint uStackSize = 0;
+	stack[uStackSize++] = 0;
+	while (uStackSize > 0)
+	{
+		const CpuBvhNode& node = m_nodes[stack[--uStackSize]];
+		uTests += 6;
+		if (!TestNode(node, planes))
+		{
+			continue;
+		}
+		if (node.uCount == 0)
+		{
+			stack[uStackSize++] = node.uOffset + 1;
+			stack[uStackSize++] = node.uOffset;
+			continue;
+		}
+
+		uint primitiveMasks[TileMaxPrimitiveNum];
+		CullLightBlock(m_blocks[node.uOffset / CpuLightBlockSize], planes, uPattern, primitiveMasks);
+		uTests += node.uCount*uPlaneNum;
+		visitLeaf(node, primitiveMasks);
+	}
+	return uTests;
+}
+
+unsigned long long CpuLightBvh::Cull(const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+	uint * const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum]) const
+{
+	uint uPrimitiveNum = TilePatternPrimitiveNum[uPattern];
+	for (uint i = 0; i < uPrimitiveNum; i++)
+	{
+		listNums[i] = 0;
+	}
+	unsigned long long uTests = Traverse(planes, uPattern, [&](const CpuBvhNode& node, uint primitiveMasks[TileMaxPrimitiveNum])
+	{
+		for (uint i = 0; i < uPrimitiveNum; i++)
+		{
+			uint uMask = primitiveMasks[i];
+			while (uMask)
+			{
+				pLists[i][listNums[i]++] = m_order[node.uOffset + FirstBitLow(uMask)];
+				uMask &= uMask - 1;
+			}
+		}
+	});
+	for (uint i = 0; i < uPrimitiveNum; i++)
+	{
+		std::sort(pLists[i], pLists[i] + listNums[i]);
+	}
+	return uTests;
+}
+
+unsigned long long CpuLightBvh::CullMask(const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint * const pMasks[TileMaxPrimitiveNum]) const
+{
+	uint uPrimitiveNum = TilePatternPrimitiveNum[uPattern];
+	// Lights of a leaf are scattered in the light array, so bits are set one by one.
+	return Traverse(planes, uPattern, [&](const CpuBvhNode& node, uint primitiveMasks[TileMaxPrimitiveNum])
+	{
+		for (uint i = 0; i < uPrimitiveNum; i++)
+		{
+			uint uMask = primitiveMasks[i];
+			while (uMask)
+			{
+				uint uLightIdx = m_order[node.uOffset + FirstBitLow(uMask)];
+				pMasks[i][uLightIdx / CpuLightMaskWordBits] |= 1u << (uLightIdx % CpuLightMaskWordBits);
+				uMask &= uMask - 1;
+			}
+		}
+	});
+}
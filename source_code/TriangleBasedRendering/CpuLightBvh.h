@@ -0,0 +1,78 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightBvh.h
+//
+// A bounding volume hierarchy over view-space light spheres for CPU light culling.
+// Culling a tile walks the tree and tests the 6 frustum planes against the AABBs of nodes,
+// so a tile only runs the sphere test for lights in visited leaves instead of all lights.
+//
+// The tree is rebuilt every run by median splits on the longest axis of light centers.
+// Splits are aligned to CpuLightBlockSize, so every leaf is one SoA block and the leaves are
+// tested with CullLightBlock. The top levels are split level by level, then the subtrees are
+// built in parallel on the scheduler.
+// The node test is conservative and leaves use the exact test, so the lists are equal to the lists of
+// the linear kernels. Lists are sorted to keep the ascending order of light indexes.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <vector>
+#include "ShaderTypeDefine.h"
+#include "CpuShaderMath.h"
+#include "CpuCullingKernel.h"
+#include "CpuTaskScheduler.h"
+
+// A node of the light BVH.
+struct CpuBvhNode
+{
+	float boundsMin[3];	// The AABB of the light spheres in view space.
+	float boundsMax[3];
+	uint uOffset;		// Inner nodes: the left child, the right child is uOffset + 1. Leaves: the first light in BVH order.
+	uint uCount;		// The number of lights in a leaf, 0 for inner nodes.
+};
+
+class CpuLightBvh
+{
+public:
+	CpuLightBvh();
+
+	// Build the tree over view-space lights, pScheduler can be nullptr to build on the calling thread.
+	void Build(const CpuLightSoA& lights, CpuTaskScheduler* const pScheduler);
+
+	// Same as CullLightBlocks, and return the number of light-plane and node-plane tests.
+	unsigned long long Cull(const CpuFloat4 planes[TilePlaneNum], uint uPattern,
+		uint* const pLists[TileMaxPrimitiveNum], uint listNums[TileMaxPrimitiveNum]) const;
+
+	// Same as CullLightBlocksMask, but only set the bits of passed lights, so masks must be cleared before.
+	unsigned long long CullMask(const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint* const pMasks[TileMaxPrimitiveNum]) const;
+
+	uint GetNodeNum() const { return (uint)m_nodes.size(); }
+	uint GetLightNum() const { return m_uLightNum; }
+
+private:
+	// A node to build and its lights [uBegin, uEnd) in m_order.
+	struct BuildTask
+	{
+		uint uNode;
+		uint uBegin;
+		uint uEnd;
+		uint uNextNode;	// The first free node of the subtree.
+	};
+
+	// Compute the bounds of a node, and split its lights at the aligned median. uLeft is the left child.
+	void SplitNode(uint uNode, uint uBegin, uint uEnd, uint uLeft);
+	// Compute the bounds of a leaf, and copy its lights to a block.
+	void MakeLeaf(uint uNode, uint uBegin, uint uEnd);
+	void BuildSubtree(uint uNode, uint uBegin, uint uEnd, uint& uNextNode);
+	// Does any sphere inside a node pass the 6 frustum planes?
+	bool TestNode(const CpuBvhNode& node, const CpuFloat4 planes[TilePlaneNum]) const;
+	// Walk the tree and call visitLeaf(leaf, primitiveMasks) for every visited leaf, return the number of tests.
+	template<typename VisitLeaf>
+	unsigned long long Traverse(const CpuFloat4 planes[TilePlaneNum], uint uPattern, VisitLeaf visitLeaf) const;
+
+	uint m_uLightNum;
+	// View-space lights as (x, y, z, radius).
+	std::vector<CpuFloat4> m_lights;
+	std::vector<CpuBvhNode> m_nodes;
+	// Original light indexes in BVH order.
+	std::vector<uint> m_order;
+	// Lights in BVH order, a block per leaf.
+	std::vector<CpuLightBlock> m_blocks;
+};
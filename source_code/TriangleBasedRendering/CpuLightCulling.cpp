@@ -0,0 +1,1057 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightCulling.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuLightCulling.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <numeric>
+
+// Does a sphere overlap an AABB? The squared distance between the center and the box is compared with the radius.
+static inline bool IsSphereInAabb(const CpuFloat4& center, float fRadius, const CpuFloat4& aabbMin, const CpuFloat4& aabbMax)
+{
+	float dx = std::max(std::max(aabbMin.x - center.x, center.x - aabbMax.x), 0.0f);
+	float dy = std::max(std::max(aabbMin.y - center.y, center.y - aabbMax.y), 0.0f);
+	float dz = std::max(std::max(aabbMin.z - center.z, center.z - aabbMax.z), 0.0f);
+	return dx*dx + dy*dy + dz*dz < fRadius*fRadius;
+}
+
+// Does a sphere overlap a cone whose apex is the origin?
+// The distance between the center and the surface of the cone is negative inside, and it never exceeds the
+// distance to the apex behind the cone, so the test is conservative.
+static inline bool IsSphereInCone(const CpuFloat4& center, float fRadius, const CpuFloat4& axis, float fCos, float fSin)
+{
+	float fAxisDist = Dot3(center, axis);
+	float fPerpDist = sqrtf(std::max(Dot3(center, center) - fAxisDist*fAxisDist, 0.0f));
+	return fCos*fPerpDist - fSin*fAxisDist < fRadius;
+}
+
+CpuLightCuller::CpuLightCuller()
+{
+	m_uSubdivision = TileSubdivision;
+	m_bUseDepthBins = UseDepthBinCulling;
+	m_bSelectDiagonals = UseTileDiagonalSelection;
+	m_uTileTest = LightTileTest;
+	m_uCoarseTileFactor = 1;
+	m_kernel = CpuCullingKernel_Reference;
+	m_lightTable = CpuLightTable_IndexList;
+	m_uMaskWordNum = 0;
+	m_pScheduler = nullptr;
+	m_pDepth = nullptr;
+	m_uDepthWidth = 0;
+	m_uDepthHeight = 0;
+	m_incremental.bEnabled = false;
+	m_incremental.bHistoryValid = false;
+	m_incremental.fCameraThreshold = IncrementalCameraThreshold;
+	m_occlusion.bEnabled = UseLightOcclusion;
+	m_scatter.bEnabled = UseLightScatter;
+	m_overflow.uPolicy = LightOverflowPolicy;
+	m_overflow.uPackedCapacity = 0;
+	m_bUseShapeTests = UseLightShapeTests;
+	m_bUseViewSpaceLights = UseViewSpaceLights;
+	m_bUseTilePlanes = UseTilePlaneTable;
+	memset(&m_tilePlaneProjInv, 0, sizeof(m_tilePlaneProjInv));
+	m_fTilePlaneSizeX = 0.0f;
+	m_fTilePlaneSizeY = 0.0f;
+	m_pShapes = nullptr;
+	memset(&m_cullingData, 0, sizeof(m_cullingData));
+	memset(&m_viewData, 0, sizeof(m_viewData));
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void CpuLightCuller::Init(uint uSubdivision)
+{
+	m_uSubdivision = std::min(uSubdivision, (uint)TileSubdivisionPatternNum - 1);
+	Invalidate();
+}
+
+void CpuLightCuller::SetDepthBuffer(const float * const pDepth, uint uWidth, uint uHeight)
+{
+	if (uWidth != m_uDepthWidth || uHeight != m_uDepthHeight)
+	{
+		Invalidate();
+	}
+	m_pDepth = pDepth;
+	m_uDepthWidth = uWidth;
+	m_uDepthHeight = uHeight;
+}
+
+void CpuLightCuller::SetDepthPlanes(const float * const pPlanes, uint uPlaneNum)
+{
+	// Depth planes are set every frame, and only new planes invalidate the tables.
+	if (uPlaneNum != m_depthPlanes.size() || !std::equal(pPlanes, pPlanes + uPlaneNum, m_depthPlanes.begin()))
+	{
+		Invalidate();
+	}
+	m_depthPlanes.assign(pPlanes, pPlanes + uPlaneNum);
+}
+
+void CpuLightCuller::Run(const ClusteredData& cullingData, const ViewData& viewData, const PointLight* const pLights)
+{
+	auto begin = std::chrono::high_resolution_clock::now();
+
+	CpuCullingStats prevStats = m_stats;
+	memset(&m_stats, 0, sizeof(m_stats));
+	if (CanPatch(cullingData, viewData))
+	{
+		// Patched tables keep the view of the last full run, the camera moved less than the threshold.
+		bool bChanged = PatchTables(pLights, cullingData.lightNum);
+		if (!bChanged)
+		{
+			// The tables and their statistics are the same as the last run.
+			CpuCullingStats patchStats = m_stats;
+			m_stats = prevStats;
+			m_stats.dBuildTime = 0.0;
+			m_stats.occlusion.dPyramidTime = 0.0;
+			m_stats.scatter.dTime = 0.0;
+			m_stats.uPlaneTests = 0;
+			m_stats.incremental.uDirtyTiles = patchStats.incremental.uDirtyTiles;
+			m_stats.incremental.uDirtyLights = patchStats.incremental.uDirtyLights;
+			m_stats.incremental.bPatched = true;
+			m_stats.dTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+			return;
+		}
+		m_stats.incremental.bPatched = true;
+	}
+	else
+	{
+		m_cullingData = cullingData;
+		m_viewData = viewData;
+		CullAllTiles(pLights);
+	}
+	for (auto& context : m_contexts)
+	{
+		m_stats.uPlaneTests += context.uPlaneTests;
+		m_stats.uDepthBinRemovedPairs += context.uDepthBinRemovedPairs;
+		m_stats.uTileTestRemovedPairs += context.uTileTestRemovedPairs;
+		m_stats.uShapeRemovedPairs += context.uShapeRemovedPairs;
+		m_stats.uLightTransforms += context.uLightTransforms;
+	}
+
+	// Tiles of a word run on different threads, so the bits are packed after all tiles.
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	m_tileDiagonalBits.clear();
+	if (IsDiagonalSelection())
+	{
+		m_tileDiagonalBits.assign(GetTileDiagonalWordNum(uTileNum), 0);
+		for (uint i = 0; i < uTileNum; i++)
+		{
+			if (m_tilePatterns[i] == TileSubdivisionAntiDiagonal)
+			{
+				m_tileDiagonalBits[i / 32] |= 1u << (i % 32);
+				m_stats.uAntiDiagonalTiles++;
+			}
+		}
+	}
+	if (m_lightTable == CpuLightTable_IndexList)
+	{
+		PackLists();
+	}
+	else
+	{
+		m_lightLists.clear();
+		m_packedIndexes.clear();
+	}
+
+	// Every pixel of a cluster shades all lights of the cluster.
+	uint uClusterNum = (uint)m_lightCounter.size();
+	for (uint i = 0; i < uClusterNum; i++)
+	{
+		m_stats.uLightIndices += m_lightCounter[i];
+		m_stats.uLightPixelPairs += (unsigned long long)m_lightCounter[i] * m_clusterPixels[i];
+		if (m_lightCounter[i] > PerClusterMaxLight)
+		{
+			m_stats.overflow.overflowClusters++;
+		}
+	}
+
+	if (m_incremental.bEnabled)
+	{
+		m_incremental.prevLights.assign(pLights, pLights + m_cullingData.lightNum);
+		m_incremental.prevShapes.clear();
+		if (m_pShapes)
+		{
+			m_incremental.prevShapes.assign(m_pShapes, m_pShapes + m_cullingData.spotLightNum + m_cullingData.capsuleLightNum);
+		}
+		if (!m_stats.incremental.bPatched)
+		{
+			m_incremental.prevDepth.assign(m_pDepth, m_pDepth + m_uDepthWidth*m_uDepthHeight);
+		}
+		m_incremental.bHistoryValid = true;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	m_stats.dTime = std::chrono::duration<double>(end - begin).count();
+}
+
+void CpuLightCuller::CullAllTiles(const PointLight * const pLights)
+{
+	// Every primitive of a tile is a cluster.
+	uint uPrimitiveNum = TilePatternPrimitiveNum[m_uSubdivision];
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	uint uClusterNum = uTileNum*m_cullingData.depthDim*uPrimitiveNum;
+	m_lightCounter.assign(uClusterNum, 0);
+	m_clusterPixels.assign(uClusterNum, 0);
+	if (m_lightTable == CpuLightTable_Bitmask)
+	{
+		m_uMaskWordNum = GetLightMaskWordNum(m_cullingData.lightNum);
+		m_lightMasks.assign(uClusterNum*m_uMaskWordNum, 0);
+		m_clusteredBuffer.clear();
+		m_overflow.clusters.clear();
+	}
+	else
+	{
+		m_lightMasks.clear();
+		m_clusteredBuffer.resize(uClusterNum);
+		memset(m_clusteredBuffer.data(), 0, sizeof(ClusteredBuffer)*uClusterNum);
+		m_overflow.clusters.resize(uClusterNum);
+		for (auto& overflow : m_overflow.clusters)
+		{
+			overflow.lights.clear();
+			overflow.halves.clear();
+		}
+	}
+	if (m_incremental.bEnabled)
+	{
+		m_incremental.tileBounds.resize(uTileNum);
+		m_clusterShapes.resize(uTileNum*m_cullingData.depthDim);
+	}
+
+	// Tiles read their depth range, their pattern and their depth bins from the pyramid stage, and occluded lights are
+	// never culled.
+	PrepareContexts();
+	TransformLights(pLights);
+	BuildTilePlaneTable();
+	BuildDepthPyramid();
+	TestLightOcclusion(pLights);
+	TransformLightShapes();
+
+	// The SoA kernels transform lights to view space once per run.
+	auto begin = std::chrono::high_resolution_clock::now();
+	if (m_kernel != CpuCullingKernel_Reference)
+	{
+		m_lightSoA.Build(pLights, m_cullingData.lightNum, m_viewData.View, m_occlusion.lightVisibility.empty() ? nullptr : m_occlusion.lightVisibility.data());
+		// Tiles only cull the lights of their bins with light scatter, and the BVH culls all lights.
+		if (m_kernel == CpuCullingKernel_Bvh && !m_scatter.bEnabled)
+		{
+			m_lightBvh.Build(m_lightSoA, m_pScheduler);
+		}
+		m_stats.dBuildTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+	}
+
+	ScatterLights(pLights);
+
+	// Every tile writes its own clusters, so chunks of tiles can run on any thread without atomics.
+	// Use rows as chunks, and split rows into segments when there are not enough rows to balance threads.
+	// Two-level culling uses coarse tiles as chunks, and light scatter replaces coarse tiles.
+	bool bUseCoarseTiles = m_uCoarseTileFactor > 1 && !m_scatter.bEnabled;
+	uint uThreadNum = (uint)m_contexts.size();
+	uint uChunkPerRow = 1;
+	if (m_cullingData.heightDim < uThreadNum * 4)
+	{
+		uChunkPerRow = std::min(m_cullingData.widthDim, (uThreadNum * 4 + m_cullingData.heightDim - 1) / m_cullingData.heightDim);
+	}
+	uint uChunkNum = m_cullingData.heightDim*uChunkPerRow;
+	uint uCoarseNumX = (m_cullingData.widthDim + m_uCoarseTileFactor - 1) / m_uCoarseTileFactor;
+	uint uCoarseNumY = (m_cullingData.heightDim + m_uCoarseTileFactor - 1) / m_uCoarseTileFactor;
+	if (bUseCoarseTiles)
+	{
+		uChunkNum = uCoarseNumX*uCoarseNumY;
+	}
+	ParallelFor(uChunkNum, [&](uint uChunk, uint uThreadIdx)
+	{
+		if (bUseCoarseTiles)
+		{
+			CullCoarseTile(uChunk % uCoarseNumX, uChunk / uCoarseNumX, pLights, m_contexts[uThreadIdx]);
+		}
+		else
+		{
+			CullChunk(uChunk, uChunkPerRow, pLights, m_contexts[uThreadIdx]);
+		}
+	});
+}
+
+void CpuLightCuller::PrepareContexts()
+{
+	uint uThreadNum = m_pScheduler ? m_pScheduler->GetThreadNum() : 1;
+	m_contexts.resize(uThreadNum);
+	for (auto& context : m_contexts)
+	{
+		for (uint i = 0; i < TilePatternPrimitiveNum[m_uSubdivision]; i++)
+		{
+			context.lists[i].resize(m_cullingData.lightNum);
+		}
+		context.tileDepth.resize(TileSize*TileSize);
+		context.tileViewZ.resize(TileSize*TileSize);
+		context.tilePixelFlags.resize(TileSize*TileSize);
+		context.tilePixelSlices.resize(TileSize*TileSize);
+		if (m_uCoarseTileFactor > 1)
+		{
+			context.coarseLists.resize(m_cullingData.depthDim*m_cullingData.lightNum);
+			context.coarseListNum.resize(m_cullingData.depthDim);
+		}
+		context.uPlaneTests = 0;
+		context.uDepthBinRemovedPairs = 0;
+		context.uTileTestRemovedPairs = 0;
+		context.uShapeRemovedPairs = 0;
+		context.uLightTransforms = 0;
+	}
+}
+
+void CpuLightCuller::ParallelFor(uint uChunkNum, const CpuTaskScheduler::Task& task)
+{
+	if (m_pScheduler)
+	{
+		m_pScheduler->ParallelFor(uChunkNum, task);
+	}
+	else
+	{
+		for (uint uChunk = 0; uChunk < uChunkNum; uChunk++)
+		{
+			task(uChunk, 0);
+		}
+	}
+}
+
+void CpuLightCuller::CullChunk(uint uChunk, uint uChunkPerRow, const PointLight * const pLights, ThreadContext & context)
+{
+	uint y = uChunk / uChunkPerRow;
+	uint uSegment = uChunk % uChunkPerRow;
+	uint uBeginX = m_cullingData.widthDim*uSegment / uChunkPerRow;
+	uint uEndX = m_cullingData.widthDim*(uSegment + 1) / uChunkPerRow;
+	for (uint x = uBeginX; x < uEndX; x++)
+	{
+		CullTile(x, y, false, pLights, context);
+	}
+}
+
+void CpuLightCuller::LoadTileDepth(uint uTileX, uint uTileY, float* const pTileDepth) const
+{
+	float x = m_cullingData.tileSizeX*uTileX;
+	float y = m_cullingData.tileSizeY*uTileY;
+
+	// Every tile loads TileSize*TileSize texels even if the tile is smaller, and
+	// loading outside of the texture returns 0 like Texture2D::operator[].
+	// The first texel is the first pixel whose center is in the tile, and tiles are at most TileSize pixels (GetTileNum),
+	// so all pixels of the tile are loaded.
+	for (uint i = 0; i < TileSize*TileSize; i++)
+	{
+		float tileThreadIdxY = (float)(i / TileSize);
+		float tileThreadIdxX = (float)(i % TileSize);
+		uint uTexelX = (uint)(x + 0.5f + tileThreadIdxX);
+		uint uTexelY = (uint)(y + 0.5f + tileThreadIdxY);
+		float depth = 0.0f;
+		if (uTexelX < m_uDepthWidth && uTexelY < m_uDepthHeight)
+		{
+			depth = m_pDepth[uTexelX + uTexelY*m_uDepthWidth];
+		}
+		pTileDepth[i] = depth;
+	}
+}
+
+void CpuLightCuller::BuildDepthPyramid()
+{
+	auto begin = std::chrono::high_resolution_clock::now();
+	m_occlusion.depthPyramid.Build(m_pDepth, m_uDepthWidth, m_uDepthHeight, m_cullingData, m_pScheduler);
+	BuildTileDepthBins();
+	m_stats.occlusion.dPyramidTime += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+}
+
+void CpuLightCuller::TestLightOcclusion(const PointLight * const pLights)
+{
+	auto begin = std::chrono::high_resolution_clock::now();
+	m_occlusion.lightVisibility.clear();
+	m_stats.occlusion.uOccludedLights = 0;
+	if (m_occlusion.bEnabled)
+	{
+		m_occlusion.lightVisibility.assign(GetLightMaskWordNum(m_cullingData.lightNum), 0);
+		for (uint i = 0; i < m_cullingData.lightNum; i++)
+		{
+			CpuFloat4 center = GetViewLightCenter(i, pLights, m_stats.uLightTransforms);
+			if (m_occlusion.depthPyramid.IsSphereOccluded(center, pLights[i].radius, m_viewData))
+			{
+				m_stats.occlusion.uOccludedLights++;
+			}
+			else
+			{
+				m_occlusion.lightVisibility[i / 32] |= 1u << (i % 32);
+			}
+		}
+	}
+	m_stats.occlusion.dPyramidTime += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+}
+
+void CpuLightCuller::ComputeTilePlanes(uint uTileX, uint uTileY, uint uTileNumX, uint uTileNumY, float fZMin, float fZMax, CpuFloat4 planes[TilePlaneNum],
+	TileBounds* const pBounds) const
+{
+	// The sides and the split planes of a tile are in the table, coarse tiles and clusters without the table create their
+	// own with the same math, so the planes are the same with and without the table.
+	SidePlanes sidePlanes;
+	const SidePlanes* pSidePlanes = &sidePlanes;
+	if (m_bUseTilePlanes && uTileNumX == 1 && uTileNumY == 1)
+	{
+		pSidePlanes = &m_tilePlanes[uTileX + uTileY*m_cullingData.widthDim];
+	}
+	else
+	{
+		ComputeSidePlanes(uTileX, uTileY, uTileNumX, uTileNumY, sidePlanes);
+	}
+
+	// The vertexes are the corner rays at the view-space depth of both ends of the depth range.
+	CpuFloat4 nearPos = { 0.0f, 0.0f, fZMin, 1.0f };
+	CpuFloat4 farPos = { 0.0f, 0.0f, fZMax, 1.0f };
+	float fNearZ = DivideByW(Mul(nearPos, m_viewData.ProjInv)).z;
+	float fFarZ = DivideByW(Mul(farPos, m_viewData.ProjInv)).z;
+	CpuFloat4 vertexes[8];
+	for (uint uIdx = 0; uIdx < 8; uIdx++)
+	{
+		const CpuFloat4& corner = pSidePlanes->corners[uIdx & 0x3];
+		float fZ = uIdx < 4 ? fNearZ : fFarZ;
+		vertexes[uIdx] = { corner.x*fZ, corner.y*fZ, corner.z*fZ, 1.0f };
+	}
+
+	// Vertexes of a frustum.
+	//   4---5
+	//  /   /|
+	// 0---1 7
+	// |   |/
+	// 2---3
+	// The sides pass through the camera, so they stay valid when the depth range is a single depth.
+	planes[0] = pSidePlanes->sides[0];	// Up.
+	planes[1] = { 0.0f, 0.0f, -1.0f, fNearZ };	// Front.
+	planes[2] = pSidePlanes->sides[1];	// Right.
+	planes[3] = pSidePlanes->sides[2];	// Down.
+	planes[4] = pSidePlanes->sides[3];	// Left.
+	planes[5] = { 0.0f, 0.0f, 1.0f, -fFarZ };	// Back.
+	for (uint j = 0; j < TileSplitPlaneNum; j++)
+	{
+		planes[6 + j] = pSidePlanes->sides[4 + j];
+	}
+
+	if (pBounds)
+	{
+		pBounds->aabbMin = vertexes[0];
+		pBounds->aabbMax = vertexes[0];
+		for (uint i = 1; i < 8; i++)
+		{
+			pBounds->aabbMin.x = std::min(pBounds->aabbMin.x, vertexes[i].x);
+			pBounds->aabbMin.y = std::min(pBounds->aabbMin.y, vertexes[i].y);
+			pBounds->aabbMin.z = std::min(pBounds->aabbMin.z, vertexes[i].z);
+			pBounds->aabbMax.x = std::max(pBounds->aabbMax.x, vertexes[i].x);
+			pBounds->aabbMax.y = std::max(pBounds->aabbMax.y, vertexes[i].y);
+			pBounds->aabbMax.z = std::max(pBounds->aabbMax.z, vertexes[i].z);
+		}
+		// The edges of the frustum are rays from the camera through the near vertexes (0~3), the axis of the cone
+		// is their average direction, and the angle of the cone reaches the widest edge.
+		CpuFloat4 edges[4];
+		CpuFloat4 axis = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (uint i = 0; i < 4; i++)
+		{
+			edges[i] = Normalize3(vertexes[i]);
+			axis.x += edges[i].x;
+			axis.y += edges[i].y;
+			axis.z += edges[i].z;
+		}
+		pBounds->coneAxis = Normalize3(axis);
+		pBounds->fConeCos = 1.0f;
+		for (uint i = 0; i < 4; i++)
+		{
+			pBounds->fConeCos = std::min(pBounds->fConeCos, Dot3(edges[i], pBounds->coneAxis));
+		}
+		pBounds->fConeSin = sqrtf(std::max(1.0f - pBounds->fConeCos*pBounds->fConeCos, 0.0f));
+		pBounds->center = { 0.0f, 0.0f, 0.0f, 1.0f };
+		for (uint i = 0; i < 8; i++)
+		{
+			pBounds->center.x += vertexes[i].x / 8;
+			pBounds->center.y += vertexes[i].y / 8;
+			pBounds->center.z += vertexes[i].z / 8;
+		}
+	}
+}
+
+void CpuLightCuller::ComputeSidePlanes(uint uTileX, uint uTileY, uint uTileNumX, uint uTileNumY, SidePlanes & sidePlanes) const
+{
+	float x[2];
+	float y[2];
+	x[0] = m_cullingData.tileSizeX*uTileX;
+	y[0] = m_cullingData.tileSizeY*uTileY;
+	x[1] = m_cullingData.tileSizeX*(uTileX + uTileNumX);
+	y[1] = m_cullingData.tileSizeY*(uTileY + uTileNumY);
+
+	// The near vertexes of the frustum (0~3) are scaled to rays at z = 1.
+	uint uWindowWidthEvenlyDivisibleByTileRes = (uint)(m_cullingData.tileSizeX*m_cullingData.widthDim);
+	uint uWindowHeightEvenlyDivisibleByTileRes = (uint)(m_cullingData.tileSizeY*m_cullingData.heightDim);
+	CpuFloat4* const corners = sidePlanes.corners;
+	for (uint uIdx = 0; uIdx < 4; uIdx++)
+	{
+		uint xId = uIdx & 0x1;
+		uint yId = (uIdx & 0x2) >> 1;
+		CpuFloat4 projPos = { x[xId] / (float)uWindowWidthEvenlyDivisibleByTileRes*2.f - 1.f,
+			((float)uWindowHeightEvenlyDivisibleByTileRes - y[yId]) / (float)uWindowHeightEvenlyDivisibleByTileRes*2.f - 1.f,
+			0.0f, 1.0f };
+		CpuFloat4 vertex = DivideByW(Mul(projPos, m_viewData.ProjInv));
+		corners[uIdx] = { vertex.x / vertex.z, vertex.y / vertex.z, 1.0f, 0.0f };
+	}
+
+	// 0---1
+	// |   |
+	// 2---3
+	sidePlanes.sides[0] = CreatePlaneEquation(corners[0], corners[1]);	// Up.
+	sidePlanes.sides[1] = CreatePlaneEquation(corners[1], corners[3]);	// Right.
+	sidePlanes.sides[2] = CreatePlaneEquation(corners[3], corners[2]);	// Down.
+	sidePlanes.sides[3] = CreatePlaneEquation(corners[2], corners[0]);	// Left.
+	sidePlanes.sides[4] = CreatePlaneEquation(corners[1], corners[2]);	// Top-left side of the diagonal.
+	sidePlanes.sides[5] = CreatePlaneEquation(corners[2], corners[1]);	// Bottom-right side of the diagonal.
+	sidePlanes.sides[6] = CreatePlaneEquation(corners[3], corners[0]);	// Top-right side of the anti-diagonal.
+	sidePlanes.sides[7] = CreatePlaneEquation(corners[0], corners[3]);	// Bottom-left side of the anti-diagonal.
+}
+
+void CpuLightCuller::BuildTilePlaneTable()
+{
+	if (!m_bUseTilePlanes)
+	{
+		m_tilePlanes.clear();
+		return;
+	}
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	if (m_tilePlanes.size() == uTileNum && m_fTilePlaneSizeX == m_cullingData.tileSizeX && m_fTilePlaneSizeY == m_cullingData.tileSizeY &&
+		memcmp(&m_tilePlaneProjInv, &m_viewData.ProjInv, sizeof(float4x4)) == 0)
+	{
+		return;
+	}
+
+	m_tilePlanes.resize(uTileNum);
+	ParallelFor(m_cullingData.heightDim, [&](uint uTileY, uint)
+	{
+		for (uint uTileX = 0; uTileX < m_cullingData.widthDim; uTileX++)
+		{
+			ComputeSidePlanes(uTileX, uTileY, 1, 1, m_tilePlanes[uTileX + uTileY*m_cullingData.widthDim]);
+		}
+	});
+	m_tilePlaneProjInv = m_viewData.ProjInv;
+	m_fTilePlaneSizeX = m_cullingData.tileSizeX;
+	m_fTilePlaneSizeY = m_cullingData.tileSizeY;
+	m_stats.uTilePlaneBuilds = uTileNum;
+}
+
+bool CpuLightCuller::ClipDepthRange(uint uSlice, uint uZMin, uint uZMax, float & fZMin, float & fZMax) const
+{
+	// Clip the depth range of the tile by the depth slice of the cluster.
+	fZMin = AsFloat(uZMin);
+	fZMax = AsFloat(uZMax);
+	if (m_depthPlanes.size() > uSlice + 1)
+	{
+		fZMin = std::max(fZMin, m_depthPlanes[uSlice]);
+		fZMax = std::min(fZMax, m_depthPlanes[uSlice + 1]);
+	}
+	return fZMin <= fZMax;
+}
+
+void CpuLightCuller::CullTile(uint uTileX, uint uTileY, bool bUseCoarseLists, const PointLight* const pLights, ThreadContext& context)
+{
+	const DepthBounds& tileBounds = m_occlusion.depthPyramid.GetTileBounds(uTileX, uTileY);
+	uint uZMin = AsUint(tileBounds.zMin);
+	uint uZMax = AsUint(tileBounds.zMax);
+	uint uTileIdx = uTileX + uTileY*m_cullingData.widthDim;
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	if (m_incremental.bEnabled)
+	{
+		m_incremental.tileBounds[uTileIdx] = tileBounds;
+	}
+
+	for (uint z = 0; z < m_cullingData.depthDim; z++)
+	{
+		// If no pixel of the tile is in this slice, the cluster is empty (counters are already 0).
+		float fZMin, fZMax;
+		ClusterShape shape;
+		shape.uPattern = GetTilePattern(uTileIdx);
+		shape.bValid = ClipDepthRange(z, uZMin, uZMax, fZMin, fZMax);
+		if (shape.bValid)
+		{
+			shape.bins = m_tileDepthBins[uTileIdx + z*uTileNum];
+			const uint* pParent = bUseCoarseLists ? context.coarseLists.data() + z*m_cullingData.lightNum : nullptr;
+			uint uParentNum = bUseCoarseLists ? context.coarseListNum[z] : 0;
+			if (!m_scatter.tileLightOffsets.empty())
+			{
+				// The bin of the tile is the parent list of all slices.
+				pParent = m_scatter.tileLights.data() + m_scatter.tileLightOffsets[uTileIdx];
+				uParentNum = m_scatter.tileLightOffsets[uTileIdx + 1] - m_scatter.tileLightOffsets[uTileIdx];
+			}
+			CullCluster(uTileX, uTileY, z, fZMin, fZMax, shape, pParent, uParentNum, pLights, context);
+		}
+		if (m_incremental.bEnabled)
+		{
+			m_clusterShapes[uTileIdx + z*uTileNum] = shape;
+		}
+	}
+}
+
+bool CpuLightCuller::GetTilePixelUv(uint uTileX, uint uTileY, uint uPixel, float & u, float & v) const
+{
+	// The center of the texel loaded for this pixel in the tile, (1, 1) is the bottom-right corner.
+	float x = m_cullingData.tileSizeX*uTileX;
+	float y = m_cullingData.tileSizeY*uTileY;
+	uint uTexelX = (uint)(x + 0.5f + (float)(uPixel % TileSize));
+	uint uTexelY = (uint)(y + 0.5f + (float)(uPixel / TileSize));
+	u = ((float)uTexelX + 0.5f - x) / m_cullingData.tileSizeX;
+	v = ((float)uTexelY + 0.5f - y) / m_cullingData.tileSizeY;
+	// Loaded texels outside of the tile belong to other tiles.
+	return u >= 0.0f && v >= 0.0f && u < 1.0f && v < 1.0f && uTexelX < m_uDepthWidth && uTexelY < m_uDepthHeight;
+}
+
+uint CpuLightCuller::SelectTileSubdivision(uint uTileX, uint uTileY, const ThreadContext & context) const
+{
+	// The min/max depth of the two triangles of both diagonals (ldsDiagZMin, ldsDiagZMax as uint).
+	const uint patterns[2] = { TileSubdivisionDiagonal, TileSubdivisionAntiDiagonal };
+	uint zMin[4] = { 0x7f7fffff, 0x7f7fffff, 0x7f7fffff, 0x7f7fffff };
+	uint zMax[4] = {};
+	for (uint i = 0; i < TileSize*TileSize; i++)
+	{
+		float u, v;
+		if (!GetTilePixelUv(uTileX, uTileY, i, u, v))
+		{
+			continue;
+		}
+		uint uDepth = AsUint(context.tileDepth[i]);
+		for (uint c = 0; c < 2; c++)
+		{
+			uint uIdx = c * 2 + GetTilePrimitive(patterns[c], u, v);
+			zMin[uIdx] = std::min(zMin[uIdx], uDepth);
+			zMax[uIdx] = std::max(zMax[uIdx], uDepth);
+		}
+	}
+
+	// Depth ranges are compared in view space, so a step to the sky or the background costs its real distance.
+	float cost[2] = {};
+	for (uint c = 0; c < 2; c++)
+	{
+		for (uint p = 0; p < 2; p++)
+		{
+			uint uIdx = c * 2 + p;
+			if (zMin[uIdx] <= zMax[uIdx])
+			{
+				CpuFloat4 nearPos = { 0.0f, 0.0f, AsFloat(zMin[uIdx]), 1.0f };
+				CpuFloat4 farPos = { 0.0f, 0.0f, AsFloat(zMax[uIdx]), 1.0f };
+				cost[c] += DivideByW(Mul(farPos, m_viewData.ProjInv)).z - DivideByW(Mul(nearPos, m_viewData.ProjInv)).z;
+			}
+		}
+	}
+	// Ties keep the default diagonal.
+	return cost[1] < cost[0] ? TileSubdivisionAntiDiagonal : TileSubdivisionDiagonal;
+}
+
+bool CpuLightCuller::IsLightInTileBounds(const CpuFloat4 & center, float fRadius, const TileBounds & bounds) const
+{
+	if (m_uTileTest == LightTileTestAabb)
+	{
+		return IsSphereInAabb(center, fRadius, bounds.aabbMin, bounds.aabbMax);
+	}
+	if (m_uTileTest == LightTileTestCone)
+	{
+		return IsSphereInCone(center, fRadius, bounds.coneAxis, bounds.fConeCos, bounds.fConeSin);
+	}
+	return true;
+}
+
+uint CpuLightCuller::FilterListByTileBounds(uint * const pList, uint & uNum, const TileBounds & bounds) const
+{
+	const CpuLightBlock* pBlocks = m_lightSoA.GetBlocks();
+	uint uKeepNum = 0;
+	for (uint i = 0; i < uNum; i++)
+	{
+		const CpuLightBlock& block = pBlocks[pList[i] / CpuLightBlockSize];
+		uint uLane = pList[i] % CpuLightBlockSize;
+		CpuFloat4 center = { block.x[uLane], block.y[uLane], block.z[uLane], 1.0f };
+		if (IsLightInTileBounds(center, block.radius[uLane], bounds))
+		{
+			pList[uKeepNum++] = pList[i];
+		}
+	}
+	uint uRemoved = uNum - uKeepNum;
+	uNum = uKeepNum;
+	return uRemoved;
+}
+
+uint CpuLightCuller::FilterMaskByTileBounds(uint * const pMask, const TileBounds & bounds) const
+{
+	const CpuLightBlock* pBlocks = m_lightSoA.GetBlocks();
+	uint uRemoved = 0;
+	for (uint uWord = 0; uWord < m_uMaskWordNum; uWord++)
+	{
+		uint uBits = pMask[uWord];
+		while (uBits)
+		{
+			uint uBit = FirstBitLow(uBits);
+			uBits &= uBits - 1;
+			uint uLightIdx = uWord*CpuLightMaskWordBits + uBit;
+			const CpuLightBlock& block = pBlocks[uLightIdx / CpuLightBlockSize];
+			uint uLane = uLightIdx % CpuLightBlockSize;
+			CpuFloat4 center = { block.x[uLane], block.y[uLane], block.z[uLane], 1.0f };
+			if (!IsLightInTileBounds(center, block.radius[uLane], bounds))
+			{
+				pMask[uWord] &= ~(1u << uBit);
+				uRemoved++;
+			}
+		}
+	}
+	return uRemoved;
+}
+
+void CpuLightCuller::CullCluster(uint uTileX, uint uTileY, uint uSlice, float fZMin, float fZMax, ClusterShape& shape,
+	const uint* const pParent, uint uParentNum, const PointLight* const pLights, ThreadContext& context)
+{
+	const CpuFloat4* planes = shape.planes;
+	const TileBounds& bounds = shape.bounds;
+	const DepthBins& bins = shape.bins;
+	uint uPattern = shape.uPattern;
+	bool bUseBounds = m_uTileTest != LightTileTestPlanes;
+	// Clamped lists also need the center of the frustum.
+	bool bComputeBounds = bUseBounds || m_overflow.uPolicy == LightOverflowClamp;
+	ComputeTilePlanes(uTileX, uTileY, 1, 1, fZMin, fZMax, shape.planes, bComputeBounds ? &shape.bounds : nullptr);
+
+	uint tileIdxFlattened = uTileX + uTileY*m_cullingData.widthDim + uSlice*m_cullingData.widthDim*m_cullingData.heightDim;
+	uint uPrimitiveNum = TilePatternPrimitiveNum[uPattern];
+	uint uCluster = tileIdxFlattened*uPrimitiveNum;
+	uint uPlaneNum = GetTilePatternPlaneNum(uPattern);
+	uint removed[TileMaxPrimitiveNum] = {};
+	uint tileRemoved[TileMaxPrimitiveNum] = {};
+	uint shapeRemoved[TileMaxPrimitiveNum] = {};
+	bool bUseShapes = m_bUseShapeTests && !m_viewShapes.empty();
+
+	if (m_kernel == CpuCullingKernel_Reference)
+	{
+		// Test all lights, or the lights of the coarse cluster.
+		uint uCandidateNum = pParent ? uParentNum : m_cullingData.lightNum;
+		context.uPlaneTests += (unsigned long long)uCandidateNum*uPlaneNum;
+		for (uint k = 0; k < uCandidateNum; k++)
+		{
+			// Transform lights to view-space.
+			uint i = pParent ? pParent[k] : k;
+			if (!IsLightVisible(i))
+			{
+				continue;
+			}
+			const PointLight& L = pLights[i];
+			CpuFloat4 center = GetViewLightCenter(i, pLights, context.uLightTransforms);
+			uint uTileRemoved, uBinRemoved, uShapeRemoved;
+			uint uMask = TestLightPrimitives(i, center, L.radius, shape, uTileRemoved, uBinRemoved, uShapeRemoved);
+			for (uint p = 0; p < uPrimitiveNum; p++)
+			{
+				if (uMask & (1u << p))
+				{
+					AppendLight(uCluster + p, i);
+				}
+				tileRemoved[p] += (uTileRemoved >> p) & 1;
+				removed[p] += (uBinRemoved >> p) & 1;
+				shapeRemoved[p] += (uShapeRemoved >> p) & 1;
+			}
+		}
+	}
+	else if (pParent == nullptr && m_lightTable == CpuLightTable_Bitmask)
+	{
+		uint* pMasks[TileMaxPrimitiveNum] = {};
+		for (uint p = 0; p < uPrimitiveNum; p++)
+		{
+			pMasks[p] = m_lightMasks.data() + (uCluster + p)*m_uMaskWordNum;
+		}
+		if (m_kernel == CpuCullingKernel_Bvh)
+		{
+			context.uPlaneTests += m_lightBvh.CullMask(planes, uPattern, pMasks);
+		}
+		else if (m_kernel == CpuCullingKernel_Simd)
+		{
+			CullLightBlocksMask(m_lightSoA, planes, uPattern, pMasks);
+		}
+		else
+		{
+			CullLightBlocksMaskScalar(m_lightSoA, planes, uPattern, pMasks);
+		}
+		if (m_kernel != CpuCullingKernel_Bvh)
+		{
+			context.uPlaneTests += (unsigned long long)m_cullingData.lightNum*uPlaneNum;
+		}
+		for (uint p = 0; p < uPrimitiveNum; p++)
+		{
+			if (bUseBounds)
+			{
+				tileRemoved[p] = FilterMaskByTileBounds(pMasks[p], bounds);
+			}
+			if (m_bUseDepthBins)
+			{
+				removed[p] = FilterMaskByDepthBins(pMasks[p], bins.primitiveBins[p], bins);
+			}
+			if (bUseShapes)
+			{
+				shapeRemoved[p] = FilterMaskByShapes(pMasks[p], planes, uPattern, p);
+			}
+			CountMask(uCluster + p);
+		}
+	}
+	else
+	{
+		uint* pLists[TileMaxPrimitiveNum];
+		uint listNums[TileMaxPrimitiveNum];
+		for (uint p = 0; p < TileMaxPrimitiveNum; p++)
+		{
+			pLists[p] = context.lists[p].data();
+		}
+		if (pParent)
+		{
+			// Coarse lists are short, so the BVH kernel only culls coarse clusters.
+			if (m_kernel == CpuCullingKernel_Scalar)
+			{
+				CullLightListScalar(m_lightSoA, pParent, uParentNum, planes, uPattern, pLists, listNums);
+			}
+			else
+			{
+				CullLightList(m_lightSoA, pParent, uParentNum, planes, uPattern, pLists, listNums);
+			}
+			context.uPlaneTests += (unsigned long long)uParentNum*uPlaneNum;
+		}
+		else if (m_kernel == CpuCullingKernel_Bvh)
+		{
+			context.uPlaneTests += m_lightBvh.Cull(planes, uPattern, pLists, listNums);
+		}
+		else
+		{
+			if (m_kernel == CpuCullingKernel_Simd)
+			{
+				CullLightBlocks(m_lightSoA, planes, uPattern, pLists, listNums);
+			}
+			else
+			{
+				CullLightBlocksScalar(m_lightSoA, planes, uPattern, pLists, listNums);
+			}
+			context.uPlaneTests += (unsigned long long)m_cullingData.lightNum*uPlaneNum;
+		}
+		for (uint p = 0; p < uPrimitiveNum; p++)
+		{
+			if (bUseBounds)
+			{
+				tileRemoved[p] = FilterListByTileBounds(pLists[p], listNums[p], bounds);
+			}
+			if (m_bUseDepthBins)
+			{
+				removed[p] = FilterListByDepthBins(pLists[p], listNums[p], bins.primitiveBins[p], bins);
+			}
+			if (bUseShapes)
+			{
+				shapeRemoved[p] = FilterListByShapes(pLists[p], listNums[p], planes, uPattern, p);
+			}
+			StoreList(uCluster + p, pLists[p], listNums[p]);
+		}
+	}
+
+	for (uint p = 0; p < uPrimitiveNum; p++)
+	{
+		m_clusterPixels[uCluster + p] = bins.primitivePixels[p];
+		context.uDepthBinRemovedPairs += (unsigned long long)removed[p] * bins.primitivePixels[p];
+		context.uTileTestRemovedPairs += (unsigned long long)tileRemoved[p] * bins.primitivePixels[p];
+		context.uShapeRemovedPairs += (unsigned long long)shapeRemoved[p] * bins.primitivePixels[p];
+		if (m_lightTable == CpuLightTable_IndexList && m_lightCounter[uCluster + p] > PerClusterMaxLight)
+		{
+			ResolveOverflow(uCluster + p, shape, pLights, context);
+		}
+	}
+}
+
+uint CpuLightCuller::TestLightPrimitives(uint uLightIdx, const CpuFloat4 & center, float fRadius, const ClusterShape & shape, uint & uTileRemoved,
+	uint & uBinRemoved, uint & uShapeRemoved) const
+{
+	uTileRemoved = 0;
+	uBinRemoved = 0;
+	uShapeRemoved = 0;
+	float r[TilePlaneNum];
+	for (uint j = 0; j < TilePlaneNum; j++)
+	{
+		r[j] = GetSignedDistanceFromPlane(center, shape.planes[j]);
+	}
+	// In the frustum?
+	if (!(r[0] < fRadius && r[1] < fRadius && r[2] < fRadius && r[3] < fRadius && r[4] < fRadius && r[5] < fRadius))
+	{
+		return 0;
+	}
+	// Does the light overlap the depth bins of pixels, and the bounds of the frustum?
+	uint uLightBins = GetLightDepthBins(center.z, fRadius, shape.bins);
+	bool bInBounds = m_uTileTest == LightTileTestPlanes || IsLightInTileBounds(center, fRadius, shape.bounds);
+	uint uMask = 0;
+	for (uint p = 0; p < TilePatternPrimitiveNum[shape.uPattern]; p++)
+	{
+		// Inside the split planes of the primitive?
+		uint uSplitPlanes = TilePatternSplitPlanes[shape.uPattern*TileMaxPrimitiveNum + p];
+		bool bInside = true;
+		for (uint j = 0; j < TileSplitPlaneNum; j++)
+		{
+			bInside = bInside && ((uSplitPlanes & (1u << j)) == 0 || r[6 + j] <= fRadius);
+		}
+		if (!bInside)
+		{
+			continue;
+		}
+		if (!bInBounds)
+		{
+			uTileRemoved |= 1u << p;
+		}
+		else if (uLightBins & shape.bins.primitiveBins[p])
+		{
+			uMask |= 1u << p;
+		}
+		else
+		{
+			uBinRemoved |= 1u << p;
+		}
+	}
+	// The shape of a spot or capsule light is tested after its bounding sphere.
+	if (uMask && m_bUseShapeTests && HasShape(uLightIdx))
+	{
+		for (uint p = 0; p < TilePatternPrimitiveNum[shape.uPattern]; p++)
+		{
+			if ((uMask & (1u << p)) && !IsLightShapeInPrimitive(uLightIdx, shape.planes, shape.uPattern, p))
+			{
+				uMask &= ~(1u << p);
+				uShapeRemoved |= 1u << p;
+			}
+		}
+	}
+	return uMask;
+}
+
+void CpuLightCuller::TransformLights(const PointLight * const pLights)
+{
+	m_viewLights.clear();
+	if (!m_bUseViewSpaceLights)
+	{
+		return;
+	}
+	m_viewLights.resize(m_cullingData.lightNum);
+	for (uint i = 0; i < m_cullingData.lightNum; i++)
+	{
+		m_viewLights[i] = TransformToView(pLights[i].pos, m_viewData.View);
+	}
+	m_stats.uLightTransforms += m_cullingData.lightNum;
+}
+
+void CpuLightCuller::TransformLightShapes()
+{
+	uint uShapeNum = m_cullingData.spotLightNum + m_cullingData.capsuleLightNum;
+	m_viewShapes.clear();
+	if (m_pShapes == nullptr)
+	{
+		return;
+	}
+	m_viewShapes.resize(uShapeNum);
+	uint uShapeOffset = GetShapeOffset();
+	for (uint i = 0; i < uShapeNum; i++)
+	{
+		uint uType = GetLightType(uShapeOffset + i, m_cullingData.lightNum, m_cullingData.spotLightNum, m_cullingData.capsuleLightNum);
+		m_viewShapes[i] = TransformShapeToView(m_pShapes[i], uType, m_viewData.View);
+	}
+}
+
+bool CpuLightCuller::IsLightShapeInPrimitive(uint uLightIdx, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint p) const
+{
+	// The shaders test the 6 planes like spheres, and the split planes of the primitive with <=.
+	const CpuViewLightShape& viewShape = m_viewShapes[uLightIdx - GetShapeOffset()];
+	for (uint j = 0; j < 6; j++)
+	{
+		if (!(GetLightShapePlaneDistance(viewShape, planes[j]) < 0.0f))
+		{
+			return false;
+		}
+	}
+	uint uSplitPlanes = TilePatternSplitPlanes[uPattern*TileMaxPrimitiveNum + p];
+	for (uint j = 0; j < TileSplitPlaneNum; j++)
+	{
+		if ((uSplitPlanes & (1u << j)) && !(GetLightShapePlaneDistance(viewShape, planes[6 + j]) <= 0.0f))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint CpuLightCuller::FilterListByShapes(uint * const pList, uint & uNum, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint p) const
+{
+	// Lists are in ascending order, so the lights with shapes are the last lights.
+	uint uKeepNum = (uint)(std::lower_bound(pList, pList + uNum, GetShapeOffset()) - pList);
+	for (uint i = uKeepNum; i < uNum; i++)
+	{
+		if (IsLightShapeInPrimitive(pList[i], planes, uPattern, p))
+		{
+			pList[uKeepNum++] = pList[i];
+		}
+	}
+	uint uRemoved = uNum - uKeepNum;
+	uNum = uKeepNum;
+	return uRemoved;
+}
+
+uint CpuLightCuller::FilterMaskByShapes(uint * const pMask, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint p) const
+{
+	uint uShapeOffset = GetShapeOffset();
+	uint uRemoved = 0;
+	for (uint uWord = uShapeOffset / CpuLightMaskWordBits; uWord < m_uMaskWordNum; uWord++)
+	{
+		uint uBits = pMask[uWord];
+		while (uBits)
+		{
+			uint uBit = FirstBitLow(uBits);
+			uBits &= uBits - 1;
+			uint uLightIdx = uWord*CpuLightMaskWordBits + uBit;
+			if (uLightIdx >= uShapeOffset && !IsLightShapeInPrimitive(uLightIdx, planes, uPattern, p))
+			{
+				pMask[uWord] &= ~(1u << uBit);
+				uRemoved++;
+			}
+		}
+	}
+	return uRemoved;
+}
+
+void CpuLightCuller::AppendLight(uint uCluster, uint uLightIdx)
+{
+	if (m_lightTable == CpuLightTable_Bitmask)
+	{
+		m_lightMasks[uCluster*m_uMaskWordNum + uLightIdx / CpuLightMaskWordBits] |= 1u << (uLightIdx % CpuLightMaskWordBits);
+		m_lightCounter[uCluster]++;
+		return;
+	}
+	int dstIdx = m_lightCounter[uCluster]++;
+	if (dstIdx < PerClusterMaxLight)
+	{
+		m_clusteredBuffer[uCluster].lightIdxs[dstIdx] = uLightIdx;
+	}
+	else
+	{
+		m_overflow.clusters[uCluster].lights.push_back(uLightIdx);
+	}
+}
+
+void CpuLightCuller::StoreList(uint uCluster, const uint * const pList, uint uNum)
+{
+	m_lightCounter[uCluster] = (int)uNum;
+	if (m_lightTable == CpuLightTable_Bitmask)
+	{
+		uint* pMask = m_lightMasks.data() + uCluster*m_uMaskWordNum;
+		for (uint i = 0; i < uNum; i++)
+		{
+			pMask[pList[i] / CpuLightMaskWordBits] |= 1u << (pList[i] % CpuLightMaskWordBits);
+		}
+		return;
+	}
+	uint uStoreNum = std::min(uNum, (uint)PerClusterMaxLight);
+	std::copy(pList, pList + uStoreNum, m_clusteredBuffer[uCluster].lightIdxs);
+	m_overflow.clusters[uCluster].lights.assign(pList + uStoreNum, pList + uNum);
+}
+
+void CpuLightCuller::CountMask(uint uCluster)
+{
+	// Counters are only statistics, a shading loop doesn't need them.
+	const uint* pMask = m_lightMasks.data() + uCluster*m_uMaskWordNum;
+	uint uNum = 0;
+	for (uint i = 0; i < m_uMaskWordNum; i++)
+	{
+		uNum += CountBits(pMask[i]);
+	}
+	m_lightCounter[uCluster] = (int)uNum;
+}
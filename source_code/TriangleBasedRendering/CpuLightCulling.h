@@ -0,0 +1,572 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightCulling.h
+//
+// A headless CPU reference of the light culling compute shaders (PerTileCullingCS and PerTriangleCullingCS), which
+// writes the light tables of LightClusteredManager in the same layout, to validate or benchmark culling without a GPU.
+// Every optional stage has its own state and statistics, and its code is in its own file (CpuLightCulling*.cpp).
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "ShaderTypeDefine.h"
+#include "ClusteredCommon.h"
+#include "CameraCommon.h"
+#include "CpuShaderMath.h"
+#include "CpuCullingKernel.h"
+#include "CpuLightBvh.h"
+#include "CpuDepthPyramid.h"
+#include "CpuTaskScheduler.h"
+#include "CpuLightShape.h"
+#include "CpuLightIndex.h"
+
+// The implementation of the sphere-versus-prism test.
+enum CpuCullingKernelType
+{
+	CpuCullingKernel_Reference,	// Transform every light in every tile like the shaders.
+	CpuCullingKernel_Scalar,	// Transform lights once, and test SoA light blocks without SIMD.
+	CpuCullingKernel_Simd,		// Transform lights once, and test SoA light blocks with AVX2/SSE.
+	CpuCullingKernel_Bvh		// Build a light BVH once, and test its nodes before the light blocks of its leaves.
+};
+
+// The representation of light tables.
+enum CpuLightTableType
+{
+	CpuLightTable_IndexList,	// Lists of light indexes (the light indexed buffer and packed light indexes).
+	CpuLightTable_Bitmask		// A bitmask over the light array per cluster.
+};
+
+// Statistics of incremental culling (SetIncremental).
+struct CpuIncrementalStats
+{
+	bool bPatched;						// The run patched the tables of the last run.
+	uint uDirtyTiles;					// Tiles culled again because their depth changed.
+	uint uDirtyLights;					// Lights added, removed or edited since the last run.
+};
+
+// Statistics of the depth pyramid and light occlusion (SetLightOcclusion).
+struct CpuOcclusionStats
+{
+	double dPyramidTime;				// Seconds spent building the depth pyramid and testing light occlusion.
+	uint uOccludedLights;				// Lights rejected by the light occlusion test.
+};
+
+// Statistics of light scatter (SetLightScatter).
+struct CpuScatterStats
+{
+	double dTime;						// Seconds spent binning lights to tiles.
+	unsigned long long uPairs;			// Light-tile pairs of the bins.
+};
+
+// Statistics of the last culling run. The overflow statistics are the ones LightListScanCS reduces on the GPU.
+struct CpuCullingStats
+{
+	double dTime;						// Seconds spent in Run().
+	double dBuildTime;					// Seconds spent building the SoA light buffer and the light BVH.
+	unsigned long long uPlaneTests;		// The number of light-plane distance tests.
+	unsigned long long uLightIndices;	// The total number of lights written to all clusters.
+	unsigned long long uLightPixelPairs;		// The sum of light counters of the clusters of all pixels.
+	unsigned long long uDepthBinRemovedPairs;	// Light-pixel pairs removed by depth bin culling.
+	uint uAntiDiagonalTiles;			// Tiles whose selected diagonal is TileSubdivisionAntiDiagonal.
+	unsigned long long uTileTestRemovedPairs;	// Light-pixel pairs removed by the tighter tile test.
+	unsigned long long uShapeRemovedPairs;	// Light-pixel pairs removed by the shape tests of spot and capsule lights.
+	unsigned long long uLightTransforms;	// Light centers transformed to view space (once per light with view-space lights).
+	uint uTilePlaneBuilds;				// Tiles whose entries of the tile plane table were built (after the projection changed).
+	CpuIncrementalStats incremental;
+	CpuOcclusionStats occlusion;
+	CpuScatterStats scatter;
+	LightOverflowStats overflow;
+};
+
+// Exact per-pixel accounting of the light lists of the last culling run.
+// A pair is a light in the cluster of a pixel, which is a loop iteration of LightPassPS. A false positive pair is a light
+// which doesn't reach the pixel (the distance is not less than the radius, or the pixel is outside the shape of a spot or
+// capsule light), so the pixel shader skips its GGX evaluation.
+struct CpuFalsePositiveStats
+{
+	unsigned long long uLightPixelPairs;	// Lights in the clusters of all pixels.
+	unsigned long long uFalsePositivePairs;	// Pairs whose light doesn't reach the pixel.
+	std::vector<uint> tileFalsePositives;	// False positive pairs of every tile (tileIdxFlattened of slice 0).
+};
+
+// Buckets of list length histograms: bucket 0 is empty lists, bucket b is [2^(b-1), 2^b), and the last bucket is longer lists.
+#define CpuListLengthBucketNum 10
+inline uint GetListLengthBucket(uint uLength)
+{
+	uint uBucket = 0;
+	for (; uLength && uBucket < CpuListLengthBucketNum - 1; uLength >>= 1)
+	{
+		uBucket++;
+	}
+	return uBucket;
+}
+
+// The quality of the light lists of the last culling run against the exact light coverage of the depth buffer.
+// The lights of a cluster are the distinct lights of its list (both lists of a split list), and a covered light reaches
+// a pixel of the cluster. Pairs are loop iterations of LightPassPS like CpuFalsePositiveStats.
+// Waves of the light pass are modelled as blocks of pixels of one primitive of a tile. A wave runs GGXBRDF in an iteration
+// of a light loop if the light of any of its lanes reaches the pixel of the lane, so every lane of the wave spends the
+// evaluation, and the lanes whose lights don't reach their pixels (or whose loops ended) waste it.
+struct CpuCullingQuality
+{
+	uint clusterLengths[CpuListLengthBucketNum];		// Clusters with pixels per bucket of their light numbers.
+	uint coveredLengths[CpuListLengthBucketNum];		// Clusters with pixels per bucket of their covered light numbers.
+	unsigned long long pixelLengths[CpuListLengthBucketNum];	// Pixels per bucket of the length of their light loops.
+	uint uClusterNum;						// Clusters with pixels.
+	unsigned long long uClusterLights;		// Lights of all clusters with pixels.
+	unsigned long long uCoveredLights;		// Lights of clusters which reach a pixel of their cluster.
+	unsigned long long uLightPixelPairs;	// Lights in the loops of all pixels.
+	unsigned long long uFalsePositivePairs;	// Pairs whose light doesn't reach the pixel.
+	unsigned long long uWaveNum;			// Waves of the light pass.
+	unsigned long long uGgxLanes;			// Lanes of waves running GGXBRDF, including the lanes which waste it.
+	unsigned long long uWastedGgxLanes;		// Lanes running GGXBRDF for a light which doesn't reach their pixels.
+};
+
+class CpuLightCuller
+{
+public:
+	CpuLightCuller();
+
+	// Select the subdivision pattern of tiles (TileSubdivision*), the default is TileSubdivision.
+	// TileSubdivisionQuad is per tile culling (PerTileCullingCS), the others are per triangle culling (PerTriangleCullingCS).
+	void Init(uint uSubdivision);
+	// Select the culling kernel, the default is CpuCullingKernel_Reference.
+	void SetKernel(CpuCullingKernelType kernel) { m_kernel = kernel; Invalidate(); }
+	// Select the light table, the default is CpuLightTable_IndexList. Only the buffers of the selected table are written.
+	void SetLightTable(CpuLightTableType table) { m_lightTable = table; Invalidate(); }
+	// Enable depth bin culling (2.5D culling), the default is UseDepthBinCulling. A light is rejected unless its depth range
+	// overlaps the DepthBinNum view-space bins occupied by the pixels of a cluster. Pixels near a diagonal are in the
+	// primitives of both sides.
+	void SetDepthBinCulling(bool bUseDepthBins) { m_bUseDepthBins = bUseDepthBins; Invalidate(); }
+	// Select the light-versus-tile test (LightTileTest*), the default is LightTileTest. The AABB and cone tests reject lights
+	// which pass the planes of a tile but miss the bounds of its frustum.
+	void SetTileTest(uint uTileTest) { m_uTileTest = std::min(uTileTest, (uint)LightTileTestNum - 1); Invalidate(); }
+	// Select the diagonal of every tile by its depth samples, the default is UseTileDiagonalSelection.
+	// Only 2-triangle patterns (TileSubdivisionDiagonal and TileSubdivisionAntiDiagonal) select diagonals, and primitive 0 of
+	// a tile stays above its diagonal.
+	void SetDiagonalSelection(bool bSelectDiagonals) { m_bSelectDiagonals = bSelectDiagonals; Invalidate(); }
+	// Cull coarse tiles of uFactor*uFactor tiles first, and cull tiles against the lights of their coarse tiles.
+	// The default is 1 (one-level culling like the shaders). The lists are subsets of one-level lists, a light only
+	// disappears if it passes the planes of a tile but misses its coarse frustum.
+	void SetCoarseTileFactor(uint uFactor) { m_uCoarseTileFactor = std::max(uFactor, 1u); Invalidate(); }
+	// Reject lights behind the max depth of the depth pyramid cells under their screen rects before culling, like
+	// LightOcclusionCS, the default is UseLightOcclusion.
+	void SetLightOcclusion(bool bUseLightOcclusion) { m_occlusion.bEnabled = bUseLightOcclusion; Invalidate(); }
+	// Bin lights to the tiles under their screen rects before culling, the default is UseLightScatter.
+	// Bins are merged in light order, so lists stay in ascending order and equal one-level lists. Coarse tiles are ignored
+	// with light scatter.
+	void SetLightScatter(bool bUseLightScatter) { m_scatter.bEnabled = bUseLightScatter; Invalidate(); }
+	bool IsLightScatter() const { return m_scatter.bEnabled; }
+	// Test the shapes of spot and capsule lights after their bounding spheres, the default is UseLightShapeTests.
+	// The stages before the planes (occlusion, scatter, BVH, bins and clamping) always use the spheres.
+	void SetLightShapeTests(bool bUseShapeTests) { m_bUseShapeTests = bUseShapeTests; Invalidate(); }
+	bool IsLightShapeTests() const { return m_bUseShapeTests; }
+	// Transform all lights to view space once per run, and read the view-space lights in every stage instead of
+	// transforming every candidate light in every cluster, the default is UseViewSpaceLights.
+	// The SoA kernels always transform lights once (CpuLightSoA), so the reference kernel and the stages outside the
+	// kernels (occlusion, scatter and overflow) read them.
+	void SetViewSpaceLights(bool bUseViewSpaceLights) { m_bUseViewSpaceLights = bUseViewSpaceLights; Invalidate(); }
+	bool IsViewSpaceLights() const { return m_bUseViewSpaceLights; }
+	// Read the sides and the split planes of tiles from a table built for the projection and the tile grid, and only create
+	// the front and back planes of clusters, the default is UseTilePlaneTable. Clusters create the same planes without the
+	// table (ComputeSidePlanes), so the lists are the same.
+	void SetTilePlaneTable(bool bUseTilePlanes) { m_bUseTilePlanes = bUseTilePlanes; Invalidate(); }
+	bool IsTilePlaneTable() const { return m_bUseTilePlanes; }
+	// Set the shapes of the spot and capsule lights of the next runs (the last spotLightNum+capsuleLightNum lights of
+	// ClusteredData), in the order of the lights. The array is read in Run() and CountFalsePositives().
+	void SetLightShapes(const LightShape* const pShapes) { m_pShapes = pShapes; }
+	// Select the policy of lists over PerClusterMaxLight (LightOverflow*), the default is LightOverflowPolicy. Clamped lists
+	// keep the first lights of the last kept bucket where the GPU keeps any, and split depths may differ from the GPU in
+	// the last bits. A split list which doesn't fit in the packed light indexes is spilled.
+	void SetOverflowPolicy(uint uPolicy) { m_overflow.uPolicy = std::min(uPolicy, (uint)LightOverflowPolicyNum - 1); Invalidate(); }
+	uint GetOverflowPolicy() const { return m_overflow.uPolicy; }
+	// Patch the tables of the last run instead of culling all tiles, the default is false (every run culls all tiles).
+	// A camera whose ViewData differs by more than fCameraThreshold (in any element) rebuilds all tables. Tiles whose depth
+	// range or depth bins changed are culled again, and the others only test the lights added, removed or edited since the
+	// last run, so the lists equal a full run as sets (supersets with coarse tiles), except clusters over PerClusterMaxLight.
+	void SetIncremental(bool bIncremental, float fCameraThreshold = IncrementalCameraThreshold);
+	// Rebuild all tables in the next run.
+	void Invalidate() { m_incremental.bHistoryValid = false; }
+	bool IsIncremental() const { return m_incremental.bEnabled; }
+	// Run tiles (and the BVH build) on the threads of a scheduler, nullptr runs all tiles on the calling thread.
+	// Per-thread timings are available from the scheduler after Run().
+	void SetScheduler(CpuTaskScheduler* const pScheduler) { m_pScheduler = pScheduler; }
+
+	// Set the depth buffer (gDepthBuffer), the values are post-projection depth.
+	void SetDepthBuffer(const float* const pDepth, uint uWidth, uint uHeight);
+	// Set depthDim+1 depth planes (gDepthPlaneSRV) in post-projection depth.
+	// Without depth planes, all slices use the whole depth range of a tile. Clusters without pixels in their slices are empty.
+	void SetDepthPlanes(const float* const pPlanes, uint uPlaneNum);
+
+	// Run light culling for all tiles (Dispatch(widthDim, heightDim, depthDim)).
+	void Run(const ClusteredData& cullingData, const ViewData& viewData, const PointLight* const pLights);
+
+	// Get light indexed buffer, primitive i of a tile is cluster tileIdxFlattened*TilePatternPrimitiveNum[pattern]+i.
+	// Lists are in ascending order where the GPU appends in any order, so compare them as sets (CountMismatchedClusters).
+	const std::vector<ClusteredBuffer>& GetClusteredBuffer() const { return m_clusteredBuffer; }
+	// Get light counter buffer, counters keep counting after PerClusterMaxLight like the shaders.
+	const std::vector<int>& GetCounterBuffer() const { return m_lightCounter; }
+	// Get light lists of packed light indexes.
+	const std::vector<ClusteredList>& GetLightListBuffer() const { return m_lightLists; }
+	// Get packed light indexes (GetPackedIndexCapacity() slots, LoadLightIndex reads a slot). With UseLightIndex16 a uint
+	// holds two 16-bit slots like the GPU buffer.
+	const std::vector<uint>& GetPackedIndexBuffer() const { return m_packedIndexes; }
+	// The slots of the packed light indexes, which grow and shrink like the GPU buffer (GetPackedIndexCapacity).
+	uint GetPackedIndexCapacity() const { return m_overflow.uPackedCapacity; }
+	// The culling data and the depth planes of the last run (gCB and gDepthPlanes of the light passes).
+	const ClusteredData& GetCullingData() const { return m_cullingData; }
+	const std::vector<float>& GetDepthPlanes() const { return m_depthPlanes; }
+	// Get light bitmasks (GetMaskWordNum() words per cluster, bit i of word i/32 is light i). Bitmasks never overflow, and
+	// they have no GPU path yet.
+	const std::vector<uint>& GetLightMaskBuffer() const { return m_lightMasks; }
+	uint GetMaskWordNum() const { return m_uMaskWordNum; }
+	// Get the diagonal bits of tiles (bit i%32 of word i/32 is set if tile i uses TileSubdivisionAntiDiagonal).
+	// The buffer is empty unless diagonals are selected.
+	const std::vector<uint>& GetTileDiagonalBuffer() const { return m_tileDiagonalBits; }
+	// The subdivision pattern used by a tile (tileIdxFlattened of slice 0).
+	uint GetTilePattern(uint uTileIdx) const { return m_tilePatterns.empty() ? m_uSubdivision : m_tilePatterns[uTileIdx]; }
+	uint GetTileTest() const { return m_uTileTest; }
+	// Get the depth pyramid of the last run.
+	const CpuDepthPyramid& GetDepthPyramid() const { return m_occlusion.depthPyramid; }
+	// Get the visibility bits of lights (bit i%32 of word i/32 is set if light i isn't occluded).
+	// The buffer is empty without light occlusion.
+	const std::vector<uint>& GetLightVisibilityBuffer() const { return m_occlusion.lightVisibility; }
+	bool IsDiagonalSelection() const { return m_bSelectDiagonals && TilePatternPrimitiveNum[m_uSubdivision] == 2; }
+	CpuLightTableType GetLightTable() const { return m_lightTable; }
+	// The number of elements in light indexed buffer (tiles or triangles).
+	uint GetClusterNum() const { return (uint)m_lightCounter.size(); }
+	const CpuCullingStats& GetStats() const { return m_stats; }
+	bool IsTriangleCulling() const { return m_uSubdivision != TileSubdivisionQuad; }
+	uint GetSubdivision() const { return m_uSubdivision; }
+	// Count the pairs of a pixel and a light which reaches it but isn't in the cluster of the pixel, for every uPixelStep-th
+	// pixel in both directions. Culling is conservative, so only lights lost by clamped or truncated clusters may be
+	// missed, and these clusters are skipped. Spilled and split lists are checked. It tests every light against every pixel, so it is much slower than culling.
+	unsigned long long CountMissedPairs(const PointLight* const pLights, uint uPixelStep = 1) const;
+
+	// Count the lights of the clusters of all pixels which don't reach the pixels, for the light table of the last run.
+	// Index lists are read from packed light indexes like LightPassPS. It tests every light in the cluster of every pixel,
+	// so it is much slower than culling.
+	void CountFalsePositives(const PointLight* const pLights, CpuFalsePositiveStats& stats) const;
+	// Measure the light lists of the last run against the lights which reach every pixel, with waves of
+	// uWaveWidth*uWaveHeight pixels. The culler must use index lists, and the lists are read from packed light indexes,
+	// or from pLists and pIndexes if they aren't nullptr (e.g. a readback of the GPU buffers for the same inputs).
+	// It tests every light in the cluster of every pixel like CountFalsePositives.
+	void MeasureQuality(const PointLight* const pLights, uint uWaveWidth, uint uWaveHeight, CpuCullingQuality& quality,
+		const ClusteredList* const pLists = nullptr, const uint* const pIndexes = nullptr) const;
+
+	// Compare two light indexed buffers as sets of light indexes, and return the number of different clusters.
+	static uint CountMismatchedClusters(const ClusteredBuffer* const pBufferA, const int* const pCounterA,
+		const ClusteredBuffer* const pBufferB, const int* const pCounterB, uint uClusterNum);
+	// Same as CountMismatchedClusters for packed light indexes (e.g. a readback of the GPU buffers).
+	static uint CountMismatchedPackedClusters(const ClusteredList* const pListA, const uint* const pIndexA,
+		const ClusteredList* const pListB, const uint* const pIndexB, uint uClusterNum);
+	// Count the clusters of B whose lights are not all in the same cluster of A, clusters over PerClusterMaxLight are skipped.
+	static uint CountUncoveredClusters(const ClusteredBuffer* const pBufferA, const int* const pCounterA,
+		const ClusteredBuffer* const pBufferB, const int* const pCounterB, uint uClusterNum);
+
+private:
+	// Temporary data of a thread, so threads don't share anything except their own output clusters.
+	struct ThreadContext
+	{
+		// Light lists of the primitives of a cluster.
+		std::vector<uint> lists[TileMaxPrimitiveNum];
+		// Pixels of the current tile (ldsDepth).
+		std::vector<float> tileDepth;
+		std::vector<float> tileViewZ;
+		std::vector<uint> tilePixelFlags;
+		std::vector<uint> tilePixelSlices;
+		// Light lists of the clusters of the current coarse tile, lightNum indexes per slice.
+		std::vector<uint> coarseLists;
+		std::vector<uint> coarseListNum;
+		unsigned long long uPlaneTests;
+		unsigned long long uDepthBinRemovedPairs;
+		unsigned long long uTileTestRemovedPairs;
+		unsigned long long uShapeRemovedPairs;
+		unsigned long long uLightTransforms;
+	};
+
+	// Depth bins of a cluster.
+	struct DepthBins
+	{
+		float fNearZ;		// The view-space depth of the first bin.
+		float fInvBinSize;
+		uint primitiveBins[TileMaxPrimitiveNum];	// Bins occupied by pixels of every primitive.
+		uint primitivePixels[TileMaxPrimitiveNum];	// Pixels shaded with the cluster of every primitive.
+	};
+
+	// The planes of tiles through the camera and the rays through their corners (TilePlanes).
+	struct SidePlanes
+	{
+		CpuFloat4 sides[TileSidePlaneNum];
+		CpuFloat4 corners[4];
+	};
+
+	// The bounds of the frustum of a cluster for the tighter tile tests.
+	struct TileBounds
+	{
+		CpuFloat4 aabbMin;		// The view-space AABB of the 8 vertexes of the frustum.
+		CpuFloat4 aabbMax;
+		CpuFloat4 coneAxis;		// The cone from the camera which contains the frustum.
+		float fConeCos;
+		float fConeSin;
+		CpuFloat4 center;		// The average of the 8 vertexes, lights are clamped by their distance to it.
+	};
+
+	// The culling volume of a cluster, kept for patching in incremental mode.
+	struct ClusterShape
+	{
+		CpuFloat4 planes[TilePlaneNum];
+		TileBounds bounds;
+		DepthBins bins;
+		uint uPattern;
+		bool bValid;	// False if no pixel of the tile is in the slice (the cluster is empty).
+	};
+
+	// The lights of a cluster after PerClusterMaxLight.
+	struct ClusterOverflow
+	{
+		std::vector<uint> lights;	// Lights after the light indexed buffer, in the order of the list.
+		std::vector<uint> halves;	// LightOverflowSplit: bit 0 (1) if a light of the whole list is in the near (far) list.
+		float fSplitZ;				// LightOverflowSplit: the post-projection split depth.
+	};
+
+	// The bins of a chunk of lights, tileCounts becomes the first index of every tile in tileLights after the prefix sum.
+	struct ScatterChunk
+	{
+		std::vector<uint> tileCounts;
+		std::vector<uint> pairs;	// (tile, light) pairs in light order.
+	};
+
+	// Cull all tiles against all lights.
+	void CullAllTiles(const PointLight* const pLights);
+	// Cull tiles whose depth changed, and patch dirty lights in the other tiles (incremental mode).
+	// Return false if nothing changed since the last run.
+	bool PatchTables(const PointLight* const pLights, uint uLightNum);
+	// Compare the depth of a tile in the depth pyramid and the tile depth bins to the last run: its min/max depth, its
+	// pattern, and the depth bins and pixels of every slice. Other depth edits inside the tile don't change its lists.
+	bool IsTileDepthChanged(uint uTileX, uint uTileY) const;
+	// Can the next run patch the tables of the last run?
+	bool CanPatch(const ClusteredData& cullingData, const ViewData& viewData) const;
+	// Resize the thread contexts for the current culling data, and reset their statistics.
+	void PrepareContexts();
+	// Run a task for every chunk on the scheduler, or on the calling thread without a scheduler.
+	void ParallelFor(uint uChunkNum, const CpuTaskScheduler::Task& task);
+
+	// Cull a chunk of tiles (a row, or a segment of a row).
+	void CullChunk(uint uChunk, uint uChunkPerRow, const PointLight* const pLights, ThreadContext& context);
+	// Load the depth of a tile (ldsDepth), the min/max depth of the texels is in level 0 of the depth pyramid.
+	void LoadTileDepth(uint uTileX, uint uTileY, float* const pTileDepth) const;
+	// Build the depth pyramid, and the patterns and the depth bins of all tiles (DepthPyramidCS).
+	void BuildDepthPyramid();
+	// Build the patterns of all tiles and the depth bins of all of their slices from the depth pyramid, once per tile.
+	void BuildTileDepthBins();
+	// Test all lights against the depth pyramid (light occlusion).
+	void TestLightOcclusion(const PointLight* const pLights);
+	// Bin all visible lights to tiles (light scatter).
+	void ScatterLights(const PointLight* const pLights);
+	// Is a light in the bin of a tile? The lights of a bin are in ascending order.
+	bool IsLightInTileBin(uint uTileIdx, uint uLightIdx) const
+	{
+		return std::binary_search(m_scatter.tileLights.begin() + m_scatter.tileLightOffsets[uTileIdx], m_scatter.tileLights.begin() + m_scatter.tileLightOffsets[uTileIdx + 1], uLightIdx);
+	}
+	bool IsLightVisible(uint uLightIdx) const
+	{
+		return m_occlusion.lightVisibility.empty() || (m_occlusion.lightVisibility[uLightIdx / 32] & (1u << (uLightIdx % 32))) != 0;
+	}
+	// The tile and the cluster shading a pixel of the depth buffer in the light pass, and its view-space position.
+	uint GetPixelCluster(uint uPixelX, uint uPixelY, uint& uTileIdx, CpuFloat4& pos) const;
+	// Get the position (u, v) of a loaded pixel in a tile, and return false if the pixel belongs to another tile.
+	bool GetTilePixelUv(uint uTileX, uint uTileY, uint uPixel, float& u, float& v) const;
+	// Select the diagonal of a tile whose triangles have the smaller sum of view-space depth ranges.
+	uint SelectTileSubdivision(uint uTileX, uint uTileY, const ThreadContext& context) const;
+	// Compute the view-space depth, the primitives and the depth slice of every pixel of a tile.
+	void ComputeTilePixels(uint uTileX, uint uTileY, uint uPattern, ThreadContext& context) const;
+	// Compute the depth bins and pixel counters of the clusters of a tile in a depth slice.
+	void ComputeDepthBins(uint uSlice, float fZMin, float fZMax, const ThreadContext& context, DepthBins& bins) const;
+	// Remove lights of a list (or a light bitmask) outside depth bins, and return the number of removed lights.
+	uint FilterListByDepthBins(uint* const pList, uint& uNum, uint uBins, const DepthBins& bins) const;
+	uint FilterMaskByDepthBins(uint* const pMask, uint uBins, const DepthBins& bins) const;
+	// The depth bins of a cluster overlapped by a light sphere.
+	static uint GetLightDepthBins(float fViewZ, float fRadius, const DepthBins& bins);
+	// Does a view-space light sphere pass the tighter tile test?
+	bool IsLightInTileBounds(const CpuFloat4& center, float fRadius, const TileBounds& bounds) const;
+	// Remove lights of a list (or a light bitmask) outside the bounds of a tile, and return the number of removed lights.
+	uint FilterListByTileBounds(uint* const pList, uint& uNum, const TileBounds& bounds) const;
+	uint FilterMaskByTileBounds(uint* const pMask, const TileBounds& bounds) const;
+	// Create the planes of the frustum of uTileNumX*uTileNumY tiles (ldsPlanes), the last four planes are the split planes of primitives.
+	// The bounds of the frustum for the tighter tile tests are also computed if pBounds isn't nullptr.
+	void ComputeTilePlanes(uint uTileX, uint uTileY, uint uTileNumX, uint uTileNumY, float fZMin, float fZMax, CpuFloat4 planes[TilePlaneNum],
+		TileBounds* const pBounds = nullptr) const;
+	// Create the planes through the camera and the corner rays of uTileNumX*uTileNumY tiles, like TilePlane.hlsli.
+	void ComputeSidePlanes(uint uTileX, uint uTileY, uint uTileNumX, uint uTileNumY, SidePlanes& sidePlanes) const;
+	// Build the tile plane table if the projection or the tile grid changed since it was built.
+	void BuildTilePlaneTable();
+	// Clip the depth range of a tile by a depth slice, and return false if the cluster is empty.
+	bool ClipDepthRange(uint uSlice, uint uZMin, uint uZMax, float& fZMin, float& fZMax) const;
+	// Cull the clusters of a coarse tile against all lights, then cull its tiles against the coarse lists.
+	void CullCoarseTile(uint uCoarseX, uint uCoarseY, const PointLight* const pLights, ThreadContext& context);
+	// Cull all lights against the 6 planes of a coarse cluster, and return the number of lights written to pList.
+	uint CullCoarseCluster(const CpuFloat4 planes[TilePlaneNum], const PointLight* const pLights, uint* const pList, ThreadContext& context);
+	// Cull all lights (or the lists of the coarse tile) against the clusters of one tile in all depth slices.
+	void CullTile(uint uTileX, uint uTileY, bool bUseCoarseLists, const PointLight* const pLights, ThreadContext& context);
+	// Cull all lights (or the lights in pParent) against the primitives of a tile whose depth range is [fZMin, fZMax].
+	// The planes and bounds of the shape are computed here, its pattern and bins are inputs.
+	void CullCluster(uint uTileX, uint uTileY, uint uSlice, float fZMin, float fZMax, ClusterShape& shape,
+		const uint* const pParent, uint uParentNum, const PointLight* const pLights, ThreadContext& context);
+	// Test a view-space light against the primitives of a cluster like the shaders, and return the mask of primitives
+	// whose lists get the light. Primitives rejected by the tighter tile test, by depth bins or by the shape of a spot or
+	// capsule light are returned in the masks.
+	uint TestLightPrimitives(uint uLightIdx, const CpuFloat4& center, float fRadius, const ClusterShape& shape, uint& uTileRemoved,
+		uint& uBinRemoved, uint& uShapeRemoved) const;
+	// Transform all lights to view space once (view-space lights), like LightTransformCS.
+	void TransformLights(const PointLight* const pLights);
+	// The view-space center of a light, from the view-space lights or transformed again like the shaders without them.
+	CpuFloat4 GetViewLightCenter(uint uLightIdx, const PointLight* const pLights, unsigned long long& uTransforms) const
+	{
+		if (!m_viewLights.empty())
+		{
+			return m_viewLights[uLightIdx];
+		}
+		uTransforms++;
+		return TransformToView(pLights[uLightIdx].pos, m_viewData.View);
+	}
+	// Transform the shapes of spot and capsule lights to view space.
+	void TransformLightShapes();
+	// The first spot light, lights from it have shapes.
+	uint GetShapeOffset() const
+	{
+		return GetLightTypeOffset(m_cullingData.lightNum, m_cullingData.spotLightNum, m_cullingData.capsuleLightNum, LightTypeSpot);
+	}
+	bool HasShape(uint uLightIdx) const { return !m_viewShapes.empty() && uLightIdx >= GetShapeOffset(); }
+	// Does a light reach a view-space position? View-space centers of the lights are in pCenters, and spot and capsule
+	// lights reach the positions in their shapes (the shapes of the last run).
+	bool IsLightReachingPixel(uint uLightIdx, const CpuFloat4* const pCenters, const PointLight* const pLights, const CpuFloat4& pos) const
+	{
+		CpuFloat4 d = Sub3(pCenters[uLightIdx], pos);
+		return HasShape(uLightIdx) ? IsPointInLightShape(m_viewShapes[uLightIdx - GetShapeOffset()], pos) :
+			Dot3(d, d) < pLights[uLightIdx].radius*pLights[uLightIdx].radius;
+	}
+	// Is the shape of a spot or capsule light inside the 6 planes and the split planes of primitive p?
+	bool IsLightShapeInPrimitive(uint uLightIdx, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint p) const;
+	// Remove the spot and capsule lights of a list (or a light bitmask) whose shapes miss primitive p, and return the number of removed lights.
+	uint FilterListByShapes(uint* const pList, uint& uNum, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint p) const;
+	uint FilterMaskByShapes(uint* const pMask, const CpuFloat4 planes[TilePlaneNum], uint uPattern, uint p) const;
+	// Remove the dirty lights from the clusters of a tile, and append the dirty lights which still exist.
+	void PatchTile(uint uTileIdx, const std::vector<uint>& dirtyLights, const std::vector<CpuFloat4>& dirtyCenters,
+		const PointLight* const pLights, ThreadContext& context);
+	// Clear the clusters of a tile before it is culled again.
+	void ResetTileClusters(uint uTileIdx);
+	void AppendLight(uint uCluster, uint uLightIdx);
+	void RemoveLight(uint uCluster, uint uLightIdx);
+	// Sort a patched list in ascending order, so the lights of every type are contiguous again.
+	void SortList(uint uCluster);
+	// Store a list created by the SoA kernels in the light indexed buffer (or the light bitmasks).
+	void StoreList(uint uCluster, const uint* const pList, uint uNum);
+	// Apply the overflow policy to a list over PerClusterMaxLight after all of its lights are appended.
+	void ResolveOverflow(uint uCluster, const ClusterShape& shape, const PointLight* const pLights, ThreadContext& context);
+	// Count the lights of a bitmask created by the SoA kernels.
+	void CountMask(uint uCluster);
+	// The packed light indexes a list of uCounter lights asks for like LightListScanCS, a light may be in both halves of a
+	// split list.
+	uint GetListSize(uint uCounter) const;
+	// Allocate light lists with an exclusive prefix sum of counters, and copy lists into packed light indexes.
+	void PackLists();
+
+	uint m_uSubdivision;
+	bool m_bUseDepthBins;
+	bool m_bSelectDiagonals;
+	uint m_uTileTest;
+	uint m_uCoarseTileFactor;
+	CpuCullingKernelType m_kernel;
+	CpuLightTableType m_lightTable;
+	ClusteredData m_cullingData;
+	ViewData m_viewData;
+
+	const float* m_pDepth;
+	uint m_uDepthWidth;
+	uint m_uDepthHeight;
+	std::vector<float> m_depthPlanes;
+
+	std::vector<ClusteredBuffer> m_clusteredBuffer;
+	std::vector<int> m_lightCounter;
+	std::vector<ClusteredList> m_lightLists;
+	std::vector<uint> m_packedIndexes;
+	std::vector<uint> m_lightMasks;
+	uint m_uMaskWordNum;
+	// The shapes of clusters (tileIdxFlattened) and their pixels (light-pixel pairs, and the pairs of patched runs).
+	std::vector<ClusterShape> m_clusterShapes;
+	std::vector<uint> m_clusterPixels;
+	// The patterns of tiles and their diagonal bits (with diagonal selection).
+	std::vector<uint> m_tilePatterns;
+	// The depth bins of the slices of tiles (BuildTileDepthBins), tileIdxFlattened like m_clusterShapes.
+	std::vector<DepthBins> m_tileDepthBins;
+	std::vector<uint> m_tileDiagonalBits;
+
+	// Lists over PerClusterMaxLight (CpuLightCullingOverflow.cpp).
+	struct OverflowState
+	{
+		uint uPolicy;
+		uint uPackedCapacity;	// Slots of the packed light indexes.
+		std::vector<ClusterOverflow> clusters;
+	};
+	OverflowState m_overflow;
+
+	// The depth pyramid of every run, and the visibility bits of lights with light occlusion.
+	struct OcclusionState
+	{
+		bool bEnabled;
+		CpuDepthPyramid depthPyramid;
+		std::vector<uint> lightVisibility;
+	};
+	OcclusionState m_occlusion;
+
+	// Light scatter (CpuLightCullingCoarse.cpp).
+	struct ScatterState
+	{
+		bool bEnabled;
+		std::vector<ScatterChunk> chunks;
+		// The view-space depth range of every tile (zMin, zMax).
+		std::vector<float> tileViewZ;
+		// The lights of tile i are tileLights[tileLightOffsets[i], tileLightOffsets[i + 1]), empty without light scatter.
+		std::vector<uint> tileLightOffsets;
+		std::vector<uint> tileLights;
+	};
+	ScatterState m_scatter;
+
+	// Shapes of spot and capsule lights, and their view-space shapes (empty without shapes).
+	bool m_bUseShapeTests;
+	const LightShape* m_pShapes;
+	std::vector<CpuViewLightShape> m_viewShapes;
+
+	// The side planes of every tile, and the projection and the tile grid they were built for (empty without the table).
+	bool m_bUseTilePlanes;
+	std::vector<SidePlanes> m_tilePlanes;
+	float4x4 m_tilePlaneProjInv;
+	float m_fTilePlaneSizeX;
+	float m_fTilePlaneSizeY;
+
+	// View-space centers of lights (empty without view-space lights).
+	bool m_bUseViewSpaceLights;
+	std::vector<CpuFloat4> m_viewLights;
+
+	// View-space lights for the SoA kernels.
+	CpuLightSoA m_lightSoA;
+	CpuLightBvh m_lightBvh;
+	CpuTaskScheduler* m_pScheduler;
+	std::vector<ThreadContext> m_contexts;
+	CpuCullingStats m_stats;
+
+	// Incremental culling (CpuLightCullingIncremental.cpp) keeps the lights and the depth buffer of the last run and the
+	// min/max depth of every tile, the depth bins of clusters are in m_clusterShapes.
+	struct IncrementalState
+	{
+		bool bEnabled;
+		bool bHistoryValid;
+		float fCameraThreshold;
+		std::vector<PointLight> prevLights;
+		std::vector<LightShape> prevShapes;
+		std::vector<float> prevDepth;
+		std::vector<DepthBounds> tileBounds;
+		std::vector<unsigned char> dirtyTiles;
+	};
+	IncrementalState m_incremental;
+};
@@ -0,0 +1,186 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightCullingCoarse.cpp
+//
+// Coarse tiles and light scatter, which narrow the candidate lights of tiles before culling.
+//--------------------------------------------------------------------------------------
+#include "CpuLightCulling.h"
+#include <algorithm>
+#include <chrono>
+
+void CpuLightCuller::ScatterLights(const PointLight * const pLights)
+{
+	m_scatter.tileLightOffsets.clear();
+	m_scatter.tileLights.clear();
+	if (!m_scatter.bEnabled)
+	{
+		return;
+	}
+	auto begin = std::chrono::high_resolution_clock::now();
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	uint uLightNum = m_cullingData.lightNum;
+
+	// The view-space depth range of tiles, like LightScatterCS.
+	m_scatter.tileViewZ.resize(uTileNum * 2);
+	for (uint i = 0; i < uTileNum; i++)
+	{
+		const DepthBounds& bounds = m_occlusion.depthPyramid.GetTileBounds(i % m_cullingData.widthDim, i / m_cullingData.widthDim);
+		CpuFloat4 minPos = { 0.0f, 0.0f, bounds.zMin, 1.0f };
+		CpuFloat4 maxPos = { 0.0f, 0.0f, bounds.zMax, 1.0f };
+		m_scatter.tileViewZ[i * 2] = DivideByW(Mul(minPos, m_viewData.ProjInv)).z;
+		m_scatter.tileViewZ[i * 2 + 1] = DivideByW(Mul(maxPos, m_viewData.ProjInv)).z;
+	}
+	CpuFloat4 nearPos = { 0.0f, 0.0f, 0.0f, 1.0f };
+	float fNearZ = DivideByW(Mul(nearPos, m_viewData.ProjInv)).z;
+
+	// Every chunk of lights bins its pairs on its own, so threads never share a counter.
+	uint uChunkNum = std::min(uLightNum, (uint)m_contexts.size() * 4);
+	m_scatter.chunks.resize(uChunkNum);
+	ParallelFor(uChunkNum, [&](uint uChunk, uint uThreadIdx)
+	{
+		ScatterChunk& chunk = m_scatter.chunks[uChunk];
+		chunk.tileCounts.assign(uTileNum, 0);
+		chunk.pairs.clear();
+		for (uint i = uLightNum*uChunk / uChunkNum; i < uLightNum*(uChunk + 1) / uChunkNum; i++)
+		{
+			if (!IsLightVisible(i))
+			{
+				continue;
+			}
+			float fRadius = pLights[i].radius;
+			CpuFloat4 center = GetViewLightCenter(i, pLights, m_contexts[uThreadIdx].uLightTransforms);
+			// Spheres crossing the near plane cover all tiles.
+			uint x0 = 0, y0 = 0, x1 = m_cullingData.widthDim - 1, y1 = m_cullingData.heightDim - 1;
+			if (center.z - fRadius > fNearZ && !m_occlusion.depthPyramid.GetSphereTileRect(center, fRadius, m_viewData, x0, y0, x1, y1))
+			{
+				continue;
+			}
+			for (uint y = y0; y <= y1; y++)
+			{
+				for (uint x = x0; x <= x1; x++)
+				{
+					uint uTileIdx = x + y*m_cullingData.widthDim;
+					if (center.z + fRadius >= m_scatter.tileViewZ[uTileIdx * 2] && center.z - fRadius <= m_scatter.tileViewZ[uTileIdx * 2 + 1])
+					{
+						chunk.tileCounts[uTileIdx]++;
+						chunk.pairs.push_back(uTileIdx);
+						chunk.pairs.push_back(i);
+					}
+				}
+			}
+		}
+	});
+
+	// Tile-major prefix sum over chunks, the bins of a tile are in chunk order.
+	m_scatter.tileLightOffsets.resize(uTileNum + 1);
+	uint uOffset = 0;
+	for (uint i = 0; i < uTileNum; i++)
+	{
+		m_scatter.tileLightOffsets[i] = uOffset;
+		for (auto& chunk : m_scatter.chunks)
+		{
+			uint uCount = chunk.tileCounts[i];
+			chunk.tileCounts[i] = uOffset;
+			uOffset += uCount;
+		}
+	}
+	m_scatter.tileLightOffsets[uTileNum] = uOffset;
+
+	m_scatter.tileLights.resize(uOffset);
+	ParallelFor(uChunkNum, [&](uint uChunk, uint)
+	{
+		ScatterChunk& chunk = m_scatter.chunks[uChunk];
+		for (size_t k = 0; k < chunk.pairs.size(); k += 2)
+		{
+			m_scatter.tileLights[chunk.tileCounts[chunk.pairs[k]]++] = chunk.pairs[k + 1];
+		}
+	});
+	m_stats.scatter.uPairs = uOffset;
+	m_stats.scatter.dTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+}
+
+void CpuLightCuller::CullCoarseTile(uint uCoarseX, uint uCoarseY, const PointLight * const pLights, ThreadContext & context)
+{
+	uint uBeginX = uCoarseX*m_uCoarseTileFactor;
+	uint uBeginY = uCoarseY*m_uCoarseTileFactor;
+	uint uEndX = std::min(uBeginX + m_uCoarseTileFactor, m_cullingData.widthDim);
+	uint uEndY = std::min(uBeginY + m_uCoarseTileFactor, m_cullingData.heightDim);
+
+	// The depth range of a coarse tile covers the depth ranges of its tiles.
+	uint uZMin = 0x7f7fffff;
+	uint uZMax = 0;
+	for (uint y = uBeginY; y < uEndY; y++)
+	{
+		for (uint x = uBeginX; x < uEndX; x++)
+		{
+			const DepthBounds& bounds = m_occlusion.depthPyramid.GetTileBounds(x, y);
+			uZMin = std::min(uZMin, AsUint(bounds.zMin));
+			uZMax = std::max(uZMax, AsUint(bounds.zMax));
+		}
+	}
+
+	// The clusters of a coarse tile are culled against all lights, and a cluster of a tile is inside the coarse cluster
+	// in the same slice, so tiles only test the lights of the coarse cluster.
+	for (uint z = 0; z < m_cullingData.depthDim; z++)
+	{
+		float fZMin, fZMax;
+		uint* pList = context.coarseLists.data() + z*m_cullingData.lightNum;
+		context.coarseListNum[z] = 0;
+		if (ClipDepthRange(z, uZMin, uZMax, fZMin, fZMax))
+		{
+			CpuFloat4 planes[TilePlaneNum];
+			ComputeTilePlanes(uBeginX, uBeginY, uEndX - uBeginX, uEndY - uBeginY, fZMin, fZMax, planes);
+			context.coarseListNum[z] = CullCoarseCluster(planes, pLights, pList, context);
+		}
+	}
+
+	for (uint y = uBeginY; y < uEndY; y++)
+	{
+		for (uint x = uBeginX; x < uEndX; x++)
+		{
+			CullTile(x, y, true, pLights, context);
+		}
+	}
+}
+
+uint CpuLightCuller::CullCoarseCluster(const CpuFloat4 planes[TilePlaneNum], const PointLight * const pLights, uint * const pList, ThreadContext & context)
+{
+	// A coarse cluster covers all primitives of its tiles, so it is culled as a quad.
+	uint* pLists[TileMaxPrimitiveNum] = { pList };
+	uint listNums[TileMaxPrimitiveNum];
+	if (m_kernel == CpuCullingKernel_Bvh)
+	{
+		context.uPlaneTests += m_lightBvh.Cull(planes, TileSubdivisionQuad, pLists, listNums);
+		return listNums[0];
+	}
+	context.uPlaneTests += (unsigned long long)m_cullingData.lightNum * 6;
+	if (m_kernel == CpuCullingKernel_Simd)
+	{
+		CullLightBlocks(m_lightSoA, planes, TileSubdivisionQuad, pLists, listNums);
+		return listNums[0];
+	}
+	if (m_kernel == CpuCullingKernel_Scalar)
+	{
+		CullLightBlocksScalar(m_lightSoA, planes, TileSubdivisionQuad, pLists, listNums);
+		return listNums[0];
+	}
+	uint uNum = 0;
+	for (uint i = 0; i < m_cullingData.lightNum; i++)
+	{
+		if (!IsLightVisible(i))
+		{
+			continue;
+		}
+		const PointLight& L = pLights[i];
+		CpuFloat4 center = GetViewLightCenter(i, pLights, context.uLightTransforms);
+		bool bInside = true;
+		for (uint j = 0; j < 6; j++)
+		{
+			bInside = bInside && GetSignedDistanceFromPlane(center, planes[j]) < L.radius;
+		}
+		if (bInside)
+		{
+			pList[uNum++] = i;
+		}
+	}
+	return uNum;
+}
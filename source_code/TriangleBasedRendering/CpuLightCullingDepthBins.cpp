@@ -0,0 +1,199 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightCullingDepthBins.cpp
+//
+// The pixels of tiles and the depth bins of clusters (depth bin culling).
+//--------------------------------------------------------------------------------------
+#include "CpuLightCulling.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Flags of the pixels of a tile: bit i marks depth bins of primitive i,
+// and bit PixelCountShift+i means the pixel is shaded with the cluster of primitive i.
+#define PixelCountShift TileMaxPrimitiveNum
+#define PixelBinsMask ((1u << PixelCountShift) - 1)
+
+// Select the primitives of a pixel whose center is (u, v) in a tile, (1, 1) is the bottom-right corner.
+// Primitives are split by the diagonals of a subdivision pattern like the triangles of the light pass.
+// Pixels near a diagonal mark depth bins of both sides, so rounding never loses a pixel of a primitive.
+static inline uint GetPixelFlags(float u, float v, uint uPattern)
+{
+	uint uSides = GetTileSplitSides(u, v, DepthBinDiagonalTolerance);
+	uint uFlags = 1u << (PixelCountShift + GetTilePrimitive(uPattern, u, v));
+	for (uint i = 0; i < TilePatternPrimitiveNum[uPattern]; i++)
+	{
+		uFlags |= (TilePatternSplitPlanes[uPattern*TileMaxPrimitiveNum + i] & ~uSides) == 0 ? 1u << i : 0;
+	}
+	return uFlags;
+}
+
+// The depth bin of a view-space depth, bins split the depth range of a cluster evenly.
+static inline uint GetDepthBin(float fViewZ, float fNearZ, float fInvBinSize)
+{
+	float bin = floorf((fViewZ - fNearZ)*fInvBinSize);
+	return (uint)std::min(std::max(bin, 0.0f), (float)(DepthBinNum - 1));
+}
+
+uint CpuLightCuller::GetLightDepthBins(float fViewZ, float fRadius, const DepthBins& bins)
+{
+	uint uFirst = GetDepthBin(fViewZ - fRadius, bins.fNearZ, bins.fInvBinSize);
+	uint uLast = GetDepthBin(fViewZ + fRadius, bins.fNearZ, bins.fInvBinSize);
+	return (0xffffffff >> (DepthBinNum - 1 - uLast)) & (0xffffffff << uFirst);
+}
+
+void CpuLightCuller::BuildTileDepthBins()
+{
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	if (IsDiagonalSelection())
+	{
+		m_tilePatterns.resize(uTileNum);
+	}
+	else
+	{
+		m_tilePatterns.clear();
+	}
+	m_tileDepthBins.resize(uTileNum*m_cullingData.depthDim);
+
+	// The pixels of a tile are loaded and classified once, and every slice and both passes of culling read the bins.
+	ParallelFor(m_cullingData.heightDim, [&](uint uTileY, uint uThreadIdx)
+	{
+		ThreadContext& context = m_contexts[uThreadIdx];
+		for (uint uTileX = 0; uTileX < m_cullingData.widthDim; uTileX++)
+		{
+			uint uTileIdx = uTileX + uTileY*m_cullingData.widthDim;
+			LoadTileDepth(uTileX, uTileY, context.tileDepth.data());
+			uint uPattern = m_uSubdivision;
+			if (IsDiagonalSelection())
+			{
+				uPattern = SelectTileSubdivision(uTileX, uTileY, context);
+				m_tilePatterns[uTileIdx] = uPattern;
+			}
+			ComputeTilePixels(uTileX, uTileY, uPattern, context);
+
+			const DepthBounds& tileBounds = m_occlusion.depthPyramid.GetTileBounds(uTileX, uTileY);
+			for (uint z = 0; z < m_cullingData.depthDim; z++)
+			{
+				// Slices without pixels of the tile have no bins.
+				DepthBins& bins = m_tileDepthBins[uTileIdx + z*uTileNum];
+				float fZMin, fZMax;
+				if (ClipDepthRange(z, AsUint(tileBounds.zMin), AsUint(tileBounds.zMax), fZMin, fZMax))
+				{
+					ComputeDepthBins(z, fZMin, fZMax, context, bins);
+				}
+				else
+				{
+					memset(&bins, 0, sizeof(DepthBins));
+				}
+			}
+		}
+	});
+}
+
+void CpuLightCuller::ComputeTilePixels(uint uTileX, uint uTileY, uint uPattern, ThreadContext & context) const
+{
+	for (uint i = 0; i < TileSize*TileSize; i++)
+	{
+		float depth = context.tileDepth[i];
+		if (m_bUseDepthBins)
+		{
+			CpuFloat4 projPos = { 0.0f, 0.0f, depth, 1.0f };
+			context.tileViewZ[i] = DivideByW(Mul(projPos, m_viewData.ProjInv)).z;
+		}
+
+		float u, v;
+		bool bInTile = GetTilePixelUv(uTileX, uTileY, i, u, v);
+		context.tilePixelFlags[i] = GetPixelFlags(u, v, uPattern);
+		if (!bInTile)
+		{
+			context.tilePixelFlags[i] &= PixelBinsMask;
+		}
+
+		// The depth slice selected by the light pass (GetDepthSlice).
+		uint uSlice = 0;
+		for (uint z = 1; z < m_cullingData.depthDim && z < m_depthPlanes.size(); z++)
+		{
+			uSlice = depth >= m_depthPlanes[z] ? z : uSlice;
+		}
+		context.tilePixelSlices[i] = uSlice;
+	}
+}
+
+void CpuLightCuller::ComputeDepthBins(uint uSlice, float fZMin, float fZMax, const ThreadContext & context, DepthBins & bins) const
+{
+	CpuFloat4 nearPos = { 0.0f, 0.0f, fZMin, 1.0f };
+	CpuFloat4 farPos = { 0.0f, 0.0f, fZMax, 1.0f };
+	bins.fNearZ = DivideByW(Mul(nearPos, m_viewData.ProjInv)).z;
+	float fFarZ = DivideByW(Mul(farPos, m_viewData.ProjInv)).z;
+	bins.fInvBinSize = fFarZ > bins.fNearZ ? DepthBinNum / (fFarZ - bins.fNearZ) : 0.0f;
+	// Without depth bin culling, all lights overlap the bins.
+	uint uPrimitiveNum = TilePatternPrimitiveNum[m_uSubdivision];
+	for (uint j = 0; j < TileMaxPrimitiveNum; j++)
+	{
+		bins.primitiveBins[j] = m_bUseDepthBins ? 0 : 0xffffffff;
+		bins.primitivePixels[j] = 0;
+	}
+
+	for (uint i = 0; i < TileSize*TileSize; i++)
+	{
+		uint uFlags = context.tilePixelFlags[i];
+		if (context.tilePixelSlices[i] == uSlice)
+		{
+			for (uint j = 0; j < uPrimitiveNum; j++)
+			{
+				bins.primitivePixels[j] += (uFlags >> (PixelCountShift + j)) & 0x1;
+			}
+		}
+		float depth = context.tileDepth[i];
+		if (!m_bUseDepthBins || depth < fZMin || depth > fZMax)
+		{
+			continue;
+		}
+		uint uBin = 1u << GetDepthBin(context.tileViewZ[i], bins.fNearZ, bins.fInvBinSize);
+		for (uint j = 0; j < uPrimitiveNum; j++)
+		{
+			bins.primitiveBins[j] |= (uFlags & (1u << j)) ? uBin : 0;
+		}
+	}
+}
+
+uint CpuLightCuller::FilterListByDepthBins(uint * const pList, uint & uNum, uint uBins, const DepthBins & bins) const
+{
+	const CpuLightBlock* pBlocks = m_lightSoA.GetBlocks();
+	uint uKeepNum = 0;
+	for (uint i = 0; i < uNum; i++)
+	{
+		const CpuLightBlock& block = pBlocks[pList[i] / CpuLightBlockSize];
+		uint uLane = pList[i] % CpuLightBlockSize;
+		if (GetLightDepthBins(block.z[uLane], block.radius[uLane], bins) & uBins)
+		{
+			pList[uKeepNum++] = pList[i];
+		}
+	}
+	uint uRemoved = uNum - uKeepNum;
+	uNum = uKeepNum;
+	return uRemoved;
+}
+
+uint CpuLightCuller::FilterMaskByDepthBins(uint * const pMask, uint uBins, const DepthBins & bins) const
+{
+	const CpuLightBlock* pBlocks = m_lightSoA.GetBlocks();
+	uint uRemoved = 0;
+	for (uint uWord = 0; uWord < m_uMaskWordNum; uWord++)
+	{
+		uint uBits = pMask[uWord];
+		while (uBits)
+		{
+			uint uBit = FirstBitLow(uBits);
+			uBits &= uBits - 1;
+			uint uLightIdx = uWord*CpuLightMaskWordBits + uBit;
+			const CpuLightBlock& block = pBlocks[uLightIdx / CpuLightBlockSize];
+			uint uLane = uLightIdx % CpuLightBlockSize;
+			if ((GetLightDepthBins(block.z[uLane], block.radius[uLane], bins) & uBins) == 0)
+			{
+				pMask[uWord] &= ~(1u << uBit);
+				uRemoved++;
+			}
+		}
+	}
+	return uRemoved;
+}
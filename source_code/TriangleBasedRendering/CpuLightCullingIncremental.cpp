@@ -0,0 +1,345 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightCullingIncremental.cpp
+//
+// Incremental culling, which patches the tables of the last run.
+//--------------------------------------------------------------------------------------
+#include "CpuLightCulling.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+bool CpuLightCuller::IsTileDepthChanged(uint uTileX, uint uTileY) const
+{
+	uint uTileIdx = uTileX + uTileY*m_cullingData.widthDim;
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	const DepthBounds& bounds = m_occlusion.depthPyramid.GetTileBounds(uTileX, uTileY);
+	const DepthBounds& prevBounds = m_incremental.tileBounds[uTileIdx];
+	if (AsUint(bounds.zMin) != AsUint(prevBounds.zMin) || AsUint(bounds.zMax) != AsUint(prevBounds.zMax))
+	{
+		return true;
+	}
+	for (uint z = 0; z < m_cullingData.depthDim; z++)
+	{
+		const ClusterShape& shape = m_clusterShapes[uTileIdx + z*uTileNum];
+		float fZMin, fZMax;
+		bool bValid = ClipDepthRange(z, AsUint(bounds.zMin), AsUint(bounds.zMax), fZMin, fZMax);
+		if (shape.uPattern != GetTilePattern(uTileIdx) || shape.bValid != bValid ||
+			(bValid && memcmp(&m_tileDepthBins[uTileIdx + z*uTileNum], &shape.bins, sizeof(DepthBins)) != 0))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void CpuLightCuller::SetIncremental(bool bIncremental, float fCameraThreshold)
+{
+	m_incremental.bEnabled = bIncremental;
+	m_incremental.fCameraThreshold = fCameraThreshold;
+	Invalidate();
+}
+
+bool CpuLightCuller::CanPatch(const ClusteredData& cullingData, const ViewData& viewData) const
+{
+	if (!m_incremental.bEnabled || !m_incremental.bHistoryValid)
+	{
+		return false;
+	}
+	// The cluster layout must be the same, and bitmasks must have the same number of words.
+	if (cullingData.widthDim != m_cullingData.widthDim || cullingData.heightDim != m_cullingData.heightDim ||
+		cullingData.depthDim != m_cullingData.depthDim || cullingData.tileSizeX != m_cullingData.tileSizeX ||
+		cullingData.tileSizeY != m_cullingData.tileSizeY)
+	{
+		return false;
+	}
+	// Spot and capsule lights are the last lights, and added or removed typed lights move the typed index ranges.
+	if (cullingData.spotLightNum != m_cullingData.spotLightNum || cullingData.capsuleLightNum != m_cullingData.capsuleLightNum ||
+		(m_pShapes != nullptr) != !m_incremental.prevShapes.empty())
+	{
+		return false;
+	}
+	if (m_lightTable == CpuLightTable_Bitmask && GetLightMaskWordNum(cullingData.lightNum) != m_uMaskWordNum)
+	{
+		return false;
+	}
+	// ViewData only has floats.
+	const float* pNew = (const float*)&viewData;
+	const float* pOld = (const float*)&m_viewData;
+	for (uint i = 0; i < sizeof(ViewData) / sizeof(float); i++)
+	{
+		if (!(std::abs(pNew[i] - pOld[i]) <= m_incremental.fCameraThreshold))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CpuLightCuller::PatchTables(const PointLight * const pLights, uint uLightNum)
+{
+	auto begin = std::chrono::high_resolution_clock::now();
+
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	uint uPrimitiveNum = TilePatternPrimitiveNum[m_uSubdivision];
+	uint uPrevLightNum = m_cullingData.lightNum;
+	m_cullingData.lightNum = uLightNum;
+
+	// Lights which were added, removed or edited since the last run, a spot or capsule light is also dirty if its shape
+	// was edited. Added or removed point lights move the typed lights, so the lights of the moved slots are dirty.
+	std::vector<uint> dirtyLights;
+	std::vector<CpuFloat4> dirtyCenters;
+	uint uSpotNum = m_cullingData.spotLightNum;
+	uint uCapsuleNum = m_cullingData.capsuleLightNum;
+	uint uPrevShapeOffset = GetLightTypeOffset(uPrevLightNum, uSpotNum, uCapsuleNum, LightTypeSpot);
+	uint uShapeOffset = GetShapeOffset();
+	for (uint i = 0; i < std::max(uPrevLightNum, uLightNum); i++)
+	{
+		bool bDirty = i >= uPrevLightNum || i >= uLightNum || memcmp(&m_incremental.prevLights[i], &pLights[i], sizeof(PointLight)) != 0;
+		if (!bDirty && m_pShapes)
+		{
+			uint uPrevType = GetLightType(i, uPrevLightNum, uSpotNum, uCapsuleNum);
+			bDirty = uPrevType != GetLightType(i, uLightNum, uSpotNum, uCapsuleNum) ||
+				(uPrevType != LightTypePoint && memcmp(&m_incremental.prevShapes[i - uPrevShapeOffset], &m_pShapes[i - uShapeOffset], sizeof(LightShape)) != 0);
+		}
+		if (bDirty)
+		{
+			dirtyLights.push_back(i);
+			dirtyCenters.push_back(i < uLightNum ? TransformToView(pLights[i].pos, m_viewData.View) : CpuFloat4());
+		}
+	}
+	m_stats.incremental.uDirtyLights = (uint)dirtyLights.size();
+
+	PrepareContexts();
+
+	// Tiles whose depth range or depth bins changed are culled again, the tiles are only compared if the depth buffer changed.
+	// A list over PerClusterMaxLight is resolved by the overflow policy (a clamped list loses lights), so removing a light
+	// can't restore the list, and such tiles with dirty lights are culled again too.
+	uint uDepthTexelNum = m_uDepthWidth*m_uDepthHeight;
+	bool bDepthChanged = memcmp(m_incremental.prevDepth.data(), m_pDepth, uDepthTexelNum*sizeof(float)) != 0;
+	if (bDepthChanged)
+	{
+		// The depth pyramid and the tile depth bins of the new depth.
+		BuildDepthPyramid();
+	}
+	m_incremental.dirtyTiles.assign(uTileNum, 0);
+	ParallelFor(m_cullingData.heightDim, [&](uint y, uint)
+	{
+		for (uint x = 0; x < m_cullingData.widthDim; x++)
+		{
+			uint uTileIdx = x + y*m_cullingData.widthDim;
+			bool bDirty = bDepthChanged && IsTileDepthChanged(x, y);
+			for (uint z = 0; z < m_cullingData.depthDim && !bDirty && !dirtyLights.empty(); z++)
+			{
+				uint uCluster = (uTileIdx + z*uTileNum)*uPrimitiveNum;
+				for (uint p = 0; p < uPrimitiveNum; p++)
+				{
+					bDirty = bDirty || (m_lightTable == CpuLightTable_IndexList && m_lightCounter[uCluster + p] > PerClusterMaxLight);
+				}
+			}
+			m_incremental.dirtyTiles[uTileIdx] = bDirty ? 1 : 0;
+		}
+	});
+	if (bDepthChanged)
+	{
+		m_incremental.prevDepth.assign(m_pDepth, m_pDepth + uDepthTexelNum);
+	}
+	for (uint i = 0; i < uTileNum; i++)
+	{
+		m_stats.incremental.uDirtyTiles += m_incremental.dirtyTiles[i];
+	}
+	if (m_stats.incremental.uDirtyTiles == 0 && dirtyLights.empty())
+	{
+		return false;
+	}
+
+	// New depth or new lights change the occlusion of lights, and lights whose visibility changed are dirty too.
+	std::vector<uint> prevVisibility;
+	prevVisibility.swap(m_occlusion.lightVisibility);
+	TransformLights(pLights);
+	TestLightOcclusion(pLights);
+	ScatterLights(pLights);
+	TransformLightShapes();
+	if (!m_occlusion.lightVisibility.empty() || !prevVisibility.empty())
+	{
+		std::vector<uint> dirtyFlags(uLightNum, 0);
+		for (uint i : dirtyLights)
+		{
+			if (i < uLightNum)
+			{
+				dirtyFlags[i] = 1;
+			}
+		}
+		for (uint i = 0; i < std::min(uPrevLightNum, uLightNum); i++)
+		{
+			bool bPrevVisible = prevVisibility.empty() || (prevVisibility[i / 32] & (1u << (i % 32))) != 0;
+			if (!dirtyFlags[i] && bPrevVisible != IsLightVisible(i))
+			{
+				dirtyLights.push_back(i);
+				dirtyCenters.push_back(TransformToView(pLights[i].pos, m_viewData.View));
+			}
+		}
+	}
+
+	// Tiles culled again use the SoA kernels, and the light buffers may be older than the lights.
+	if (m_stats.incremental.uDirtyTiles > 0 && m_kernel != CpuCullingKernel_Reference)
+	{
+		m_lightSoA.Build(pLights, uLightNum, m_viewData.View, m_occlusion.lightVisibility.empty() ? nullptr : m_occlusion.lightVisibility.data());
+		if (m_kernel == CpuCullingKernel_Bvh && !m_scatter.bEnabled)
+		{
+			m_lightBvh.Build(m_lightSoA, m_pScheduler);
+		}
+		m_stats.dBuildTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+	}
+
+	ParallelFor(m_cullingData.heightDim, [&](uint y, uint uThreadIdx)
+	{
+		ThreadContext& context = m_contexts[uThreadIdx];
+		for (uint x = 0; x < m_cullingData.widthDim; x++)
+		{
+			uint uTileIdx = x + y*m_cullingData.widthDim;
+			if (m_incremental.dirtyTiles[uTileIdx])
+			{
+				ResetTileClusters(uTileIdx);
+				CullTile(x, y, false, pLights, context);
+			}
+			else if (!dirtyLights.empty())
+			{
+				PatchTile(uTileIdx, dirtyLights, dirtyCenters, pLights, context);
+			}
+		}
+	});
+	return true;
+}
+
+void CpuLightCuller::PatchTile(uint uTileIdx, const std::vector<uint>& dirtyLights, const std::vector<CpuFloat4>& dirtyCenters,
+	const PointLight * const pLights, ThreadContext & context)
+{
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	uint uPrimitiveNum = TilePatternPrimitiveNum[m_uSubdivision];
+	for (uint z = 0; z < m_cullingData.depthDim; z++)
+	{
+		// Empty clusters have no pixels, so they never get lights.
+		const ClusterShape& shape = m_clusterShapes[uTileIdx + z*uTileNum];
+		if (!shape.bValid)
+		{
+			continue;
+		}
+		uint uCluster = (uTileIdx + z*uTileNum)*uPrimitiveNum;
+		context.uPlaneTests += (unsigned long long)dirtyLights.size()*GetTilePatternPlaneNum(shape.uPattern);
+		for (uint k = 0; k < dirtyLights.size(); k++)
+		{
+			uint i = dirtyLights[k];
+			for (uint p = 0; p < uPrimitiveNum; p++)
+			{
+				RemoveLight(uCluster + p, i);
+			}
+			if (i >= m_cullingData.lightNum || !IsLightVisible(i) || (!m_scatter.tileLightOffsets.empty() && !IsLightInTileBin(uTileIdx, i)))
+			{
+				continue;
+			}
+			uint uTileRemoved, uBinRemoved, uShapeRemoved;
+			uint uMask = TestLightPrimitives(i, dirtyCenters[k], pLights[i].radius, shape, uTileRemoved, uBinRemoved, uShapeRemoved);
+			for (uint p = 0; p < uPrimitiveNum; p++)
+			{
+				if (uMask & (1u << p))
+				{
+					AppendLight(uCluster + p, i);
+				}
+			}
+		}
+		for (uint p = 0; p < uPrimitiveNum; p++)
+		{
+			// Light lists are sets, and only lists with spot or capsule lights need their typed order.
+			if (m_lightTable == CpuLightTable_IndexList && m_cullingData.spotLightNum + m_cullingData.capsuleLightNum > 0)
+			{
+				SortList(uCluster + p);
+			}
+			if (m_lightTable == CpuLightTable_IndexList && m_lightCounter[uCluster + p] > PerClusterMaxLight)
+			{
+				ResolveOverflow(uCluster + p, shape, pLights, context);
+			}
+		}
+	}
+}
+
+void CpuLightCuller::ResetTileClusters(uint uTileIdx)
+{
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	uint uPrimitiveNum = TilePatternPrimitiveNum[m_uSubdivision];
+	for (uint z = 0; z < m_cullingData.depthDim; z++)
+	{
+		uint uCluster = (uTileIdx + z*uTileNum)*uPrimitiveNum;
+		for (uint p = 0; p < uPrimitiveNum; p++)
+		{
+			m_lightCounter[uCluster + p] = 0;
+			m_clusterPixels[uCluster + p] = 0;
+			if (m_lightTable == CpuLightTable_Bitmask)
+			{
+				std::fill_n(m_lightMasks.begin() + (uCluster + p)*m_uMaskWordNum, m_uMaskWordNum, 0u);
+			}
+			else
+			{
+				memset(&m_clusteredBuffer[uCluster + p], 0, sizeof(ClusteredBuffer));
+				m_overflow.clusters[uCluster + p].lights.clear();
+				m_overflow.clusters[uCluster + p].halves.clear();
+			}
+		}
+	}
+}
+
+void CpuLightCuller::RemoveLight(uint uCluster, uint uLightIdx)
+{
+	if (m_lightTable == CpuLightTable_Bitmask)
+	{
+		uint& uWord = m_lightMasks[uCluster*m_uMaskWordNum + uLightIdx / CpuLightMaskWordBits];
+		uint uBit = 1u << (uLightIdx % CpuLightMaskWordBits);
+		if (uWord & uBit)
+		{
+			uWord &= ~uBit;
+			m_lightCounter[uCluster]--;
+		}
+		return;
+	}
+	// The last light of the list takes the place of the removed light, lists are sets like the GPU lists.
+	// Lists are only patched before their overflow is resolved, and resolved lists are culled again in the next run.
+	uint* pList = m_clusteredBuffer[uCluster].lightIdxs;
+	std::vector<uint>& overflowLights = m_overflow.clusters[uCluster].lights;
+	uint uNum = std::min((uint)m_lightCounter[uCluster], (uint)PerClusterMaxLight);
+	for (uint i = 0; i < uNum; i++)
+	{
+		if (pList[i] == uLightIdx)
+		{
+			if (overflowLights.empty())
+			{
+				pList[i] = pList[uNum - 1];
+				pList[uNum - 1] = 0;
+			}
+			else
+			{
+				pList[i] = overflowLights.back();
+				overflowLights.pop_back();
+			}
+			m_lightCounter[uCluster]--;
+			return;
+		}
+	}
+	auto it = std::find(overflowLights.begin(), overflowLights.end(), uLightIdx);
+	if (it != overflowLights.end())
+	{
+		*it = overflowLights.back();
+		overflowLights.pop_back();
+		m_lightCounter[uCluster]--;
+	}
+}
+
+void CpuLightCuller::SortList(uint uCluster)
+{
+	uint* pList = m_clusteredBuffer[uCluster].lightIdxs;
+	std::vector<uint>& overflowLights = m_overflow.clusters[uCluster].lights;
+	uint uStoreNum = std::min((uint)m_lightCounter[uCluster], (uint)PerClusterMaxLight);
+	std::vector<uint> lights(pList, pList + uStoreNum);
+	lights.insert(lights.end(), overflowLights.begin(), overflowLights.end());
+	std::sort(lights.begin(), lights.end());
+	std::copy(lights.begin(), lights.begin() + uStoreNum, pList);
+	std::copy(lights.begin() + uStoreNum, lights.end(), overflowLights.begin());
+}
@@ -0,0 +1,149 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightCullingOverflow.cpp
+//
+// Lists over PerClusterMaxLight (LightOverflow*), and the packed light indexes of LightListScanCS.
+//--------------------------------------------------------------------------------------
+#include "CpuLightCulling.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+
+// The importance bucket of a light (LightOverflowClamp), a bucket is a quarter of a power of 2 of radius over distance.
+static inline uint GetLightImportanceBucket(float fRadius, float fDistance)
+{
+	float importance = floorf(log2f(std::max(fRadius, 1e-6f) / std::max(fDistance, 1e-6f)) * 4.0f) + LightImportanceBucketNum / 2;
+	return (uint)std::min(std::max(importance, 0.0f), (float)(LightImportanceBucketNum - 1));
+}
+
+void CpuLightCuller::ResolveOverflow(uint uCluster, const ClusterShape & shape, const PointLight * const pLights, ThreadContext & context)
+{
+	ClusterOverflow& overflow = m_overflow.clusters[uCluster];
+	uint* pList = m_clusteredBuffer[uCluster].lightIdxs;
+	uint uNum = (uint)m_lightCounter[uCluster];
+	auto getLight = [&](uint k) { return k < PerClusterMaxLight ? pList[k] : overflow.lights[k - PerClusterMaxLight]; };
+	if (m_overflow.uPolicy == LightOverflowClamp)
+	{
+		// Keep the lights of the highest buckets, the stable sort keeps the first lights of the last kept bucket.
+		std::vector<uint> lights(uNum);
+		std::vector<uint> buckets(uNum);
+		for (uint k = 0; k < uNum; k++)
+		{
+			lights[k] = getLight(k);
+			CpuFloat4 d = Sub3(GetViewLightCenter(lights[k], pLights, context.uLightTransforms), shape.bounds.center);
+			buckets[k] = GetLightImportanceBucket(pLights[lights[k]].radius, sqrtf(Dot3(d, d)));
+		}
+		std::vector<uint> order(uNum);
+		std::iota(order.begin(), order.end(), 0u);
+		std::stable_sort(order.begin(), order.end(), [&](uint a, uint b) { return buckets[a] > buckets[b]; });
+		for (uint k = 0; k < PerClusterMaxLight; k++)
+		{
+			pList[k] = lights[order[k]];
+		}
+		// The kept lights are sorted again, so the lights of every type are contiguous.
+		std::sort(pList, pList + PerClusterMaxLight);
+		overflow.lights.clear();
+	}
+	else if (m_overflow.uPolicy == LightOverflowSplit)
+	{
+		// The split depth between the near and the far half of the depth bins, flat clusters only have near lights.
+		overflow.fSplitZ = FLT_MAX;
+		if (shape.bins.fInvBinSize > 0.0f)
+		{
+			CpuFloat4 splitPos = { 0.0f, 0.0f, shape.bins.fNearZ + DepthBinNum / 2 / shape.bins.fInvBinSize, 1.0f };
+			overflow.fSplitZ = DivideByW(Mul(splitPos, m_viewData.Proj)).z;
+		}
+		overflow.halves.resize(uNum);
+		for (uint k = 0; k < uNum; k++)
+		{
+			const PointLight& L = pLights[getLight(k)];
+			CpuFloat4 center = GetViewLightCenter(getLight(k), pLights, context.uLightTransforms);
+			uint uBins = GetLightDepthBins(center.z, L.radius, shape.bins);
+			overflow.halves[k] = ((uBins & SplitNearBins) ? 0x1 : 0) | ((uBins & SplitFarBins) ? 0x2 : 0);
+		}
+	}
+}
+
+uint CpuLightCuller::GetListSize(uint uCounter) const
+{
+	if (uCounter > PerClusterMaxLight && m_overflow.uPolicy == LightOverflowClamp)
+	{
+		return PerClusterMaxLight;
+	}
+	else if (uCounter > PerClusterMaxLight && m_overflow.uPolicy == LightOverflowSplit)
+	{
+		return ClusteredSplitHeaderSize + uCounter * 2;
+	}
+	return uCounter;
+}
+
+void CpuLightCuller::PackLists()
+{
+	// The CPU knows the slots of all lists before packing, so the packed light indexes grow before any list is truncated.
+	// The GPU grows the buffer from a readback of the statistics, so a frame may truncate lists until the buffer grows.
+	uint uClusterNum = (uint)m_lightCounter.size();
+	uint uRequired = 0;
+	for (uint i = 0; i < uClusterNum; i++)
+	{
+		uRequired += GetLightListStride(GetListSize((uint)m_lightCounter[i]));
+	}
+	m_stats.overflow.requiredIndexes = uRequired;
+	m_overflow.uPackedCapacity = ::GetPackedIndexCapacity(m_overflow.uPackedCapacity, uRequired, uClusterNum);
+	uint uCapacity = m_overflow.uPackedCapacity;
+	m_lightLists.resize(uClusterNum);
+	m_packedIndexes.assign(GetLightIndexWordNum(uCapacity), 0);
+
+	uint uOffset = 0;
+	for (uint i = 0; i < uClusterNum; i++)
+	{
+		uint uCounter = (uint)m_lightCounter[i];
+		uint uSize = GetListSize(uCounter);
+		ClusteredList& list = m_lightLists[i];
+		list.offset = std::min(uOffset, uCapacity);
+		list.lightNum = std::min(uSize, uCapacity - list.offset);
+		uOffset += GetLightListStride(uSize);
+
+		const uint* pList = m_clusteredBuffer[i].lightIdxs;
+		const ClusterOverflow& overflow = m_overflow.clusters[i];
+		uint* pDst = m_packedIndexes.data();
+		bool bSplit = m_overflow.uPolicy == LightOverflowSplit && uCounter > PerClusterMaxLight && list.lightNum == uSize;
+		if (bSplit)
+		{
+			// Near lights follow the header, and far lights end at the end of the list.
+			uint uNearNum = 0;
+			uint uFarNum = 0;
+			for (uint k = 0; k < uCounter; k++)
+			{
+				uint uLightIdx = k < PerClusterMaxLight ? pList[k] : overflow.lights[k - PerClusterMaxLight];
+				if (overflow.halves[k] & 0x1)
+				{
+					StoreLightIndex(pDst, list.offset + ClusteredSplitHeaderSize + uNearNum++, uLightIdx);
+				}
+				if (overflow.halves[k] & 0x2)
+				{
+					StoreLightIndex(pDst, list.offset + uSize - 1 - uFarNum++, uLightIdx);
+				}
+			}
+			StoreSplitListHeader(pDst, list.offset, overflow.fSplitZ, uNearNum, uFarNum);
+			list.lightNum |= ClusteredListSplitBit;
+			m_stats.overflow.splitClusters++;
+		}
+		else
+		{
+			// Spilled lights follow the light indexed buffer, and a split list which doesn't fit falls back to a spilled list.
+			list.lightNum = std::min(list.lightNum, uCounter);
+			uint uStoreNum = std::min(list.lightNum, (uint)PerClusterMaxLight);
+			PackLightIndexes(pList, uStoreNum, pDst, list.offset);
+			PackLightIndexes(overflow.lights.data(), list.lightNum - uStoreNum, pDst, list.offset + uStoreNum);
+		}
+
+		uint uStored = bSplit ? uCounter : list.lightNum;
+		m_stats.overflow.maxClusterLights = std::max(m_stats.overflow.maxClusterLights, uCounter);
+		m_stats.overflow.droppedLights += uCounter - uStored;
+		m_stats.overflow.spilledLights += uStored > PerClusterMaxLight ? uStored - PerClusterMaxLight : 0;
+		if ((list.lightNum & ~ClusteredListSplitBit) < uSize)
+		{
+			m_stats.overflow.truncatedClusters++;
+		}
+	}
+}
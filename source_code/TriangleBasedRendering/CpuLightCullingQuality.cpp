@@ -0,0 +1,496 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightCullingQuality.cpp
+//
+// Measurements of the lists of a run against the lights which reach every pixel, and comparisons of lists.
+//--------------------------------------------------------------------------------------
+#include "CpuLightCulling.h"
+#include <algorithm>
+#include <cstring>
+
+uint CpuLightCuller::GetPixelCluster(uint uPixelX, uint uPixelY, uint & uTileIdx, CpuFloat4 & pos) const
+{
+	// Pixels are shaded by the tile mesh, so a pixel belongs to the tile containing its center.
+	float fTileX = ((float)uPixelX + 0.5f) / m_cullingData.tileSizeX;
+	float fTileY = ((float)uPixelY + 0.5f) / m_cullingData.tileSizeY;
+	uint uTileX = std::min((uint)fTileX, m_cullingData.widthDim - 1);
+	uint uTileY = std::min((uint)fTileY, m_cullingData.heightDim - 1);
+	uTileIdx = uTileX + uTileY*m_cullingData.widthDim;
+	float depth = m_pDepth[uPixelX + uPixelY*m_uDepthWidth];
+	uint uSlice = 0;
+	for (uint z = 1; z < m_cullingData.depthDim && z < m_depthPlanes.size(); z++)
+	{
+		uSlice = depth >= m_depthPlanes[z] ? z : uSlice;
+	}
+
+	// The view-space position of the pixel.
+	CpuFloat4 projPos = { ((float)uPixelX + 0.5f) / m_uDepthWidth*2.0f - 1.0f, 1.0f - ((float)uPixelY + 0.5f) / m_uDepthHeight*2.0f, depth, 1.0f };
+	pos = DivideByW(Mul(projPos, m_viewData.ProjInv));
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	return (uTileIdx + uSlice*uTileNum)*TilePatternPrimitiveNum[m_uSubdivision] +
+		GetTilePrimitive(GetTilePattern(uTileIdx), fTileX - (float)uTileX, fTileY - (float)uTileY);
+}
+
+void CpuLightCuller::CountFalsePositives(const PointLight * const pLights, CpuFalsePositiveStats & stats) const
+{
+	uint uTileNum = m_cullingData.widthDim*m_cullingData.heightDim;
+	stats.uLightPixelPairs = 0;
+	stats.uFalsePositivePairs = 0;
+	stats.tileFalsePositives.assign(uTileNum, 0);
+
+	std::vector<CpuFloat4> centers(m_cullingData.lightNum);
+	for (uint i = 0; i < m_cullingData.lightNum; i++)
+	{
+		centers[i] = TransformToView(pLights[i].pos, m_viewData.View);
+	}
+
+	// Rows of tiles write their own tiles, so they run on any thread.
+	std::vector<unsigned long long> rowPairs(m_cullingData.heightDim, 0);
+	std::vector<unsigned long long> rowFalsePositives(m_cullingData.heightDim, 0);
+	auto countRow = [&](uint uTileY, uint)
+	{
+		for (uint py = 0; py < m_uDepthHeight; py++)
+		{
+			float fTileY = ((float)py + 0.5f) / m_cullingData.tileSizeY;
+			if (std::min((uint)fTileY, m_cullingData.heightDim - 1) != uTileY)
+			{
+				continue;
+			}
+			for (uint px = 0; px < m_uDepthWidth; px++)
+			{
+				uint uTileIdx;
+				CpuFloat4 pos;
+				uint uCluster = GetPixelCluster(px, py, uTileIdx, pos);
+				uint uFalsePositives = 0;
+				auto testLight = [&](uint uLightIdx)
+				{
+					uFalsePositives += IsLightReachingPixel(uLightIdx, centers.data(), pLights, pos) ? 0 : 1;
+					rowPairs[uTileY]++;
+				};
+				if (m_lightTable == CpuLightTable_Bitmask)
+				{
+					const uint* pMask = m_lightMasks.data() + uCluster*m_uMaskWordNum;
+					for (uint uWord = 0; uWord < m_uMaskWordNum; uWord++)
+					{
+						for (uint uBits = pMask[uWord]; uBits; uBits &= uBits - 1)
+						{
+							testLight(uWord*CpuLightMaskWordBits + FirstBitLow(uBits));
+						}
+					}
+				}
+				else
+				{
+					ClusteredList list = m_lightLists[uCluster];
+					if (list.lightNum & ClusteredListSplitBit)
+					{
+						float fSplitZ;
+						uint uNearNum, uFarNum;
+						LoadSplitListHeader(m_packedIndexes.data(), list.offset, fSplitZ, uNearNum, uFarNum);
+						list = GetSplitLightList(list, m_pDepth[px + py*m_uDepthWidth], fSplitZ, uNearNum, uFarNum);
+					}
+					for (uint i = 0; i < list.lightNum; i++)
+					{
+						testLight(LoadLightIndex(m_packedIndexes.data(), list.offset + i));
+					}
+				}
+				stats.tileFalsePositives[uTileIdx] += uFalsePositives;
+				rowFalsePositives[uTileY] += uFalsePositives;
+			}
+		}
+	};
+	if (m_pScheduler)
+	{
+		m_pScheduler->ParallelFor(m_cullingData.heightDim, countRow);
+	}
+	else
+	{
+		for (uint y = 0; y < m_cullingData.heightDim; y++)
+		{
+			countRow(y, 0);
+		}
+	}
+	for (uint y = 0; y < m_cullingData.heightDim; y++)
+	{
+		stats.uLightPixelPairs += rowPairs[y];
+		stats.uFalsePositivePairs += rowFalsePositives[y];
+	}
+}
+
+void CpuLightCuller::MeasureQuality(const PointLight * const pLights, uint uWaveWidth, uint uWaveHeight, CpuCullingQuality & quality,
+	const ClusteredList * const pLists, const uint * const pIndexes) const
+{
+	memset(&quality, 0, sizeof(quality));
+	const ClusteredList* pClusterLists = pLists ? pLists : m_lightLists.data();
+	const uint* pWords = pIndexes ? pIndexes : m_packedIndexes.data();
+	uint uClusterNum = GetClusterNum();
+	uint uPrimitiveNum = TilePatternPrimitiveNum[m_uSubdivision];
+	uWaveWidth = std::max(uWaveWidth, 1u);
+	uWaveHeight = std::max(uWaveHeight, 1u);
+	uint uWaveNumX = (uint)ceilf(m_cullingData.tileSizeX / uWaveWidth);
+	uint uWaveNumY = (uint)ceilf(m_cullingData.tileSizeY / uWaveHeight);
+
+	std::vector<CpuFloat4> centers(m_cullingData.lightNum);
+	for (uint i = 0; i < m_cullingData.lightNum; i++)
+	{
+		centers[i] = TransformToView(pLights[i].pos, m_viewData.View);
+	}
+
+	// A slot of the lists is reached if its light reaches a pixel of its cluster. Every slot and every cluster belongs
+	// to one tile, so rows of tiles write their own slots and clusters.
+	uint uSlotNum = 0;
+	for (uint i = 0; i < uClusterNum; i++)
+	{
+		uSlotNum = std::max(uSlotNum, pClusterLists[i].offset + (pClusterLists[i].lightNum & ~ClusteredListSplitBit));
+	}
+	std::vector<unsigned char> slotReached(uSlotNum, 0);
+	std::vector<uint> clusterPixels(uClusterNum, 0);
+
+	// A pixel of a wave, its light loops are the ranges of light types in its list.
+	struct Lane
+	{
+		CpuFloat4 pos;
+		ClusteredList list;
+		uint typeBegin[LightTypeNum];
+		uint typeNum[LightTypeNum];
+	};
+	std::vector<CpuCullingQuality> rowQualities(m_cullingData.heightDim);
+	auto measureRow = [&](uint uTileY, uint)
+	{
+		CpuCullingQuality& rowQuality = rowQualities[uTileY];
+		memset(&rowQuality, 0, sizeof(rowQuality));
+		std::vector<std::vector<Lane>> waves(m_cullingData.widthDim*uWaveNumX*uWaveNumY*uPrimitiveNum);
+		for (uint py = 0; py < m_uDepthHeight; py++)
+		{
+			float fTileY = ((float)py + 0.5f) / m_cullingData.tileSizeY;
+			if (std::min((uint)fTileY, m_cullingData.heightDim - 1) != uTileY)
+			{
+				continue;
+			}
+			for (uint px = 0; px < m_uDepthWidth; px++)
+			{
+				uint uTileIdx;
+				Lane lane;
+				uint uCluster = GetPixelCluster(px, py, uTileIdx, lane.pos);
+				clusterPixels[uCluster]++;
+				lane.list = pClusterLists[uCluster];
+				if (lane.list.lightNum & ClusteredListSplitBit)
+				{
+					float fSplitZ;
+					uint uNearNum, uFarNum;
+					LoadSplitListHeader(pWords, lane.list.offset, fSplitZ, uNearNum, uFarNum);
+					lane.list = GetSplitLightList(lane.list, m_pDepth[px + py*m_uDepthWidth], fSplitZ, uNearNum, uFarNum);
+				}
+				// The lights of every type are contiguous in a list.
+				for (uint t = 0; t < LightTypeNum; t++)
+				{
+					lane.typeBegin[t] = 0;
+					lane.typeNum[t] = 0;
+				}
+				for (uint i = 0; i < lane.list.lightNum; i++)
+				{
+					uint uType = GetLightType(LoadLightIndex(pWords, lane.list.offset + i), m_cullingData.lightNum,
+						m_cullingData.spotLightNum, m_cullingData.capsuleLightNum);
+					lane.typeBegin[uType] = lane.typeNum[uType] == 0 ? i : lane.typeBegin[uType];
+					lane.typeNum[uType]++;
+				}
+				rowQuality.pixelLengths[GetListLengthBucket(lane.list.lightNum)]++;
+
+				// Waves don't cross the primitives of a tile, every primitive is drawn by its own triangles.
+				uint uTileX = uTileIdx % m_cullingData.widthDim;
+				uint uWaveX = std::min((uint)((float)px - uTileX*m_cullingData.tileSizeX) / uWaveWidth, uWaveNumX - 1);
+				uint uWaveY = std::min((uint)((float)py - uTileY*m_cullingData.tileSizeY) / uWaveHeight, uWaveNumY - 1);
+				uint uWave = ((uTileX*uWaveNumY + uWaveY)*uWaveNumX + uWaveX)*uPrimitiveNum + uCluster % uPrimitiveNum;
+				waves[uWave].push_back(lane);
+			}
+		}
+
+		for (const std::vector<Lane>& lanes : waves)
+		{
+			if (lanes.empty())
+			{
+				continue;
+			}
+			rowQuality.uWaveNum++;
+			for (uint t = 0; t < LightTypeNum; t++)
+			{
+				uint uIterationNum = 0;
+				for (const Lane& lane : lanes)
+				{
+					uIterationNum = std::max(uIterationNum, lane.typeNum[t]);
+				}
+				for (uint i = 0; i < uIterationNum; i++)
+				{
+					uint uReached = 0;
+					for (const Lane& lane : lanes)
+					{
+						if (i >= lane.typeNum[t])
+						{
+							continue;
+						}
+						uint uSlot = lane.list.offset + lane.typeBegin[t] + i;
+						bool bReach = IsLightReachingPixel(LoadLightIndex(pWords, uSlot), centers.data(), pLights, lane.pos);
+						slotReached[uSlot] |= bReach ? 1 : 0;
+						uReached += bReach ? 1 : 0;
+						rowQuality.uFalsePositivePairs += bReach ? 0 : 1;
+						rowQuality.uLightPixelPairs++;
+					}
+					if (uReached > 0)
+					{
+						rowQuality.uGgxLanes += lanes.size();
+						rowQuality.uWastedGgxLanes += lanes.size() - uReached;
+					}
+				}
+			}
+		}
+	};
+	if (m_pScheduler)
+	{
+		m_pScheduler->ParallelFor(m_cullingData.heightDim, measureRow);
+	}
+	else
+	{
+		for (uint y = 0; y < m_cullingData.heightDim; y++)
+		{
+			measureRow(y, 0);
+		}
+	}
+	for (const CpuCullingQuality& rowQuality : rowQualities)
+	{
+		for (uint b = 0; b < CpuListLengthBucketNum; b++)
+		{
+			quality.pixelLengths[b] += rowQuality.pixelLengths[b];
+		}
+		quality.uLightPixelPairs += rowQuality.uLightPixelPairs;
+		quality.uFalsePositivePairs += rowQuality.uFalsePositivePairs;
+		quality.uWaveNum += rowQuality.uWaveNum;
+		quality.uGgxLanes += rowQuality.uGgxLanes;
+		quality.uWastedGgxLanes += rowQuality.uWastedGgxLanes;
+	}
+
+	// A light in both lists of a split list is a light of the cluster once, and it is covered if either slot is reached.
+	std::vector<uint> clusterSlots;
+	for (uint uCluster = 0; uCluster < uClusterNum; uCluster++)
+	{
+		if (clusterPixels[uCluster] == 0)
+		{
+			continue;
+		}
+		clusterSlots.clear();
+		auto addSlots = [&](uint uBegin, uint uNum)
+		{
+			for (uint uSlot = uBegin; uSlot < uBegin + uNum; uSlot++)
+			{
+				clusterSlots.push_back(LoadLightIndex(pWords, uSlot) << 1 | slotReached[uSlot]);
+			}
+		};
+		ClusteredList list = pClusterLists[uCluster];
+		if (list.lightNum & ClusteredListSplitBit)
+		{
+			float fSplitZ;
+			uint uNearNum, uFarNum;
+			LoadSplitListHeader(pWords, list.offset, fSplitZ, uNearNum, uFarNum);
+			addSlots(list.offset + ClusteredSplitHeaderSize, uNearNum);
+			addSlots(list.offset + (list.lightNum & ~ClusteredListSplitBit) - uFarNum, uFarNum);
+		}
+		else
+		{
+			addSlots(list.offset, list.lightNum);
+		}
+		// A reached slot of a light is sorted after the other slots of the light.
+		std::sort(clusterSlots.begin(), clusterSlots.end());
+		uint uLights = 0;
+		uint uCovered = 0;
+		for (size_t i = 0; i < clusterSlots.size(); i++)
+		{
+			if (i + 1 == clusterSlots.size() || (clusterSlots[i + 1] >> 1) != (clusterSlots[i] >> 1))
+			{
+				uLights++;
+				uCovered += clusterSlots[i] & 1;
+			}
+		}
+		quality.uClusterNum++;
+		quality.uClusterLights += uLights;
+		quality.uCoveredLights += uCovered;
+		quality.clusterLengths[GetListLengthBucket(uLights)]++;
+		quality.coveredLengths[GetListLengthBucket(uCovered)]++;
+	}
+}
+
+uint CpuLightCuller::CountMismatchedClusters(const ClusteredBuffer * const pBufferA, const int * const pCounterA,
+	const ClusteredBuffer * const pBufferB, const int * const pCounterB, uint uClusterNum)
+{
+	uint uMismatch = 0;
+	std::vector<uint> listA, listB;
+	for (uint i = 0; i < uClusterNum; i++)
+	{
+		if (pCounterA[i] != pCounterB[i])
+		{
+			uMismatch++;
+			continue;
+		}
+		// Only the first PerClusterMaxLight indexes are valid.
+		uint uNum = std::min(pCounterA[i], PerClusterMaxLight);
+		listA.assign(pBufferA[i].lightIdxs, pBufferA[i].lightIdxs + uNum);
+		listB.assign(pBufferB[i].lightIdxs, pBufferB[i].lightIdxs + uNum);
+		std::sort(listA.begin(), listA.end());
+		std::sort(listB.begin(), listB.end());
+		if (listA != listB)
+		{
+			uMismatch++;
+		}
+	}
+	return uMismatch;
+}
+
+uint CpuLightCuller::CountUncoveredClusters(const ClusteredBuffer * const pBufferA, const int * const pCounterA,
+	const ClusteredBuffer * const pBufferB, const int * const pCounterB, uint uClusterNum)
+{
+	uint uUncovered = 0;
+	std::vector<uint> listA, listB;
+	for (uint i = 0; i < uClusterNum; i++)
+	{
+		if (pCounterA[i] > PerClusterMaxLight || pCounterB[i] > PerClusterMaxLight)
+		{
+			continue;
+		}
+		listA.assign(pBufferA[i].lightIdxs, pBufferA[i].lightIdxs + pCounterA[i]);
+		listB.assign(pBufferB[i].lightIdxs, pBufferB[i].lightIdxs + pCounterB[i]);
+		std::sort(listA.begin(), listA.end());
+		std::sort(listB.begin(), listB.end());
+		if (!std::includes(listA.begin(), listA.end(), listB.begin(), listB.end()))
+		{
+			uUncovered++;
+		}
+	}
+	return uUncovered;
+}
+
+uint CpuLightCuller::CountMismatchedPackedClusters(const ClusteredList * const pListA, const uint * const pIndexA,
+	const ClusteredList * const pListB, const uint * const pIndexB, uint uClusterNum)
+{
+	// A split list is compared as the near number, then the near and the far list as sets (the split depth is skipped).
+	auto loadList = [](const ClusteredList& list, const uint* const pIndex, std::vector<uint>& lights)
+	{
+		if (list.lightNum & ClusteredListSplitBit)
+		{
+			uint uSize = list.lightNum & ~ClusteredListSplitBit;
+			float fSplitZ;
+			uint uNearNum, uFarNum;
+			LoadSplitListHeader(pIndex, list.offset, fSplitZ, uNearNum, uFarNum);
+			lights.resize(1 + uNearNum + uFarNum);
+			lights[0] = uNearNum;
+			UnpackLightIndexes(pIndex, list.offset + ClusteredSplitHeaderSize, uNearNum, lights.data() + 1);
+			UnpackLightIndexes(pIndex, list.offset + uSize - uFarNum, uFarNum, lights.data() + 1 + uNearNum);
+			std::sort(lights.begin() + 1, lights.begin() + 1 + uNearNum);
+			std::sort(lights.begin() + 1 + uNearNum, lights.end());
+			return;
+		}
+		lights.resize(list.lightNum);
+		UnpackLightIndexes(pIndex, list.offset, list.lightNum, lights.data());
+		std::sort(lights.begin(), lights.end());
+	};
+	uint uMismatch = 0;
+	std::vector<uint> listA, listB;
+	for (uint i = 0; i < uClusterNum; i++)
+	{
+		if (pListA[i].lightNum != pListB[i].lightNum)
+		{
+			uMismatch++;
+			continue;
+		}
+		loadList(pListA[i], pIndexA, listA);
+		loadList(pListB[i], pIndexB, listB);
+		if (listA != listB)
+		{
+			uMismatch++;
+		}
+	}
+	return uMismatch;
+}
+
+unsigned long long CpuLightCuller::CountMissedPairs(const PointLight * const pLights, uint uPixelStep) const
+{
+	uPixelStep = std::max(uPixelStep, 1u);
+	std::vector<CpuFloat4> centers(m_cullingData.lightNum);
+	for (uint i = 0; i < m_cullingData.lightNum; i++)
+	{
+		centers[i] = TransformToView(pLights[i].pos, m_viewData.View);
+	}
+
+	// Rows of pixels are counted on any thread, and every thread marks the lights of a pixel in its own flags.
+	uint uRowNum = (m_uDepthHeight + uPixelStep - 1) / uPixelStep;
+	std::vector<unsigned long long> rowMissed(uRowNum, 0);
+	std::vector<std::vector<unsigned char>> threadFlags(m_pScheduler ? m_pScheduler->GetThreadNum() : 1);
+	auto countRow = [&](uint uRow, uint uThreadIdx)
+	{
+		std::vector<unsigned char>& listed = threadFlags[uThreadIdx];
+		listed.assign(m_cullingData.lightNum, 0);
+		std::vector<uint> lights;
+		uint py = uRow*uPixelStep;
+		for (uint px = 0; px < m_uDepthWidth; px += uPixelStep)
+		{
+			uint uTileIdx;
+			CpuFloat4 pos;
+			uint uCluster = GetPixelCluster(px, py, uTileIdx, pos);
+			lights.clear();
+			if (m_lightTable == CpuLightTable_Bitmask)
+			{
+				const uint* pMask = m_lightMasks.data() + uCluster*m_uMaskWordNum;
+				for (uint uWord = 0; uWord < m_uMaskWordNum; uWord++)
+				{
+					for (uint uBits = pMask[uWord]; uBits; uBits &= uBits - 1)
+					{
+						lights.push_back(uWord*CpuLightMaskWordBits + FirstBitLow(uBits));
+					}
+				}
+			}
+			else
+			{
+				ClusteredList list = m_lightLists[uCluster];
+				if (list.lightNum & ClusteredListSplitBit)
+				{
+					float fSplitZ;
+					uint uNearNum, uFarNum;
+					LoadSplitListHeader(m_packedIndexes.data(), list.offset, fSplitZ, uNearNum, uFarNum);
+					list = GetSplitLightList(list, m_pDepth[px + py*m_uDepthWidth], fSplitZ, uNearNum, uFarNum);
+				}
+				else if ((uint)m_lightCounter[uCluster] > list.lightNum)
+				{
+					// Clamped or truncated lists drop lights on purpose.
+					continue;
+				}
+				lights.resize(list.lightNum);
+				UnpackLightIndexes(m_packedIndexes.data(), list.offset, list.lightNum, lights.data());
+			}
+
+			for (uint uLightIdx : lights)
+			{
+				listed[uLightIdx] = 1;
+			}
+			for (uint i = 0; i < m_cullingData.lightNum; i++)
+			{
+				rowMissed[uRow] += !listed[i] && IsLightReachingPixel(i, centers.data(), pLights, pos) ? 1 : 0;
+			}
+			for (uint uLightIdx : lights)
+			{
+				listed[uLightIdx] = 0;
+			}
+		}
+	};
+	if (m_pScheduler)
+	{
+		m_pScheduler->ParallelFor(uRowNum, countRow);
+	}
+	else
+	{
+		for (uint uRow = 0; uRow < uRowNum; uRow++)
+		{
+			countRow(uRow, 0);
+		}
+	}
+	unsigned long long uMissed = 0;
+	for (unsigned long long uRowMissed : rowMissed)
+	{
+		uMissed += uRowMissed;
+	}
+	return uMissed;
+}
@@ -0,0 +1,108 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightIndex.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuLightIndex.h"
+#include "CpuShaderMath.h"
+
+void PackLightIndexes(const uint* const pIndexes, uint uNum, uint* const pWords, uint uSlot)
+{
+	uint i = 0;
+	if (UseLightIndex16)
+	{
+		// Whole uints are written at once, only an odd first slot and the last slot share their uints.
+		if ((uSlot & 1) && uNum > 0)
+		{
+			StoreLightIndex(pWords, uSlot, pIndexes[0]);
+			i = 1;
+		}
+		for (; i + 1 < uNum; i += 2)
+		{
+			pWords[(uSlot + i) / 2] = pIndexes[i] | (pIndexes[i + 1] << 16);
+		}
+	}
+	for (; i < uNum; i++)
+	{
+		StoreLightIndex(pWords, uSlot + i, pIndexes[i]);
+	}
+}
+
+void UnpackLightIndexes(const uint* const pWords, uint uSlot, uint uNum, uint* const pIndexes)
+{
+	for (uint i = 0; i < uNum; i++)
+	{
+		pIndexes[i] = LoadLightIndex(pWords, uSlot + i);
+	}
+}
+
+void StoreSplitListHeader(uint* const pWords, uint uSlot, float fSplitZ, uint uNearNum, uint uFarNum)
+{
+	// The split depth takes a whole uint, lists of 16-bit indexes start at even slots.
+	pWords[GetLightIndexWord(uSlot)] = AsUint(fSplitZ);
+	StoreLightIndex(pWords, uSlot + ClusteredSplitHeaderSize - 2, uNearNum);
+	StoreLightIndex(pWords, uSlot + ClusteredSplitHeaderSize - 1, uFarNum);
+}
+
+void LoadSplitListHeader(const uint* const pWords, uint uSlot, float& fSplitZ, uint& uNearNum, uint& uFarNum)
+{
+	fSplitZ = AsFloat(pWords[GetLightIndexWord(uSlot)]);
+	uNearNum = LoadLightIndex(pWords, uSlot + ClusteredSplitHeaderSize - 2);
+	uFarNum = LoadLightIndex(pWords, uSlot + ClusteredSplitHeaderSize - 1);
+}
+
+ClusteredList GetPixelLightList(ClusteredList list, float z, const uint* const pWords, bool& bFarList)
+{
+	bFarList = false;
+	if (list.lightNum & ClusteredListSplitBit)
+	{
+		float fSplitZ;
+		uint uNearNum, uFarNum;
+		LoadSplitListHeader(pWords, list.offset, fSplitZ, uNearNum, uFarNum);
+		bFarList = z >= fSplitZ;
+		list = GetSplitLightList(list, z, fSplitZ, uNearNum, uFarNum);
+	}
+	return list;
+}
+
+// The first light of a list ordered by type whose index isn't below uLightOffset (or, for a reversed list, is below uLightOffset).
+static uint FindLightTypeBoundary(const ClusteredList& list, uint uLightOffset, bool bReversed, const uint* const pWords)
+{
+	uint uFirst = 0;
+	uint uLast = list.lightNum;
+	while (uFirst < uLast)
+	{
+		uint uMid = (uFirst + uLast) / 2;
+		if ((LoadLightIndex(pWords, list.offset + uMid) >= uLightOffset) != bReversed)
+		{
+			uLast = uMid;
+		}
+		else
+		{
+			uFirst = uMid + 1;
+		}
+	}
+	return uFirst;
+}
+
+void GetLightTypeRanges(const ClusteredList& list, bool bFarList, const ClusteredData& cd, const uint* const pWords,
+	uint ranges[LightTypeNum][2])
+{
+	ranges[LightTypePoint][0] = 0;
+	ranges[LightTypePoint][1] = list.lightNum;
+	ranges[LightTypeSpot][0] = ranges[LightTypeSpot][1] = list.lightNum;
+	ranges[LightTypeCapsule][0] = ranges[LightTypeCapsule][1] = list.lightNum;
+	if (cd.spotLightNum + cd.capsuleLightNum == 0)
+	{
+		return;
+	}
+	uint uSpot = FindLightTypeBoundary(list, GetLightTypeOffset(cd.lightNum, cd.spotLightNum, cd.capsuleLightNum, LightTypeSpot),
+		bFarList, pWords);
+	uint uCapsule = FindLightTypeBoundary(list, GetLightTypeOffset(cd.lightNum, cd.spotLightNum, cd.capsuleLightNum, LightTypeCapsule),
+		bFarList, pWords);
+	// Far lists of split lists are in the reverse order.
+	ranges[LightTypePoint][0] = bFarList ? uSpot : 0;
+	ranges[LightTypePoint][1] = bFarList ? list.lightNum : uSpot;
+	ranges[LightTypeSpot][0] = bFarList ? uCapsule : uSpot;
+	ranges[LightTypeSpot][1] = bFarList ? uSpot : uCapsule;
+	ranges[LightTypeCapsule][0] = bFarList ? 0 : uCapsule;
+	ranges[LightTypeCapsule][1] = bFarList ? uCapsule : list.lightNum;
+}
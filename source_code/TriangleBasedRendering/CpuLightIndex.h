@@ -0,0 +1,45 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightIndex.h
+//
+// Packed light indexes in the layout of the culling shaders and LoadLightIndex of the light passes.
+// A list is a range of slots, and with UseLightIndex16 a slot is 16 bits and the even slot of a uint is its low half.
+// The CPU culler packs its lists in this layout, so its buffers can be compared with GPU readbacks uint by uint.
+// The list of a pixel and the ranges of light types in it are selected like DeferredRender.hlsli (CpuLightPass).
+//--------------------------------------------------------------------------------------
+#pragma once
+#include "ShaderTypeDefine.h"
+#include "ClusteredCommon.h"
+
+// Load and store a slot of packed light indexes, a 16-bit store keeps the other half of its uint.
+inline uint LoadLightIndex(const uint* const pWords, uint uSlot)
+{
+	return GetPackedLightIndex(pWords[GetLightIndexWord(uSlot)], uSlot);
+}
+inline void StoreLightIndex(uint* const pWords, uint uSlot, uint uValue)
+{
+	uint& uWord = pWords[GetLightIndexWord(uSlot)];
+	if (UseLightIndex16)
+	{
+		uint uShift = (uSlot & 1) * 16;
+		uWord = (uWord & ~(0xffffu << uShift)) | (uValue << uShift);
+	}
+	else
+	{
+		uWord = uValue;
+	}
+}
+
+// Pack uNum light indexes into the slots from uSlot, and unpack the slots from uSlot.
+void PackLightIndexes(const uint* const pIndexes, uint uNum, uint* const pWords, uint uSlot);
+void UnpackLightIndexes(const uint* const pWords, uint uSlot, uint uNum, uint* const pIndexes);
+
+// Store and load the header of a split list (ClusteredListSplitBit) whose first slot is uSlot.
+void StoreSplitListHeader(uint* const pWords, uint uSlot, float fSplitZ, uint uNearNum, uint uFarNum);
+void LoadSplitListHeader(const uint* const pWords, uint uSlot, float& fSplitZ, uint& uNearNum, uint& uFarNum);
+
+// The light list of a pixel at post-projection depth z (GetPixelLightList of the light passes).
+// The far list of a split list is written backwards, so bFarList is set for it.
+ClusteredList GetPixelLightList(ClusteredList list, float z, const uint* const pWords, bool& bFarList);
+// The [begin, end) range of the lights of every type in a light list ordered by type (GetLightTypeRanges of the light passes).
+void GetLightTypeRanges(const ClusteredList& list, bool bFarList, const ClusteredData& cd, const uint* const pWords,
+	uint ranges[LightTypeNum][2]);
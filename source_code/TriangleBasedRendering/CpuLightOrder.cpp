@@ -0,0 +1,67 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightOrder.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuLightOrder.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+// Insert two zero bits after each of the low 10 bits.
+static inline uint ExpandBits(uint v)
+{
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+static inline uint QuantizeAxis(float v)
+{
+	const float fMax = (float)((1 << MortonBitsPerAxis) - 1);
+	return (uint)std::min(std::max(v * fMax + 0.5f, 0.0f), fMax);
+}
+
+uint GetMortonCode(float x, float y, float z)
+{
+	return (ExpandBits(QuantizeAxis(x)) << 2) | (ExpandBits(QuantizeAxis(y)) << 1) | ExpandBits(QuantizeAxis(z));
+}
+
+void ComputeMortonOrder(const void * const pLights, uint uNum, uint uStride, uint uPositionOffset, std::vector<uint>& order)
+{
+	const unsigned char* pBytes = (const unsigned char*)pLights + uPositionOffset;
+	float3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (uint i = 0; i < uNum; i++)
+	{
+		float3 pos;
+		memcpy(&pos, pBytes + i*uStride, sizeof(pos));
+		boundsMin.x = std::min(boundsMin.x, pos.x);
+		boundsMin.y = std::min(boundsMin.y, pos.y);
+		boundsMin.z = std::min(boundsMin.z, pos.z);
+		boundsMax.x = std::max(boundsMax.x, pos.x);
+		boundsMax.y = std::max(boundsMax.y, pos.y);
+		boundsMax.z = std::max(boundsMax.z, pos.z);
+	}
+	// A flat axis maps to 0.
+	float fInvX = boundsMax.x > boundsMin.x ? 1.0f / (boundsMax.x - boundsMin.x) : 0.0f;
+	float fInvY = boundsMax.y > boundsMin.y ? 1.0f / (boundsMax.y - boundsMin.y) : 0.0f;
+	float fInvZ = boundsMax.z > boundsMin.z ? 1.0f / (boundsMax.z - boundsMin.z) : 0.0f;
+
+	// Sort (code, index) pairs, the index breaks ties.
+	std::vector<unsigned long long> keys(uNum);
+	for (uint i = 0; i < uNum; i++)
+	{
+		float3 pos;
+		memcpy(&pos, pBytes + i*uStride, sizeof(pos));
+		uint uCode = GetMortonCode((pos.x - boundsMin.x)*fInvX, (pos.y - boundsMin.y)*fInvY, (pos.z - boundsMin.z)*fInvZ);
+		keys[i] = ((unsigned long long)uCode << 32) | i;
+	}
+	std::sort(keys.begin(), keys.end());
+
+	order.resize(uNum);
+	for (uint i = 0; i < uNum; i++)
+	{
+		order[i] = (uint)keys[i];
+	}
+}
@@ -0,0 +1,20 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightOrder.h
+//
+// Morton order of lights. Positions are quantized to 10 bits per axis in the bounds of all positions, and lights are
+// sorted by the interleaved bits, so lights near in space are near in the light buffer. Neighbouring clusters then
+// read nearby entries of gLightSRV in the light pass.
+// Lights are read as raw bytes, so any light type with a float3 position can be sorted.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <vector>
+#include "ShaderTypeDefine.h"
+
+#define MortonBitsPerAxis 10
+
+// The 30-bit Morton code of a position, x, y and z are in [0, 1].
+uint GetMortonCode(float x, float y, float z);
+
+// Compute the Morton order of uNum lights, uStride bytes apart with a float3 position at uPositionOffset.
+// order[slot] is the index of the light stored in slot, lights with equal codes keep their relative order.
+void ComputeMortonOrder(const void* const pLights, uint uNum, uint uStride, uint uPositionOffset, std::vector<uint>& order);
@@ -0,0 +1,984 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightPass.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuLightPass.h"
+#include "CpuLightCulling.h"
+#include "CpuLightIndex.h"
+#include "CpuShaderMath.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__AVX2__)
+#define LIGHT_PASS_AVX2 1
+#include <immintrin.h>
+#endif
+
+// max(a, b) and min(a, b) like maxps and minps: b is returned if a is NaN, so max(x, 0) is 0 for NaN like HLSL.
+static inline float MaxPs(float a, float b)
+{
+	return a > b ? a : b;
+}
+static inline float MinPs(float a, float b)
+{
+	return a < b ? a : b;
+}
+static inline float Saturate(float x)
+{
+	return MinPs(MaxPs(x, 0.0f), 1.0f);
+}
+static inline float Dot(const float a[3], const float b[3])
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+// normalize(v) = v * rsqrt(dot(v, v)).
+static inline void Normalize(float v[3])
+{
+	float invLen = 1.0f / std::sqrt(Dot(v, v));
+	v[0] *= invLen;
+	v[1] *= invLen;
+	v[2] *= invLen;
+}
+// pow(x, 5) without exp2/log2, so both kernels compute it the same way.
+static inline float Pow5(float x)
+{
+	float x2 = x*x;
+	return x2*x2*x;
+}
+
+CpuLightPass::CpuLightPass()
+{
+	m_kernel = CpuLightPassKernel_Simd;
+	m_uTierPolicy = ShadingTierPolicy;
+	m_bViewSpaceLighting = UseViewSpaceLighting;
+	m_pScheduler = nullptr;
+	memset(&m_gbuffer, 0, sizeof(m_gbuffer));
+	memset(&m_tables, 0, sizeof(m_tables));
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_pViewData = nullptr;
+	m_pLights = nullptr;
+	m_pShapes = nullptr;
+	memset(&m_viewRays, 0, sizeof(m_viewRays));
+}
+
+void CpuLightPass::SetLightTables(const CpuLightCuller & culler)
+{
+	m_tables.cullingData = culler.GetCullingData();
+	m_tables.uSubdivision = culler.GetSubdivision();
+	m_tables.pLists = culler.GetLightListBuffer().data();
+	m_tables.pIndexes = culler.GetPackedIndexBuffer().data();
+	m_tables.pDepthPlanes = culler.GetDepthPlanes().empty() ? nullptr : culler.GetDepthPlanes().data();
+	m_tables.uDepthPlaneNum = (uint)culler.GetDepthPlanes().size();
+	m_tables.pTileDiagonals = culler.GetTileDiagonalBuffer().empty() ? nullptr : culler.GetTileDiagonalBuffer().data();
+}
+
+void CpuLightPass::Render(const ViewData & viewData, const PointLight * const pLights, const LightShape * const pShapes, float * const pColor[3])
+{
+	auto begin = std::chrono::high_resolution_clock::now();
+	m_pViewData = &viewData;
+	m_pLights = pLights;
+	m_pShapes = pShapes;
+	if (m_bViewSpaceLighting)
+	{
+		// Transform the lights and their shapes to view space once, like LightTransformCS.
+		const ClusteredData& cd = m_tables.cullingData;
+		GetLightPassViewRays(viewData, m_gbuffer.uWidth, m_gbuffer.uHeight, m_viewRays);
+		m_viewLights.assign(pLights, pLights + cd.lightNum);
+		for (PointLight& L : m_viewLights)
+		{
+			CpuFloat4 center = TransformToView(L.pos, viewData.View);
+			L.pos.x = center.x;
+			L.pos.y = center.y;
+			L.pos.z = center.z;
+		}
+		uint uShapeNum = pShapes ? cd.spotLightNum + cd.capsuleLightNum : 0;
+		m_viewShapes.assign(pShapes, pShapes + uShapeNum);
+		for (LightShape& S : m_viewShapes)
+		{
+			CpuFloat4 origin = TransformToView(S.origin, viewData.View);
+			CpuFloat4 axis = { S.axis.x, S.axis.y, S.axis.z, 0.0f };
+			axis = Mul(axis, viewData.View);
+			S.origin.x = origin.x;
+			S.origin.y = origin.y;
+			S.origin.z = origin.z;
+			S.axis.x = axis.x;
+			S.axis.y = axis.y;
+			S.axis.z = axis.z;
+		}
+		m_pLights = m_viewLights.data();
+		m_pShapes = uShapeNum ? m_viewShapes.data() : pShapes;
+	}
+
+	// Rows of tiles write their own pixel rows, so they run on any thread.
+	uint uRowNum = m_tables.cullingData.heightDim;
+	std::vector<CpuLightPassStats> rowStats(uRowNum);
+	auto renderRow = [&](uint uTileY, uint)
+	{
+		CpuLightPassStats& stats = rowStats[uTileY];
+		memset(&stats, 0, sizeof(stats));
+		if (m_kernel == CpuLightPassKernel_Simd)
+		{
+			RenderRowSimd(uTileY, pColor, stats);
+		}
+		else
+		{
+			RenderRowScalar(uTileY, pColor, stats);
+		}
+	};
+	if (m_pScheduler)
+	{
+		m_pScheduler->ParallelFor(uRowNum, renderRow);
+	}
+	else
+	{
+		for (uint y = 0; y < uRowNum; y++)
+		{
+			renderRow(y, 0);
+		}
+	}
+
+	memset(&m_stats, 0, sizeof(m_stats));
+	for (const CpuLightPassStats& stats : rowStats)
+	{
+		m_stats.uLightPixelPairs += stats.uLightPixelPairs;
+		m_stats.uShadedPairs += stats.uShadedPairs;
+		for (uint uTier = 0; uTier < ShadingTierNum; uTier++)
+		{
+			m_stats.tierPairs[uTier] += stats.tierPairs[uTier];
+		}
+		m_stats.uPackets += stats.uPackets;
+		m_stats.uPacketLists += stats.uPacketLists;
+		m_stats.uGgxPackets += stats.uGgxPackets;
+	}
+	m_stats.dTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+}
+
+void CpuLightPass::GetTileRowPixels(uint uTileY, uint & uBegin, uint & uEnd) const
+{
+	// A pixel row belongs to the row of tiles containing its center, and the last row of tiles takes the rows below the grid.
+	const ClusteredData& cd = m_tables.cullingData;
+	auto getTileRow = [&](uint py)
+	{
+		return std::min((uint)(((float)py + 0.5f) / cd.tileSizeY), cd.heightDim - 1);
+	};
+	uBegin = std::min((uint)std::max(cd.tileSizeY*uTileY - 1.0f, 0.0f), m_gbuffer.uHeight);
+	while (uBegin < m_gbuffer.uHeight && getTileRow(uBegin) < uTileY)
+	{
+		uBegin++;
+	}
+	uEnd = uBegin;
+	while (uEnd < m_gbuffer.uHeight && getTileRow(uEnd) == uTileY)
+	{
+		uEnd++;
+	}
+}
+
+uint CpuLightPass::GetPixelCluster(uint uPixelX, uint uPixelY) const
+{
+	// Pixels are shaded by the tile mesh, so a pixel belongs to the tile containing its center,
+	// and to the triangle of the pattern of the tile containing its center.
+	const ClusteredData& cd = m_tables.cullingData;
+	float fTileX = ((float)uPixelX + 0.5f) / cd.tileSizeX;
+	float fTileY = ((float)uPixelY + 0.5f) / cd.tileSizeY;
+	uint uTileX = std::min((uint)fTileX, cd.widthDim - 1);
+	uint uTileY = std::min((uint)fTileY, cd.heightDim - 1);
+	uint uTileIdx = uTileX + uTileY*cd.widthDim;
+	uint uPattern = m_tables.pTileDiagonals ?
+		GetTileDiagonalPattern((m_tables.pTileDiagonals[uTileIdx / 32] >> (uTileIdx % 32)) & 0x1) : m_tables.uSubdivision;
+	return uTileIdx*TilePatternPrimitiveNum[m_tables.uSubdivision] +
+		GetTilePrimitive(uPattern, fTileX - (float)uTileX, fTileY - (float)uTileY);
+}
+
+uint CpuLightPass::GetDepthSlice(float z) const
+{
+	uint uSlice = 0;
+	for (uint i = 1; i < m_tables.cullingData.depthDim && i < m_tables.uDepthPlaneNum; i++)
+	{
+		uSlice = z >= m_tables.pDepthPlanes[i] ? i : uSlice;
+	}
+	return uSlice;
+}
+
+void CpuLightPass::LoadPixel(uint uPixelX, uint uPixelY, PixelData & pixel) const
+{
+	uint uIdx = uPixelX + uPixelY*m_gbuffer.uWidth;
+
+	// Reconstruct the position with depth buffer, SV_Position is the center of the pixel.
+	float p[4] = { (float)uPixelX + 0.5f, (float)uPixelY + 0.5f, m_gbuffer.pDepth[uIdx], 1.0f };
+	float camPos[3] = { m_pViewData->CamPos.x, m_pViewData->CamPos.y, m_pViewData->CamPos.z };
+	if (m_bViewSpaceLighting)
+	{
+		// Scale the view ray by the linear depth, the camera is at the origin of view space.
+		float fViewDepth = GetLightPassViewDepth(*m_pViewData, p[2]);
+		for (uint c = 0; c < 3; c++)
+		{
+			pixel.pos[c] = (m_viewRays.origin[c] + p[0] * m_viewRays.dx[c] + p[1] * m_viewRays.dy[c])*fViewDepth;
+			camPos[c] = 0.0f;
+		}
+	}
+	else
+	{
+		// Transform by the inverse screen view projection matrix to world space.
+		const float4x4& m = m_pViewData->InvPV;
+		float w = p[0] * m.m[3][0] + p[1] * m.m[3][1] + p[2] * m.m[3][2] + p[3] * m.m[3][3];
+		for (uint c = 0; c < 3; c++)
+		{
+			pixel.pos[c] = (p[0] * m.m[c][0] + p[1] * m.m[c][1] + p[2] * m.m[c][2] + p[3] * m.m[c][3]) / w;
+		}
+	}
+	for (uint c = 0; c < 3; c++)
+	{
+		pixel.albedo[c] = m_gbuffer.pAlbedo[c][uIdx];
+		pixel.normal[c] = m_gbuffer.pNormal[c][uIdx];
+	}
+	for (uint c = 0; c < 4; c++)
+	{
+		pixel.specGloss[c] = m_gbuffer.pSpecularGloss[c][uIdx];
+	}
+	Normalize(pixel.normal);
+	for (uint c = 0; c < 3; c++)
+	{
+		pixel.viewDir[c] = camPos[c] - pixel.pos[c];
+	}
+	pixel.fViewDistance = std::sqrt(Dot(pixel.viewDir, pixel.viewDir));
+	Normalize(pixel.viewDir);
+}
+
+// G_Smith and GGXBRDF of Lighting.hlsli, for a pixel and a unit light vector.
+static inline void GgxBrdf(const float lightDir[3], const float albedo[3], const float normal[3], const float viewDir[3],
+	const float specGloss[4], float col[3])
+{
+	const float pi = 3.14159f;
+	float h[3] = { viewDir[0] + lightDir[0], viewDir[1] + lightDir[1], viewDir[2] + lightDir[2] };
+	Normalize(h);
+
+	float NdotL = MaxPs(Dot(normal, lightDir), 0.0f);
+	float NdotH = MaxPs(Dot(normal, h), 0.0f);
+	float VdotH = MaxPs(Dot(viewDir, h), 0.0f);
+	float NdotV = MaxPs(Dot(normal, viewDir), 0.0f);
+	float roughness = specGloss[3];
+
+	// D.
+	float alpha = roughness*roughness;
+	float alphaSqr = alpha*alpha;
+	float denom = ((NdotH*NdotH)*(alphaSqr - 1.0f) + 1.0f);
+	float D = alphaSqr / (pi*denom*denom);
+
+	// Fresnel and visibility.
+	float F_b = Pow5(1.0f - VdotH);
+	float k = (roughness + 1.0f)*(roughness + 1.0f) / 8.0f;
+	float vis = (NdotV / (NdotV*(1.0f - k) + k))*(NdotL / (NdotL*(1.0f - k) + k));
+	float FV_b = F_b*vis;
+	for (uint c = 0; c < 3; c++)
+	{
+		col[c] = NdotL*D*(specGloss[c] * vis + (1.0f - specGloss[c])*FV_b) + NdotL*albedo[c];
+	}
+}
+
+// GGXFastBRDF of Lighting.hlsli (ShadingTierFast).
+static inline void GgxFastBrdf(const float lightDir[3], const float albedo[3], const float normal[3], const float viewDir[3],
+	const float specGloss[4], float col[3])
+{
+	const float pi = 3.14159f;
+	float h[3] = { viewDir[0] + lightDir[0], viewDir[1] + lightDir[1], viewDir[2] + lightDir[2] };
+	Normalize(h);
+
+	float NdotL = MaxPs(Dot(normal, lightDir), 0.0f);
+	float NdotH = MaxPs(Dot(normal, h), 0.0f);
+	float VdotH = MaxPs(Dot(viewDir, h), 0.0f);
+	float NdotV = MaxPs(Dot(normal, viewDir), 0.0f);
+	float roughness = specGloss[3];
+
+	// D.
+	float alpha = roughness*roughness;
+	float alphaSqr = alpha*alpha;
+	float denom = ((NdotH*NdotH)*(alphaSqr - 1.0f) + 1.0f);
+	float D = alphaSqr / (pi*denom*denom);
+
+	// Spherical Gaussian Fresnel and Kelemen visibility.
+	float F_b = std::exp2((-5.55473f*VdotH - 6.98316f)*VdotH);
+	float vis = Saturate(NdotL*NdotV / MaxPs(VdotH*VdotH, 1e-4f));
+	float FV_b = F_b*vis;
+	for (uint c = 0; c < 3; c++)
+	{
+		col[c] = NdotL*D*(specGloss[c] * vis + (1.0f - specGloss[c])*FV_b) + NdotL*albedo[c];
+	}
+}
+
+// LambertBlinnBRDF of Lighting.hlsli (ShadingTierLambertBlinn).
+static inline void LambertBlinnBrdf(const float lightDir[3], const float albedo[3], const float normal[3], const float viewDir[3],
+	const float specGloss[4], float col[3])
+{
+	const float pi = 3.14159f;
+	float h[3] = { viewDir[0] + lightDir[0], viewDir[1] + lightDir[1], viewDir[2] + lightDir[2] };
+	Normalize(h);
+
+	float NdotL = MaxPs(Dot(normal, lightDir), 0.0f);
+	float NdotH = MaxPs(Dot(normal, h), 0.0f);
+	float alpha = specGloss[3] * specGloss[3];
+	float alphaSqr = MaxPs(alpha*alpha, 1e-6f);
+	float n = 2.0f / alphaSqr - 2.0f;
+	float D = (n + 2.0f) / (2.0f*pi)*std::pow(NdotH, n);
+	for (uint c = 0; c < 3; c++)
+	{
+		col[c] = NdotL*D*specGloss[c] + NdotL*albedo[c];
+	}
+}
+
+// The attenuation of a spot or capsule light at a world-space position, and the position the light comes from (GetLightShapeAttenuation).
+static inline float GetLightShapeAttenuation(uint uType, const LightShape& S, const float p[3], float lightPos[3])
+{
+	const float origin[3] = { S.origin.x, S.origin.y, S.origin.z };
+	const float axis[3] = { S.axis.x, S.axis.y, S.axis.z };
+	float v[3] = { p[0] - origin[0], p[1] - origin[1], p[2] - origin[2] };
+	if (uType == LightTypeCapsule)
+	{
+		// The closest point of the segment.
+		float t = MinPs(MaxPs(Dot(v, axis) / MaxPs(Dot(axis, axis), 1e-12f), -1.0f), 1.0f);
+		float d[3];
+		for (uint c = 0; c < 3; c++)
+		{
+			lightPos[c] = origin[c] + axis[c] * t;
+			d[c] = p[c] - lightPos[c];
+		}
+		return Saturate(1.0f - std::sqrt(Dot(d, d)) / S.range);
+	}
+	for (uint c = 0; c < 3; c++)
+	{
+		lightPos[c] = origin[c];
+	}
+	float dist = std::sqrt(Dot(v, v));
+	float cone = Saturate((Dot(v, axis) / MaxPs(dist, 1e-6f) - S.cosAngle) / MaxPs(1.0f - S.cosAngle, 1e-6f));
+	return Saturate(1.0f - dist / S.range)*cone;
+}
+
+void CpuLightPass::ShadePixel(const PixelData & pixel, const ClusteredList & list, bool bFarList, float color[3], CpuLightPassStats & stats) const
+{
+	const ClusteredData& cd = m_tables.cullingData;
+	uint ranges[LightTypeNum][2];
+	GetLightTypeRanges(list, bFarList, cd, m_tables.pIndexes, ranges);
+	uint uShapeOffset = GetLightTypeOffset(cd.lightNum, cd.spotLightNum, cd.capsuleLightNum, LightTypeSpot);
+	stats.uLightPixelPairs += list.lightNum;
+
+	// The lights of every type are in one range of the list, so every type has its own loop.
+	for (uint uType = 0; uType < LightTypeNum; uType++)
+	{
+		for (uint i = ranges[uType][0]; i < ranges[uType][1]; i++)
+		{
+			uint uLightIdx = LoadLightIndex(m_tables.pIndexes, list.offset + i);
+			const PointLight& L = m_pLights[uLightIdx];
+			float lightPos[3] = { L.pos.x, L.pos.y, L.pos.z };
+			float d;
+			if (uType == LightTypePoint)
+			{
+				// Attenuation light (the intensity decreases to 0 at the radius, but it is not physically-based).
+				float v[3] = { lightPos[0] - pixel.pos[0], lightPos[1] - pixel.pos[1], lightPos[2] - pixel.pos[2] };
+				d = Saturate(1.0f - std::sqrt(Dot(v, v)) / L.radius);
+			}
+			else
+			{
+				d = GetLightShapeAttenuation(uType, m_pShapes[uLightIdx - uShapeOffset], pixel.pos, lightPos);
+			}
+
+			// GetLightContribution.
+			if (d > 0.0f)
+			{
+				float lightVector[3] = { lightPos[0] - pixel.pos[0], lightPos[1] - pixel.pos[1], lightPos[2] - pixel.pos[2] };
+				Normalize(lightVector);
+				if (Dot(lightVector, pixel.normal) > 0.0f)
+				{
+					const float lightColor[3] = { L.color.x, L.color.y, L.color.z };
+					uint uTier = SelectShadingTier(m_uTierPolicy, pixel.fViewDistance, d*MaxPs(lightColor[0], MaxPs(lightColor[1], lightColor[2])));
+					float col[3];
+					if (uTier == ShadingTierFull)
+					{
+						GgxBrdf(lightVector, pixel.albedo, pixel.normal, pixel.viewDir, pixel.specGloss, col);
+					}
+					else if (uTier == ShadingTierFast)
+					{
+						GgxFastBrdf(lightVector, pixel.albedo, pixel.normal, pixel.viewDir, pixel.specGloss, col);
+					}
+					else
+					{
+						LambertBlinnBrdf(lightVector, pixel.albedo, pixel.normal, pixel.viewDir, pixel.specGloss, col);
+					}
+					for (uint c = 0; c < 3; c++)
+					{
+						color[c] += col[c] * d*lightColor[c];
+					}
+					stats.uShadedPairs++;
+					stats.tierPairs[uTier]++;
+				}
+			}
+		}
+	}
+}
+
+void CpuLightPass::RenderRowScalar(uint uTileY, float * const pColor[3], CpuLightPassStats & stats) const
+{
+	const ClusteredData& cd = m_tables.cullingData;
+	uint uSliceStride = cd.widthDim*cd.heightDim*TilePatternPrimitiveNum[m_tables.uSubdivision];
+	uint uBegin, uEnd;
+	GetTileRowPixels(uTileY, uBegin, uEnd);
+	for (uint py = uBegin; py < uEnd; py++)
+	{
+		for (uint px = 0; px < m_gbuffer.uWidth; px++)
+		{
+			uint uIdx = px + py*m_gbuffer.uWidth;
+			PixelData pixel;
+			LoadPixel(px, py, pixel);
+
+			// Select the cluster of this pixel in the depth slices of its triangle (or tile).
+			float z = m_gbuffer.pDepth[uIdx];
+			uint uCluster = GetPixelCluster(px, py) + GetDepthSlice(z)*uSliceStride;
+			bool bFarList;
+			ClusteredList list = GetPixelLightList(m_tables.pLists[uCluster], z, m_tables.pIndexes, bFarList);
+			float color[3] = { 0.0f, 0.0f, 0.0f };
+			ShadePixel(pixel, list, bFarList, color, stats);
+			for (uint c = 0; c < 3; c++)
+			{
+				pColor[c][uIdx] = color[c];
+			}
+		}
+	}
+}
+
+#if defined(LIGHT_PASS_AVX2)
+
+// A packet of 8 pixels, the data of LoadPixel in lanes.
+struct PixelPacket
+{
+	__m256 pos[3];
+	__m256 albedo[3];
+	__m256 normal[3];
+	__m256 viewDir[3];
+	__m256 specGloss[4];
+	__m256 viewDistance;
+};
+
+static inline __m256 Dot8(const __m256 a[3], const __m256 b[3])
+{
+	__m256 d = _mm256_mul_ps(a[0], b[0]);
+	d = _mm256_add_ps(d, _mm256_mul_ps(a[1], b[1]));
+	return _mm256_add_ps(d, _mm256_mul_ps(a[2], b[2]));
+}
+static inline void Normalize8(__m256 v[3])
+{
+	__m256 invLen = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(Dot8(v, v)));
+	v[0] = _mm256_mul_ps(v[0], invLen);
+	v[1] = _mm256_mul_ps(v[1], invLen);
+	v[2] = _mm256_mul_ps(v[2], invLen);
+}
+static inline __m256 Saturate8(__m256 x)
+{
+	return _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+}
+static inline __m256 Pow5x8(__m256 x)
+{
+	__m256 x2 = _mm256_mul_ps(x, x);
+	return _mm256_mul_ps(_mm256_mul_ps(x2, x2), x);
+}
+// exp2 and pow per lane with the functions of the scalar kernel.
+static inline __m256 Exp2x8(__m256 x)
+{
+	float lanes[CpuLightPassPacketSize];
+	_mm256_storeu_ps(lanes, x);
+	for (uint uLane = 0; uLane < CpuLightPassPacketSize; uLane++)
+	{
+		lanes[uLane] = std::exp2(lanes[uLane]);
+	}
+	return _mm256_loadu_ps(lanes);
+}
+static inline __m256 Pow8(__m256 x, __m256 y)
+{
+	float xLanes[CpuLightPassPacketSize], yLanes[CpuLightPassPacketSize];
+	_mm256_storeu_ps(xLanes, x);
+	_mm256_storeu_ps(yLanes, y);
+	for (uint uLane = 0; uLane < CpuLightPassPacketSize; uLane++)
+	{
+		xLanes[uLane] = std::pow(xLanes[uLane], yLanes[uLane]);
+	}
+	return _mm256_loadu_ps(xLanes);
+}
+// The lanes of a bit mask (the lowest bit is the first lane) as a float mask.
+static inline __m256 GetLaneMask(uint uMask)
+{
+	const __m256i bits = _mm256_setr_epi32(0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80);
+	return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)uMask), bits), bits));
+}
+
+// GgxBrdf for 8 lanes.
+static inline void GgxBrdf8(const __m256 lightDir[3], const PixelPacket& p, __m256 col[3])
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 h[3] = { _mm256_add_ps(p.viewDir[0], lightDir[0]), _mm256_add_ps(p.viewDir[1], lightDir[1]), _mm256_add_ps(p.viewDir[2], lightDir[2]) };
+	Normalize8(h);
+
+	__m256 NdotL = _mm256_max_ps(Dot8(p.normal, lightDir), zero);
+	__m256 NdotH = _mm256_max_ps(Dot8(p.normal, h), zero);
+	__m256 VdotH = _mm256_max_ps(Dot8(p.viewDir, h), zero);
+	__m256 NdotV = _mm256_max_ps(Dot8(p.normal, p.viewDir), zero);
+	__m256 roughness = p.specGloss[3];
+
+	// D.
+	__m256 alpha = _mm256_mul_ps(roughness, roughness);
+	__m256 alphaSqr = _mm256_mul_ps(alpha, alpha);
+	__m256 denom = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(NdotH, NdotH), _mm256_sub_ps(alphaSqr, one)), one);
+	__m256 D = _mm256_div_ps(alphaSqr, _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(3.14159f), denom), denom));
+
+	// Fresnel and visibility.
+	__m256 F_b = Pow5x8(_mm256_sub_ps(one, VdotH));
+	__m256 r1 = _mm256_add_ps(roughness, one);
+	__m256 k = _mm256_div_ps(_mm256_mul_ps(r1, r1), _mm256_set1_ps(8.0f));
+	__m256 oneMinusK = _mm256_sub_ps(one, k);
+	__m256 vis = _mm256_mul_ps(_mm256_div_ps(NdotV, _mm256_add_ps(_mm256_mul_ps(NdotV, oneMinusK), k)),
+		_mm256_div_ps(NdotL, _mm256_add_ps(_mm256_mul_ps(NdotL, oneMinusK), k)));
+	__m256 FV_b = _mm256_mul_ps(F_b, vis);
+	__m256 NdotLD = _mm256_mul_ps(NdotL, D);
+	for (uint c = 0; c < 3; c++)
+	{
+		__m256 spec = _mm256_add_ps(_mm256_mul_ps(p.specGloss[c], vis), _mm256_mul_ps(_mm256_sub_ps(one, p.specGloss[c]), FV_b));
+		col[c] = _mm256_add_ps(_mm256_mul_ps(NdotLD, spec), _mm256_mul_ps(NdotL, p.albedo[c]));
+	}
+}
+
+// GgxFastBrdf for 8 lanes.
+static inline void GgxFastBrdf8(const __m256 lightDir[3], const PixelPacket& p, __m256 col[3])
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 h[3] = { _mm256_add_ps(p.viewDir[0], lightDir[0]), _mm256_add_ps(p.viewDir[1], lightDir[1]), _mm256_add_ps(p.viewDir[2], lightDir[2]) };
+	Normalize8(h);
+
+	__m256 NdotL = _mm256_max_ps(Dot8(p.normal, lightDir), zero);
+	__m256 NdotH = _mm256_max_ps(Dot8(p.normal, h), zero);
+	__m256 VdotH = _mm256_max_ps(Dot8(p.viewDir, h), zero);
+	__m256 NdotV = _mm256_max_ps(Dot8(p.normal, p.viewDir), zero);
+	__m256 roughness = p.specGloss[3];
+
+	// D.
+	__m256 alpha = _mm256_mul_ps(roughness, roughness);
+	__m256 alphaSqr = _mm256_mul_ps(alpha, alpha);
+	__m256 denom = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(NdotH, NdotH), _mm256_sub_ps(alphaSqr, one)), one);
+	__m256 D = _mm256_div_ps(alphaSqr, _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(3.14159f), denom), denom));
+
+	// Spherical Gaussian Fresnel and Kelemen visibility.
+	__m256 F_b = Exp2x8(_mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(-5.55473f), VdotH), _mm256_set1_ps(6.98316f)), VdotH));
+	__m256 vis = Saturate8(_mm256_div_ps(_mm256_mul_ps(NdotL, NdotV), _mm256_max_ps(_mm256_mul_ps(VdotH, VdotH), _mm256_set1_ps(1e-4f))));
+	__m256 FV_b = _mm256_mul_ps(F_b, vis);
+	__m256 NdotLD = _mm256_mul_ps(NdotL, D);
+	for (uint c = 0; c < 3; c++)
+	{
+		__m256 spec = _mm256_add_ps(_mm256_mul_ps(p.specGloss[c], vis), _mm256_mul_ps(_mm256_sub_ps(one, p.specGloss[c]), FV_b));
+		col[c] = _mm256_add_ps(_mm256_mul_ps(NdotLD, spec), _mm256_mul_ps(NdotL, p.albedo[c]));
+	}
+}
+
+// LambertBlinnBrdf for 8 lanes.
+static inline void LambertBlinnBrdf8(const __m256 lightDir[3], const PixelPacket& p, __m256 col[3])
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 two = _mm256_set1_ps(2.0f);
+	__m256 h[3] = { _mm256_add_ps(p.viewDir[0], lightDir[0]), _mm256_add_ps(p.viewDir[1], lightDir[1]), _mm256_add_ps(p.viewDir[2], lightDir[2]) };
+	Normalize8(h);
+
+	__m256 NdotL = _mm256_max_ps(Dot8(p.normal, lightDir), zero);
+	__m256 NdotH = _mm256_max_ps(Dot8(p.normal, h), zero);
+	__m256 alpha = _mm256_mul_ps(p.specGloss[3], p.specGloss[3]);
+	__m256 alphaSqr = _mm256_max_ps(_mm256_mul_ps(alpha, alpha), _mm256_set1_ps(1e-6f));
+	__m256 n = _mm256_sub_ps(_mm256_div_ps(two, alphaSqr), two);
+	__m256 D = _mm256_mul_ps(_mm256_div_ps(_mm256_add_ps(n, two), _mm256_set1_ps(2.0f*3.14159f)), Pow8(NdotH, n));
+	__m256 NdotLD = _mm256_mul_ps(NdotL, D);
+	for (uint c = 0; c < 3; c++)
+	{
+		col[c] = _mm256_add_ps(_mm256_mul_ps(NdotLD, p.specGloss[c]), _mm256_mul_ps(NdotL, p.albedo[c]));
+	}
+}
+
+// SelectShadingTier for 8 lanes, the masks of the lanes of every tier.
+static inline void SelectShadingTier8(uint uPolicy, __m256 viewDistance, __m256 intensity, __m256 tierMasks[ShadingTierNum])
+{
+	__m256 fast = _mm256_setzero_ps();
+	__m256 lambert = _mm256_setzero_ps();
+	if (uPolicy == ShadingTierPolicyDistance)
+	{
+		fast = _mm256_cmp_ps(viewDistance, _mm256_set1_ps(ShadingTierFastDistance), _CMP_GE_OQ);
+		lambert = _mm256_cmp_ps(viewDistance, _mm256_set1_ps(ShadingTierLambertDistance), _CMP_GE_OQ);
+	}
+	else if (uPolicy == ShadingTierPolicyIntensity)
+	{
+		fast = _mm256_cmp_ps(intensity, _mm256_set1_ps(ShadingTierFastIntensity), _CMP_LT_OQ);
+		lambert = _mm256_cmp_ps(intensity, _mm256_set1_ps(ShadingTierLambertIntensity), _CMP_LT_OQ);
+	}
+	tierMasks[ShadingTierLambertBlinn] = lambert;
+	tierMasks[ShadingTierFast] = _mm256_andnot_ps(lambert, fast);
+	tierMasks[ShadingTierFull] = _mm256_andnot_ps(_mm256_or_ps(fast, lambert), _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+}
+
+// GetLightShapeAttenuation for 8 lanes.
+static inline __m256 GetLightShapeAttenuation8(uint uType, const LightShape& S, const __m256 p[3], __m256 lightPos[3])
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 origin[3] = { _mm256_set1_ps(S.origin.x), _mm256_set1_ps(S.origin.y), _mm256_set1_ps(S.origin.z) };
+	const __m256 axis[3] = { _mm256_set1_ps(S.axis.x), _mm256_set1_ps(S.axis.y), _mm256_set1_ps(S.axis.z) };
+	__m256 v[3] = { _mm256_sub_ps(p[0], origin[0]), _mm256_sub_ps(p[1], origin[1]), _mm256_sub_ps(p[2], origin[2]) };
+	if (uType == LightTypeCapsule)
+	{
+		// The closest point of the segment.
+		__m256 t = _mm256_div_ps(Dot8(v, axis), _mm256_max_ps(Dot8(axis, axis), _mm256_set1_ps(1e-12f)));
+		t = _mm256_min_ps(_mm256_max_ps(t, _mm256_set1_ps(-1.0f)), one);
+		__m256 d[3];
+		for (uint c = 0; c < 3; c++)
+		{
+			lightPos[c] = _mm256_add_ps(origin[c], _mm256_mul_ps(axis[c], t));
+			d[c] = _mm256_sub_ps(p[c], lightPos[c]);
+		}
+		return Saturate8(_mm256_sub_ps(one, _mm256_div_ps(_mm256_sqrt_ps(Dot8(d, d)), _mm256_set1_ps(S.range))));
+	}
+	for (uint c = 0; c < 3; c++)
+	{
+		lightPos[c] = origin[c];
+	}
+	__m256 dist = _mm256_sqrt_ps(Dot8(v, v));
+	__m256 cone = _mm256_div_ps(Dot8(v, axis), _mm256_max_ps(dist, _mm256_set1_ps(1e-6f)));
+	cone = Saturate8(_mm256_div_ps(_mm256_sub_ps(cone, _mm256_set1_ps(S.cosAngle)), _mm256_set1_ps(MaxPs(1.0f - S.cosAngle, 1e-6f))));
+	return _mm256_mul_ps(Saturate8(_mm256_sub_ps(one, _mm256_div_ps(dist, _mm256_set1_ps(S.range)))), cone);
+}
+
+void CpuLightPass::RenderRowSimd(uint uTileY, float * const pColor[3], CpuLightPassStats & stats) const
+{
+	const ClusteredData& cd = m_tables.cullingData;
+	const float4x4& m = m_pViewData->InvPV;
+	const float4x4& proj = m_pViewData->Proj;
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	// The camera is at the origin of view space.
+	const __m256 camPos[3] = { _mm256_set1_ps(m_bViewSpaceLighting ? 0.0f : m_pViewData->CamPos.x),
+		_mm256_set1_ps(m_bViewSpaceLighting ? 0.0f : m_pViewData->CamPos.y), _mm256_set1_ps(m_bViewSpaceLighting ? 0.0f : m_pViewData->CamPos.z) };
+	uint uSliceStride = cd.widthDim*cd.heightDim*TilePatternPrimitiveNum[m_tables.uSubdivision];
+	uint uShapeOffset = GetLightTypeOffset(cd.lightNum, cd.spotLightNum, cd.capsuleLightNum, LightTypeSpot);
+
+	uint uBegin, uEnd;
+	GetTileRowPixels(uTileY, uBegin, uEnd);
+	for (uint py = uBegin; py < uEnd; py++)
+	{
+		for (uint px = 0; px < m_gbuffer.uWidth; px += CpuLightPassPacketSize)
+		{
+			uint uIdx = px + py*m_gbuffer.uWidth;
+			uint uLaneNum = std::min(m_gbuffer.uWidth - px, (uint)CpuLightPassPacketSize);
+
+			// Load the planes of the G-buffer, the lanes after the last pixel of a row repeat it.
+			float lanes[11][CpuLightPassPacketSize];
+			const float* planes[11] = { m_gbuffer.pDepth, m_gbuffer.pAlbedo[0], m_gbuffer.pAlbedo[1], m_gbuffer.pAlbedo[2],
+				m_gbuffer.pNormal[0], m_gbuffer.pNormal[1], m_gbuffer.pNormal[2], m_gbuffer.pSpecularGloss[0],
+				m_gbuffer.pSpecularGloss[1], m_gbuffer.pSpecularGloss[2], m_gbuffer.pSpecularGloss[3] };
+			__m256 values[11];
+			for (uint j = 0; j < 11; j++)
+			{
+				if (uLaneNum == CpuLightPassPacketSize)
+				{
+					values[j] = _mm256_loadu_ps(planes[j] + uIdx);
+				}
+				else
+				{
+					for (uint uLane = 0; uLane < CpuLightPassPacketSize; uLane++)
+					{
+						lanes[j][uLane] = planes[j][uIdx + std::min(uLane, uLaneNum - 1)];
+					}
+					values[j] = _mm256_loadu_ps(lanes[j]);
+				}
+			}
+			PixelPacket packet;
+			for (uint c = 0; c < 3; c++)
+			{
+				packet.albedo[c] = values[1 + c];
+				packet.normal[c] = values[4 + c];
+			}
+			for (uint c = 0; c < 4; c++)
+			{
+				packet.specGloss[c] = values[7 + c];
+			}
+			Normalize8(packet.normal);
+
+			// Reconstruct positions with the depth buffer like LoadPixel.
+			__m256 x = _mm256_add_ps(_mm256_set1_ps((float)px), laneOffsets);
+			__m256 y = _mm256_set1_ps((float)py + 0.5f);
+			__m256 z = values[0];
+			if (m_bViewSpaceLighting)
+			{
+				__m256 viewDepth = _mm256_div_ps(_mm256_set1_ps(proj.m[2][3]), _mm256_sub_ps(z, _mm256_set1_ps(proj.m[2][2])));
+				for (uint c = 0; c < 3; c++)
+				{
+					__m256 ray = _mm256_add_ps(_mm256_set1_ps(m_viewRays.origin[c]), _mm256_mul_ps(x, _mm256_set1_ps(m_viewRays.dx[c])));
+					ray = _mm256_add_ps(ray, _mm256_mul_ps(y, _mm256_set1_ps(m_viewRays.dy[c])));
+					packet.pos[c] = _mm256_mul_ps(ray, viewDepth);
+				}
+			}
+			else
+			{
+				__m256 projPos[4] = { x, y, z, one };
+				__m256 wsPos[4];
+				for (uint r = 0; r < 4; r++)
+				{
+					__m256 d = _mm256_mul_ps(projPos[0], _mm256_set1_ps(m.m[r][0]));
+					d = _mm256_add_ps(d, _mm256_mul_ps(projPos[1], _mm256_set1_ps(m.m[r][1])));
+					d = _mm256_add_ps(d, _mm256_mul_ps(projPos[2], _mm256_set1_ps(m.m[r][2])));
+					wsPos[r] = _mm256_add_ps(d, _mm256_mul_ps(projPos[3], _mm256_set1_ps(m.m[r][3])));
+				}
+				for (uint c = 0; c < 3; c++)
+				{
+					packet.pos[c] = _mm256_div_ps(wsPos[c], wsPos[3]);
+				}
+			}
+			for (uint c = 0; c < 3; c++)
+			{
+				packet.viewDir[c] = _mm256_sub_ps(camPos[c], packet.pos[c]);
+			}
+			packet.viewDistance = _mm256_sqrt_ps(Dot8(packet.viewDir, packet.viewDir));
+			Normalize8(packet.viewDir);
+
+			// The light list of every lane, lanes with the same list loop it together.
+			ClusteredList lists[CpuLightPassPacketSize];
+			bool farLists[CpuLightPassPacketSize];
+			float depths[CpuLightPassPacketSize];
+			_mm256_storeu_ps(depths, z);
+			for (uint uLane = 0; uLane < uLaneNum; uLane++)
+			{
+				uint uCluster = GetPixelCluster(px + uLane, py) + GetDepthSlice(depths[uLane])*uSliceStride;
+				lists[uLane] = GetPixelLightList(m_tables.pLists[uCluster], depths[uLane], m_tables.pIndexes, farLists[uLane]);
+				stats.uLightPixelPairs += lists[uLane].lightNum;
+			}
+			stats.uPackets++;
+
+			__m256 color[3] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+			uint uRemaining = (1u << uLaneNum) - 1;
+			while (uRemaining)
+			{
+				uint uFirst = FirstBitLow(uRemaining);
+				const ClusteredList& list = lists[uFirst];
+				uint uGroup = 0;
+				for (uint uLane = uFirst; uLane < uLaneNum; uLane++)
+				{
+					bool bSame = lists[uLane].offset == list.offset && lists[uLane].lightNum == list.lightNum && farLists[uLane] == farLists[uFirst];
+					uGroup |= bSame ? 1u << uLane : 0;
+				}
+				uRemaining &= ~uGroup;
+				if (list.lightNum == 0)
+				{
+					continue;
+				}
+				stats.uPacketLists++;
+
+				uint ranges[LightTypeNum][2];
+				GetLightTypeRanges(list, farLists[uFirst], cd, m_tables.pIndexes, ranges);
+				__m256 groupMask = GetLaneMask(uGroup);
+				for (uint uType = 0; uType < LightTypeNum; uType++)
+				{
+					for (uint i = ranges[uType][0]; i < ranges[uType][1]; i++)
+					{
+						uint uLightIdx = LoadLightIndex(m_tables.pIndexes, list.offset + i);
+						const PointLight& L = m_pLights[uLightIdx];
+						__m256 lightPos[3] = { _mm256_set1_ps(L.pos.x), _mm256_set1_ps(L.pos.y), _mm256_set1_ps(L.pos.z) };
+						__m256 d;
+						if (uType == LightTypePoint)
+						{
+							__m256 v[3] = { _mm256_sub_ps(lightPos[0], packet.pos[0]), _mm256_sub_ps(lightPos[1], packet.pos[1]), _mm256_sub_ps(lightPos[2], packet.pos[2]) };
+							d = Saturate8(_mm256_sub_ps(one, _mm256_div_ps(_mm256_sqrt_ps(Dot8(v, v)), _mm256_set1_ps(L.radius))));
+						}
+						else
+						{
+							d = GetLightShapeAttenuation8(uType, m_pShapes[uLightIdx - uShapeOffset], packet.pos, lightPos);
+						}
+
+						// GetLightContribution, the packet skips lights which reach none of its lanes.
+						__m256 active = _mm256_and_ps(groupMask, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GT_OQ));
+						if (_mm256_movemask_ps(active) == 0)
+						{
+							continue;
+						}
+						__m256 lightVector[3] = { _mm256_sub_ps(lightPos[0], packet.pos[0]), _mm256_sub_ps(lightPos[1], packet.pos[1]), _mm256_sub_ps(lightPos[2], packet.pos[2]) };
+						Normalize8(lightVector);
+						active = _mm256_and_ps(active, _mm256_cmp_ps(Dot8(lightVector, packet.normal), _mm256_setzero_ps(), _CMP_GT_OQ));
+						uint uActive = (uint)_mm256_movemask_ps(active);
+						if (uActive == 0)
+						{
+							continue;
+						}
+						const __m256 lightColor[3] = { _mm256_set1_ps(L.color.x), _mm256_set1_ps(L.color.y), _mm256_set1_ps(L.color.z) };
+						__m256 intensity = _mm256_mul_ps(d, _mm256_set1_ps(MaxPs(L.color.x, MaxPs(L.color.y, L.color.z))));
+						__m256 tierMasks[ShadingTierNum];
+						SelectShadingTier8(m_uTierPolicy, packet.viewDistance, intensity, tierMasks);
+
+						// The tiers of the active lanes run one after another.
+						for (uint uTier = 0; uTier < ShadingTierNum; uTier++)
+						{
+							__m256 tierActive = _mm256_and_ps(active, tierMasks[uTier]);
+							uint uTierActive = (uint)_mm256_movemask_ps(tierActive);
+							if (uTierActive == 0)
+							{
+								continue;
+							}
+							__m256 col[3];
+							if (uTier == ShadingTierFull)
+							{
+								GgxBrdf8(lightVector, packet, col);
+							}
+							else if (uTier == ShadingTierFast)
+							{
+								GgxFastBrdf8(lightVector, packet, col);
+							}
+							else
+							{
+								LambertBlinnBrdf8(lightVector, packet, col);
+							}
+							for (uint c = 0; c < 3; c++)
+							{
+								__m256 contribution = _mm256_mul_ps(_mm256_mul_ps(col[c], d), lightColor[c]);
+								color[c] = _mm256_add_ps(color[c], _mm256_and_ps(tierActive, contribution));
+							}
+							stats.tierPairs[uTier] += CountBits(uTierActive);
+							stats.uGgxPackets++;
+						}
+						stats.uShadedPairs += CountBits(uActive);
+					}
+				}
+			}
+
+			for (uint c = 0; c < 3; c++)
+			{
+				if (uLaneNum == CpuLightPassPacketSize)
+				{
+					_mm256_storeu_ps(pColor[c] + uIdx, color[c]);
+				}
+				else
+				{
+					float result[CpuLightPassPacketSize];
+					_mm256_storeu_ps(result, color[c]);
+					memcpy(pColor[c] + uIdx, result, uLaneNum*sizeof(float));
+				}
+			}
+		}
+	}
+}
+
+const char* GetLightPassKernelName()
+{
+	return "AVX2";
+}
+
+#else
+
+void CpuLightPass::RenderRowSimd(uint uTileY, float * const pColor[3], CpuLightPassStats & stats) const
+{
+	RenderRowScalar(uTileY, pColor, stats);
+}
+
+const char* GetLightPassKernelName()
+{
+	return "Scalar";
+}
+
+#endif
+
+void GetLightPassViewRays(const ViewData & viewData, uint uWidth, uint uHeight, CpuViewRays & rays)
+{
+	// The rays of the top-left, the top-right and the bottom-left corners of the screen, rays are linear on the screen.
+	auto getViewRay = [&](float x, float y, float ray[3])
+	{
+		CpuFloat4 p = { x, y, 0.0f, 1.0f };
+		CpuFloat4 vertex = Mul(p, viewData.ProjInv);
+		ray[0] = vertex.x / vertex.z;
+		ray[1] = vertex.y / vertex.z;
+		ray[2] = vertex.z / vertex.z;
+	};
+	float topLeft[3], topRight[3], bottomLeft[3];
+	getViewRay(-1.0f, 1.0f, topLeft);
+	getViewRay(1.0f, 1.0f, topRight);
+	getViewRay(-1.0f, -1.0f, bottomLeft);
+	for (uint c = 0; c < 3; c++)
+	{
+		rays.origin[c] = topLeft[c];
+		rays.dx[c] = (topRight[c] - topLeft[c]) / (float)std::max(uWidth, 1u);
+		rays.dy[c] = (bottomLeft[c] - topLeft[c]) / (float)std::max(uHeight, 1u);
+	}
+}
+
+void CpuLightPass::CompareLightPassImages(const float * const pColorA[3], const float * const pColorB[3], uint uPixelNum,
+	CpuLightPassImageDifference & diff, float fTolerance)
+{
+	memset(&diff, 0, sizeof(diff));
+	double dSum = 0.0;
+	for (uint i = 0; i < uPixelNum; i++)
+	{
+		bool bOver = false;
+		for (uint c = 0; c < 3; c++)
+		{
+			float fError = std::fabs(pColorA[c][i] - pColorB[c][i]);
+			float fRelativeError = fError / std::max(std::fabs(pColorB[c][i]), 1.0f);
+			// NaN is always over the tolerance.
+			bOver = bOver || !(fRelativeError <= fTolerance);
+			diff.fMaxError = std::max(diff.fMaxError, fError);
+			diff.fMaxRelativeError = std::max(diff.fMaxRelativeError, fRelativeError);
+			dSum += (double)fError*fError;
+		}
+		diff.uPixelsOverTolerance += bOver ? 1 : 0;
+	}
+	diff.dRmsError = uPixelNum ? std::sqrt(dSum / (3.0*uPixelNum)) : 0.0;
+}
+
+bool CpuLightPass::WriteLightPassImage(const char * const pFileName, const float * const pColor[3], uint uWidth, uint uHeight)
+{
+	FILE* pFile = fopen(pFileName, "wb");
+	if (!pFile)
+	{
+		return false;
+	}
+	// A negative scale is little-endian.
+	fprintf(pFile, "PF\n%u %u\n-1.0\n", uWidth, uHeight);
+	std::vector<float> row(uWidth * 3);
+	bool bSucceeded = true;
+	for (uint y = uHeight; y-- > 0;)
+	{
+		for (uint x = 0; x < uWidth; x++)
+		{
+			for (uint c = 0; c < 3; c++)
+			{
+				row[x * 3 + c] = pColor[c][x + y*uWidth];
+			}
+		}
+		bSucceeded = bSucceeded && fwrite(row.data(), sizeof(float), row.size(), pFile) == row.size();
+	}
+	fclose(pFile);
+	return bSucceeded;
+}
+
+bool CpuLightPass::ReadLightPassImage(const char * const pFileName, std::vector<float>& color, uint & uWidth, uint & uHeight)
+{
+	FILE* pFile = fopen(pFileName, "rb");
+	if (!pFile)
+	{
+		return false;
+	}
+	// Only little-endian RGB files (a negative scale), like WriteLightPassImage.
+	float fScale = 0.0f;
+	bool bSucceeded = fscanf(pFile, "PF %u %u %f", &uWidth, &uHeight, &fScale) == 3 && fScale < 0.0f && fgetc(pFile) == '\n';
+	uint uPixelNum = bSucceeded ? uWidth*uHeight : 0;
+	color.assign(uPixelNum * 3, 0.0f);
+	std::vector<float> row(uWidth * 3);
+	for (uint y = uHeight; bSucceeded && y-- > 0;)
+	{
+		bSucceeded = fread(row.data(), sizeof(float), row.size(), pFile) == row.size();
+		for (uint x = 0; bSucceeded && x < uWidth; x++)
+		{
+			for (uint c = 0; c < 3; c++)
+			{
+				color[uPixelNum*c + x + y*uWidth] = row[x * 3 + c];
+			}
+		}
+	}
+	fclose(pFile);
+	return bSucceeded;
+}
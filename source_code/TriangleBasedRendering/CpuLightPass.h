@@ -0,0 +1,187 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightPass.h
+//
+// A headless CPU port of the light accumulation of the light passes (LightPassPS, TiledLightPassPS and GGXBRDF of
+// Lighting.hlsli), for golden images on machines without GPUs and for still frames on render nodes.
+// It reads the G-buffer as planes of floats and the light lists of the light passes (a CpuLightCuller or readbacks of
+// gLightListSRV and gPerTileLightIndex), and it writes the color of every pixel as planes of floats.
+// Rows of tiles run on the threads of a CpuTaskScheduler. With AVX2 (/arch:AVX2 or -mavx2), a row of 8 pixels is shaded
+// as a packet: the lanes with the same light list loop over it together, and the lanes a light doesn't reach are masked.
+// Without AVX2, and with CpuLightPassKernel_Scalar, pixels are shaded one by one like the pixel shaders.
+//
+// Pixels are mapped to clusters like CpuLightCuller::MeasureQuality: a pixel belongs to the tile containing its center,
+// and to the primitive of the tile pattern (the tile diagonal bits) containing its center, or to the tile with
+// TileSubdivisionQuad (TiledLightPassPS). Every pair is shaded with the BRDF of its shading tier (SelectShadingTier),
+// and the lanes of a packet with different tiers run the tiers one after another like the waves of the GPU.
+// With view-space lighting (UseViewSpaceLighting), pixels are reconstructed in view space from the frustum rays of the tile
+// mesh and their linear depth, the lights and their shapes are transformed to view space once per pass like
+// LightTransformCS, and the normals of the G-buffer are in view space (AdvancedShadingVS).
+// Every function keeps the operation order of the shaders, pow(x, 5) is computed with multiplications, and exp2 and pow
+// of the cheaper tiers are computed per lane, so both kernels produce the same colors when FMA contraction is off
+// (-ffp-contract=off).
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "ShaderTypeDefine.h"
+#include "ClusteredCommon.h"
+#include "CameraCommon.h"
+#include "CpuTaskScheduler.h"
+
+class CpuLightCuller;
+
+// The relative tolerance of a channel against the GPU light pass (CpuLightPassTest).
+#define CpuLightPassTolerance 1e-3f
+// The number of pixels of a packet of the SIMD kernel.
+#define CpuLightPassPacketSize 8
+
+// The kernel of the light pass.
+enum CpuLightPassKernelType
+{
+	CpuLightPassKernel_Scalar,	// Shade pixels one by one like the pixel shaders.
+	CpuLightPassKernel_Simd		// Shade packets of 8 pixels with AVX2 (the scalar kernel without AVX2).
+};
+
+// The G-buffer of the light pass, planes of uWidth*uHeight floats in rows.
+struct CpuGBuffer
+{
+	const float* pAlbedo[3];		// gAlbedoTexture.xyz.
+	const float* pNormal[3];		// gNormalTexture.xyz, the light pass normalizes it.
+	const float* pSpecularGloss[4];	// gSpecularGlossTexture.xyzw.
+	const float* pDepth;			// gDepth, post-projection depth.
+	uint uWidth;
+	uint uHeight;
+};
+
+// The frustum rays of pixels at view-space z = 1 (GetViewRay of DeferredRender.hlsli). The ray of a position (x, y) on the
+// screen is origin + x*dx + y*dy, like the rays interpolated from the vertexes of the tile mesh.
+struct CpuViewRays
+{
+	float origin[3];
+	float dx[3];
+	float dy[3];
+};
+
+// The light lists read by the light pass.
+struct CpuLightPassTables
+{
+	ClusteredData cullingData;		// gCB.
+	uint uSubdivision;				// TileSubdivisionQuad for TiledLightPassPS, a triangle pattern for LightPassPS.
+	const ClusteredList* pLists;	// gLightListSRV.
+	const uint* pIndexes;			// gPerTileLightIndex (packed light indexes).
+	const float* pDepthPlanes;		// gDepthPlanes, depthDim+1 post-projection depths (nullptr with one slice).
+	uint uDepthPlaneNum;
+	const uint* pTileDiagonals;		// gTileDiagonals, nullptr if all tiles use uSubdivision.
+};
+
+// Statistics of the last light pass.
+struct CpuLightPassStats
+{
+	double dTime;						// Seconds of Render().
+	unsigned long long uLightPixelPairs;	// Iterations of the light loops of all pixels.
+	unsigned long long uShadedPairs;	// Pairs which run a BRDF (the light reaches the pixel and faces its normal).
+	unsigned long long tierPairs[ShadingTierNum];	// Shaded pairs of every shading tier (ShadingTier*).
+	unsigned long long uPackets;		// Packets of the SIMD kernel.
+	unsigned long long uPacketLists;	// Lists looped by packets, lanes with different lists loop them one after another.
+	unsigned long long uGgxPackets;		// BRDF evaluations of 8 lanes (one per tier of the lanes), at least one lane of each is shaded.
+};
+
+// The difference between two images of the light pass.
+struct CpuLightPassImageDifference
+{
+	float fMaxError;			// The max |a - b| of a channel.
+	float fMaxRelativeError;	// The max |a - b| / max(|b|, 1) of a channel.
+	double dRmsError;			// The root mean square of |a - b| over all channels.
+	uint uPixelsOverTolerance;	// Pixels with a channel over the tolerance.
+};
+
+class CpuLightPass
+{
+public:
+	CpuLightPass();
+
+	// Select the kernel, the default is CpuLightPassKernel_Simd.
+	void SetKernel(CpuLightPassKernelType kernel) { m_kernel = kernel; }
+	// Select the policy of shading tiers (ShadingTierPolicy*), the default is ShadingTierPolicy.
+	void SetShadingTierPolicy(uint uPolicy) { m_uTierPolicy = std::min(uPolicy, (uint)ShadingTierPolicyNum - 1); }
+	uint GetShadingTierPolicy() const { return m_uTierPolicy; }
+	// Light in view space from the view rays (true), or in world space from InvPV, the default is UseViewSpaceLighting.
+	void SetViewSpaceLighting(bool bViewSpaceLighting) { m_bViewSpaceLighting = bViewSpaceLighting; }
+	bool IsViewSpaceLighting() const { return m_bViewSpaceLighting; }
+	// Run rows of tiles on the threads of a scheduler, nullptr runs all rows on the calling thread.
+	void SetScheduler(CpuTaskScheduler* const pScheduler) { m_pScheduler = pScheduler; }
+	void SetGBuffer(const CpuGBuffer& gbuffer) { m_gbuffer = gbuffer; }
+	const CpuGBuffer& GetGBuffer() const { return m_gbuffer; }
+	// Set the light lists of the next passes. The arrays are read in Render().
+	void SetLightTables(const CpuLightPassTables& tables) { m_tables = tables; }
+	// Set the light lists of the last run of a culler, which must use index lists.
+	void SetLightTables(const CpuLightCuller& culler);
+
+	// Shade all pixels of the G-buffer, and write the colors to planes of uWidth*uHeight floats (the alpha is always 1).
+	// pShapes are the shapes of the spot and capsule lights (gLightShapeSRV), nullptr without them.
+	void Render(const ViewData& viewData, const PointLight* const pLights, const LightShape* const pShapes, float* const pColor[3]);
+
+	const CpuLightPassStats& GetStats() const { return m_stats; }
+
+	// Compare two images of uPixelNum pixels, b is the reference (e.g. a GPU readback).
+	static void CompareLightPassImages(const float* const pColorA[3], const float* const pColorB[3], uint uPixelNum,
+		CpuLightPassImageDifference& diff, float fTolerance = CpuLightPassTolerance);
+	// Write an image to a PFM file (3 channels of 32-bit floats, rows from the bottom).
+	static bool WriteLightPassImage(const char* const pFileName, const float* const pColor[3], uint uWidth, uint uHeight);
+	// Read an image written by WriteLightPassImage (or a little-endian PFM capture) to 3 planes of uWidth*uHeight floats.
+	static bool ReadLightPassImage(const char* const pFileName, std::vector<float>& color, uint& uWidth, uint& uHeight);
+
+private:
+	// The data of a pixel shared by its light loops.
+	struct PixelData
+	{
+		float pos[3];		// The position in world space, or in view space with view-space lighting.
+		float albedo[3];
+		float normal[3];
+		float viewDir[3];
+		float specGloss[4];
+		float fViewDistance;	// The distance to the camera for the shading tier.
+	};
+
+	// Shade the pixel rows of a row of tiles.
+	void RenderRowScalar(uint uTileY, float* const pColor[3], CpuLightPassStats& stats) const;
+	void RenderRowSimd(uint uTileY, float* const pColor[3], CpuLightPassStats& stats) const;
+	// The pixel rows [uBegin, uEnd) of a row of tiles.
+	void GetTileRowPixels(uint uTileY, uint& uBegin, uint& uEnd) const;
+	// The cluster of a pixel in the first depth slice, like the tile ID of LightPassPS or the tile address of TiledLightPassPS.
+	uint GetPixelCluster(uint uPixelX, uint uPixelY) const;
+	// The depth slice of a post-projection depth (GetDepthSlice).
+	uint GetDepthSlice(float z) const;
+	// Load the G-buffer of a pixel, and reconstruct its position in the space of the lights.
+	void LoadPixel(uint uPixelX, uint uPixelY, PixelData& pixel) const;
+	// Loop the lights of a list for a pixel.
+	void ShadePixel(const PixelData& pixel, const ClusteredList& list, bool bFarList, float color[3], CpuLightPassStats& stats) const;
+
+	CpuLightPassKernelType m_kernel;
+	uint m_uTierPolicy;
+	bool m_bViewSpaceLighting;
+	CpuTaskScheduler* m_pScheduler;
+	CpuGBuffer m_gbuffer;
+	CpuLightPassTables m_tables;
+	CpuLightPassStats m_stats;
+
+	// The inputs of the current pass.
+	const ViewData* m_pViewData;
+	const PointLight* m_pLights;
+	const LightShape* m_pShapes;
+	// The view rays, and the lights and the shapes transformed to view space (view-space lighting).
+	CpuViewRays m_viewRays;
+	std::vector<PointLight> m_viewLights;
+	std::vector<LightShape> m_viewShapes;
+};
+
+// The frustum rays of the pixels of an image of uWidth*uHeight pixels.
+void GetLightPassViewRays(const ViewData& viewData, uint uWidth, uint uHeight, CpuViewRays& rays);
+// The view-space depth of a post-projection depth (GetViewDepth), Proj is transposed like the other matrices of ViewData.
+inline float GetLightPassViewDepth(const ViewData& viewData, float z)
+{
+	return viewData.Proj.m[2][3] / (z - viewData.Proj.m[2][2]);
+}
+
+// The instruction set of the SIMD kernel: "AVX2" or "Scalar".
+const char* GetLightPassKernelName();
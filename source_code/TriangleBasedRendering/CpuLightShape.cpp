@@ -0,0 +1,90 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightShape.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuLightShape.h"
+#include <algorithm>
+
+PointLight CreateSpotLight(const float3& pos, const float3& dir, float fRange, float fAngle, const float3& color, LightShape& shape)
+{
+	shape.origin = pos;
+	shape.range = fRange;
+	shape.axis = dir;
+	shape.cosAngle = cosf(fAngle);
+	shape.sinAngle = sinf(fAngle);
+
+	// A cone up to 45 degrees is bounded by the sphere through its apex and its rim, a wider cone by the sphere around
+	// its rim, and a cone over 90 degrees by the sphere of its range.
+	float fCenterDist = 0.0f;
+	PointLight light;
+	light.radius = fRange;
+	if (shape.cosAngle >= shape.sinAngle)
+	{
+		fCenterDist = fRange / (2.0f*shape.cosAngle);
+		light.radius = fCenterDist;
+	}
+	else if (shape.cosAngle > 0.0f)
+	{
+		fCenterDist = fRange*shape.cosAngle;
+		light.radius = fRange*shape.sinAngle;
+	}
+	light.pos = { pos.x + dir.x*fCenterDist, pos.y + dir.y*fCenterDist, pos.z + dir.z*fCenterDist };
+	light.color = color;
+	return light;
+}
+
+PointLight CreateCapsuleLight(const float3& pos0, const float3& pos1, float fRange, const float3& color, LightShape& shape)
+{
+	shape.origin = { (pos0.x + pos1.x)*0.5f, (pos0.y + pos1.y)*0.5f, (pos0.z + pos1.z)*0.5f };
+	shape.range = fRange;
+	shape.axis = { (pos1.x - pos0.x)*0.5f, (pos1.y - pos0.y)*0.5f, (pos1.z - pos0.z)*0.5f };
+	shape.cosAngle = 0.0f;
+	shape.sinAngle = 0.0f;
+
+	PointLight light;
+	light.radius = sqrtf(shape.axis.x*shape.axis.x + shape.axis.y*shape.axis.y + shape.axis.z*shape.axis.z) + fRange;
+	light.pos = shape.origin;
+	light.color = color;
+	return light;
+}
+
+CpuViewLightShape TransformShapeToView(const LightShape& shape, uint uType, const float4x4& view)
+{
+	CpuViewLightShape viewShape;
+	viewShape.origin = TransformToView(shape.origin, view);
+	CpuFloat4 axis = { shape.axis.x, shape.axis.y, shape.axis.z, 0.0f };
+	viewShape.axis = Mul(axis, view);
+	viewShape.axis.w = 0.0f;
+	viewShape.fRange = shape.range;
+	viewShape.fCos = shape.cosAngle;
+	viewShape.fSin = shape.sinAngle;
+	viewShape.uType = uType;
+	return viewShape;
+}
+
+float GetLightShapePlaneDistance(const CpuViewLightShape& shape, const CpuFloat4& plane)
+{
+	float d = GetSignedDistanceFromPlane(shape.origin, plane);
+	float nd = Dot3(plane, shape.axis);
+	if (shape.uType == LightTypeCapsule)
+	{
+		return d - std::abs(nd) - shape.fRange;
+	}
+	// The closest direction of the cone is -n inside the cone, or the edge of the cone in the plane of n and the axis.
+	float fPerp = sqrtf(std::max(1.0f - nd*nd, 0.0f));
+	float fEdge = -nd >= shape.fCos ? -1.0f : std::min(nd*shape.fCos - fPerp*shape.fSin, 0.0f);
+	return d + shape.fRange*fEdge;
+}
+
+bool IsPointInLightShape(const CpuViewLightShape& shape, const CpuFloat4& pos)
+{
+	CpuFloat4 v = Sub3(pos, shape.origin);
+	if (shape.uType == LightTypeCapsule)
+	{
+		// The distance to the closest point of the segment.
+		float t = std::min(std::max(Dot3(v, shape.axis) / std::max(Dot3(shape.axis, shape.axis), 1e-12f), -1.0f), 1.0f);
+		CpuFloat4 d = { v.x - shape.axis.x*t, v.y - shape.axis.y*t, v.z - shape.axis.z*t, 0.0f };
+		return Dot3(d, d) < shape.fRange*shape.fRange;
+	}
+	float fDist = sqrtf(Dot3(v, v));
+	return fDist < shape.fRange && Dot3(v, shape.axis) > shape.fCos*fDist;
+}
@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------
+// File: CpuLightShape.h
+//
+// Spot and capsule lights for the CPU culling reference (LightShape of ClusteredCommon.h), like LightShape.hlsli.
+// The PointLight of a spot or capsule light is its bounding sphere, so the sphere stages of culling don't change,
+// and the shape is only tested against the planes of the clusters its sphere passes (UseLightShapeTests).
+//--------------------------------------------------------------------------------------
+#pragma once
+#include "ShaderTypeDefine.h"
+#include "ClusteredCommon.h"
+#include "CpuShaderMath.h"
+
+// A light shape in view space.
+struct CpuViewLightShape
+{
+	CpuFloat4 origin;
+	CpuFloat4 axis;
+	float fRange;
+	float fCos;
+	float fSin;
+	uint uType;		// LightTypeSpot or LightTypeCapsule.
+};
+
+// Create a spot light whose apex is pos and whose unit direction is dir, fAngle is the half angle of the cone in radians.
+// The shape is written to shape, and the bounding sphere of the cone is returned.
+PointLight CreateSpotLight(const float3& pos, const float3& dir, float fRange, float fAngle, const float3& color, LightShape& shape);
+// Create a capsule light whose segment is [pos0, pos1], the shape is written to shape and its bounding sphere is returned.
+PointLight CreateCapsuleLight(const float3& pos0, const float3& pos1, float fRange, const float3& color, LightShape& shape);
+
+// Transform a light shape to view space.
+CpuViewLightShape TransformShapeToView(const LightShape& shape, uint uType, const float4x4& view);
+// The signed distance from a plane to the closest point of a view-space shape (GetLightShapePlaneDistance).
+float GetLightShapePlaneDistance(const CpuViewLightShape& shape, const CpuFloat4& plane);
+// Does a view-space shape light a view-space position? It is true if the attenuation of the light pass is over 0.
+bool IsPointInLightShape(const CpuViewLightShape& shape, const CpuFloat4& pos);
@@ -0,0 +1,124 @@
+//--------------------------------------------------------------------------------------
+// File: CpuShaderMath.h
+//
+// HLSL intrinsics used by the light culling shaders, rewritten for the CPU.
+// Every function keeps the operation order of the shader code, so the CPU results
+// are the same as the GPU results up to the precision of GPU division and rsqrt.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <cmath>
+#include <cstring>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "ShaderTypeDefine.h"
+
+// A HLSL float4.
+struct CpuFloat4
+{
+	float x;
+	float y;
+	float z;
+	float w;
+};
+
+inline uint AsUint(float f)
+{
+	uint u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+inline float AsFloat(uint u)
+{
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+// firstbitlow(u), the index of the lowest set bit (u must not be 0).
+inline uint FirstBitLow(uint u)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, u);
+	return (uint)index;
+#else
+	return (uint)__builtin_ctz(u);
+#endif
+}
+
+// countbits(u), the number of set bits.
+inline uint CountBits(uint u)
+{
+#if defined(_MSC_VER)
+	return (uint)__popcnt(u);
+#else
+	return (uint)__builtin_popcount(u);
+#endif
+}
+
+inline float Dot3(const CpuFloat4& a, const CpuFloat4& b)
+{
+	return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+inline CpuFloat4 Cross3(const CpuFloat4& a, const CpuFloat4& b)
+{
+	CpuFloat4 r = { a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x, 0.0f };
+	return r;
+}
+
+inline CpuFloat4 Sub3(const CpuFloat4& a, const CpuFloat4& b)
+{
+	CpuFloat4 r = { a.x - b.x, a.y - b.y, a.z - b.z, 0.0f };
+	return r;
+}
+
+// normalize(v) = v * rsqrt(dot(v, v)).
+inline CpuFloat4 Normalize3(const CpuFloat4& v)
+{
+	float invLen = 1.0f / std::sqrt(Dot3(v, v));
+	CpuFloat4 r = { v.x*invLen, v.y*invLen, v.z*invLen, 0.0f };
+	return r;
+}
+
+// mul(p, M) with the row-vector convention of the shaders.
+// The matrices in ViewData are transposed on the C++ side, so column j of the shader matrix is row j of "m".
+inline CpuFloat4 Mul(const CpuFloat4& p, const float4x4& m)
+{
+	CpuFloat4 r;
+	r.x = p.x*m.m[0][0] + p.y*m.m[0][1] + p.z*m.m[0][2] + p.w*m.m[0][3];
+	r.y = p.x*m.m[1][0] + p.y*m.m[1][1] + p.z*m.m[1][2] + p.w*m.m[1][3];
+	r.z = p.x*m.m[2][0] + p.y*m.m[2][1] + p.z*m.m[2][2] + p.w*m.m[2][3];
+	r.w = p.x*m.m[3][0] + p.y*m.m[3][1] + p.z*m.m[3][2] + p.w*m.m[3][3];
+	return r;
+}
+
+// p /= p.w.
+inline CpuFloat4 DivideByW(const CpuFloat4& p)
+{
+	CpuFloat4 r = { p.x / p.w, p.y / p.w, p.z / p.w, p.w / p.w };
+	return r;
+}
+
+// Transform a light position to view space (mul(float4(L.pos, 1), View) and the division by w).
+inline CpuFloat4 TransformToView(const float3& pos, const float4x4& view)
+{
+	CpuFloat4 p = { pos.x, pos.y, pos.z, 1.0f };
+	return DivideByW(Mul(p, view));
+}
+
+// A plane through the origin and the points b and c.
+inline CpuFloat4 CreatePlaneEquation(const CpuFloat4& b, const CpuFloat4& c)
+{
+	CpuFloat4 n = Normalize3(Cross3(b, c));
+	n.w = 0.0f;
+	return n;
+}
+
+// Point-plane distance.
+inline float GetSignedDistanceFromPlane(const CpuFloat4& p, const CpuFloat4& eqn)
+{
+	return Dot3(eqn, p) + eqn.w;
+}
@@ -0,0 +1,217 @@
+//--------------------------------------------------------------------------------------
+// File: CpuTaskScheduler.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuTaskScheduler.h"
+#include <chrono>
+
+static inline unsigned long long PackRange(uint uBegin, uint uEnd)
+{
+	return ((unsigned long long)uEnd << 32) | uBegin;
+}
+
+static inline uint RangeBegin(unsigned long long range)
+{
+	return (uint)(range & 0xffffffff);
+}
+
+static inline uint RangeEnd(unsigned long long range)
+{
+	return (uint)(range >> 32);
+}
+
+CpuTaskScheduler::CpuTaskScheduler()
+{
+	m_uThreadNum = 0;
+	m_pTask = nullptr;
+	m_uJobId = 0;
+	m_uRunningNum = 0;
+	m_bExit = false;
+}
+
+CpuTaskScheduler::~CpuTaskScheduler()
+{
+	Shutdown();
+}
+
+void CpuTaskScheduler::Init(uint uThreadNum)
+{
+	Shutdown();
+
+	if (uThreadNum == 0)
+	{
+		uThreadNum = std::thread::hardware_concurrency();
+		if (uThreadNum == 0)
+		{
+			uThreadNum = 1;
+		}
+	}
+	m_uThreadNum = uThreadNum;
+	m_ranges.reset(new ChunkRange[uThreadNum]);
+	for (uint i = 0; i < uThreadNum; i++)
+	{
+		m_ranges[i].range.store(0);
+	}
+	m_threadStats.assign(uThreadNum, CpuThreadStats());
+
+	// Thread 0 is the calling thread of ParallelFor.
+	m_bExit = false;
+	for (uint i = 1; i < uThreadNum; i++)
+	{
+		m_threads.push_back(std::thread(&CpuTaskScheduler::WorkerThread, this, i));
+	}
+}
+
+void CpuTaskScheduler::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_bExit = true;
+	}
+	m_startCV.notify_all();
+	for (auto& thread : m_threads)
+	{
+		thread.join();
+	}
+	m_threads.clear();
+}
+
+void CpuTaskScheduler::ParallelFor(uint uChunkNum, const Task & task)
+{
+	if (m_uThreadNum == 0)
+	{
+		Init();
+	}
+
+	// Split chunks evenly.
+	for (uint i = 0; i < m_uThreadNum; i++)
+	{
+		uint uBegin = (uint)((unsigned long long)uChunkNum*i / m_uThreadNum);
+		uint uEnd = (uint)((unsigned long long)uChunkNum*(i + 1) / m_uThreadNum);
+		m_ranges[i].range.store(PackRange(uBegin, uEnd));
+		m_threadStats[i] = CpuThreadStats();
+	}
+
+	// Wake up workers.
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_pTask = &task;
+		m_uRunningNum = m_uThreadNum - 1;
+		m_uJobId++;
+	}
+	m_startCV.notify_all();
+
+	RunChunks(0);
+
+	// Wait until all workers are finished.
+	std::unique_lock<std::mutex> locker(m_mutex);
+	m_finishCV.wait(locker, [this] { return m_uRunningNum == 0; });
+	m_pTask = nullptr;
+}
+
+void CpuTaskScheduler::WorkerThread(uint uThreadIdx)
+{
+	unsigned long long uLastJob = 0;
+	while (1)
+	{
+		{
+			std::unique_lock<std::mutex> locker(m_mutex);
+			m_startCV.wait(locker, [&] { return m_bExit || m_uJobId != uLastJob; });
+			if (m_bExit)
+			{
+				return;
+			}
+			uLastJob = m_uJobId;
+		}
+
+		RunChunks(uThreadIdx);
+
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			m_uRunningNum--;
+		}
+		m_finishCV.notify_one();
+	}
+}
+
+void CpuTaskScheduler::RunChunks(uint uThreadIdx)
+{
+	CpuThreadStats& stats = m_threadStats[uThreadIdx];
+	auto begin = std::chrono::high_resolution_clock::now();
+	uint uChunk;
+	while (1)
+	{
+		while (PopChunk(uThreadIdx, uChunk))
+		{
+			(*m_pTask)(uChunk, uThreadIdx);
+			stats.uChunkNum++;
+		}
+		if (!StealChunks(uThreadIdx))
+		{
+			break;
+		}
+		stats.uStealNum++;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	stats.dBusyTime = std::chrono::duration<double>(end - begin).count();
+}
+
+bool CpuTaskScheduler::PopChunk(uint uThreadIdx, uint & uChunk)
+{
+	std::atomic<unsigned long long>& range = m_ranges[uThreadIdx].range;
+	unsigned long long cur = range.load();
+	while (1)
+	{
+		uint uBegin = RangeBegin(cur);
+		uint uEnd = RangeEnd(cur);
+		if (uBegin >= uEnd)
+		{
+			return false;
+		}
+		if (range.compare_exchange_weak(cur, PackRange(uBegin + 1, uEnd)))
+		{
+			uChunk = uBegin;
+			return true;
+		}
+	}
+}
+
+bool CpuTaskScheduler::StealChunks(uint uThreadIdx)
+{
+	while (1)
+	{
+		// Find the victim with the most remaining chunks.
+		uint uVictim = uThreadIdx;
+		uint uMaxNum = 0;
+		unsigned long long victimRange = 0;
+		for (uint i = 0; i < m_uThreadNum; i++)
+		{
+			if (i == uThreadIdx)
+			{
+				continue;
+			}
+			unsigned long long cur = m_ranges[i].range.load();
+			uint uNum = RangeEnd(cur) > RangeBegin(cur) ? RangeEnd(cur) - RangeBegin(cur) : 0;
+			if (uNum > uMaxNum)
+			{
+				uMaxNum = uNum;
+				uVictim = i;
+				victimRange = cur;
+			}
+		}
+		if (uMaxNum == 0)
+		{
+			return false;
+		}
+
+		// Take the back half of the victim's range, the victim keeps working on the front.
+		uint uBegin = RangeBegin(victimRange);
+		uint uEnd = RangeEnd(victimRange);
+		uint uSplit = uEnd - (uEnd - uBegin + 1) / 2;
+		if (m_ranges[uVictim].range.compare_exchange_strong(victimRange, PackRange(uBegin, uSplit)))
+		{
+			// Only this thread writes its own empty range, thieves skip empty ranges.
+			m_ranges[uThreadIdx].range.store(PackRange(uSplit, uEnd));
+			return true;
+		}
+	}
+}
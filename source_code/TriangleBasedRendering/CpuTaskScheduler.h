@@ -0,0 +1,78 @@
+//--------------------------------------------------------------------------------------
+// File: CpuTaskScheduler.h
+//
+// A work-stealing thread pool for CPU light culling.
+// ParallelFor splits chunks evenly between threads, and every thread owns a range of chunks.
+// A thread takes chunks from the front of its range; when its range is empty,
+// it steals the back half of the largest range of another thread.
+// The calling thread works as thread 0, so a scheduler with 1 thread runs tasks in place.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "ShaderTypeDefine.h"
+
+// Statistics of a thread in the last ParallelFor.
+struct CpuThreadStats
+{
+	double dBusyTime;	// Seconds spent in tasks.
+	uint uChunkNum;		// The number of chunks this thread executed.
+	uint uStealNum;		// The number of successful steals.
+};
+
+class CpuTaskScheduler
+{
+public:
+	// A task runs a chunk: task(uChunk, uThreadIdx).
+	typedef std::function<void(uint, uint)> Task;
+
+	CpuTaskScheduler();
+	~CpuTaskScheduler();
+
+	// Create worker threads, 0 uses all hardware threads.
+	void Init(uint uThreadNum = 0);
+	// Stop and join worker threads.
+	void Shutdown();
+
+	// Run a task for every chunk in [0, uChunkNum), and wait until all chunks are finished.
+	void ParallelFor(uint uChunkNum, const Task& task);
+
+	uint GetThreadNum() const { return m_uThreadNum; }
+	// Per-thread statistics of the last ParallelFor.
+	const std::vector<CpuThreadStats>& GetThreadStats() const { return m_threadStats; }
+
+private:
+	// A range of chunks [begin, end) packed in 64 bits (begin in the low 32 bits),
+	// so the owner and thieves can update it with one CAS.
+	// Every range uses its own cache line.
+	struct ChunkRange
+	{
+		std::atomic<unsigned long long> range;
+		char padding[64 - sizeof(std::atomic<unsigned long long>)];
+	};
+
+	void WorkerThread(uint uThreadIdx);
+	// Execute chunks until no range has work left.
+	void RunChunks(uint uThreadIdx);
+	bool PopChunk(uint uThreadIdx, uint& uChunk);
+	bool StealChunks(uint uThreadIdx);
+
+	uint m_uThreadNum;
+	std::vector<std::thread> m_threads;
+	std::unique_ptr<ChunkRange[]> m_ranges;
+	std::vector<CpuThreadStats> m_threadStats;
+
+	// Job data.
+	const Task* m_pTask;
+	std::mutex m_mutex;
+	std::condition_variable m_startCV;
+	std::condition_variable m_finishCV;
+	unsigned long long m_uJobId;
+	uint m_uRunningNum;
+	bool m_bExit;
+};
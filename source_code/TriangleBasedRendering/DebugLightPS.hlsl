@@ -2,6 +2,7 @@
 // File: DebugLightPS.hlsl
 //
 // A pixel shader to show the number of lights for each triangle ( or tile).
+// With depth slices, it shows the number of lights in the cluster of every pixel.
 //--------------------------------------------------------------------------------------
 #include "DeferredRender.hlsli"
 #include "Lighting.hlsli"
@@ -10,18 +11,22 @@ Texture2D gAlbedoTexture : register(t0);
 Texture2D gNormalTexture : register(t1);
 Texture2D gSpecularGlossTexture : register(t2);
 Texture2D gDepth: register(t3);
-StructuredBuffer<ClusteredBuffer> gPerTileLightIndex : register(t5);
+StructuredBuffer<uint> gPerTileLightIndex : register(t5);
 ConstantBuffer<ClusteredData> gCB : register(b2);
 StructuredBuffer<PointLight> gLightSRV : register(t6);
+StructuredBuffer<ClusteredList> gLightListSRV : register(t7);	// Light lists of clusters.
 
 sampler gLinearSample;
 
 float4 main(gs_out pIn) : SV_TARGET
 {
 	float3 color = 0;
+	float z = gDepth[pIn.position.xy].x;
+	// Split lists (LightOverflowSplit) show the size of both halves.
+	uint lightNum = gLightListSRV[pIn.tileID + GetDepthSlice(z, gCB.depthDim)*GetSliceStride(gCB.widthDim, gCB.heightDim)].lightNum & ~ClusteredListSplitBit;
 	uint channelNum = (PerClusterMaxLight / 3);
-	uint colIndex = pIn.tileCounter / channelNum;
-	float remaider = (float)(pIn.tileCounter % channelNum) / (float)(channelNum);
+	uint colIndex = lightNum / channelNum;
+	float remaider = (float)(lightNum % channelNum) / (float)(channelNum);
 
 	if (colIndex > 1)
 	{
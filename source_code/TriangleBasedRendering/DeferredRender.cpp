@@ -59,7 +59,11 @@ void DeferredRender::SetLightCullingMgr(LightClusteredManager & mgr)
 {
 	m_lightIdxCbGpuAdr = mgr.GetClusteredCB()->GetGPUVirtualAddress();
 	m_lightIdxBufferGpuAdr = mgr.GetClusteredBuffer()->GetGPUVirtualAddress();
-	m_lightCounterBufferGpuAdr = mgr.GetCounterBuffer()->GetGPUVirtualAddress();
+	m_lightListBufferGpuAdr = mgr.GetLightListBuffer()->GetGPUVirtualAddress();
+	m_depthPlanesGpuAdr = mgr.GetDepthPlanesBuffer()->GetGPUVirtualAddress();
+	m_tileDiagonalGpuAdr = mgr.GetTileDiagonalBuffer()->GetGPUVirtualAddress();
+	m_viewLightBufferGpuAdr = mgr.GetViewLightBuffer()->GetGPUVirtualAddress();
+	m_viewLightShapeBufferGpuAdr = mgr.GetViewLightShapeBuffer()->GetGPUVirtualAddress();
 }
 
 void DeferredRender::Init()
@@ -390,7 +394,12 @@ void DeferredRender::SetParametersLightPso(ID3D12GraphicsCommandList * const com
 	command->SetGraphicsRootShaderResourceView(2, m_lightIdxBufferGpuAdr);
 	command->SetGraphicsRootShaderResourceView(3, m_lightBufferGpuAdr);
 	command->SetGraphicsRootConstantBufferView(4, m_lightIdxCbGpuAdr);
-	command->SetGraphicsRootShaderResourceView(7, m_lightCounterBufferGpuAdr);
+	command->SetGraphicsRootShaderResourceView(7, m_lightListBufferGpuAdr);
+	command->SetGraphicsRootShaderResourceView(8, m_depthPlanesGpuAdr);
+	command->SetGraphicsRootShaderResourceView(9, m_tileDiagonalGpuAdr);
+	command->SetGraphicsRootShaderResourceView(10, m_lightShapeBufferGpuAdr);
+	command->SetGraphicsRootShaderResourceView(11, m_viewLightBufferGpuAdr);
+	command->SetGraphicsRootShaderResourceView(12, m_viewLightShapeBufferGpuAdr);
 }
 void DeferredRender::ApplyLightAccumulationPso(ID3D12GraphicsCommandList * const command, bool bSetPSO)
 {
@@ -417,6 +426,11 @@ void DeferredRender::SetLightBuffer(ID3D12Resource* const lightBuffer)
 	m_lightBufferGpuAdr = lightBuffer->GetGPUVirtualAddress();
 }
 
+void DeferredRender::SetLightShapeBuffer(ID3D12Resource* const shapeBuffer)
+{
+	m_lightShapeBufferGpuAdr = shapeBuffer->GetGPUVirtualAddress();
+}
+
 void DeferredRender::UpdateConstantBuffer(const ViewData& camData)
 {
 	void* mapped = nullptr;
@@ -533,7 +547,7 @@ void DeferredRender::CreateLightPassPsO()
 
 void DeferredRender::CreateRootSignature()
 {
-	// Total Root Parameter Count: 7.
+	// Total Root Parameter Count: 13.
 	// [0] : CBV for the camera data (b0)
 	// --------------------------------------
 	// [1] : Descriptor Table for G-buffer. Total Range Count: 1
@@ -544,7 +558,7 @@ void DeferredRender::CreateRootSignature()
 	// [1][0][2] : SRV for specular+gloss texture data (t2)
 	// [1][0][3] : SRV for depth texture (t3)
 	// --------------------------------------
-	// [2] : SRV for light indexed buffer (t5)
+	// [2] : SRV for light indexed buffer (packed light indexes) (t5)
 	// [3] : SRV for light buffer (t6)
 	// [4] : CBV for culling data (b2)
 	// [5] : Descriptor Table for material data. Total Range Count: 1
@@ -558,7 +572,13 @@ void DeferredRender::CreateRootSignature()
 	// [6][0] : Sampler Range Count : 1
 	// [6][0][0] : Sampler for sampling textures of materials (s0)
 	// --------------------------------------
-	CD3DX12_ROOT_PARAMETER rootParameters[8];
+	// [7] : SRV for light list buffer (t7)
+	// [8] : SRV for depth planes of clusters (t8)
+	// [9] : SRV for diagonal bits of tiles (t9)
+	// [10] : SRV for shapes of spot and capsule lights (t10)
+	// [11] : SRV for view-space lights (t11)
+	// [12] : SRV for view-space shapes of spot and capsule lights (t12)
+	CD3DX12_ROOT_PARAMETER rootParameters[13];
 	CD3DX12_DESCRIPTOR_RANGE range[4];
 	// Camera data CBV.
 	rootParameters[0].InitAsConstantBufferView(0);
@@ -572,8 +592,8 @@ void DeferredRender::CreateRootSignature()
 
 	// Light data.
 	rootParameters[3].InitAsShaderResourceView(6);
-	// Light culling data.
-	rootParameters[4].InitAsConstantBufferView(2,0, D3D12_SHADER_VISIBILITY_PIXEL);
+	// Light culling data, geometry shaders use it to find clusters in depth slices.
+	rootParameters[4].InitAsConstantBufferView(2);
 
 	// All materials' SRVs for G-buffer creation.
 	range[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, -1, 0, 1);
@@ -583,9 +603,22 @@ void DeferredRender::CreateRootSignature()
 	range[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER, 1, 0);
 	rootParameters[6].InitAsDescriptorTable(1, &range[3], D3D12_SHADER_VISIBILITY_PIXEL);
 
-	// Light indexed buffer.
+	// Light list buffer (offsets and numbers of clusters in light indexed buffer).
 	rootParameters[7].InitAsShaderResourceView(7);
 
+	// Depth planes of clusters.
+	rootParameters[8].InitAsShaderResourceView(8, 0, D3D12_SHADER_VISIBILITY_PIXEL);
+
+	// Diagonal bits of tiles, the geometry shader rebuilds the triangles of tiles with them.
+	rootParameters[9].InitAsShaderResourceView(9, 0, D3D12_SHADER_VISIBILITY_GEOMETRY);
+
+	// Shapes of spot and capsule lights.
+	rootParameters[10].InitAsShaderResourceView(10, 0, D3D12_SHADER_VISIBILITY_PIXEL);
+
+	// View-space lights and shapes of LightTransformCS, the light passes read them with UseViewSpaceLighting.
+	rootParameters[11].InitAsShaderResourceView(11, 0, D3D12_SHADER_VISIBILITY_PIXEL);
+	rootParameters[12].InitAsShaderResourceView(12, 0, D3D12_SHADER_VISIBILITY_PIXEL);
+
 	CD3DX12_ROOT_SIGNATURE_DESC descRootSignature;
 	descRootSignature.Init(_countof(rootParameters), rootParameters, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
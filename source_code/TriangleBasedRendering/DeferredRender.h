@@ -32,6 +32,7 @@ public:
 	void SetMaterials(MaterialManager& materialMgr, bool bUploadToDefault = true);
 	void SetLightCullingMgr(LightClusteredManager& materialMgr);
 	void SetLightBuffer(ID3D12Resource* const lightBuffer);
+	void SetLightShapeBuffer(ID3D12Resource* const shapeBuffer);
 	
 
 	const D3D12_GPU_VIRTUAL_ADDRESS GetViewCbGpuHandle() { return m_viewCb->GetGPUVirtualAddress(); } // I should use a camera manager to manage this constant buffer.
@@ -111,9 +112,14 @@ private:
 	ScreenQuadRenderer m_quadRenderer;
 
 	D3D12_GPU_VIRTUAL_ADDRESS m_lightBufferGpuAdr;
+	D3D12_GPU_VIRTUAL_ADDRESS m_lightShapeBufferGpuAdr;
 	D3D12_GPU_VIRTUAL_ADDRESS m_lightIdxBufferGpuAdr;
-	D3D12_GPU_VIRTUAL_ADDRESS m_lightCounterBufferGpuAdr;
+	D3D12_GPU_VIRTUAL_ADDRESS m_lightListBufferGpuAdr;
 	D3D12_GPU_VIRTUAL_ADDRESS m_lightIdxCbGpuAdr;
+	D3D12_GPU_VIRTUAL_ADDRESS m_depthPlanesGpuAdr;
+	D3D12_GPU_VIRTUAL_ADDRESS m_tileDiagonalGpuAdr;
+	D3D12_GPU_VIRTUAL_ADDRESS m_viewLightBufferGpuAdr;
+	D3D12_GPU_VIRTUAL_ADDRESS m_viewLightShapeBufferGpuAdr;
 
 
 	// [0] : CBV for the camera data (b0)
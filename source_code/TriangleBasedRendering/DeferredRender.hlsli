@@ -7,6 +7,142 @@
 #include "CameraCommon.h"
 
 ConstantBuffer<ViewData> gViewCB : register(b0);
+StructuredBuffer<float> gDepthPlanes : register(t8);	// Depth planes of clusters (depthDim+1 post-projection depths).
+StructuredBuffer<uint> gTileDiagonals : register(t9);	// Diagonal bits of tiles (a bit per tile, set for TileSubdivisionAntiDiagonal).
+StructuredBuffer<ViewLight> gViewLightSRV : register(t11);	// View-space lights (LightTransformCS), read with UseViewSpaceLighting.
+StructuredBuffer<LightShape> gViewLightShapeSRV : register(t12);	// View-space shapes of spot and capsule lights.
+
+// Find the depth slice of a post-projection depth.
+uint GetDepthSlice(float z, uint depthDim)
+{
+	uint slice = 0;
+	for (uint i = 1; i < depthDim; i++)
+	{
+		slice = z >= gDepthPlanes[i] ? i : slice;
+	}
+	return slice;
+}
+
+// The view-space depth of a post-projection depth, for the perspective projections of the camera (Proj[2][3] = 1).
+float GetViewDepth(float z)
+{
+	return gViewCB.Proj[3][2] / (z - gViewCB.Proj[2][2]);
+}
+
+// The frustum ray of a post-projection position at view-space z = 1 (the view-ray reconstruction of the light passes).
+float3 GetViewRay(float2 projPos)
+{
+	float4 vertex = mul(float4(projPos, 0, 1), gViewCB.ProjInv);
+	return vertex.xyz / vertex.z;
+}
+
+// The center (xyz) and the radius (w) of a light in the space of the light pass, view space with UseViewSpaceLighting.
+float4 LoadLightSphere(StructuredBuffer<PointLight> lights, uint lightIdx)
+{
+	[branch]
+	if (UseViewSpaceLighting)
+	{
+		ViewLight V = gViewLightSRV[lightIdx];
+		return float4(V.center, V.radius);
+	}
+	PointLight L = lights[lightIdx];
+	return float4(L.pos, L.radius);
+}
+
+// The shape of a spot or capsule light in the space of the light pass, view space with UseViewSpaceLighting.
+LightShape LoadLightShape(StructuredBuffer<LightShape> shapes, uint shapeIdx)
+{
+	[branch]
+	if (UseViewSpaceLighting)
+	{
+		return gViewLightShapeSRV[shapeIdx];
+	}
+	return shapes[shapeIdx];
+}
+
+// The distance between the clusters of a triangle (or tile) in two adjacent depth slices.
+uint GetSliceStride(uint widthDim, uint heightDim)
+{
+	return widthDim*heightDim*TilePrimitiveNum;
+}
+
+// Load a light index (or a value of a split list header) from a slot of the packed light indexes, a slot is 16-bit with UseLightIndex16.
+uint LoadLightIndex(StructuredBuffer<uint> lightIndexes, uint slot)
+{
+	return GetPackedLightIndex(lightIndexes[GetLightIndexWord(slot)], slot);
+}
+
+// The light list of a pixel at post-projection depth z, a split list (LightOverflowSplit) has a list per half of its cluster.
+// The far list of a split list is written backwards, so farList is set for it.
+ClusteredList GetPixelLightList(ClusteredList list, float z, StructuredBuffer<uint> lightIndexes, out bool farList)
+{
+	farList = false;
+	[branch]
+	if (list.lightNum & ClusteredListSplitBit)
+	{
+		float splitZ = asfloat(lightIndexes[GetLightIndexWord(list.offset)]);
+		farList = z >= splitZ;
+		list = GetSplitLightList(list, z, splitZ, LoadLightIndex(lightIndexes, list.offset + ClusteredSplitHeaderSize - 2),
+			LoadLightIndex(lightIndexes, list.offset + ClusteredSplitHeaderSize - 1));
+	}
+	return list;
+}
+
+// The first light of a list ordered by type whose index isn't below lightOffset (or, for a reversed list, is below lightOffset).
+uint FindLightTypeBoundary(ClusteredList list, uint lightOffset, bool reversed, StructuredBuffer<uint> lightIndexes)
+{
+	uint first = 0;
+	uint last = list.lightNum;
+	while (first < last)
+	{
+		uint mid = (first + last) / 2;
+		[flatten]
+		if ((LoadLightIndex(lightIndexes, list.offset + mid) >= lightOffset) != reversed)
+		{
+			last = mid;
+		}
+		else
+		{
+			first = mid + 1;
+		}
+	}
+	return first;
+}
+
+// The [begin, end) range of the lights of every type in a light list. Culling appends lights type by type, so lists
+// have point lights first, then spot and capsule lights, and far lists of split lists are in the reverse order.
+void GetLightTypeRanges(ClusteredList list, bool farList, ClusteredData cd, StructuredBuffer<uint> lightIndexes,
+	out uint2 ranges[LightTypeNum])
+{
+	ranges[LightTypePoint] = uint2(0, list.lightNum);
+	ranges[LightTypeSpot] = uint2(list.lightNum, list.lightNum);
+	ranges[LightTypeCapsule] = uint2(list.lightNum, list.lightNum);
+	[branch]
+	if (cd.spotLightNum + cd.capsuleLightNum > 0)
+	{
+		uint spotBoundary = FindLightTypeBoundary(list, GetLightTypeOffset(cd.lightNum, cd.spotLightNum, cd.capsuleLightNum, LightTypeSpot),
+			farList, lightIndexes);
+		uint capsuleBoundary = FindLightTypeBoundary(list, GetLightTypeOffset(cd.lightNum, cd.spotLightNum, cd.capsuleLightNum, LightTypeCapsule),
+			farList, lightIndexes);
+		ranges[LightTypePoint] = farList ? uint2(spotBoundary, list.lightNum) : uint2(0, spotBoundary);
+		ranges[LightTypeSpot] = farList ? uint2(capsuleBoundary, spotBoundary) : uint2(spotBoundary, capsuleBoundary);
+		ranges[LightTypeCapsule] = farList ? uint2(0, capsuleBoundary) : uint2(capsuleBoundary, list.lightNum);
+	}
+}
+
+// The subdivision pattern of a tile, with UseTileDiagonalBits every tile uses the diagonal selected by light culling.
+uint GetTilePattern(uint tileIdx)
+{
+	return UseTileDiagonalBits ? GetTileDiagonalPattern((gTileDiagonals[tileIdx / 32] >> (tileIdx % 32)) & 0x1) : TileSubdivision;
+}
+
+// The cluster of a triangle of the tile mesh (SV_PrimitiveID) in the first depth slice.
+// Triangles of the same primitive (e.g. two triangles of a quad) share a cluster.
+uint GetTriangleCluster(uint triangleIdx)
+{
+	uint tileIdx = triangleIdx / TileTriangleNum;
+	return tileIdx*TilePrimitiveNum + TilePatternTrianglePrimitive[GetTilePattern(tileIdx)*TileMaxPrimitiveNum + triangleIdx % TileTriangleNum];
+}
 
 struct vs_in {
 	float4 position : POSITION;
@@ -16,8 +152,39 @@ struct vs_in {
 struct gs_in {
 	float4 position : SV_POSITION;
 	float2 texcoord : TEXCOORD;
+	float3 viewRay : TEXCOORD1;	// The frustum ray at view-space z = 1 (UseViewSpaceLighting).
 };
 
+// Rebuild a triangle of the tile mesh (created with TileSubdivision) for the pattern of its tile.
+// The mesh triangle has 3 corners of the tile, and the last corner completes the parallelogram.
+void GetTileTriangle(uint triangleIdx, inout gs_in vertexes[3])
+{
+	uint triangleInTile = triangleIdx % TileTriangleNum;
+	uint pattern = GetTilePattern(triangleIdx / TileTriangleNum);
+	[branch]
+	if (pattern == TileSubdivision)
+	{
+		return;
+	}
+	gs_in corners[4];
+	uint missing = 6;
+	[unroll]
+	for (uint i = 0; i < 3; i++)
+	{
+		uint corner = TilePatternTriangleCorners[(TileSubdivision*TileMaxPrimitiveNum + triangleInTile) * 3 + i];
+		corners[corner] = vertexes[i];
+		missing -= corner;
+	}
+	corners[missing].position = corners[missing ^ 1].position + corners[missing ^ 2].position - corners[missing ^ 3].position;
+	corners[missing].texcoord = corners[missing ^ 1].texcoord + corners[missing ^ 2].texcoord - corners[missing ^ 3].texcoord;
+	corners[missing].viewRay = corners[missing ^ 1].viewRay + corners[missing ^ 2].viewRay - corners[missing ^ 3].viewRay;
+	[unroll]
+	for (uint j = 0; j < 3; j++)
+	{
+		vertexes[j] = corners[TilePatternTriangleCorners[(pattern*TileMaxPrimitiveNum + triangleInTile) * 3 + j]];
+	}
+}
+
 struct ps_output
 {
 	float3 albedo : SV_TARGET0;
@@ -30,6 +197,7 @@ struct gs_out {
 	float2 texcoord : TEXCOORD0;
 	nointerpolation uint tileID : TEXCOORD1;
 	nointerpolation uint tileCounter : TEXCOORD2;
+	float3 viewRay : TEXCOORD4;	// The frustum ray at view-space z = 1, interpolated linearly in screen space.
 	//nointerpolation uint tileBaseID : TEXCOORD3;
 };
 
@@ -0,0 +1,18 @@
+//--------------------------------------------------------------------------------------
+// File: DepthBin.hlsli
+//
+// Depth bins of tiles (2.5D culling), for the depth pyramid (DepthPyramidCS) and the culling shaders.
+//--------------------------------------------------------------------------------------
+
+// The depth bin of a view-space depth, bins split the depth range of a cluster evenly (2.5D culling).
+uint GetDepthBin(float viewZ, float binNearZ, float invBinSize)
+{
+	return (uint)clamp(floor((viewZ - binNearZ)*invBinSize), 0, DepthBinNum - 1);
+}
+
+// The center of a loaded pixel in a tile, (1, 1) is the bottom-right corner.
+float2 GetTilePixelUv(uint i, float2 tilePos, float2 tileSize)
+{
+	float2 texel = floor(float2(tilePos.x + 0.5f + i % TileSize, tilePos.y + 0.5f + i / TileSize));
+	return (texel + 0.5f - tilePos) / tileSize;
+}
@@ -0,0 +1,209 @@
+//--------------------------------------------------------------------------------------
+// File: DepthPyramidCS.hlsl
+//
+// A compute shader to build level 0 of the depth pyramid, a group per tile.
+// A tile loads the same TileSize*TileSize texels as the culling shaders, every thread reduces its texels in registers,
+// then the group reduces the threads with one atomic per thread (instead of one per texel).
+// DepthPyramidReduceCS builds the other levels. With UseLightScatter, a group also clears the light mask of its tile
+// before LightScatterCS.
+// With UseDepthPyramid, a group also selects the diagonal of its tile (UseTileDiagonalBits) and builds the depth bins of
+// the tile in all depth slices, so the culling shaders of every slice and both passes read them instead of the texels.
+//--------------------------------------------------------------------------------------
+#include "ClusteredCommon.h"
+#include "CameraCommon.h"
+#include "DepthBin.hlsli"
+
+ConstantBuffer<ClusteredData> gCB : register(b0);	// Light culling information.
+ConstantBuffer<ViewData> gViewCB : register(b1);		// Camera data.
+StructuredBuffer<float> gDepthPlaneSRV : register(t1);	// Depth planes for clustered lighting.
+Texture2D<float> gDepthBuffer : register(t2);
+RWStructuredBuffer<uint> gTileDiagonalUAV : register(u3);	// Diagonal bits of tiles (a bit per tile, set for TileSubdivisionAntiDiagonal).
+RWStructuredBuffer<DepthBounds> gDepthPyramidUAV : register(u4);	// All levels of the depth pyramid.
+RWStructuredBuffer<uint> gTileLightMaskUAV : register(u7);	// Light masks of tiles (LightScatterCS).
+RWStructuredBuffer<uint> gClusterDepthBinUAV : register(u11);	// Depth bins of clusters, an element per primitive.
+
+groupshared uint ldsZMin;
+groupshared uint ldsZMax;
+groupshared float ldsDepth[TileSize*TileSize];
+// The min/max depth of the two triangles of both diagonals, and the selected pattern of the tile.
+groupshared uint ldsDiagZMin[4];
+groupshared uint ldsDiagZMax[4];
+groupshared uint ldsTilePattern;
+// The clipped depth range of every slice, its near view-space depth and the inverse size of its bins.
+groupshared float2 ldsSliceRange[ClusteredDepthNum];
+groupshared float ldsBinNearZ[ClusteredDepthNum];
+groupshared float ldsInvBinSize[ClusteredDepthNum];
+// Depth bins occupied by pixels of every primitive of every slice.
+groupshared uint ldsDepthBin[ClusteredDepthNum][TilePrimitiveNum];
+
+// Convert a point from post-projection space into view space.
+float4 ConvertProjToView(float4 p)
+{
+	p = mul(p, gViewCB.ProjInv);
+	p /= p.w;
+	return p;
+}
+
+[numthreads(NumThreadX, NumThreadY, 1)]
+void main(uint3 Gid : SV_GroupID, uint Gindex : SV_GroupIndex)
+{
+	float x = gCB.tileSizeX*Gid.x;
+	float y = gCB.tileSizeY*Gid.y;
+	uint tileIdx = Gid.x + Gid.y*gCB.widthDim;
+	uint tileNum = gCB.widthDim*gCB.heightDim;
+
+	if (Gindex == 0)
+	{
+		ldsZMin = 0x7f7fffff;
+		ldsZMax = 0;
+		for (uint k = 0; k < 4; k++)
+		{
+			ldsDiagZMin[k] = 0x7f7fffff;
+			ldsDiagZMax[k] = 0;
+		}
+		ldsTilePattern = TileSubdivision;
+	}
+	for (uint b = Gindex; b < ClusteredDepthNum*TilePrimitiveNum; b += NUM_THREADS_PER_TILE)
+	{
+		ldsDepthBin[b / TilePrimitiveNum][b % TilePrimitiveNum] = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	[branch]
+	if (UseLightScatter)
+	{
+		for (uint w = Gindex; w < TileLightMaskWordNum; w += NUM_THREADS_PER_TILE)
+		{
+			gTileLightMaskUAV[tileIdx*TileLightMaskWordNum + w] = 0;
+		}
+	}
+
+	// Start at the first pixel whose center is in the tile, and loading outside of the texture returns 0.
+	// Depth values are non-negative, so the float min/max is equal to the uint min/max.
+	uint width, height;
+	gDepthBuffer.GetDimensions(width, height);
+	float zMin = asfloat(0x7f7fffff);
+	float zMax = 0;
+	for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+	{
+		float tileThreadIdxY = i / TileSize;
+		float tileThreadIdxX = i % TileSize;
+		float depth = gDepthBuffer[float2(x + 0.5f + tileThreadIdxX, y + 0.5f + tileThreadIdxY)].x;
+		ldsDepth[i] = depth;
+		zMin = min(zMin, depth);
+		zMax = max(zMax, depth);
+		// The depth range of the triangles of both diagonals, loaded pixels outside of the tile belong to other tiles.
+		[branch]
+		if (UseDepthPyramid && UseTileDiagonalBits)
+		{
+			float2 uv = GetTilePixelUv(i, float2(x, y), float2(gCB.tileSizeX, gCB.tileSizeY));
+			float2 texel = floor(float2(x + 0.5f + tileThreadIdxX, y + 0.5f + tileThreadIdxY));
+			if (all(uv >= 0.0f) && all(uv < 1.0f) && texel.x < width && texel.y < height)
+			{
+				[unroll]
+				for (uint c = 0; c < 2; c++)
+				{
+					uint idx = c * 2 + GetTilePrimitive(GetTileDiagonalPattern(c), uv.x, uv.y);
+					InterlockedMin(ldsDiagZMin[idx], asuint(depth));
+					InterlockedMax(ldsDiagZMax[idx], asuint(depth));
+				}
+			}
+		}
+	}
+	InterlockedMin(ldsZMin, asuint(zMin));
+	InterlockedMax(ldsZMax, asuint(zMax));
+	GroupMemoryBarrierWithGroupSync();
+
+	if (Gindex == 0)
+	{
+		DepthBounds bounds;
+		bounds.zMin = asfloat(ldsZMin);
+		bounds.zMax = asfloat(ldsZMax);
+		gDepthPyramidUAV[tileIdx] = bounds;
+	}
+	// Without UseDepthPyramid, the culling shaders load the texels of tiles again.
+	[branch]
+	if (!UseDepthPyramid)
+	{
+		return;
+	}
+
+	// Select the diagonal whose triangles have the smaller sum of view-space depth ranges, ties keep the default diagonal.
+	// Other tiles of the word write other bits.
+	[branch]
+	if (UseTileDiagonalBits && Gindex == 0)
+	{
+		float cost[2] = { 0, 0 };
+		[unroll]
+		for (uint k = 0; k < 4; k++)
+		{
+			if (ldsDiagZMin[k] <= ldsDiagZMax[k])
+			{
+				cost[k / 2] += ConvertProjToView(float4(0, 0, asfloat(ldsDiagZMax[k]), 1)).z -
+					ConvertProjToView(float4(0, 0, asfloat(ldsDiagZMin[k]), 1)).z;
+			}
+		}
+		ldsTilePattern = cost[1] < cost[0] ? TileSubdivisionAntiDiagonal : TileSubdivisionDiagonal;
+		uint mask = 1u << (tileIdx % 32);
+		if (ldsTilePattern == TileSubdivisionAntiDiagonal)
+		{
+			InterlockedOr(gTileDiagonalUAV[tileIdx / 32], mask);
+		}
+		else
+		{
+			InterlockedAnd(gTileDiagonalUAV[tileIdx / 32], ~mask);
+		}
+	}
+	// Clip the depth range of the tile by every depth slice, bins split the view-space depth range of a cluster evenly.
+	for (uint s = Gindex; s < ClusteredDepthNum; s += NUM_THREADS_PER_TILE)
+	{
+		float z0 = max(asfloat(ldsZMin), gDepthPlaneSRV[s]);
+		float z1 = min(asfloat(ldsZMax), gDepthPlaneSRV[s + 1]);
+		float binNearZ = ConvertProjToView(float4(0, 0, z0, 1)).z;
+		float binFarZ = ConvertProjToView(float4(0, 0, z1, 1)).z;
+		ldsSliceRange[s] = float2(z0, z1);
+		ldsBinNearZ[s] = binNearZ;
+		ldsInvBinSize[s] = binFarZ > binNearZ ? DepthBinNum / (binFarZ - binNearZ) : 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+	uint tilePattern = ldsTilePattern;
+
+	// 2.5D culling: mark the depth bins occupied by pixels in the slices of their depth, pixels near a diagonal mark the
+	// bins of the primitives of both sides.
+	[branch]
+	if (UseDepthBinCulling)
+	{
+		for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+		{
+			float depth = ldsDepth[i];
+			float viewZ = ConvertProjToView(float4(0, 0, depth, 1)).z;
+			float2 uv = GetTilePixelUv(i, float2(x, y), float2(gCB.tileSizeX, gCB.tileSizeY));
+			uint sides = GetTileSplitSides(uv.x, uv.y, DepthBinDiagonalTolerance);
+			for (uint z = 0; z < ClusteredDepthNum; z++)
+			{
+				if (depth >= ldsSliceRange[z].x && depth <= ldsSliceRange[z].y)
+				{
+					uint bin = 1u << GetDepthBin(viewZ, ldsBinNearZ[z], ldsInvBinSize[z]);
+					[unroll]
+					for (uint p = 0; p < TilePrimitiveNum; p++)
+					{
+						if ((TilePatternSplitPlanes[tilePattern*TileMaxPrimitiveNum + p] & ~sides) == 0)
+						{
+							InterlockedOr(ldsDepthBin[z][p], bin);
+						}
+					}
+				}
+			}
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	// Store the bins of all clusters of the tile, without 2.5D culling all lights overlap the bins.
+	for (uint n = Gindex; n < ClusteredDepthNum*TilePrimitiveNum; n += NUM_THREADS_PER_TILE)
+	{
+		uint slice = n / TilePrimitiveNum;
+		uint primitive = n % TilePrimitiveNum;
+		gClusterDepthBinUAV[(tileIdx + slice*tileNum)*TilePrimitiveNum + primitive] =
+			UseDepthBinCulling ? ldsDepthBin[slice][primitive] : 0xffffffff;
+	}
+}
@@ -0,0 +1,48 @@
+//--------------------------------------------------------------------------------------
+// File: DepthPyramidReduceCS.hlsl
+//
+// A compute shader to build a level of the depth pyramid from the level below it, a thread per cell.
+// A cell covers 2x2 cells of the level below, and cells at the right or bottom edge cover fewer cells.
+// It runs once per level after DepthPyramidCS, and every level waits for the UAV writes of the last level.
+//--------------------------------------------------------------------------------------
+#include "ClusteredCommon.h"
+
+struct DepthPyramidLevel
+{
+	uint level;
+};
+
+ConstantBuffer<ClusteredData> gCB : register(b0);	// Light culling information.
+ConstantBuffer<DepthPyramidLevel> gLevelCB : register(b2);	// The level to build (> 0).
+RWStructuredBuffer<DepthBounds> gDepthPyramidUAV : register(u4);	// All levels of the depth pyramid.
+
+[numthreads(NumThreadX, NumThreadY, 1)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	uint level = gLevelCB.level;
+	uint width = GetDepthPyramidLevelSize(gCB.widthDim, level);
+	uint height = GetDepthPyramidLevelSize(gCB.heightDim, level);
+	if (DTid.x >= width || DTid.y >= height)
+	{
+		return;
+	}
+
+	uint srcWidth = GetDepthPyramidLevelSize(gCB.widthDim, level - 1);
+	uint srcHeight = GetDepthPyramidLevelSize(gCB.heightDim, level - 1);
+	uint srcOffset = GetDepthPyramidLevelOffset(gCB.widthDim, gCB.heightDim, level - 1);
+	DepthBounds bounds;
+	bounds.zMin = asfloat(0x7f7fffff);
+	bounds.zMax = 0;
+	[unroll]
+	for (uint k = 0; k < 4; k++)
+	{
+		uint2 src = DTid.xy * 2 + uint2(k & 1, k >> 1);
+		if (src.x < srcWidth && src.y < srcHeight)
+		{
+			DepthBounds srcBounds = gDepthPyramidUAV[srcOffset + src.x + src.y*srcWidth];
+			bounds.zMin = min(bounds.zMin, srcBounds.zMin);
+			bounds.zMax = max(bounds.zMax, srcBounds.zMax);
+		}
+	}
+	gDepthPyramidUAV[srcOffset + srcWidth*srcHeight + DTid.x + DTid.y*width] = bounds;
+}
@@ -5,6 +5,7 @@
 #include "d3dx12.h"
 #include "ShaderManager.h"
 #include <time.h>
+#include <math.h>
 
 using namespace Microsoft::WRL;
 
@@ -15,9 +16,14 @@ void LightClusteredManager::Init(int width, int height, int depth)
 	m_uNumPixelPerTileX = width;
 	m_uNumPixelPerTileY = height;
 	m_uDepth = depth;
+	m_bCullingDirty = true;
+	memset(&m_culledViewData, 0, sizeof(m_culledViewData));
+	memset(&m_tilePlaneProjInv, 0, sizeof(m_tilePlaneProjInv));
+	m_iSpotLightNum = 0;
+	m_iCapsuleLightNum = 0;
 
 	// Create a heap class to store all resource views.
-	m_viewsHeap.Create(g_d3dObjects->GetD3DDevice(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, 10, true);
+	m_viewsHeap.Create(g_d3dObjects->GetD3DDevice(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, 16, true);
 
 	// Create rendering pipeline data.
 	CreateRootSignature();
@@ -30,6 +36,12 @@ void LightClusteredManager::Init(int width, int height, int depth)
 
 void LightClusteredManager::RunLightCullingCS(ID3D12GraphicsCommandList * const command)
 {
+	// The lists of the last culling are still valid.
+	if (!m_bCullingDirty.exchange(false) && UseIncrementalCulling)
+	{
+		return;
+	}
+
 	ID3D12DescriptorHeap* ppHeaps[1] = { m_viewsHeap.pDH.Get() };
 	command->SetDescriptorHeaps(1, ppHeaps);
 	command->SetComputeRootSignature(m_rootSignature.Get());
@@ -38,16 +50,105 @@ void LightClusteredManager::RunLightCullingCS(ID3D12GraphicsCommandList * const
 	command->SetComputeRootConstantBufferView(1, m_camCbGpuAdr);
 	command->SetComputeRootConstantBufferView(2, m_clusteredCB->GetGPUVirtualAddress());
 
-	command->SetPipelineState(m_lightCullPso.Get());
+	// Build the planes of tiles through the camera, only after the window or the projection changed.
+	if (UseTilePlaneTable && m_bTilePlanesDirty.exchange(false))
+	{
+		command->SetPipelineState(m_tilePlanePso.Get());
+		command->Dispatch((m_uWidth + NumThreadX - 1) / NumThreadX, (m_uHeight + NumThreadY - 1) / NumThreadY, 1);
+		AddUavBarrier(command, m_tilePlaneBuffer.Get());
+	}
+	// Transform lights to view space once, the stages below read the view-space lights.
+	if (UseViewSpaceLights && m_iLightNum > 0)
+	{
+		command->SetPipelineState(m_lightTransformPso.Get());
+		command->Dispatch((m_iLightNum + LightTransformGroupSize - 1) / LightTransformGroupSize, 1, 1);
+		AddUavBarrier(command, m_viewLightBuffer.Get());
+		AddUavBarrier(command, m_viewLightShapeBuffer.Get());
+	}
+	// Build the depth pyramid, every level reads the level below it. Level 0 also clears the light masks of tiles, and
+	// builds the diagonal bits and the depth bins of tiles for the culling shaders (UseDepthPyramid).
+	if (UseDepthPyramid || UseLightOcclusion || UseLightScatter)
+	{
+		command->SetPipelineState(m_depthPyramidPso.Get());
+		command->Dispatch(m_uWidth, m_uHeight, 1);
+		AddUavBarrier(command, m_depthPyramidBuffer.Get());
+		AddUavBarrier(command, m_tileDiagonalBuffer.Get());
+		AddUavBarrier(command, m_clusterDepthBinBuffer.Get());
+		command->SetPipelineState(m_depthPyramidReducePso.Get());
+		for (UINT level = 1; level < GetDepthPyramidLevelNum(m_uWidth, m_uHeight); level++)
+		{
+			command->SetComputeRoot32BitConstant(3, level, 0);
+			command->Dispatch((GetDepthPyramidLevelSize(m_uWidth, level) + NumThreadX - 1) / NumThreadX,
+				(GetDepthPyramidLevelSize(m_uHeight, level) + NumThreadY - 1) / NumThreadY, 1);
+			AddUavBarrier(command, m_depthPyramidBuffer.Get());
+		}
+	}
+	// Reject lights behind the depth pyramid.
+	if (UseLightOcclusion && m_iLightNum > 0)
+	{
+		command->SetPipelineState(m_lightOcclusionPso.Get());
+		command->Dispatch((m_iLightNum + LightOcclusionGroupSize - 1) / LightOcclusionGroupSize, 1, 1);
+		AddUavBarrier(command, m_lightVisibilityBuffer.Get());
+	}
+	// Set the bits of lights in the light masks of the tiles under them.
+	if (UseLightScatter && m_iLightNum > 0)
+	{
+		command->SetPipelineState(m_lightScatterPso.Get());
+		command->Dispatch((m_iLightNum + LightScatterGroupSize - 1) / LightScatterGroupSize, 1, 1);
+		AddUavBarrier(command, m_tileLightMaskBuffer.Get());
+	}
 
+	// 1. Count lights of every cluster.
+	command->SetPipelineState(m_lightCountPso.Get());
 	command->Dispatch(m_uWidth, m_uHeight, m_uDepth);
+	AddUavBarrier(command, m_lightCounterBuffer.Get());
+
+	// 2. Allocate light lists with an exclusive prefix sum of counters, and write the overflow statistics.
+	command->SetPipelineState(m_lightScanPso.Get());
+	command->Dispatch(1, 1, 1);
+	AddUavBarrier(command, m_lightListBuffer.Get());
+
+	// 3. Write light indexes into the lists.
+	command->SetPipelineState(m_lightCullPso.Get());
+	command->Dispatch(m_uWidth, m_uHeight, m_uDepth);
+}
+
+void LightClusteredManager::UpdateViewData(const ViewData & viewData)
+{
+	// ViewData only has floats.
+	// The tile plane table only depends on the projection, any change builds it again.
+	if (memcmp(&viewData.ProjInv, &m_tilePlaneProjInv, sizeof(float4x4)) != 0)
+	{
+		m_tilePlaneProjInv = viewData.ProjInv;
+		m_bTilePlanesDirty = true;
+	}
+	const float* pNew = (const float*)&viewData;
+	const float* pOld = (const float*)&m_culledViewData;
+	for (UINT i = 0; i < sizeof(ViewData) / sizeof(float); i++)
+	{
+		if (!(fabsf(pNew[i] - pOld[i]) <= IncrementalCameraThreshold))
+		{
+			m_culledViewData = viewData;
+			m_bCullingDirty = true;
+			return;
+		}
+	}
+}
+
+void LightClusteredManager::AddUavBarrier(ID3D12GraphicsCommandList * const command, ID3D12Resource * const resource)
+{
+	D3D12_RESOURCE_BARRIER desc;
+	ZeroMemory(&desc, sizeof(desc));
+	desc.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+	desc.UAV.pResource = resource;
+	command->ResourceBarrier(1, &desc);
 }
 
 void LightClusteredManager::InitWindowSizeDependentResources()
 {
 	// Calculate the number of tiles (or triangles) for light culling.
-	m_uWidth = (UINT)((float)g_d3dObjects->GetScreenViewport().Width / (float)m_uNumPixelPerTileX + 0.5f);
-	m_uHeight = (UINT)((float)g_d3dObjects->GetScreenViewport().Height / (float)m_uNumPixelPerTileY + 0.5f);
+	m_uWidth = GetTileNum((UINT)g_d3dObjects->GetScreenViewport().Width);
+	m_uHeight = GetTileNum((UINT)g_d3dObjects->GetScreenViewport().Height);
 	m_uNumPixelPerTileX = g_d3dObjects->GetScreenViewport().Width *(1/ (float)m_uWidth);
 	m_uNumPixelPerTileY = g_d3dObjects->GetScreenViewport().Height *(1 / (float)m_uHeight);
 
@@ -55,7 +156,9 @@ void LightClusteredManager::InitWindowSizeDependentResources()
 	CreateTiledMesh();
 
 	// Initialize light indexed buffer (UAV and SRV).
+	m_uPackedIndexCapacity = GetClusterNum()*PackedAverageLightNum;
 	CreateTiledResources();
+	CreatePackedIndexBuffer();
 	CreateUAV();
 
 	// Create depth planes SRV.
@@ -64,6 +167,8 @@ void LightClusteredManager::InitWindowSizeDependentResources()
 	// Create light culling data.
 	CreateCB();
 	UpdateCullingCB();
+	m_bCullingDirty = true;
+	m_bTilePlanesDirty = true;
 }
 
 void LightClusteredManager::CreateCB()
@@ -100,26 +205,91 @@ void LightClusteredManager::CreateTiledResources()
 	resourceDesc.DepthOrArraySize = 1;
 	resourceDesc.Height = 1;
 	resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-	resourceDesc.Width = sizeof(ClusteredBuffer)*m_uWidth*m_uHeight*m_uDepth;
-	// Allocate double size memory to store per triangle data.
-	if (m_bUseTriangle)
-	{
-		resourceDesc.Width = resourceDesc.Width * 2;
-	}
 	resourceDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
 
+	resourceDesc.Width = sizeof(int)*GetClusterNum();
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_lightCounterBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(ClusteredList)*GetClusterNum();
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_lightListBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(uint)*GetTileDiagonalWordNum(m_uWidth*m_uHeight);
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_tileDiagonalBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(DepthBounds)*GetDepthPyramidCellNum();
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_depthPyramidBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(uint)*MaxLightNum / 32;
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_lightVisibilityBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(LightOverflowStats);
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_overflowStatsBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(uint)*m_uWidth*m_uHeight*TileLightMaskWordNum;
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_tileLightMaskBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(TilePlanes)*m_uWidth*m_uHeight;
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_tilePlaneBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(uint)*GetClusterNum();
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_clusterDepthBinBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(ViewLight)*MaxLightNum;
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_viewLightBuffer.GetAddressOf())));
+
+	resourceDesc.Width = sizeof(LightShape)*MaxLightNum;
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_viewLightShapeBuffer.GetAddressOf())));
+	
+}
+
+
+void LightClusteredManager::CreatePackedIndexBuffer()
+{
+	// Packed light indexes, m_uPackedIndexCapacity slots (two per uint with UseLightIndex16).
+	CD3DX12_HEAP_PROPERTIES heapDefaultProperty(D3D12_HEAP_TYPE_DEFAULT);
+	D3D12_RESOURCE_DESC resourceDesc;
+	ZeroMemory(&resourceDesc, sizeof(resourceDesc));
+	resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+	resourceDesc.Alignment = 0;
+	resourceDesc.SampleDesc.Count = 1;
+	resourceDesc.SampleDesc.Quality = 0;
+	resourceDesc.MipLevels = 1;
+	resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
+	resourceDesc.DepthOrArraySize = 1;
+	resourceDesc.Height = 1;
+	resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+	resourceDesc.Width = sizeof(uint)*GetLightIndexWordNum(m_uPackedIndexCapacity);
+	resourceDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+	m_clusteredBuffer.Reset();
 	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_clusteredBuffer.GetAddressOf())));
 
-	resourceDesc.Width = sizeof(int)*m_uWidth*m_uHeight*m_uDepth;
-	if (m_bUseTriangle)
+	// Create an UAV for packed light indexes.
+	D3D12_UNORDERED_ACCESS_VIEW_DESC desc;
+	ZeroMemory(&desc, sizeof(desc));
+	desc.Buffer.FirstElement = 0;
+	desc.Buffer.NumElements = GetLightIndexWordNum(m_uPackedIndexCapacity);
+	desc.Buffer.StructureByteStride = sizeof(uint);
+	desc.Buffer.CounterOffsetInBytes = 0;
+	desc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+	desc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+	desc.Format = DXGI_FORMAT_UNKNOWN;
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_clusteredBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(0));
+}
+
+bool LightClusteredManager::ResizePackedIndexes(UINT requiredIndexes)
+{
+	UINT capacity = GetPackedIndexCapacity(m_uPackedIndexCapacity, requiredIndexes, GetClusterNum());
+	if (capacity == m_uPackedIndexCapacity)
 	{
-		resourceDesc.Width = resourceDesc.Width * 2;
+		return false;
 	}
-	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapDefaultProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(m_lightCounterBuffer.GetAddressOf())));
-	
+	m_uPackedIndexCapacity = capacity;
+	CreatePackedIndexBuffer();
+	UpdateCullingCB();
+	m_bCullingDirty = true;
+	return true;
 }
 
-
 void LightClusteredManager::CreateSRV()
 {
 	// Create a SRV for depth planes.
@@ -133,31 +303,60 @@ void LightClusteredManager::CreateSRV()
 	desc.Buffer.NumElements = m_uDepth + 1;
 	desc.Buffer.StructureByteStride = sizeof(float);
 
-	g_d3dObjects->GetD3DDevice()->CreateShaderResourceView(m_depthPlanesBuffer.Get(), &desc, m_viewsHeap.hCPU(3));
+	g_d3dObjects->GetD3DDevice()->CreateShaderResourceView(m_depthPlanesBuffer.Get(), &desc, m_viewsHeap.hCPU(4));
 
 }
 
 void LightClusteredManager::CreateUAV()
 {
-	// Create an UAV for light indexes.
 	D3D12_UNORDERED_ACCESS_VIEW_DESC desc;
 	ZeroMemory(&desc, sizeof(desc));
 	desc.Buffer.FirstElement = 0;
-	desc.Buffer.NumElements = m_uWidth*m_uHeight*m_uDepth;;
-	// If we use per triangle culling, we need double size buffer to store indexes.
-	if (m_bUseTriangle)
-	{
-		desc.Buffer.NumElements = desc.Buffer.NumElements * 2;
-	}
-	desc.Buffer.StructureByteStride = sizeof(ClusteredBuffer);
 	desc.Buffer.CounterOffsetInBytes = 0;
 	desc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
 	desc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
 	desc.Format = DXGI_FORMAT_UNKNOWN;
 
-	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_clusteredBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(0));
+	// Create UAVs for light counters and light lists, an element per cluster.
+	desc.Buffer.NumElements = GetClusterNum();
 	desc.Buffer.StructureByteStride = sizeof(int);
 	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_lightCounterBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(1));
+	desc.Buffer.StructureByteStride = sizeof(ClusteredList);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_lightListBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(2));
+	// Create an UAV for diagonal bits of tiles, 32 tiles per element.
+	desc.Buffer.NumElements = GetTileDiagonalWordNum(m_uWidth*m_uHeight);
+	desc.Buffer.StructureByteStride = sizeof(uint);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_tileDiagonalBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(6));
+	// Create an UAV for all cells of the depth pyramid.
+	desc.Buffer.NumElements = GetDepthPyramidCellNum();
+	desc.Buffer.StructureByteStride = sizeof(DepthBounds);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_depthPyramidBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(7));
+	// Create an UAV for visibility bits of lights, 32 lights per element.
+	desc.Buffer.NumElements = MaxLightNum / 32;
+	desc.Buffer.StructureByteStride = sizeof(uint);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_lightVisibilityBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(8));
+	// Create an UAV for the overflow statistics.
+	desc.Buffer.NumElements = 1;
+	desc.Buffer.StructureByteStride = sizeof(LightOverflowStats);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_overflowStatsBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(9));
+	// Create an UAV for light masks of tiles, 32 lights per element.
+	desc.Buffer.NumElements = m_uWidth*m_uHeight*TileLightMaskWordNum;
+	desc.Buffer.StructureByteStride = sizeof(uint);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_tileLightMaskBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(10));
+	// Create UAVs for view-space lights and view-space shapes, an element per light.
+	desc.Buffer.NumElements = MaxLightNum;
+	desc.Buffer.StructureByteStride = sizeof(ViewLight);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_viewLightBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(12));
+	desc.Buffer.StructureByteStride = sizeof(LightShape);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_viewLightShapeBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(13));
+	// Create an UAV for the tile plane table, an element per tile.
+	desc.Buffer.NumElements = m_uWidth*m_uHeight;
+	desc.Buffer.StructureByteStride = sizeof(TilePlanes);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_tilePlaneBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(14));
+	// Create an UAV for depth bins of clusters, an element per cluster.
+	desc.Buffer.NumElements = GetClusterNum();
+	desc.Buffer.StructureByteStride = sizeof(uint);
+	g_d3dObjects->GetD3DDevice()->CreateUnorderedAccessView(m_clusterDepthBinBuffer.Get(), nullptr, &desc, m_viewsHeap.hCPU(15));
 	
 }
 
@@ -168,8 +367,11 @@ void LightClusteredManager::UpdateCullingCB()
 	clusteredData.heightDim = m_uHeight;
 	clusteredData.depthDim = m_uDepth;
 	clusteredData.lightNum = m_iLightNum;
+	clusteredData.spotLightNum = m_iSpotLightNum;
+	clusteredData.capsuleLightNum = m_iCapsuleLightNum;
 	clusteredData.tileSizeX = m_uNumPixelPerTileX;
 	clusteredData.tileSizeY = m_uNumPixelPerTileY;
+	clusteredData.packedIndexCapacity = m_uPackedIndexCapacity;
 
 	void* mapped = nullptr;
 	m_clusteredCB->Map(0, nullptr, &mapped);
@@ -183,26 +385,39 @@ void LightClusteredManager::UpdateDepthPlanes(const float * planes)
 	m_depthPlanesBuffer->Map(0, nullptr, &mapped);
 	memcpy(mapped, planes, sizeof(float)*(m_uDepth + 1));
 	m_depthPlanesBuffer->Unmap(0, nullptr);
+	m_bCullingDirty = true;
 }
 
 void LightClusteredManager::SetLightBuffer(ID3D12Resource* const lightBuffer, const D3D12_SHADER_RESOURCE_VIEW_DESC& SrvDesc, int lightNum)
 {
 	m_iLightNum = lightNum;
-	g_d3dObjects->GetD3DDevice()->CreateShaderResourceView(lightBuffer, &SrvDesc, m_viewsHeap.hCPU(2));
+	g_d3dObjects->GetD3DDevice()->CreateShaderResourceView(lightBuffer, &SrvDesc, m_viewsHeap.hCPU(3));
 	// Update light culling CB, after the number of light is different.
 	UpdateCullingCB();
+	m_bCullingDirty = true;
+}
+
+void LightClusteredManager::SetLightShapeBuffer(ID3D12Resource* const shapeBuffer, const D3D12_SHADER_RESOURCE_VIEW_DESC& SrvDesc, int spotLightNum, int capsuleLightNum)
+{
+	m_iSpotLightNum = spotLightNum;
+	m_iCapsuleLightNum = capsuleLightNum;
+	g_d3dObjects->GetD3DDevice()->CreateShaderResourceView(shapeBuffer, &SrvDesc, m_viewsHeap.hCPU(11));
+	// The typed index ranges are in the light culling CB.
+	UpdateCullingCB();
+	m_bCullingDirty = true;
 }
 
 void LightClusteredManager::SetDepthBuffer(ID3D12Resource * const depthBuffer, const D3D12_SHADER_RESOURCE_VIEW_DESC& SrvDesc)
 {
 
-	g_d3dObjects->GetD3DDevice()->CreateShaderResourceView(depthBuffer, &SrvDesc, m_viewsHeap.hCPU(4));
-	
+	g_d3dObjects->GetD3DDevice()->CreateShaderResourceView(depthBuffer, &SrvDesc, m_viewsHeap.hCPU(5));
+	m_bCullingDirty = true;
 }
 
 void LightClusteredManager::CreateTiledMesh()
 {                      
-	m_quadRenderer.InitTiles((m_uWidth), (m_uHeight));
+	// The triangles of the mesh use the clusters of the same subdivision pattern as light culling.
+	m_quadRenderer.InitTiles((m_uWidth), (m_uHeight), TileSubdivision);
 }
 
 void LightClusteredManager::CreatePSO()
@@ -211,10 +426,12 @@ void LightClusteredManager::CreatePSO()
 
 	// Per tile culling.
 	const ShaderObject* cs = g_ShaderManager.GetShaderObj("PerTileCullingCS");
+	const ShaderObject* countCs = g_ShaderManager.GetShaderObj("PerTileCountCS");
 	if (m_bUseTriangle)
 	{
 		// Per triangle culling.
 		cs = g_ShaderManager.GetShaderObj("PerTriangleCullingCS");
+		countCs = g_ShaderManager.GetShaderObj("PerTriangleCountCS");
 	}
 
 	// A compute shader for light culling, culling lights per triangle or per tile.
@@ -227,33 +444,82 @@ void LightClusteredManager::CreatePSO()
 
 	ComPtr<ID3D12RootSignature> m_rootSignature;
 	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateComputePipelineState(&descPipelineState, IID_PPV_ARGS(&m_lightCullPso)));
+
+	// The count pass uses the same root signature.
+	descPipelineState.CS = { countCs->binaryPtr,countCs->size };
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateComputePipelineState(&descPipelineState, IID_PPV_ARGS(&m_lightCountPso)));
+
+	// A prefix sum of light counters.
+	const ShaderObject* scanCs = g_ShaderManager.GetShaderObj("LightListScanCS");
+	descPipelineState.CS = { scanCs->binaryPtr,scanCs->size };
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateComputePipelineState(&descPipelineState, IID_PPV_ARGS(&m_lightScanPso)));
+
+	// The depth pyramid, the light occlusion test and the light scatter.
+	const ShaderObject* pyramidCs = g_ShaderManager.GetShaderObj("DepthPyramidCS");
+	descPipelineState.CS = { pyramidCs->binaryPtr,pyramidCs->size };
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateComputePipelineState(&descPipelineState, IID_PPV_ARGS(&m_depthPyramidPso)));
+	const ShaderObject* reduceCs = g_ShaderManager.GetShaderObj("DepthPyramidReduceCS");
+	descPipelineState.CS = { reduceCs->binaryPtr,reduceCs->size };
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateComputePipelineState(&descPipelineState, IID_PPV_ARGS(&m_depthPyramidReducePso)));
+	const ShaderObject* occlusionCs = g_ShaderManager.GetShaderObj("LightOcclusionCS");
+	descPipelineState.CS = { occlusionCs->binaryPtr,occlusionCs->size };
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateComputePipelineState(&descPipelineState, IID_PPV_ARGS(&m_lightOcclusionPso)));
+	const ShaderObject* scatterCs = g_ShaderManager.GetShaderObj("LightScatterCS");
+	descPipelineState.CS = { scatterCs->binaryPtr,scatterCs->size };
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateComputePipelineState(&descPipelineState, IID_PPV_ARGS(&m_lightScatterPso)));
+	const ShaderObject* transformCs = g_ShaderManager.GetShaderObj("LightTransformCS");
+	descPipelineState.CS = { transformCs->binaryPtr,transformCs->size };
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateComputePipelineState(&descPipelineState, IID_PPV_ARGS(&m_lightTransformPso)));
+	const ShaderObject* tilePlaneCs = g_ShaderManager.GetShaderObj("TilePlaneCS");
+	descPipelineState.CS = { tilePlaneCs->binaryPtr,tilePlaneCs->size };
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateComputePipelineState(&descPipelineState, IID_PPV_ARGS(&m_tilePlanePso)));
 }
 
 void LightClusteredManager::CreateRootSignature()
 {
 
-	// Total Root Parameter Count: 2.
-	// [0] : Descriptor Table Range Count: 3
+	// Total Root Parameter Count: 4.
+	// [0] : Descriptor Table Range Count: 5
 	// --------------------------------------
-	// [0][0] : UAV Range Count : 1
+	// [0][0] : UAV Range Count : 3
 	// [0][0][0]: UAV for saving light indexed for every triangle(or tile) (u0)
+	// [0][0][1]: UAV for light counters (u1)
+	// [0][0][2]: UAV for light lists (u2)
 	// [0][1] : SRV Range Count : 3
 	// [0][1][0] : SRV for light buffer (t0)
 	// [0][1][1] : SRV for depth planes (t1)
 	// [0][1][2] : SRV for depth texture (t2)
+	// [0][2] : UAV Range Count : 5 (after the SRVs in the heap)
+	// [0][2][0]: UAV for diagonal bits of tiles (u3)
+	// [0][2][1]: UAV for the depth pyramid (u4)
+	// [0][2][2]: UAV for visibility bits of lights (u5)
+	// [0][2][3]: UAV for overflow statistics (u6)
+	// [0][2][4]: UAV for light masks of tiles (u7)
+	// [0][3] : SRV Range Count : 1 (after the UAVs in the heap)
+	// [0][3][0] : SRV for shapes of spot and capsule lights (t3)
+	// [0][4] : UAV Range Count : 4 (after the shape SRV in the heap)
+	// [0][4][0]: UAV for view-space lights (u8)
+	// [0][4][1]: UAV for view-space shapes of spot and capsule lights (u9)
+	// [0][4][2]: UAV for the tile plane table (u10)
+	// [0][4][3]: UAV for depth bins of clusters (u11)
 	// --------------------------------------
 	// [1] : CBV for the camera data (b1)
 	// [2] : CBV for culling data (b0)
-	CD3DX12_DESCRIPTOR_RANGE range[2];
-	CD3DX12_ROOT_PARAMETER parameter[3];
-	range[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 2, 0);
+	// [3] : Constants for the level of the depth pyramid (b2)
+	CD3DX12_DESCRIPTOR_RANGE range[5];
+	CD3DX12_ROOT_PARAMETER parameter[4];
+	range[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 3, 0);
 	range[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 3, 0);
+	range[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 5, 3, 0, 6);
+	range[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 3, 0, 11);
+	range[4].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 4, 8, 0, 12);
 	parameter[0].InitAsDescriptorTable(_countof(range), range, D3D12_SHADER_VISIBILITY_ALL);
 	parameter[1].InitAsConstantBufferView(1);
 	parameter[2].InitAsConstantBufferView(0);
+	parameter[3].InitAsConstants(1, 2);
 
 	CD3DX12_ROOT_SIGNATURE_DESC descRootSignature;
-	descRootSignature.Init(3, parameter, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+	descRootSignature.Init(_countof(parameter), parameter, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
 
 	ComPtr<ID3DBlob> rootSigBlob, errorBlob;
 	ThrowIfFailed(D3D12SerializeRootSignature(&descRootSignature, D3D_ROOT_SIGNATURE_VERSION_1, rootSigBlob.GetAddressOf(), errorBlob.GetAddressOf()));
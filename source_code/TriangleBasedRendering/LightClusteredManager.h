@@ -4,14 +4,27 @@
 // The class runs a compute shader for light culling to create light indexed buffer.
 // It finds the intersections between lights and flat triangles (or tiles).
 // According to width, height and depth, the class allocates a buffer to store light indexes.
-// To do:
-// 1. Support for clustered rendering (Now only support depth=1 for the modified light accumulation stage).
-// 2. Good distribution of depth planes (exponential distribution).
+// Every tile is split into the primitives of a subdivision pattern (TileSubdivision), and the tile mesh of the light pass
+// is generated from the same pattern. With depth > 1, every primitive is split into clusters by depth planes, and the tile's
+// depth range is clipped by the slice of a cluster. The cluster of primitive i in slice z is
+// (tileIdx*TilePrimitiveNum + i) + z*width*height*TilePrimitiveNum.
+// Light indexes of all clusters are packed into one buffer:
+// 1. A count pass runs culling and only writes light counters.
+// 2. An exclusive prefix sum of counters creates the light list (offset and number) of every cluster.
+// 3. A write pass runs culling again, and writes light indexes into the lists.
+// The packed buffer reserves PackedAverageLightNum indexes per cluster instead of PerClusterMaxLight, and with
+// UseLightIndex16 the indexes are 16-bit, so the buffer and the index reads of the light pass are halved. The prefix sum
+// reports the slots all lists ask for, and ResizePackedIndexes grows the buffer from the readback of these statistics.
+// The tile plane table (after the window or the projection changes), the light transform, the depth pyramid, light occlusion
+// and light scatter run before culling when they are enabled.
+// Clusters over PerClusterMaxLight follow LightOverflowPolicy. The packed buffer is also the spill buffer: spilled and split
+// lists are just longer lists, and the prefix sum writes the overflow statistics of the frame (LightOverflowStats).
 //--------------------------------------------------------------------------------------
 
 #pragma once
 #include "DirectxHelper.h"
 #include <vector>
+#include <atomic>
 #include "ScreenQuadRenderer.h"
 #include "ShaderTypeDefine.h"
 #include "ClusteredCommon.h"
@@ -24,26 +37,65 @@ public:
 	void Init(int width, int height, int depth);
 	void InitWindowSizeDependentResources();
 
+	// Record light culling, nothing is recorded if the lists of the last culling are still valid (UseIncrementalCulling).
 	void RunLightCullingCS(ID3D12GraphicsCommandList* const  command);
-	// Get light indexed buffer.
+	// Compare the camera of a frame with the camera of the last culling, moving beyond IncrementalCameraThreshold culls again.
+	void UpdateViewData(const ViewData& viewData);
+	// Cull lights again in the next RunLightCullingCS, e.g. after the scene geometry changed.
+	void Invalidate() { m_bCullingDirty = true; }
+	// Get light indexed buffer (packed light indexes).
+	// The buffer is recreated by ResizePackedIndexes, so the light passes must read it again after a resize.
 	ID3D12Resource* const   GetClusteredBuffer() const { return m_clusteredBuffer.Get(); }
+	// Get light list buffer (a ClusteredList per cluster).
+	ID3D12Resource* const   GetLightListBuffer() const { return m_lightListBuffer.Get(); }
 	// Get light culling CB.
 	ID3D12Resource* const   GetClusteredCB() const { return m_clusteredCB.Get(); }
 	// Get light counter buffer.
 	ID3D12Resource* const   GetCounterBuffer() const { return m_lightCounterBuffer.Get(); }
+	// Get depth planes buffer.
+	ID3D12Resource* const   GetDepthPlanesBuffer() const { return m_depthPlanesBuffer.Get(); }
+	// Get the diagonal bits of tiles (a bit per tile, set for TileSubdivisionAntiDiagonal).
+	ID3D12Resource* const   GetTileDiagonalBuffer() const { return m_tileDiagonalBuffer.Get(); }
+	// Get the depth pyramid (DepthBounds of all levels, see GetDepthPyramidLevelOffset).
+	ID3D12Resource* const   GetDepthPyramidBuffer() const { return m_depthPyramidBuffer.Get(); }
+	// Get the visibility bits of lights (a bit per light, set if the light isn't occluded).
+	ID3D12Resource* const   GetLightVisibilityBuffer() const { return m_lightVisibilityBuffer.Get(); }
+	// Get the overflow statistics of the last culling (a LightOverflowStats).
+	ID3D12Resource* const   GetOverflowStatsBuffer() const { return m_overflowStatsBuffer.Get(); }
+	// Get the light masks of tiles (TileLightMaskWordNum words per tile, a bit per light).
+	ID3D12Resource* const   GetTileLightMaskBuffer() const { return m_tileLightMaskBuffer.Get(); }
+	// Get the view-space lights of the last culling (a ViewLight per light).
+	ID3D12Resource* const   GetViewLightBuffer() const { return m_viewLightBuffer.Get(); }
+	// Get the view-space shapes of spot and capsule lights of the last culling (a LightShape per shape).
+	ID3D12Resource* const   GetViewLightShapeBuffer() const { return m_viewLightShapeBuffer.Get(); }
+	// Get the tile plane table (a TilePlanes per tile).
+	ID3D12Resource* const   GetTilePlaneBuffer() const { return m_tilePlaneBuffer.Get(); }
 	UINT GetAxisXNumber() { return m_uWidth; }
 	UINT GetAxisYNumber() { return m_uHeight; }
+	UINT GetAxisZNumber() { return m_uDepth; }
+	// Resize the packed light indexes for the slots the lists of a culling asked for (LightOverflowStats::requiredIndexes),
+	// with the hysteresis of GetPackedIndexCapacity. Both queues must be idle, the lists are culled again after a resize.
+	// Return true if the buffer was recreated.
+	bool ResizePackedIndexes(UINT requiredIndexes);
+	UINT GetPackedIndexCapacity() const { return m_uPackedIndexCapacity; }
+	// The number of clusters (a cluster per primitive of a tile in every depth slice).
+	UINT GetClusterNum() const { return m_uWidth*m_uHeight*m_uDepth*TilePrimitiveNum; }
+	// The number of cells of all levels of the depth pyramid.
+	UINT GetDepthPyramidCellNum() const { return GetDepthPyramidLevelOffset(m_uWidth, m_uHeight, GetDepthPyramidLevelNum(m_uWidth, m_uHeight)); }
 
 
 	void UpdateCullingCB();
+	// Update depth+1 post-projection depths in ascending order.
 	void UpdateDepthPlanes(const float* const  planes);
 	void SetCameraCB(const D3D12_GPU_VIRTUAL_ADDRESS address) { m_camCbGpuAdr = address; }
 	// Set the light buffer which we are going to cull.
 	void SetLightBuffer(ID3D12Resource* const  lightBuffer, const D3D12_SHADER_RESOURCE_VIEW_DESC& SrvDesc, int lightNum);
+	// Set the shapes of spot and capsule lights, they are the last spotLightNum+capsuleLightNum lights of the light buffer.
+	void SetLightShapeBuffer(ID3D12Resource* const  shapeBuffer, const D3D12_SHADER_RESOURCE_VIEW_DESC& SrvDesc, int spotLightNum, int capsuleLightNum);
 
 	void SetDepthBuffer(ID3D12Resource* const depthBuffer, const D3D12_SHADER_RESOURCE_VIEW_DESC& SrvDesc);
 
-	// Get a renderer for the screen-size geometry (m_uWidth * m_uHeight*2).
+	// Get a renderer for the screen-size tile mesh (m_uWidth * m_uHeight tiles subdivided by TileSubdivision).
 	ScreenQuadRenderer& GetQuadRenderer() { return m_quadRenderer; }
 
 private:
@@ -52,12 +104,16 @@ private:
 	// Create constant buffer view for culling.
 	void CreateCBV();
 	void CreateTiledResources();
+	// Create the packed light index buffer of m_uPackedIndexCapacity slots and its UAV.
+	void CreatePackedIndexBuffer();
 	void CreateSRV();
 	void CreateUAV();
 	void CreatePSO();
 	void CreateRootSignature();
 	void CreateDepthPlaneResource();
 	void CreateTiledMesh();
+	// Wait until UAV writes of a pass are finished.
+	void AddUavBarrier(ID3D12GraphicsCommandList* const command, ID3D12Resource* const resource);
 
 	// Enable to use triangle-based culling.
 	bool m_bUseTriangle;
@@ -65,6 +121,25 @@ private:
 	Microsoft::WRL::ComPtr<ID3D12Resource> m_clusteredBuffer;
 	// The counter of light indexed buffer.
 	Microsoft::WRL::ComPtr<ID3D12Resource> m_lightCounterBuffer;
+	// Offsets and numbers of light lists in light indexed buffer.
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_lightListBuffer;
+	// Diagonal bits of tiles.
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_tileDiagonalBuffer;
+	// Min/max depth of tiles and of coarser levels.
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_depthPyramidBuffer;
+	// Visibility bits of lights, MaxLightNum bits.
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_lightVisibilityBuffer;
+	// Overflow statistics of the light lists.
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_overflowStatsBuffer;
+	// Light masks of tiles.
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_tileLightMaskBuffer;
+	// View-space lights and view-space shapes of spot and capsule lights, MaxLightNum of each.
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_viewLightBuffer;
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_viewLightShapeBuffer;
+	// Planes of tiles through the camera and their corner rays.
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_tilePlaneBuffer;
+	// Depth bins of clusters, built once per tile by DepthPyramidCS.
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_clusterDepthBinBuffer;
 	// Light culling CB.
 	Microsoft::WRL::ComPtr<ID3D12Resource> m_clusteredCB;
 	// Depth value for every depth plane (the total number : depth+1).
@@ -77,40 +152,74 @@ private:
 	// Compute pipeline name :  light culling.
 	// Shader name : PerTileCullingCS, PerTriangleCullingCS.
 	Microsoft::WRL::ComPtr<ID3D12PipelineState>  m_lightCullPso;
-
-	// Total Root Parameter Count: 2.
-	// [0] : Descriptor Table Range Count: 3
-	// --------------------------------------
-	// [0][0] : CBV Range Count : 1
-	// [0][0][0] : CBV for culling data (b0)
-	// [0][1] : UAV Range Count : 1
-	// [0][1][0]: UAV for saving light indexed for every triangle(or tile) (u0)
-	// [0][2] : SRV Range Count : 3
-	// [0][2][0] : SRV for light buffer (t0)
-	// [0][2][1] : SRV for depth planes (t1)
-	// [0][2][2] : SRV for depth texture (t2)
-	// --------------------------------------
+	// The count pass of light culling.
+	// Shader name : PerTileCountCS, PerTriangleCountCS.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState>  m_lightCountPso;
+	// The prefix sum of light counters.
+	// Shader name : LightListScanCS.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState>  m_lightScanPso;
+	// Level 0 of the depth pyramid, and the other levels.
+	// Shader name : DepthPyramidCS, DepthPyramidReduceCS.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState>  m_depthPyramidPso;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState>  m_depthPyramidReducePso;
+	// The occlusion test of lights against the depth pyramid.
+	// Shader name : LightOcclusionCS.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState>  m_lightOcclusionPso;
+	// Scattering lights to the light masks of tiles.
+	// Shader name : LightScatterCS.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState>  m_lightScatterPso;
+	// Transforming lights to view space.
+	// Shader name : LightTransformCS.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState>  m_lightTransformPso;
+	// Building the tile plane table.
+	// Shader name : TilePlaneCS.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState>  m_tilePlanePso;
+
+	// Total Root Parameter Count: 4.
+	// [0] : Descriptor Table Range Count: 5 (see m_viewsHeap)
 	// [1] : CBV for the camera data (b1)
+	// [2] : CBV for culling data (b0)
+	// [3] : Constants for the level of the depth pyramid (b2)
 	Microsoft::WRL::ComPtr<ID3D12RootSignature> m_rootSignature;
 
 	ScreenQuadRenderer m_quadRenderer;
 
-	// Descriptor Table Range Count : 3.
+	// Descriptor Count : 16, the table of root parameter 0.
 	// --------------------------------------
-	// [0][0] : CBV Range Count : 1
-	// [0][0][0] : CBV for culling data (b0)
-	// [0][1] : UAV Range Count : 1
-	// [0][1][0]: UAV for saving light indexed for every triangle(or tile) (u0)
-	// [0][2] : SRV Range Count : 3
-	// [0][2][0] : SRV for light buffer (t0)
-	// [0][2][1] : SRV for depth planes (t1)
-	// [0][2][2] : SRV for depth texture (t2)
+	// [0] : UAV for saving light indexed for every triangle(or tile) (u0)
+	// [1] : UAV for light counters (u1)
+	// [2] : UAV for light lists (u2)
+	// [3] : SRV for light buffer (t0)
+	// [4] : SRV for depth planes (t1)
+	// [5] : SRV for depth texture (t2)
+	// [6] : UAV for diagonal bits of tiles (u3)
+	// [7] : UAV for the depth pyramid (u4)
+	// [8] : UAV for visibility bits of lights (u5)
+	// [9] : UAV for overflow statistics (u6)
+	// [10] : UAV for light masks of tiles (u7)
+	// [11] : SRV for shapes of spot and capsule lights (t3)
+	// [12] : UAV for view-space lights (u8)
+	// [13] : UAV for view-space shapes of spot and capsule lights (u9)
+	// [14] : UAV for the tile plane table (u10)
+	// [15] : UAV for depth bins of clusters (u11)
 	CDescriptorHeapWrapper m_viewsHeap;
 
 	UINT m_uWidth;
 	UINT m_uHeight;
 	UINT m_uDepth;
+	// Slots of the packed light index buffer.
+	UINT m_uPackedIndexCapacity;
 	int m_iLightNum;
+	int m_iSpotLightNum;
+	int m_iCapsuleLightNum;
+	// Are the light lists out of date? It is set by the main thread and cleared by the compute thread.
+	std::atomic<bool> m_bCullingDirty;
+	// The camera of the last culling.
+	ViewData m_culledViewData;
+	// Is the tile plane table out of date? It is set after the window or the projection changed.
+	std::atomic<bool> m_bTilePlanesDirty;
+	// The projection of the tile plane table.
+	float4x4 m_tilePlaneProjInv;
 	float m_uNumPixelPerTileX;
 	float m_uNumPixelPerTileY;
 };
\ No newline at end of file
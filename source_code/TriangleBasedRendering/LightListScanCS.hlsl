@@ -0,0 +1,121 @@
+//--------------------------------------------------------------------------------------
+// File: LightListScanCS.hlsl
+//
+// A compute shader to allocate packed light lists with an exclusive prefix sum of light counters.
+// It runs in one group: every thread sums a chunk of clusters, the group scans the sums of chunks,
+// then every thread writes the offsets of its chunk.
+// Counters over PerClusterMaxLight are sized by LightOverflowPolicy, and lists are clamped to the capacity of the packed
+// light indexes (gCB.packedIndexCapacity). A split list which doesn't fit falls back to a spilled list. The slots all
+// lists ask for are written to the statistics, so the buffer grows before the next frames.
+// Offsets are light index slots, and lists of 16-bit indexes start at even slots (GetLightListStride).
+// The overflow statistics of the frame are reduced in groupshared memory and written to gOverflowStatsUAV.
+//--------------------------------------------------------------------------------------
+#include "ClusteredCommon.h"
+
+ConstantBuffer<ClusteredData> gCB : register(b0);	// Light culling information.
+RWStructuredBuffer<int> gLightCounterUAV : register(u1);	// Light counter buffer.
+RWStructuredBuffer<ClusteredList> gLightListUAV : register(u2);	// Light lists in packed light indexes.
+RWStructuredBuffer<LightOverflowStats> gOverflowStatsUAV : register(u6);	// Overflow statistics of the frame.
+
+groupshared uint ldsSums[ScanGroupSize];
+groupshared LightOverflowStats ldsStats;
+
+// The number of packed light indexes a cluster asks for.
+uint GetListSize(uint counter)
+{
+	[branch]
+	if (counter <= PerClusterMaxLight || LightOverflowPolicy == LightOverflowSpill)
+	{
+		return counter;
+	}
+	else if (LightOverflowPolicy == LightOverflowClamp)
+	{
+		return PerClusterMaxLight;
+	}
+	// A light may be in both halves of a split list.
+	return ClusteredSplitHeaderSize + counter * 2;
+}
+
+[numthreads(ScanGroupSize, 1, 1)]
+void main(uint Gindex : SV_GroupIndex)
+{
+	uint clusterNum = gCB.widthDim*gCB.heightDim*gCB.depthDim*TilePrimitiveNum;
+	uint capacity = gCB.packedIndexCapacity;
+	uint chunkSize = (clusterNum + ScanGroupSize - 1) / ScanGroupSize;
+	uint begin = min(Gindex*chunkSize, clusterNum);
+	uint end = min(begin + chunkSize, clusterNum);
+
+	if (Gindex == 0)
+	{
+		ldsStats.overflowClusters = 0;
+		ldsStats.maxClusterLights = 0;
+		ldsStats.droppedLights = 0;
+		ldsStats.spilledLights = 0;
+		ldsStats.splitClusters = 0;
+		ldsStats.truncatedClusters = 0;
+		ldsStats.requiredIndexes = 0;
+	}
+
+	// Sum the list sizes of a chunk.
+	uint sum = 0;
+	for (uint i = begin; i < end; i++)
+	{
+		sum += GetLightListStride(GetListSize((uint)gLightCounterUAV[i]));
+	}
+	ldsSums[Gindex] = sum;
+	GroupMemoryBarrierWithGroupSync();
+
+	// Inclusive scan of chunk sums.
+	for (uint stride = 1; stride < ScanGroupSize; stride *= 2)
+	{
+		uint value = Gindex >= stride ? ldsSums[Gindex - stride] : 0;
+		GroupMemoryBarrierWithGroupSync();
+		ldsSums[Gindex] += value;
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	// Exclusive prefix sum inside the chunk.
+	LightOverflowStats stats = (LightOverflowStats)0;
+	uint offset = ldsSums[Gindex] - sum;
+	for (uint j = begin; j < end; j++)
+	{
+		uint counter = (uint)gLightCounterUAV[j];
+		uint size = GetListSize(counter);
+		ClusteredList list;
+		list.offset = min(offset, capacity);
+		list.lightNum = min(size, capacity - list.offset);
+		bool split = LightOverflowPolicy == LightOverflowSplit && counter > PerClusterMaxLight && list.lightNum == size;
+		if (LightOverflowPolicy == LightOverflowSplit && counter > PerClusterMaxLight)
+		{
+			list.lightNum = split ? list.lightNum | ClusteredListSplitBit : min(list.lightNum, counter);
+		}
+		gLightListUAV[j] = list;
+		offset += GetLightListStride(size);
+
+		// A split list stores all lights, the others store lightNum lights.
+		uint stored = split ? counter : min(list.lightNum, counter);
+		stats.overflowClusters += counter > PerClusterMaxLight ? 1 : 0;
+		stats.maxClusterLights = max(stats.maxClusterLights, counter);
+		stats.droppedLights += counter - stored;
+		stats.spilledLights += stored > PerClusterMaxLight ? stored - PerClusterMaxLight : 0;
+		stats.splitClusters += split ? 1 : 0;
+		stats.truncatedClusters += (list.lightNum & ~ClusteredListSplitBit) < size ? 1 : 0;
+	}
+
+	// Reduce the statistics of all threads.
+	InterlockedAdd(ldsStats.overflowClusters, stats.overflowClusters);
+	InterlockedMax(ldsStats.maxClusterLights, stats.maxClusterLights);
+	InterlockedAdd(ldsStats.droppedLights, stats.droppedLights);
+	InterlockedAdd(ldsStats.spilledLights, stats.spilledLights);
+	InterlockedAdd(ldsStats.splitClusters, stats.splitClusters);
+	InterlockedAdd(ldsStats.truncatedClusters, stats.truncatedClusters);
+	if (Gindex == ScanGroupSize - 1)
+	{
+		ldsStats.requiredIndexes = ldsSums[Gindex];
+	}
+	GroupMemoryBarrierWithGroupSync();
+	if (Gindex == 0)
+	{
+		gOverflowStatsUAV[0] = ldsStats;
+	}
+}
@@ -3,10 +3,15 @@
 //--------------------------------------------------------------------------------------
 #include "LightManager.h"
 #include "d3dx12.h"
+#include "CpuLightOrder.h"
 
 void LightManager::Init(int maxLightNum, int lightTypeSize)
 {
 	m_iTypeSize = lightTypeSize;
+	m_bMortonOrder = false;
+	m_iPositionOffset = 0;
+	m_iSpotNum = 0;
+	m_iCapsuleNum = 0;
 
 	CD3DX12_HEAP_PROPERTIES heapUploadProperty(D3D12_HEAP_TYPE_UPLOAD);
 	D3D12_RESOURCE_DESC resourceDesc;
@@ -35,6 +40,12 @@ void LightManager::Init(int maxLightNum, int lightTypeSize)
 	desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
 
 	m_srvDesc = desc;
+
+	// The shape buffer has a shape per light, spot and capsule lights use its first entries.
+	resourceDesc.Width = sizeof(LightShape)*maxLightNum;
+	ThrowIfFailed(g_d3dObjects->GetD3DDevice()->CreateCommittedResource(&heapUploadProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(m_shapeBuffer.GetAddressOf())));
+	desc.Buffer.StructureByteStride = sizeof(LightShape);
+	m_shapeSrvDesc = desc;
 }
 
 void LightManager::UpdateLightBuffer(const void* pData, int iTypeSize, int iNumber, bool  bDefault)
@@ -43,9 +54,51 @@ void LightManager::UpdateLightBuffer(const void* pData, int iTypeSize, int iNumb
 
 	void* mapped = nullptr;
 	m_lightBuffer->Map(0, nullptr, &mapped);
-	memcpy(mapped, pData, iTypeSize*iNumber);
+	int iShapeOffset = iNumber - m_iSpotNum - m_iCapsuleNum;
+	if (m_bMortonOrder)
+	{
+		// Copy lights to their slots, the order changes whenever a light moves.
+		// Every type is sorted on its own, so the lights of a type stay in the range of the type.
+		int typeOffsets[LightTypeNum + 1];
+		for (int t = 0; t <= LightTypeNum; t++)
+		{
+			typeOffsets[t] = (int)GetLightTypeOffset(iNumber, m_iSpotNum, m_iCapsuleNum, t);
+		}
+		m_slotLights.resize(iNumber);
+		m_lightSlots.resize(iNumber);
+		std::vector<uint> order;
+		for (int t = 0; t < LightTypeNum; t++)
+		{
+			ComputeMortonOrder((const char*)pData + typeOffsets[t] * iTypeSize, typeOffsets[t + 1] - typeOffsets[t], iTypeSize, m_iPositionOffset, order);
+			for (uint k = 0; k < (uint)order.size(); k++)
+			{
+				m_slotLights[typeOffsets[t] + k] = typeOffsets[t] + order[k];
+			}
+		}
+		for (int i = 0; i < iNumber; i++)
+		{
+			m_lightSlots[m_slotLights[i]] = i;
+			memcpy((char*)mapped + i*iTypeSize, (const char*)pData + m_slotLights[i] * iTypeSize, iTypeSize);
+		}
+	}
+	else
+	{
+		memcpy(mapped, pData, iTypeSize*iNumber);
+	}
 	m_lightBuffer->Unmap(0, nullptr);
 
+	// Shapes follow the slots of their lights.
+	if (iShapeOffset < iNumber)
+	{
+		m_shapeBuffer->Map(0, nullptr, &mapped);
+		LightShape* pShapes = (LightShape*)mapped;
+		for (int i = iShapeOffset; i < iNumber; i++)
+		{
+			pShapes[i - iShapeOffset] = m_shapes[GetLightIndex(i) - iShapeOffset];
+		}
+		m_shapeBuffer->Unmap(0, nullptr);
+	}
+
 	if (bDefault)
 	{
 		CopyToDefault();
@@ -53,6 +106,19 @@ void LightManager::UpdateLightBuffer(const void* pData, int iTypeSize, int iNumb
 
 }
 
+void LightManager::SetMortonOrder(bool bEnable, int iPositionOffset)
+{
+	m_bMortonOrder = bEnable;
+	m_iPositionOffset = iPositionOffset;
+}
+
+void LightManager::SetLightShapes(const LightShape* pShapes, int iSpotNum, int iCapsuleNum)
+{
+	m_iSpotNum = iSpotNum;
+	m_iCapsuleNum = iCapsuleNum;
+	m_shapes.assign(pShapes, pShapes + iSpotNum + iCapsuleNum);
+}
+
 void LightManager::CopyToDefault()
 {
 
@@ -2,8 +2,13 @@
 // File: LightManager.h
 //
 // A class for managing a light buffer.
+// Lights can be uploaded in Morton order of their positions (SetMortonOrder), so lights near in space are near in the
+// buffer. Callers keep their own light indexes, and GetLightSlot/GetLightIndex map them to and from buffer slots.
+// Spot and capsule lights are the last lights of the buffer (typed index ranges of ClusteredCommon.h), and their shapes
+// are uploaded to a shape buffer (SetLightShapes). Lights are only reordered inside the range of their type.
 //--------------------------------------------------------------------------------------
 #include "DirectxHelper.h"
+#include "ClusteredCommon.h"
 #include <vector>
 
 class LightManager
@@ -15,9 +20,23 @@ public:
 
 	void CopyToDefault();
 
+	// Upload lights in Morton order from the next UpdateLightBuffer, a float3 position is at iPositionOffset of a light.
+	void SetMortonOrder(bool bEnable, int iPositionOffset);
+	// Upload the shapes of spot and capsule lights from the next UpdateLightBuffer, the last iSpotNum+iCapsuleNum lights
+	// are spot lights then capsule lights, and pShapes has their shapes in the same order.
+	void SetLightShapes(const LightShape* pShapes, int iSpotNum, int iCapsuleNum);
+	bool IsMortonOrder() const { return m_bMortonOrder; }
+	// The buffer slot of a caller's light index, and the caller's light index of a buffer slot.
+	int GetLightSlot(int iLight) const { return m_bMortonOrder ? (int)m_lightSlots[iLight] : iLight; }
+	int GetLightIndex(int iSlot) const { return m_bMortonOrder ? (int)m_slotLights[iSlot] : iSlot; }
+
 	const Microsoft::WRL::ComPtr<ID3D12Resource> GetLightBuffer() { return m_lightBuffer; }
 	const D3D12_SHADER_RESOURCE_VIEW_DESC&  GetSrvDesc() { return m_srvDesc; }
 	int GetLightNum() { return m_iNum; }
+	const Microsoft::WRL::ComPtr<ID3D12Resource> GetLightShapeBuffer() { return m_shapeBuffer; }
+	const D3D12_SHADER_RESOURCE_VIEW_DESC&  GetShapeSrvDesc() { return m_shapeSrvDesc; }
+	int GetSpotLightNum() { return m_iSpotNum; }
+	int GetCapsuleLightNum() { return m_iCapsuleNum; }
 
 private:
 	Microsoft::WRL::ComPtr<ID3D12Resource> m_lightBuffer;
@@ -25,4 +44,15 @@ private:
 	int m_iNum;
 	int m_iTypeSize;
 
+	bool m_bMortonOrder;
+	int m_iPositionOffset;
+	std::vector<uint> m_slotLights;	// The caller's light index of every slot.
+	std::vector<uint> m_lightSlots;	// The slot of every caller's light index.
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_shapeBuffer;
+	D3D12_SHADER_RESOURCE_VIEW_DESC m_shapeSrvDesc;
+	std::vector<LightShape> m_shapes;	// Shapes of spot and capsule lights in the caller's order.
+	int m_iSpotNum;
+	int m_iCapsuleNum;
+
 };
\ No newline at end of file
@@ -0,0 +1,105 @@
+//--------------------------------------------------------------------------------------
+// File: LightOcclusionCS.hlsl
+//
+// A compute shader to reject lights behind the depth pyramid before culling, a thread per light.
+// The screen rect of a light sphere is covered by at most 2x2 cells of the finest possible level, and a light is occluded
+// if its sphere is behind the max depth of those cells. Spheres crossing the near plane are never occluded.
+// A group writes its own words of the visibility bits (bit i%32 of word i/32 is set if light i isn't occluded).
+//--------------------------------------------------------------------------------------
+#include "ClusteredCommon.h"
+#include "CameraCommon.h"
+#include "LightTileRect.hlsli"
+
+StructuredBuffer<PointLight> gLightSRV : register(t0);	// Light buffer.
+ConstantBuffer<ClusteredData> gCB : register(b0);	// Light culling information.
+ConstantBuffer<ViewData> gViewCB : register(b1);	// Camera data.
+RWStructuredBuffer<DepthBounds> gDepthPyramidUAV : register(u4);	// All levels of the depth pyramid.
+RWStructuredBuffer<uint> gLightVisibilityUAV : register(u5);	// Visibility bits of lights.
+RWStructuredBuffer<ViewLight> gViewLightUAV : register(u8);	// View-space lights (LightTransformCS).
+
+groupshared uint ldsVisibility[LightOcclusionGroupSize / 32];
+
+// The view-space center and radius of light i, from the view-space light buffer (LightTransformCS) with UseViewSpaceLights.
+void LoadViewLight(uint i, out float4 center, out float radius)
+{
+	[branch]
+	if (UseViewSpaceLights)
+	{
+		ViewLight V = gViewLightUAV[i];
+		center = float4(V.center, 1);
+		radius = V.radius;
+	}
+	else
+	{
+		PointLight L = gLightSRV[i];
+		center = mul(float4(L.pos, 1), gViewCB.View);
+		center /= center.w;
+		radius = L.radius;
+	}
+}
+
+// Convert a point from post-projection space into view space.
+float4 ConvertProjToView(float4 p)
+{
+	p = mul(p, gViewCB.ProjInv);
+	p /= p.w;
+	return p;
+}
+
+bool IsSphereOccluded(float3 center, float radius)
+{
+	float sphereNearZ = center.z - radius;
+	[branch]
+	if (!(sphereNearZ > ConvertProjToView(float4(0, 0, 0, 1)).z))
+	{
+		return false;
+	}
+
+	// All corners of the view-space AABB of the sphere are in front of the camera.
+	uint2 p0, p1;
+	GetSphereTileRect(center, radius, gViewCB.Proj, uint2(gCB.widthDim, gCB.heightDim), p0, p1);
+
+	uint level = GetDepthPyramidCoverLevel(p0.x, p0.y, p1.x, p1.y);
+	uint offset = GetDepthPyramidLevelOffset(gCB.widthDim, gCB.heightDim, level);
+	uint width = GetDepthPyramidLevelSize(gCB.widthDim, level);
+	float zMax = 0;
+	for (uint y = p0.y >> level; y <= p1.y >> level; y++)
+	{
+		for (uint x = p0.x >> level; x <= p1.x >> level; x++)
+		{
+			zMax = max(zMax, gDepthPyramidUAV[offset + x + y*width].zMax);
+		}
+	}
+	return sphereNearZ > ConvertProjToView(float4(0, 0, zMax, 1)).z;
+}
+
+[numthreads(LightOcclusionGroupSize, 1, 1)]
+void main(uint3 DTid : SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint Gindex : SV_GroupIndex)
+{
+	if (Gindex < LightOcclusionGroupSize / 32)
+	{
+		ldsVisibility[Gindex] = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	uint i = DTid.x;
+	[branch]
+	if (i < gCB.lightNum)
+	{
+		float4 center;
+		float radius;
+		LoadViewLight(i, center, radius);
+		if (!IsSphereOccluded(center.xyz, radius))
+		{
+			InterlockedOr(ldsVisibility[Gindex / 32], 1u << (Gindex % 32));
+		}
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// Words of lights after lightNum are never read.
+	uint word = Gid.x*(LightOcclusionGroupSize / 32) + Gindex;
+	if (Gindex < LightOcclusionGroupSize / 32 && word * 32 < gCB.lightNum)
+	{
+		gLightVisibilityUAV[word] = ldsVisibility[Gindex];
+	}
+}
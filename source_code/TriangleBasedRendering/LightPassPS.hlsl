@@ -3,9 +3,12 @@
 //
 // A pixel shader for triangle-based lighting method.
 // It uses the information passed from geometry shader to loop lights.
+// Light lists are ordered by type, so point, spot and capsule lights are lit in one loop per type.
+// With UseViewSpaceLighting, pixels are lit in view space from the view ray of the tile mesh and the linear depth.
 //--------------------------------------------------------------------------------------
 #include "DeferredRender.hlsli"
 #include "Lighting.hlsli"
+#include "LightShape.hlsli"
 
 // G-buffer.
 Texture2D gAlbedoTexture : register(t0);
@@ -14,55 +17,78 @@ Texture2D gSpecularGlossTexture : register(t2);
 Texture2D gDepth: register(t3);
 
 // Light culling data.
-StructuredBuffer<ClusteredBuffer> gPerTileLightIndex : register(t5);	// Light indexed buffer.
+StructuredBuffer<uint> gPerTileLightIndex : register(t5);	// Light indexed buffer (packed light indexes, LoadLightIndex).
 ConstantBuffer<ClusteredData> gCB : register(b2);	// Light culling information.
 StructuredBuffer<PointLight> gLightSRV : register(t6);	// Light buffer.
+StructuredBuffer<ClusteredList> gLightListSRV : register(t7);	// Light lists of clusters.
+StructuredBuffer<LightShape> gLightShapeSRV : register(t10);	// Shapes of spot and capsule lights.
 
 float4 main(gs_out pIn) : SV_TARGET
 {
-	// Reconstruct world position with depth buffer.
+	// Reconstruct the position with depth buffer, in the space of the lights.
 	float z = gDepth[pIn.position.xy].x;
-	float4 vProjectedPos = float4(pIn.position.xy, z, 1.0f);
-
-	// Transform by the inverse screen view projection matrix to world space.
-	float4 vPositionWS = mul(vProjectedPos, gViewCB.InvPV);
-	vPositionWS = vPositionWS / vPositionWS.w;
+	float3 position;
+	float3 toCamera;
+	[flatten]
+	if (UseViewSpaceLighting)
+	{
+		// Scale the view ray by the linear depth, the camera is at the origin of view space.
+		position = pIn.viewRay*GetViewDepth(z);
+		toCamera = -position;
+	}
+	else
+	{
+		// Transform by the inverse screen view projection matrix to world space.
+		float4 vPositionWS = mul(float4(pIn.position.xy, z, 1.0f), gViewCB.InvPV);
+		position = vPositionWS.xyz / vPositionWS.w;
+		toCamera = gViewCB.CamPos - position;
+	}
 
 	// Load G-buffer.
 	float3 albedo = gAlbedoTexture[pIn.position.xy].xyz;
 	float3 normal = normalize(gNormalTexture[pIn.position.xy].xyz);
 	float4 specGloss = gSpecularGlossTexture[pIn.position.xy].xyzw;
-	float3 viewDir = normalize(gViewCB.CamPos - vPositionWS.xyz);
+	float viewDistance = length(toCamera);	// The distance for the shading tier (ShadingTierPolicy).
+	float3 viewDir = normalize(toCamera);
+
+	// Select the cluster of this pixel in the depth slices of the triangle.
+	uint clusterIdx = pIn.tileID + GetDepthSlice(z, gCB.depthDim)*GetSliceStride(gCB.widthDim, gCB.heightDim);
+	bool farList;
+	ClusteredList list = GetPixelLightList(gLightListSRV[clusterIdx], z, gPerTileLightIndex, farList);
+	// The lights of every type are in one range of the list, so every type has its own loop.
+	uint2 ranges[LightTypeNum];
+	GetLightTypeRanges(list, farList, gCB, gPerTileLightIndex, ranges);
+	uint shapeOffset = GetLightTypeOffset(gCB.lightNum, gCB.spotLightNum, gCB.capsuleLightNum, LightTypeSpot);
 
 	float3 col = 0;
 
 	[loop]
-	for (uint i = 0; i < pIn.tileCounter; i++)
+	for (uint i = ranges[LightTypePoint].x; i < ranges[LightTypePoint].y; i++)
 	{
-	
-		{
-			// Load a light in light buffer.
-			PointLight L;
-			L = gLightSRV[gPerTileLightIndex[pIn.tileID].lightIdxs[i]];
-			// Attenuation light (This computation make sure the light intensity decrease to 0, but it is not physically-based).
-			float d = length(L.pos - vPositionWS.xyz);
-			d = saturate(1 - d / L.radius) * 1;
-			[branch]
-			if (d > 0)
-			{
-				// Lighting calculation.
-				float3 lightVector = normalize(L.pos - vPositionWS.xyz);
-				[branch]
-				if (dot(lightVector, normal) > 0)
-				{
-					float3 res = GGXBRDF(lightVector, L.pos, albedo, normal,
-						viewDir, specGloss.xyz, specGloss.w);
-
-					col += res*d*L.color;
-				}
-
-			}
-		}
+		// Load a light in light buffer.
+		uint lightIdx = LoadLightIndex(gPerTileLightIndex, list.offset + i);
+		float4 sphere = LoadLightSphere(gLightSRV, lightIdx);
+		// Attenuation light (This computation make sure the light intensity decrease to 0, but it is not physically-based).
+		float d = length(sphere.xyz - position);
+		d = saturate(1 - d / sphere.w) * 1;
+		col += GetLightContribution(sphere.xyz, d, gLightSRV[lightIdx].color, position, albedo, normal, viewDir, specGloss, viewDistance);
+	}
+	// Spot lights and capsule lights are attenuated by their shapes.
+	[loop]
+	for (uint s = ranges[LightTypeSpot].x; s < ranges[LightTypeSpot].y; s++)
+	{
+		uint lightIdx = LoadLightIndex(gPerTileLightIndex, list.offset + s);
+		float3 lightPos;
+		float d = GetLightShapeAttenuation(LightTypeSpot, LoadLightShape(gLightShapeSRV, lightIdx - shapeOffset), position, lightPos);
+		col += GetLightContribution(lightPos, d, gLightSRV[lightIdx].color, position, albedo, normal, viewDir, specGloss, viewDistance);
+	}
+	[loop]
+	for (uint c = ranges[LightTypeCapsule].x; c < ranges[LightTypeCapsule].y; c++)
+	{
+		uint lightIdx = LoadLightIndex(gPerTileLightIndex, list.offset + c);
+		float3 lightPos;
+		float d = GetLightShapeAttenuation(LightTypeCapsule, LoadLightShape(gLightShapeSRV, lightIdx - shapeOffset), position, lightPos);
+		col += GetLightContribution(lightPos, d, gLightSRV[lightIdx].color, position, albedo, normal, viewDir, specGloss, viewDistance);
 	}
 
 return float4(col,1);
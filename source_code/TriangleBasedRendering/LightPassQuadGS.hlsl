@@ -5,8 +5,8 @@
 //--------------------------------------------------------------------------------------
 #include "DeferredRender.hlsli"
 
-StructuredBuffer<ClusteredBuffer> gPerTileLightIndex : register(t5);
-StructuredBuffer<int> gPerTileLightCounter : register(t7);	// Light counter buffer.
+StructuredBuffer<ClusteredList> gLightListSRV : register(t7);	// Light lists of clusters.
+ConstantBuffer<ClusteredData> gCB : register(b2);	// Light culling information.
 
 [maxvertexcount(3)]
 void main(
@@ -14,22 +14,31 @@ void main(
 	inout TriangleStream< gs_out > output
 	)
 {
-	uint tileIndex = index/2;
+	uint tileIndex = GetTriangleCluster(index);
+	// Use the diagonal of the tile selected by light culling.
+	gs_in vertexes[3] = input;
+	GetTileTriangle(index, vertexes);
 
-	// Use triangles' indexes to load an element in light indexed buffer.
-	uint totalNum = gPerTileLightCounter[tileIndex];
+	// Use triangles' indexes to load elements in light indexed buffer.
+	// Clusters of the same tile are one slice apart, and the pixel shader selects a slice with depth.
+	uint totalNum = 0;
+	for (uint z = 0; z < gCB.depthDim; z++)
+	{
+		totalNum += gLightListSRV[tileIndex + z*GetSliceStride(gCB.widthDim, gCB.heightDim)].lightNum & ~ClusteredListSplitBit;
+	}
 	{
 		gs_out element;
-		// Triangle's index.
+		// The cluster of the triangle in the first depth slice.
 		element.tileID = tileIndex;
-		// The total number of lights in this tile.
+		// The total number of lights in all clusters of this tile.
 		element.tileCounter = totalNum;
 		if (totalNum > 0)
 		{
 			for (uint j = 0; j < 3; j++)
 			{
-				element.position = input[j].position;
-				element.texcoord = input[j].texcoord;
+				element.position = vertexes[j].position;
+				element.texcoord = vertexes[j].texcoord;
+				element.viewRay = vertexes[j].viewRay;
 				output.Append(element);
 			}
 		}
@@ -0,0 +1,91 @@
+//--------------------------------------------------------------------------------------
+// File: LightScatterCS.hlsl
+//
+// A compute shader to scatter lights to the light masks of tiles before culling, a thread per light.
+// A light sphere is projected to a rect of tiles, and its bit is set in the mask of every tile of the rect whose depth range
+// (level 0 of the depth pyramid) overlaps the view-space depth range of the sphere. Spheres crossing the near plane cover
+// all tiles. The culling shaders only test the lights of the mask of their tile, and DepthPyramidCS clears the masks.
+//--------------------------------------------------------------------------------------
+#include "ClusteredCommon.h"
+#include "CameraCommon.h"
+#include "LightTileRect.hlsli"
+
+StructuredBuffer<PointLight> gLightSRV : register(t0);	// Light buffer.
+ConstantBuffer<ClusteredData> gCB : register(b0);	// Light culling information.
+ConstantBuffer<ViewData> gViewCB : register(b1);	// Camera data.
+RWStructuredBuffer<DepthBounds> gDepthPyramidUAV : register(u4);	// The depth pyramid, level 0 has the depth range of tiles.
+RWStructuredBuffer<uint> gLightVisibilityUAV : register(u5);	// Visibility bits of lights (LightOcclusionCS).
+RWStructuredBuffer<uint> gTileLightMaskUAV : register(u7);	// Light masks of tiles (TileLightMaskWordNum words per tile).
+RWStructuredBuffer<ViewLight> gViewLightUAV : register(u8);	// View-space lights (LightTransformCS).
+
+// The view-space center and radius of light i, from the view-space light buffer (LightTransformCS) with UseViewSpaceLights.
+void LoadViewLight(uint i, out float4 center, out float radius)
+{
+	[branch]
+	if (UseViewSpaceLights)
+	{
+		ViewLight V = gViewLightUAV[i];
+		center = float4(V.center, 1);
+		radius = V.radius;
+	}
+	else
+	{
+		PointLight L = gLightSRV[i];
+		center = mul(float4(L.pos, 1), gViewCB.View);
+		center /= center.w;
+		radius = L.radius;
+	}
+}
+
+// Convert a point from post-projection space into view space.
+float4 ConvertProjToView(float4 p)
+{
+	p = mul(p, gViewCB.ProjInv);
+	p /= p.w;
+	return p;
+}
+
+[numthreads(LightScatterGroupSize, 1, 1)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	uint i = DTid.x;
+	[branch]
+	if (i >= gCB.lightNum)
+	{
+		return;
+	}
+	[branch]
+	if (UseLightOcclusion && (gLightVisibilityUAV[i / 32] & (1u << (i % 32))) == 0)
+	{
+		return;
+	}
+
+	float4 center;
+	float radius;
+	LoadViewLight(i, center, radius);
+	uint2 tileNum = uint2(gCB.widthDim, gCB.heightDim);
+	uint2 p0 = 0;
+	uint2 p1 = tileNum - 1;
+	[branch]
+	if (center.z - radius > ConvertProjToView(float4(0, 0, 0, 1)).z)
+	{
+		if (!GetSphereTileRect(center.xyz, radius, gViewCB.Proj, tileNum, p0, p1))
+		{
+			return;
+		}
+	}
+
+	for (uint y = p0.y; y <= p1.y; y++)
+	{
+		for (uint x = p0.x; x <= p1.x; x++)
+		{
+			uint tileIdx = x + y*gCB.widthDim;
+			DepthBounds bounds = gDepthPyramidUAV[tileIdx];
+			if (center.z + radius >= ConvertProjToView(float4(0, 0, bounds.zMin, 1)).z &&
+				center.z - radius <= ConvertProjToView(float4(0, 0, bounds.zMax, 1)).z)
+			{
+				InterlockedOr(gTileLightMaskUAV[tileIdx*TileLightMaskWordNum + i / 32], 1u << (i % 32));
+			}
+		}
+	}
+}
@@ -0,0 +1,42 @@
+//--------------------------------------------------------------------------------------
+// File: LightShape.hlsli
+//
+// Spot and capsule light shapes (LightShape), for the culling shaders and the light passes.
+// A spot light is the sector of the sphere of its range inside its cone, a capsule light is its segment grown by its range.
+//--------------------------------------------------------------------------------------
+
+// The signed distance from a plane to the closest point of a light shape (origin and axis in the space of the plane).
+// It is negative if the shape crosses the plane to its back.
+float GetLightShapePlaneDistance(uint type, float3 origin, float3 axis, LightShape S, float4 plane)
+{
+	float d = dot(plane.xyz, origin) + plane.w;
+	float nd = dot(plane.xyz, axis);
+	[branch]
+	if (type == LightTypeCapsule)
+	{
+		return d - abs(nd) - S.range;
+	}
+	// The closest direction of the cone is -n inside the cone, or the edge of the cone in the plane of n and the axis.
+	float perp = sqrt(max(1 - nd*nd, 0));
+	float edge = -nd >= S.cosAngle ? -1 : min(nd*S.cosAngle - perp*S.sinAngle, 0);
+	return d + S.range*edge;
+}
+
+// The attenuation of a light shape at a world-space position, and the position the light comes from.
+// Like point lights, the intensity decreases linearly to 0 at the range, and spot lights fade out to the edge of the cone.
+float GetLightShapeAttenuation(uint type, LightShape S, float3 p, out float3 lightPos)
+{
+	[branch]
+	if (type == LightTypeCapsule)
+	{
+		// The closest point of the segment.
+		float t = clamp(dot(p - S.origin, S.axis) / max(dot(S.axis, S.axis), 1e-12f), -1, 1);
+		lightPos = S.origin + S.axis*t;
+		return saturate(1 - length(p - lightPos) / S.range);
+	}
+	lightPos = S.origin;
+	float3 v = p - S.origin;
+	float dist = length(v);
+	float cone = saturate((dot(v, S.axis) / max(dist, 1e-6f) - S.cosAngle) / max(1 - S.cosAngle, 1e-6f));
+	return saturate(1 - dist / S.range) * cone;
+}
@@ -0,0 +1,28 @@
+//--------------------------------------------------------------------------------------
+// File: LightTileRect.hlsli
+//
+// The screen rect of a light sphere in tiles, for the per-light passes (LightOcclusionCS and LightScatterCS).
+//--------------------------------------------------------------------------------------
+
+// Get the tiles [p0, p1] under a view-space sphere, all corners of its view-space AABB must be in front of the camera.
+// The rect is the projection of the 8 corners of the AABB clamped to the tiles, and false is returned if it misses all tiles.
+bool GetSphereTileRect(float3 center, float radius, float4x4 proj, uint2 tileNum, out uint2 p0, out uint2 p1)
+{
+	float2 rectMin = asfloat(0x7f7fffff);
+	float2 rectMax = -asfloat(0x7f7fffff);
+	[unroll]
+	for (uint k = 0; k < 8; k++)
+	{
+		float4 corner = float4(center + float3((k & 1) ? radius : -radius, (k & 2) ? radius : -radius, (k & 4) ? radius : -radius), 1);
+		float4 projPos = mul(corner, proj);
+		projPos /= projPos.w;
+		rectMin = min(rectMin, projPos.xy);
+		rectMax = max(rectMax, projPos.xy);
+	}
+	// Projected positions to tiles, y is flipped.
+	float2 tileMin = floor(float2(rectMin.x * 0.5f + 0.5f, 0.5f - rectMax.y * 0.5f) * (float2)tileNum);
+	float2 tileMax = floor(float2(rectMax.x * 0.5f + 0.5f, 0.5f - rectMin.y * 0.5f) * (float2)tileNum);
+	p0 = (uint2)clamp(tileMin, 0, tileNum - 1);
+	p1 = (uint2)clamp(tileMax, 0, tileNum - 1);
+	return all(tileMax >= 0) && all(tileMin < (float2)tileNum);
+}
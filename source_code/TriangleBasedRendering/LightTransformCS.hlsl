@@ -0,0 +1,45 @@
+//--------------------------------------------------------------------------------------
+// File: LightTransformCS.hlsl
+//
+// A compute shader to transform lights to view space once per frame, a thread per light.
+// It writes the view-space light buffer (ViewLight) and the view-space shapes of spot and capsule lights (LightShape).
+//--------------------------------------------------------------------------------------
+#include "ClusteredCommon.h"
+#include "CameraCommon.h"
+
+StructuredBuffer<PointLight> gLightSRV : register(t0);	// Light buffer.
+StructuredBuffer<LightShape> gLightShapeSRV : register(t3);	// Shapes of spot and capsule lights.
+ConstantBuffer<ClusteredData> gCB : register(b0);	// Light culling information.
+ConstantBuffer<ViewData> gViewCB : register(b1);	// Camera data.
+RWStructuredBuffer<ViewLight> gViewLightUAV : register(u8);	// View-space lights.
+RWStructuredBuffer<LightShape> gViewLightShapeUAV : register(u9);	// View-space shapes of spot and capsule lights.
+
+[numthreads(LightTransformGroupSize, 1, 1)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	uint i = DTid.x;
+	[branch]
+	if (i >= gCB.lightNum)
+	{
+		return;
+	}
+
+	PointLight L = gLightSRV[i];
+	float4 center = mul(float4(L.pos, 1), gViewCB.View);
+	ViewLight V;
+	V.center = center.xyz / center.w;
+	V.radius = L.radius;
+	gViewLightUAV[i] = V;
+
+	// Shapes are stored at the index of the light after the first spot light.
+	uint shapeOffset = GetLightTypeOffset(gCB.lightNum, gCB.spotLightNum, gCB.capsuleLightNum, LightTypeSpot);
+	[branch]
+	if (i >= shapeOffset)
+	{
+		LightShape S = gLightShapeSRV[i - shapeOffset];
+		float4 origin = mul(float4(S.origin, 1), gViewCB.View);
+		S.origin = origin.xyz / origin.w;
+		S.axis = mul(float4(S.axis, 0), gViewCB.View).xyz;
+		gViewLightShapeUAV[i - shapeOffset] = S;
+	}
+}
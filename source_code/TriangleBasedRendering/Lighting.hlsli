@@ -42,9 +42,91 @@ float3 GGXBRDF(float3 lightDir, float3 lightPos, float3 albedo, float3 normal, f
 	return col;
 }
 
+// ShadingTierFast: GGXBRDF with a spherical Gaussian approximation of the Fresnel term and the Kelemen visibility
+// (G ~ NdotL*NdotV/LdotH^2), so it has no pow and one division instead of two.
+float3 GGXFastBRDF(float3 lightDir, float3 lightPos, float3 albedo, float3 normal, float3 viewDir, float3 specular, float gloss)
+{
+	const  float pi = 3.14159;
+	float3 h = normalize(viewDir + lightDir);
+
+	float NdotL = max(0, dot(normal, lightDir));
+	float NdotH = max(0, dot(normal, h));
+	float VdotH = max(0, dot(viewDir, h));
+	float NdotV = max(0, dot(normal, viewDir));
+	float roughness = gloss;
+
+	// D
+	float alpha = roughness *  roughness;
+	float alphaSqr = alpha*alpha;
+	float denom = ((NdotH * NdotH) * (alphaSqr - 1.0) + 1.0);
+	float D = alphaSqr / (pi * denom* denom);
+
+	// Spherical Gaussian Fresnel, and LdotH equals VdotH for the half vector.
+	float F_b = exp2((-5.55473f*VdotH - 6.98316f)*VdotH);
+	float vis = saturate(NdotL*NdotV / max(VdotH*VdotH, 1e-4f));
+	float FV_b = F_b*vis;
+	float3 col = specular*vis + (1 - specular)*FV_b;
+
+	return NdotL*D*col + NdotL*albedo;
+}
+
+// ShadingTierLambertBlinn: Lambert and a normalized Blinn-Phong lobe whose exponent gives the peak of the GGX lobe of the
+// same roughness, without the Fresnel and visibility terms.
+float3 LambertBlinnBRDF(float3 lightDir, float3 lightPos, float3 albedo, float3 normal, float3 viewDir, float3 specular, float gloss)
+{
+	const  float pi = 3.14159;
+	float3 h = normalize(viewDir + lightDir);
+
+	float NdotL = max(0, dot(normal, lightDir));
+	float NdotH = max(0, dot(normal, h));
+	float alpha = gloss*gloss;
+	float alphaSqr = max(alpha*alpha, 1e-6f);
+	float n = 2 / alphaSqr - 2;
+	float D = (n + 2) / (2 * pi) * pow(NdotH, n);
+
+	return NdotL*D*specular + NdotL*albedo;
+}
+
 float3 LambertBRDF(float3 lightDir, float3 lightPos, float3 albedo, float3 normal, float3 viewDir, float3 specular, float gloss)
 {
 
 
 	return max(0, dot(normal, lightDir))*albedo;
-}
\ No newline at end of file
+}
+
+// The light of a light at lightPos on a pixel at pos, with the attenuation of the light at the pixel. The positions, the
+// normal and the view direction are in the space of the light pass (view space with UseViewSpaceLighting).
+// The BRDF is the shading tier selected by ShadingTierPolicy for the distance of the pixel to the camera and the intensity of
+// the light at the pixel. Lanes of a wave with different tiers run the tiers one after another.
+float3 GetLightContribution(float3 lightPos, float attenuation, float3 color, float3 pos, float3 albedo, float3 normal, float3 viewDir, float4 specGloss,
+	float viewDistance)
+{
+	float3 col = 0;
+	[branch]
+	if (attenuation > 0)
+	{
+		// Lighting calculation.
+		float3 lightVector = normalize(lightPos - pos);
+		[branch]
+		if (dot(lightVector, normal) > 0)
+		{
+			uint tier = SelectShadingTier(ShadingTierPolicy, viewDistance, attenuation*max(color.r, max(color.g, color.b)));
+			float3 brdf;
+			[branch]
+			if (tier == ShadingTierFull)
+			{
+				brdf = GGXBRDF(lightVector, lightPos, albedo, normal, viewDir, specGloss.xyz, specGloss.w);
+			}
+			else if (tier == ShadingTierFast)
+			{
+				brdf = GGXFastBRDF(lightVector, lightPos, albedo, normal, viewDir, specGloss.xyz, specGloss.w);
+			}
+			else
+			{
+				brdf = LambertBlinnBRDF(lightVector, lightPos, albedo, normal, viewDir, specGloss.xyz, specGloss.w);
+			}
+			col = brdf*attenuation*color;
+		}
+	}
+	return col;
+}
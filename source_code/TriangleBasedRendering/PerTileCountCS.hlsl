@@ -0,0 +1,7 @@
+//--------------------------------------------------------------------------------------
+// File: PerTileCountCS.hlsl
+//
+// The count pass of per tile light culling, it only writes the light counter buffer.
+//--------------------------------------------------------------------------------------
+#define LIGHT_COUNT_PASS
+#include "PerTileCullingCS.hlsl"
@@ -2,28 +2,66 @@
 // File: PerTileCullingCS.hlsl
 //
 // A light culling compute shader to compute the intersections between lights and tiles.
+// It runs twice: the count pass (LIGHT_COUNT_PASS, PerTileCountCS) only writes light counters,
+// LightListScanCS allocates packed lists with the counters, then this pass writes light indexes into the lists.
 //--------------------------------------------------------------------------------------
 #include "ClusteredCommon.h"
 #include "CameraCommon.h"
+#include "LightShape.hlsli"
+#include "TilePlane.hlsli"
+#include "DepthBin.hlsli"
 
 // Global variables.
 StructuredBuffer<PointLight> gLightSRV : register(t0);
 StructuredBuffer<float> gDepthPlaneSRV : register(t1);
 ConstantBuffer<ClusteredData> gCB : register(b0);
 ConstantBuffer<ViewData> gViewCB : register(b1);
-RWStructuredBuffer<ClusteredBuffer> gDataUAV : register(u0);
+RWStructuredBuffer<uint> gDataUAV : register(u0);	// Packed light indexes of all clusters.
 RWStructuredBuffer<int> gLightCounterUAV : register(u1);	// Light counter buffer.
+RWStructuredBuffer<ClusteredList> gLightListUAV : register(u2);	// Light lists in packed light indexes.
+RWStructuredBuffer<DepthBounds> gDepthPyramidUAV : register(u4);	// The depth pyramid, level 0 has the depth range of tiles.
+RWStructuredBuffer<uint> gLightVisibilityUAV : register(u5);	// Visibility bits of lights (LightOcclusionCS).
+RWStructuredBuffer<uint> gTileLightMaskUAV : register(u7);	// Light masks of tiles (LightScatterCS).
 Texture2D gDepthBuffer : register(t2);
+StructuredBuffer<LightShape> gLightShapeSRV : register(t3);	// Shapes of spot and capsule lights.
+RWStructuredBuffer<ViewLight> gViewLightUAV : register(u8);	// View-space lights (LightTransformCS).
+RWStructuredBuffer<LightShape> gViewLightShapeUAV : register(u9);	// View-space shapes of spot and capsule lights.
+RWStructuredBuffer<TilePlanes> gTilePlaneUAV : register(u10);	// Planes of tiles through the camera (TilePlaneCS).
+RWStructuredBuffer<uint> gClusterDepthBinUAV : register(u11);	// Depth bins of clusters (DepthPyramidCS).
 
 // Group shared variables.
 groupshared uint ldsLightCounter;
 groupshared float4 ldsVertexes[8];
+groupshared float3 ldsCorners[4];	// The corner rays of the tile at view-space z = 1 (TilePlanes).
 groupshared float4 ldsPlanes[6];
 groupshared uint ldsLightIdx[PerClusterMaxLight];
 groupshared float ldsDepth[TileSize*TileSize];
 groupshared uint ldsZMax;
 groupshared uint ldsZMin;
-
+// Lights of the light mask of the tile (UseLightScatter), the candidates of a type start at the first light of the type.
+groupshared uint ldsCandidates[MaxLightNum];
+groupshared uint ldsCandidateNum[LightTypeNum];
+// Depth bins occupied by pixels of the tile.
+groupshared uint ldsDepthBin;
+// Bounds of the frustum for the tighter tile test (LightTileTest).
+groupshared float3 ldsAabbMin;
+groupshared float3 ldsAabbMax;
+groupshared float3 ldsConeAxis;
+groupshared float2 ldsConeCosSin;
+#ifndef LIGHT_COUNT_PASS
+// Lists over PerClusterMaxLight (LightOverflowPolicy): the importance histogram, the kept bucket (LightImportanceBucketNum
+// if the list isn't clamped) and the number of lights of higher buckets, the counter of lights of the kept bucket,
+// and the near/far counters of split lists.
+groupshared float3 ldsClusterCenter;
+groupshared uint ldsImportanceHist[LightImportanceBucketNum];
+groupshared uint ldsClampBucket;
+groupshared uint ldsClampHighNum;
+groupshared uint ldsClampLowCounter;
+groupshared uint ldsSplitCounter[2];
+// The number of lights of every type in a clamped list, and the cursors to sort it by type.
+groupshared uint ldsClampTypeNum[LightTypeNum];
+groupshared uint ldsClampTypeCursor[LightTypeNum];
+#endif
 
 // Convert a point from post-projection space into view space.
 float4 ConvertProjToView(float4 p)
@@ -33,39 +71,219 @@ float4 ConvertProjToView(float4 p)
 	return p;
 }
 
-// This creates the standard Hessian-normal-form plane equation from three points, 
-// except it is simplified for the case where the first point is the origin.
-float4 CreatePlaneEquation(float4 b, float4 c)
+// Point-plane distance, simplified for the case where 
+// the plane passes through the origin.
+float GetSignedDistanceFromPlane(float4 p, float4 eqn)
 {
-	float4 n;
-	
-	// Normalize(cross( b.xyz-a.xyz, c.xyz-a.xyz )), except we know "a" is the origin.
-	n.xyz = normalize(cross(b.xyz, c.xyz));
+	// Dot( eqn.xyz, p.xyz ) + eqn.w, , except we know eqn.w is zero.
+	return dot(eqn.xyz, p.xyz) + eqn.w;
+}
 
-	// -(n dot a), except we know "a" is the origin.
-	n.w = 0;
+// The depth bins overlapped by a light sphere.
+uint GetLightDepthBins(float viewZ, float radius, float binNearZ, float invBinSize)
+{
+	uint first = GetDepthBin(viewZ - radius, binNearZ, invBinSize);
+	uint last = GetDepthBin(viewZ + radius, binNearZ, invBinSize);
+	return (0xffffffff >> (DepthBinNum - 1 - last)) & (0xffffffff << first);
+}
 
-	return n;
+// Does a sphere overlap the view-space AABB of the frustum (LightTileTestAabb)?
+bool IsSphereInAabb(float3 center, float radius)
+{
+	float3 d = max(max(ldsAabbMin - center, center - ldsAabbMax), 0);
+	return dot(d, d) < radius*radius;
 }
-float4 CreatePlaneEquation(float4 b, float4 c, float4 a)
+// Does a sphere overlap the cone of the frustum from the camera (LightTileTestCone)?
+// The distance to the surface of the cone is negative inside, and never exceeds the distance to the apex behind the cone.
+bool IsSphereInCone(float3 center, float radius)
 {
-	float4 n;
-
-	// Normalize(cross( b.xyz-a.xyz, c.xyz-a.xyz )), except we know "a" is the origin.
-	n.xyz = normalize(cross(b.xyz - a.xyz, c.xyz - a.xyz));
-
-	// -(n dot a), except we know "a" is the origin.
-	n.w = -dot(a.xyz, n.xyz);
-
-	return n;
+	float axisDist = dot(center, ldsConeAxis);
+	float perpDist = sqrt(max(dot(center, center) - axisDist*axisDist, 0));
+	return ldsConeCosSin.x*perpDist - ldsConeCosSin.y*axisDist < radius;
 }
-// Point-plane distance, simplified for the case where 
-// the plane passes through the origin.
-float GetSignedDistanceFromPlane(float4 p, float4 eqn)
+// The tighter test of a light after the planes of the tile.
+bool IsLightInTileBounds(float3 center, float radius)
 {
-	// Dot( eqn.xyz, p.xyz ) + eqn.w, , except we know eqn.w is zero.
-	return dot(eqn.xyz, p.xyz) + eqn.w;
+	[branch]
+	if (LightTileTest == LightTileTestAabb)
+	{
+		return IsSphereInAabb(center, radius);
+	}
+	else if (LightTileTest == LightTileTestCone)
+	{
+		return IsSphereInCone(center, radius);
+	}
+	return true;
+}
+// The importance bucket of a light (LightOverflowClamp), a bucket is a quarter of a power of 2 of radius over distance.
+uint GetLightImportanceBucket(float radius, float distance)
+{
+	float importance = floor(log2(max(radius, 1e-6f) / max(distance, 1e-6f)) * 4) + LightImportanceBucketNum / 2;
+	return (uint)clamp(importance, 0, LightImportanceBucketNum - 1);
+}
+// Is a light not occluded by the depth pyramid?
+bool IsLightVisible(uint i)
+{
+	return !UseLightOcclusion || (gLightVisibilityUAV[i / 32] & (1u << (i % 32))) != 0;
+}
+// The light of candidate k of the tile, all lights are candidates without UseLightScatter.
+uint GetCandidateLight(uint k)
+{
+	return UseLightScatter ? ldsCandidates[k] : k;
+}
+// The type of light i.
+uint GetLightType(uint i)
+{
+	return GetLightType(i, gCB.lightNum, gCB.spotLightNum, gCB.capsuleLightNum);
+}
+// The view-space center and radius of light i, from the view-space light buffer (LightTransformCS) with UseViewSpaceLights.
+void LoadViewLight(uint i, out float4 center, out float radius)
+{
+	[branch]
+	if (UseViewSpaceLights)
+	{
+		ViewLight V = gViewLightUAV[i];
+		center = float4(V.center, 1);
+		radius = V.radius;
+	}
+	else
+	{
+		PointLight L = gLightSRV[i];
+		center = mul(float4(L.pos, 1), gViewCB.View);
+		center /= center.w;
+		radius = L.radius;
+	}
+}
+// The view-space shape of spot or capsule light i.
+LightShape LoadViewLightShape(uint i)
+{
+	uint shapeIdx = i - GetLightTypeOffset(gCB.lightNum, gCB.spotLightNum, gCB.capsuleLightNum, LightTypeSpot);
+	[branch]
+	if (UseViewSpaceLights)
+	{
+		return gViewLightShapeUAV[shapeIdx];
+	}
+	// Transform the shape to view-space.
+	LightShape S = gLightShapeSRV[shapeIdx];
+	float4 origin = mul(float4(S.origin, 1), gViewCB.View);
+	S.origin = origin.xyz / origin.w;
+	S.axis = mul(float4(S.axis, 0), gViewCB.View).xyz;
+	return S;
+}
+// Does the shape of a spot or capsule light pass the planes of the tile?
+bool IsLightShapeInTile(uint i, uint type)
+{
+	LightShape S = LoadViewLightShape(i);
+	float r[6];
+	[unroll]
+	for (int j = 0; j < 6; j++)
+	{
+		r[j] = GetLightShapePlaneDistance(type, S.origin, S.axis, S, ldsPlanes[j]);
+	}
+	return r[0] < 0 && r[1] < 0 && r[2] < 0 && r[3] < 0 && r[4] < 0 && r[5] < 0;
+}
+// Does a view-space light pass the planes and the bounds of the tile, and overlap its depth bins?
+bool IsLightInTile(uint i, float4 center, float radius, uint lightBins)
+{
+	float r[6];
+	[unroll]
+	for (int j = 0; j < 6; j++)
+	{
+		r[j] = GetSignedDistanceFromPlane(center, ldsPlanes[j]);
+	}
+	[branch]
+	if (!(r[0] < radius && r[1] < radius && r[2] < radius && r[3] < radius && r[4] < radius && r[5] < radius &&
+		IsLightInTileBounds(center.xyz, radius) && (lightBins & ldsDepthBin) != 0))
+	{
+		return false;
+	}
+	// Spot and capsule lights are tested by their shapes after their bounding spheres.
+	uint type = GetLightType(i);
+	[branch]
+	if (UseLightShapeTests && type != LightTypePoint)
+	{
+		return IsLightShapeInTile(i, type);
+	}
+	return true;
+}
+#ifndef LIGHT_COUNT_PASS
+// Store a light index (or a value of a split list header) in a slot of the packed light indexes. A 16-bit slot shares its
+// uint with a slot which another thread may store, so both halves are written with atomics.
+void StoreLightIndex(uint slot, uint value)
+{
+	[branch]
+	if (UseLightIndex16)
+	{
+		uint shift = (slot & 1) * 16;
+		InterlockedAnd(gDataUAV[slot / 2], ~(0xffffu << shift));
+		InterlockedOr(gDataUAV[slot / 2], value << shift);
+	}
+	else
+	{
+		gDataUAV[slot] = value;
+	}
+}
+
+// Append a light to the list of the tile, lists over PerClusterMaxLight follow LightOverflowPolicy.
+void AppendLight(uint i, ClusteredList list, float radius, float3 center, uint lightBins)
+{
+	uint dstIdx = 0;
+	[branch]
+	if (list.lightNum & ClusteredListSplitBit)
+	{
+		// Near lights follow the header, and far lights are written backwards from the end of the list.
+		uint listSize = list.lightNum & ~ClusteredListSplitBit;
+		if (lightBins & SplitNearBins)
+		{
+			InterlockedAdd(ldsSplitCounter[0], 1, dstIdx);
+			StoreLightIndex(list.offset + ClusteredSplitHeaderSize + dstIdx, i);
+		}
+		if (lightBins & SplitFarBins)
+		{
+			InterlockedAdd(ldsSplitCounter[1], 1, dstIdx);
+			StoreLightIndex(list.offset + listSize - 1 - dstIdx, i);
+		}
+		return;
+	}
+	[branch]
+	if (ldsClampBucket < LightImportanceBucketNum)
+	{
+		// Lights of higher buckets take the first slots, lights of the kept bucket fill the rest, and the others are dropped.
+		uint bucket = GetLightImportanceBucket(radius, length(center - ldsClusterCenter));
+		if (bucket > ldsClampBucket)
+		{
+			InterlockedAdd(ldsLightCounter, 1, dstIdx);
+		}
+		else if (bucket == ldsClampBucket)
+		{
+			InterlockedAdd(ldsClampLowCounter, 1, dstIdx);
+			dstIdx += ldsClampHighNum;
+		}
+		else
+		{
+			return;
+		}
+	}
+	else
+	{
+		// Lights after PerClusterMaxLight spill into the packed list.
+		InterlockedAdd(ldsLightCounter, 1, dstIdx);
+		if (dstIdx >= PerClusterMaxLight && dstIdx < list.lightNum)
+		{
+			StoreLightIndex(list.offset + dstIdx, i);
+		}
+	}
+	if (dstIdx < PerClusterMaxLight)
+	{
+		ldsLightIdx[dstIdx] = i;
+		// A clamped list is sorted by type again when it is stored.
+		if (ldsClampBucket < LightImportanceBucketNum)
+		{
+			InterlockedAdd(ldsClampTypeNum[GetLightType(i)], 1);
+		}
+	}
 }
+#endif
 
 [numthreads(NumThreadX, NumThreadY, 1)]
 void main(uint3 DTid : SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint3 GTid : SV_GroupThreadID, uint Gindex : SV_GroupIndex)
@@ -82,43 +300,108 @@ void main(uint3 DTid : SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint3 GTid :
 	{
 		ldsZMin = 0x7f7fffff;
 		ldsZMax = 0;
+		for (uint t = 0; t < LightTypeNum; t++)
+		{
+			ldsCandidateNum[t] = 0;
+		}
+		// Without 2.5D culling, all lights overlap the bins.
+		ldsDepthBin = UseDepthBinCulling ? 0 : 0xffffffff;
+		// The depth pyramid already has the depth range and the depth bins of the tile.
+		[branch]
+		if (UseDepthPyramid)
+		{
+			DepthBounds bounds = gDepthPyramidUAV[Gid.x + Gid.y*gCB.widthDim];
+			ldsZMin = asuint(bounds.zMin);
+			ldsZMax = asuint(bounds.zMax);
+			ldsDepthBin = gClusterDepthBinUAV[tileIdxFlattened];
+		}
 	}
 
-	for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+	// Start at the first pixel whose center is in the tile, tiles are at most TileSize pixels (GetTileNum) so all of their
+	// pixels are loaded. With the depth pyramid, the culling shaders don't need the depth texels.
+	[branch]
+	if (!UseDepthPyramid)
 	{
-		float tileThreadIdxY = i / TileSize;
-		float tileThreadIdxX = i %  TileSize;
-		ldsDepth[i] = gDepthBuffer[float2(x[0]+ tileThreadIdxX,y[0]+ tileThreadIdxY)].x;
+		for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+		{
+			float tileThreadIdxY = i / TileSize;
+			float tileThreadIdxX = i %  TileSize;
+			ldsDepth[i] = gDepthBuffer[float2(x[0] + 0.5f + tileThreadIdxX, y[0] + 0.5f + tileThreadIdxY)].x;
+		}
 	}
 	GroupMemoryBarrierWithGroupSync();
 
-	for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+	[branch]
+	if (!UseDepthPyramid)
 	{
-		InterlockedMax(ldsZMax, asuint(ldsDepth[i]));
-		InterlockedMin(ldsZMin, asuint(ldsDepth[i]));
+		for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+		{
+			InterlockedMax(ldsZMax, asuint(ldsDepth[i]));
+			InterlockedMin(ldsZMin, asuint(ldsDepth[i]));
+		}
 	}
 	GroupMemoryBarrierWithGroupSync();
 	
-	// Use 8 threads of a group thread to compute 8 different vertexes.
-	[branch]
-	if (Gindex < 8)
-	{
-		// Create a projected position according to group index.
-		z[0] = asfloat(ldsZMin);
-		x[1] = gCB.tileSizeX*(Gid.x + 1);
-		y[1] = gCB.tileSizeY*(Gid.y + 1);
-		z[1] = asfloat(ldsZMax);
-		// Select a vertex of 8 vertexes.
-		uint xId = Gindex & 0x1;
-		uint yId = (Gindex & 0x2) >> 1;
-		uint zId = (Gindex & 0x4) >> 2;
-		uint uWindowWidthEvenlyDivisibleByTileRes = gCB.tileSizeX*gCB.widthDim;
-		uint uWindowHeightEvenlyDivisibleByTileRes = gCB.tileSizeY*gCB.heightDim;
-		float4 projPos = float4(x[xId] / (float)uWindowWidthEvenlyDivisibleByTileRes*2.f - 1.f,
-			(uWindowHeightEvenlyDivisibleByTileRes - y[yId]) / (float)uWindowHeightEvenlyDivisibleByTileRes*2.f - 1.f,
-			z[zId], 1.0f);
-		// Transform to the view-space.
-		ldsVertexes[Gindex] = ConvertProjToView(projPos);
+	// Clip the depth range of the tile by the depth slice (Gid.z) of the cluster.
+	z[0] = max(asfloat(ldsZMin), gDepthPlaneSRV[Gid.z]);
+	z[1] = min(asfloat(ldsZMax), gDepthPlaneSRV[Gid.z + 1]);
+	// If no pixel of the tile is in this slice, the cluster is empty.
+	uint lightNum = z[0] <= z[1] ? gCB.lightNum : 0;
+#ifndef LIGHT_COUNT_PASS
+	// Skip clusters without space in packed light indexes.
+	ClusteredList list = gLightListUAV[tileIdxFlattened];
+	lightNum = list.lightNum > 0 ? lightNum : 0;
+#endif
+
+	// 2.5D culling: mark the depth bins occupied by pixels of the cluster (with the depth pyramid, the bins are already
+	// marked). Bins split the view-space depth range of the cluster evenly.
+	float binNearZ = ConvertProjToView(float4(0, 0, z[0], 1)).z;
+	float binFarZ = ConvertProjToView(float4(0, 0, z[1], 1)).z;
+	float invBinSize = binFarZ > binNearZ ? DepthBinNum / (binFarZ - binNearZ) : 0;
+#ifndef LIGHT_COUNT_PASS
+	// The split depth of split lists between the near and the far half of the bins, flat clusters only have near lights.
+	float splitZ = asfloat(0x7f7fffff);
+	if (invBinSize > 0)
+	{
+		float4 splitPos = mul(float4(0, 0, binNearZ + DepthBinNum / 2 / invBinSize, 1), gViewCB.Proj);
+		splitZ = splitPos.z / splitPos.w;
+	}
+	for (uint h = Gindex; h < LightImportanceBucketNum; h += NUM_THREADS_PER_TILE)
+	{
+		ldsImportanceHist[h] = 0;
+	}
+#endif
+	[branch]
+	if (UseDepthBinCulling && !UseDepthPyramid && lightNum > 0)
+	{
+		for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+		{
+			float depth = ldsDepth[i];
+			if (depth >= z[0] && depth <= z[1])
+			{
+				InterlockedOr(ldsDepthBin, 1u << GetDepthBin(ConvertProjToView(float4(0, 0, depth, 1)).z, binNearZ, invBinSize));
+			}
+		}
+	}
+
+	// Use 4 threads of a group thread to compute the 4 corner rays, and the near and far vertexes on them.
+	[branch]
+	if (Gindex < 4)
+	{
+		float3 corner;
+		[branch]
+		if (UseTilePlaneTable)
+		{
+			corner = gTilePlaneUAV[Gid.x + Gid.y*gCB.widthDim].corners[Gindex];
+		}
+		else
+		{
+			corner = GetTileCornerRay(Gid.xy, Gindex, float2(gCB.tileSizeX, gCB.tileSizeY), uint2(gCB.widthDim, gCB.heightDim), gViewCB.ProjInv);
+		}
+		// The vertexes are the corner rays at the view-space depth of both ends of the depth range.
+		ldsCorners[Gindex] = corner;
+		ldsVertexes[Gindex] = float4(corner*binNearZ, 1);
+		ldsVertexes[Gindex + 4] = float4(corner*binFarZ, 1);
 	}
 
 	GroupMemoryBarrierWithGroupSync();
@@ -128,6 +411,18 @@ void main(uint3 DTid : SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint3 GTid :
 	{
 		// Initialize groupshared variables.
 		ldsLightCounter = 0;
+#ifndef LIGHT_COUNT_PASS
+		ldsClampBucket = LightImportanceBucketNum;
+		ldsClampHighNum = 0;
+		ldsClampLowCounter = 0;
+		ldsSplitCounter[0] = 0;
+		ldsSplitCounter[1] = 0;
+		for (uint t = 0; t < LightTypeNum; t++)
+		{
+			ldsClampTypeNum[t] = 0;
+			ldsClampTypeCursor[t] = 0;
+		}
+#endif
 
 		// Vertexes of a frustum.
 		//   4---5
@@ -135,59 +430,232 @@ void main(uint3 DTid : SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint3 GTid :
 		// 0---1 7
 		// |   |/
 		// 2---3
-		// Plane1: Up.
-		ldsPlanes[0] = CreatePlaneEquation(ldsVertexes[1], ldsVertexes[4], ldsVertexes[5]);
-		// Plane2: Front.
-		ldsPlanes[1] = CreatePlaneEquation(ldsVertexes[2], ldsVertexes[0], ldsVertexes[1]);
-		// Plane3: Right.
-		ldsPlanes[2] = CreatePlaneEquation(ldsVertexes[7], ldsVertexes[1], ldsVertexes[5]);
-		// Plane4: Down.
-		ldsPlanes[3] = CreatePlaneEquation(ldsVertexes[7], ldsVertexes[2], ldsVertexes[3]);
-		// Plane5: Left.
-		ldsPlanes[4] = CreatePlaneEquation(ldsVertexes[2], ldsVertexes[4], ldsVertexes[0]);
-		// Plane6: Back.
-		ldsPlanes[5] = CreatePlaneEquation(ldsVertexes[4], ldsVertexes[7], ldsVertexes[5]);
+		// The sides pass through the camera, so they stay valid when the depth range is a single depth, and the front and
+		// back planes are the view-space depth range.
+		TilePlanes T;
+		[branch]
+		if (UseTilePlaneTable)
+		{
+			T = gTilePlaneUAV[Gid.x + Gid.y*gCB.widthDim];
+		}
+		else
+		{
+			float3 corners[4] = { ldsCorners[0], ldsCorners[1], ldsCorners[2], ldsCorners[3] };
+			T = CreateTilePlanes(corners);
+		}
+		ldsPlanes[0] = float4(T.sides[0], 0);	// Up.
+		ldsPlanes[1] = float4(0, 0, -1, binNearZ);	// Front.
+		ldsPlanes[2] = float4(T.sides[1], 0);	// Right.
+		ldsPlanes[3] = float4(T.sides[2], 0);	// Down.
+		ldsPlanes[4] = float4(T.sides[3], 0);	// Left.
+		ldsPlanes[5] = float4(0, 0, 1, -binFarZ);	// Back.
+
+		// Bounds of the frustum for the tighter tile test: the AABB of the 8 vertexes, and the cone from the camera
+		// around the edges of the frustum (rays through the near vertexes).
+		ldsAabbMin = ldsVertexes[0].xyz;
+		ldsAabbMax = ldsVertexes[0].xyz;
+		float3 axis = 0;
+		for (uint v = 0; v < 8; v++)
+		{
+			ldsAabbMin = min(ldsAabbMin, ldsVertexes[v].xyz);
+			ldsAabbMax = max(ldsAabbMax, ldsVertexes[v].xyz);
+			axis += v < 4 ? normalize(ldsVertexes[v].xyz) : 0;
+		}
+		ldsConeAxis = normalize(axis);
+		float coneCos = 1;
+		for (uint e = 0; e < 4; e++)
+		{
+			coneCos = min(coneCos, dot(normalize(ldsVertexes[e].xyz), ldsConeAxis));
+		}
+		ldsConeCosSin = float2(coneCos, sqrt(max(1 - coneCos*coneCos, 0)));
+#ifndef LIGHT_COUNT_PASS
+		float3 center = 0;
+		for (uint c = 0; c < 8; c++)
+		{
+			center += ldsVertexes[c].xyz;
+		}
+		ldsClusterCenter = center / 8;
+#endif
 	}
 
 	GroupMemoryBarrierWithGroupSync();
 
+	// The first light of every type, and the end of the candidates of every type.
+	uint lightOffsets[LightTypeNum + 1];
+	[unroll]
+	for (uint t = 0; t <= LightTypeNum; t++)
+	{
+		lightOffsets[t] = lightNum > 0 ? GetLightTypeOffset(gCB.lightNum, gCB.spotLightNum, gCB.capsuleLightNum, t) : 0;
+	}
+	// Scatter culling: collect the lights of the light mask of the tile (the same mask for all slices).
+	[branch]
+	if (UseLightScatter)
+	{
+		uint maskOffset = (Gid.x + Gid.y*gCB.widthDim)*TileLightMaskWordNum;
+		[unroll]
+		for (uint t = 0; t < LightTypeNum; t++)
+		{
+			uint begin = lightOffsets[t];
+			uint end = lightOffsets[t + 1];
+			for (uint w = begin / 32 + Gindex; w < (end + 31) / 32; w += NUM_THREADS_PER_TILE)
+			{
+				// Only the bits of the lights of the type.
+				uint bits = gTileLightMaskUAV[maskOffset + w];
+				bits &= w == begin / 32 ? 0xffffffff << (begin % 32) : 0xffffffff;
+				bits &= w == end / 32 ? (1u << (end % 32)) - 1 : 0xffffffff;
+				uint dstIdx;
+				InterlockedAdd(ldsCandidateNum[t], countbits(bits), dstIdx);
+				dstIdx += begin;
+				while (bits != 0)
+				{
+					ldsCandidates[dstIdx++] = w * 32 + firstbitlow(bits);
+					bits &= bits - 1;
+				}
+			}
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+	uint candidateEnds[LightTypeNum];
+	[unroll]
+	for (uint t = 0; t < LightTypeNum; t++)
+	{
+		candidateEnds[t] = UseLightScatter ? lightOffsets[t] + ldsCandidateNum[t] : lightOffsets[t + 1];
+	}
+
+#ifndef LIGHT_COUNT_PASS
+	// LightOverflowClamp: a tile over PerClusterMaxLight counts the importance buckets of its lights first,
+	// and keeps the lights of the highest buckets.
+	[branch]
+	if (LightOverflowPolicy == LightOverflowClamp)
+	{
+		bool clampList = (uint)gLightCounterUAV[tileIdxFlattened] > PerClusterMaxLight;
+		[unroll]
+		for (uint t = 0; t < LightTypeNum; t++)
+		{
+			for (uint k = lightOffsets[t] + Gindex; k < candidateEnds[t] && clampList; k += NUM_THREADS_PER_TILE)
+			{
+				uint i = GetCandidateLight(k);
+				[branch]
+				if (IsLightVisible(i))
+				{
+					float4 center;
+					float radius;
+					LoadViewLight(i, center, radius);
+					if (IsLightInTile(i, center, radius, GetLightDepthBins(center.z, radius, binNearZ, invBinSize)))
+					{
+						InterlockedAdd(ldsImportanceHist[GetLightImportanceBucket(radius, length(center.xyz - ldsClusterCenter))], 1);
+					}
+				}
+			}
+		}
+		GroupMemoryBarrierWithGroupSync();
+		// The kept bucket is the highest bucket whose lights don't fit after the lights of higher buckets.
+		if (Gindex == 0 && clampList)
+		{
+			uint highNum = 0;
+			uint bucket = LightImportanceBucketNum - 1;
+			while (bucket > 0 && highNum + ldsImportanceHist[bucket] <= PerClusterMaxLight)
+			{
+				highNum += ldsImportanceHist[bucket];
+				bucket--;
+			}
+			ldsClampBucket = bucket;
+			ldsClampHighNum = highNum;
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+#endif
+
 	// Use threads of a group to compute the intersections between lights and frustums.
 	// Every thread compute a different intersection, and
 	// loop offset is equal to the number of threads of a group.
-	float r[6];
-	for (uint i = Gindex; i < gCB.lightNum; i += NUM_THREADS_PER_TILE)
+	// Lights of a type are appended after all lights of the previous type, so the light list is ordered by type.
+	[unroll]
+	for (uint t = 0; t < LightTypeNum; t++)
 	{
-		// Transform lights to view-space.
-		uint dstIdx = 0;
-		[branch]
-		if (i < gCB.lightNum)
-		{
-			PointLight L = gLightSRV[i];
-			float4 center = mul(float4(L.pos, 1), gViewCB.View);
-			center /= center.w;
-			// Determine the intersections between lights and six planes.
-			[unroll]
-			for (int j = 0; j < 6; j++)
-			{
-				r[j] = GetSignedDistanceFromPlane(center, ldsPlanes[j]);
-			}
-			// In the frustum?
+		for (uint k = lightOffsets[t] + Gindex; k < candidateEnds[t]; k += NUM_THREADS_PER_TILE)
+		{
+			uint i = GetCandidateLight(k);
 			[branch]
-			if (r[0] < L.radius  && r[1] < L.radius  && r[2] < L.radius && r[3] < L.radius && r[4] < L.radius && r[5] < L.radius)
+			if (IsLightVisible(i))
 			{
-				InterlockedAdd(ldsLightCounter, 1, dstIdx);
-				ldsLightIdx[dstIdx] = i;
+				// Transform lights to view-space.
+				float4 center;
+				float radius;
+				LoadViewLight(i, center, radius);
+				// In the frustum, and overlapping depth bins of pixels?
+				uint lightBins = GetLightDepthBins(center.z, radius, binNearZ, invBinSize);
+				[branch]
+				if (IsLightInTile(i, center, radius, lightBins))
+				{
+#ifdef LIGHT_COUNT_PASS
+					InterlockedAdd(ldsLightCounter, 1);
+#else
+					AppendLight(i, list, radius, center.xyz, lightBins);
+#endif
+				}
 			}
 		}
+		GroupMemoryBarrierWithGroupSync();
 	}
-
-	GroupMemoryBarrierWithGroupSync();
-	// Store data into light indexed buffer.
+#ifdef LIGHT_COUNT_PASS
+	// Store light counters, LightListScanCS allocates light lists with them.
 	[branch]
 	if (Gindex == 0)
 	{
-		//gDataUAV[tileIdxFlattened].counter = ldsLightCounter;
 		gLightCounterUAV[tileIdxFlattened] = ldsLightCounter;
-		gDataUAV[tileIdxFlattened].lightIdxs = ldsLightIdx;
 	}
+#else
+	// Store data into packed light indexes, spilled lights are already stored.
+	// The lights of a split list are already stored too, and its header is written after the near/far counters are final.
+	[branch]
+	if (list.lightNum & ClusteredListSplitBit)
+	{
+		if (Gindex == 0)
+		{
+			gDataUAV[GetLightIndexWord(list.offset)] = asuint(splitZ);
+			StoreLightIndex(list.offset + ClusteredSplitHeaderSize - 2, ldsSplitCounter[0]);
+			StoreLightIndex(list.offset + ClusteredSplitHeaderSize - 1, ldsSplitCounter[1]);
+		}
+	}
+	else if (UseLightIndex16 && ldsClampBucket >= LightImportanceBucketNum)
+	{
+		// A thread stores two lights as a uint, and the last uint of a list (shared with a spilled light) with atomics.
+		uint storeNum = min(list.lightNum, PerClusterMaxLight);
+		for (uint k = Gindex * 2; k < storeNum; k += NUM_THREADS_PER_TILE * 2)
+		{
+			[branch]
+			if (k + 1 < storeNum)
+			{
+				gDataUAV[GetLightIndexWord(list.offset + k)] = ldsLightIdx[k] | (ldsLightIdx[k + 1] << 16);
+			}
+			else
+			{
+				StoreLightIndex(list.offset + k, ldsLightIdx[k]);
+			}
+		}
+	}
+	else
+	{
+		for (uint k = Gindex; k < min(list.lightNum, PerClusterMaxLight); k += NUM_THREADS_PER_TILE)
+		{
+			uint i = ldsLightIdx[k];
+			uint dstIdx = k;
+			// Lights of higher buckets come before the lights of the kept bucket in a clamped list,
+			// so every light is moved after the lights of lower types.
+			[branch]
+			if (ldsClampBucket < LightImportanceBucketNum)
+			{
+				uint type = GetLightType(i);
+				InterlockedAdd(ldsClampTypeCursor[type], 1, dstIdx);
+				[unroll]
+				for (uint t = 0; t < LightTypeNum; t++)
+				{
+					dstIdx += t < type ? ldsClampTypeNum[t] : 0;
+				}
+			}
+			StoreLightIndex(list.offset + dstIdx, i);
+		}
+	}
+#endif
 }
\ No newline at end of file
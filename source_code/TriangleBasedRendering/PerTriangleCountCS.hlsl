@@ -0,0 +1,7 @@
+//--------------------------------------------------------------------------------------
+// File: PerTriangleCountCS.hlsl
+//
+// The count pass of per triangle light culling, it only writes the light counter buffer.
+//--------------------------------------------------------------------------------------
+#define LIGHT_COUNT_PASS
+#include "PerTriangleCullingCS.hlsl"
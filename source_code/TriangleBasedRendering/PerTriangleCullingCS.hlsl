@@ -2,32 +2,74 @@
 // File: PerTriangleCullingCS.hlsl
 //
 // A light culling compute shader to compute the intersections between lights and triangles (Actually, a triangular prism).
+// Tiles are split into the primitives of TileSubdivision, a primitive is inside the 6 planes of the tile and its split planes.
+// It runs twice: the count pass (LIGHT_COUNT_PASS, PerTriangleCountCS) only writes light counters,
+// LightListScanCS allocates packed lists with the counters, then this pass writes light indexes into the lists.
 //--------------------------------------------------------------------------------------
 #include "ClusteredCommon.h"
 #include "CameraCommon.h"
+#include "LightShape.hlsli"
+#include "TilePlane.hlsli"
+#include "DepthBin.hlsli"
 
 // Global variables.
 StructuredBuffer<PointLight> gLightSRV : register(t0);	// Light buffer.
 StructuredBuffer<float> gDepthPlaneSRV : register(t1);	// Depth planes for clustered lighting (lights are classified according to depth).
 ConstantBuffer<ClusteredData> gCB : register(b0);		// Light culling information (size of tile, light number and etc...).
 ConstantBuffer<ViewData> gViewCB : register(b1);		// Camera data.
-RWStructuredBuffer<ClusteredBuffer> gDataUAV : register(u0);	// Light indexed buffer.
+RWStructuredBuffer<uint> gDataUAV : register(u0);	// Packed light indexes of all clusters.
 RWStructuredBuffer<int> gLightCounterUAV : register(u1);	// Light counter buffer.
+RWStructuredBuffer<ClusteredList> gLightListUAV : register(u2);	// Light lists in packed light indexes.
+RWStructuredBuffer<uint> gTileDiagonalUAV : register(u3);	// Diagonal bits of tiles (a bit per tile, set for TileSubdivisionAntiDiagonal).
+RWStructuredBuffer<DepthBounds> gDepthPyramidUAV : register(u4);	// The depth pyramid, level 0 has the depth range of tiles.
+RWStructuredBuffer<uint> gLightVisibilityUAV : register(u5);	// Visibility bits of lights (LightOcclusionCS).
+RWStructuredBuffer<uint> gTileLightMaskUAV : register(u7);	// Light masks of tiles (LightScatterCS).
 Texture2D<float> gDepthBuffer : register(t2);
+StructuredBuffer<LightShape> gLightShapeSRV : register(t3);	// Shapes of spot and capsule lights.
+RWStructuredBuffer<ViewLight> gViewLightUAV : register(u8);	// View-space lights (LightTransformCS).
+RWStructuredBuffer<LightShape> gViewLightShapeUAV : register(u9);	// View-space shapes of spot and capsule lights.
+RWStructuredBuffer<TilePlanes> gTilePlaneUAV : register(u10);	// Planes of tiles through the camera (TilePlaneCS).
+RWStructuredBuffer<uint> gClusterDepthBinUAV : register(u11);	// Depth bins of clusters (DepthPyramidCS).
 
 // Group shared variables.
 groupshared float4 ldsVertexes[8];	// 8 vertexes of the frustum (There is a unique frustum for every group thread).
-groupshared float4 ldsPlanes[8];	// 8 planes of the frustum.
-// Upper triangles of a tile.
-groupshared uint ldsTriUpLightCounter;
-groupshared uint ldsTriUpLightIdx[PerClusterMaxLight];
-// Lower triangles of a tile.
-groupshared uint ldsTriDownLightCounter;
-groupshared uint ldsTriDownLightIdx[PerClusterMaxLight];
+groupshared float3 ldsCorners[4];	// The corner rays of the tile at view-space z = 1 (TilePlanes).
+groupshared float4 ldsPlanes[TilePlaneNum];	// 6 planes of the frustum and 4 split planes.
+// Light lists of the primitives of a tile.
+groupshared uint ldsLightCounter[TilePrimitiveNum];
+groupshared uint ldsLightIdx[TilePrimitiveNum][PerClusterMaxLight];
 
 groupshared float ldsDepth[TileSize*TileSize];
 groupshared uint ldsZMax;
 groupshared uint ldsZMin;
+// Lights of the light mask of the tile (UseLightScatter), the candidates of a type start at the first light of the type.
+groupshared uint ldsCandidates[MaxLightNum];
+groupshared uint ldsCandidateNum[LightTypeNum];
+// Depth bins occupied by pixels of every primitive.
+groupshared uint ldsDepthBin[TilePrimitiveNum];
+// The min/max depth of the two triangles of both diagonals, and the selected pattern of the tile.
+groupshared uint ldsDiagZMin[4];
+groupshared uint ldsDiagZMax[4];
+groupshared uint ldsTilePattern;
+// Bounds of the frustum for the tighter tile test (LightTileTest).
+groupshared float3 ldsAabbMin;
+groupshared float3 ldsAabbMax;
+groupshared float3 ldsConeAxis;
+groupshared float2 ldsConeCosSin;
+#ifndef LIGHT_COUNT_PASS
+// Lists over PerClusterMaxLight (LightOverflowPolicy): the importance histogram of every primitive, the kept bucket
+// (LightImportanceBucketNum if the list isn't clamped) and the number of lights of higher buckets, the counter of lights
+// of the kept bucket, and the near/far counters of split lists.
+groupshared float3 ldsClusterCenter;
+groupshared uint ldsImportanceHist[TilePrimitiveNum][LightImportanceBucketNum];
+groupshared uint ldsClampBucket[TilePrimitiveNum];
+groupshared uint ldsClampHighNum[TilePrimitiveNum];
+groupshared uint ldsClampLowCounter[TilePrimitiveNum];
+groupshared uint ldsSplitCounter[TilePrimitiveNum][2];
+// The number of lights of every type in clamped lists, and the cursors to sort clamped lists by type.
+groupshared uint ldsClampTypeNum[TilePrimitiveNum][LightTypeNum];
+groupshared uint ldsClampTypeCursor[TilePrimitiveNum][LightTypeNum];
+#endif
 
 // Convert a point from post-projection space into view space.
 float4 ConvertProjToView(float4 p)
@@ -37,36 +79,251 @@ float4 ConvertProjToView(float4 p)
 	return p;
 }
 
-// This creates the standard Hessian-normal-form plane equation.
-float4 CreatePlaneEquation(float4 b, float4 c)
+// Point-plane distance.
+float GetSignedDistanceFromPlane(float4 p, float4 eqn)
 {
-	float4 n;
-
-	// Normalize(cross( b.xyz-a.xyz, c.xyz-a.xyz )), except we know "a" is the origin.
-	n.xyz = normalize(cross(b.xyz, c.xyz));
+	return dot(eqn.xyz, p.xyz) + eqn.w;
+}
 
-	// -(n dot a), except we know "a" is the origin.
-	n.w = 0;
+// The depth bins overlapped by a light sphere.
+uint GetLightDepthBins(float viewZ, float radius, float binNearZ, float invBinSize)
+{
+	uint first = GetDepthBin(viewZ - radius, binNearZ, invBinSize);
+	uint last = GetDepthBin(viewZ + radius, binNearZ, invBinSize);
+	return (0xffffffff >> (DepthBinNum - 1 - last)) & (0xffffffff << first);
+}
 
-	return n;
+// Does a sphere overlap the view-space AABB of the frustum (LightTileTestAabb)?
+bool IsSphereInAabb(float3 center, float radius)
+{
+	float3 d = max(max(ldsAabbMin - center, center - ldsAabbMax), 0);
+	return dot(d, d) < radius*radius;
 }
-float4 CreatePlaneEquation(float4 b, float4 c, float4 a)
+// Does a sphere overlap the cone of the frustum from the camera (LightTileTestCone)?
+// The distance to the surface of the cone is negative inside, and never exceeds the distance to the apex behind the cone.
+bool IsSphereInCone(float3 center, float radius)
 {
-	float4 n;
-
-	// Normalize(cross( b.xyz-a.xyz, c.xyz-a.xyz )).
-	n.xyz = normalize(cross(b.xyz - a.xyz, c.xyz - a.xyz));
+	float axisDist = dot(center, ldsConeAxis);
+	float perpDist = sqrt(max(dot(center, center) - axisDist*axisDist, 0));
+	return ldsConeCosSin.x*perpDist - ldsConeCosSin.y*axisDist < radius;
+}
+// The tighter test of a light after the planes of the tile.
+bool IsLightInTileBounds(float3 center, float radius)
+{
+	[branch]
+	if (LightTileTest == LightTileTestAabb)
+	{
+		return IsSphereInAabb(center, radius);
+	}
+	else if (LightTileTest == LightTileTestCone)
+	{
+		return IsSphereInCone(center, radius);
+	}
+	return true;
+}
+// The importance bucket of a light (LightOverflowClamp), a bucket is a quarter of a power of 2 of radius over distance.
+uint GetLightImportanceBucket(float radius, float distance)
+{
+	float importance = floor(log2(max(radius, 1e-6f) / max(distance, 1e-6f)) * 4) + LightImportanceBucketNum / 2;
+	return (uint)clamp(importance, 0, LightImportanceBucketNum - 1);
+}
+// Is a light not occluded by the depth pyramid?
+bool IsLightVisible(uint i)
+{
+	return !UseLightOcclusion || (gLightVisibilityUAV[i / 32] & (1u << (i % 32))) != 0;
+}
+// The light of candidate k of the tile, all lights are candidates without UseLightScatter.
+uint GetCandidateLight(uint k)
+{
+	return UseLightScatter ? ldsCandidates[k] : k;
+}
+// The type of light i.
+uint GetLightType(uint i)
+{
+	return GetLightType(i, gCB.lightNum, gCB.spotLightNum, gCB.capsuleLightNum);
+}
+// The view-space center and radius of light i, from the view-space light buffer (LightTransformCS) with UseViewSpaceLights.
+void LoadViewLight(uint i, out float4 center, out float radius)
+{
+	[branch]
+	if (UseViewSpaceLights)
+	{
+		ViewLight V = gViewLightUAV[i];
+		center = float4(V.center, 1);
+		radius = V.radius;
+	}
+	else
+	{
+		PointLight L = gLightSRV[i];
+		center = mul(float4(L.pos, 1), gViewCB.View);
+		center /= center.w;
+		radius = L.radius;
+	}
+}
+// The view-space shape of spot or capsule light i.
+LightShape LoadViewLightShape(uint i)
+{
+	uint shapeIdx = i - GetLightTypeOffset(gCB.lightNum, gCB.spotLightNum, gCB.capsuleLightNum, LightTypeSpot);
+	[branch]
+	if (UseViewSpaceLights)
+	{
+		return gViewLightShapeUAV[shapeIdx];
+	}
+	// Transform the shape to view-space.
+	LightShape S = gLightShapeSRV[shapeIdx];
+	float4 origin = mul(float4(S.origin, 1), gViewCB.View);
+	S.origin = origin.xyz / origin.w;
+	S.axis = mul(float4(S.axis, 0), gViewCB.View).xyz;
+	return S;
+}
 
-	// -(n dot a).
-	n.w = -dot(a.xyz, n.xyz);
+// Test the shape of a spot or capsule light against the planes of the primitives of mask, and return the primitives it overlaps.
+uint TestLightShapePrimitives(uint i, uint type, uint mask, uint tilePattern)
+{
+	LightShape S = LoadViewLightShape(i);
+	float r[TilePlaneNum];
+	[unroll]
+	for (int j = 0; j < TilePlaneNum; j++)
+	{
+		r[j] = GetLightShapePlaneDistance(type, S.origin, S.axis, S, ldsPlanes[j]);
+	}
+	[branch]
+	if (!(r[0] < 0 && r[1] < 0 && r[2] < 0 && r[3] < 0 && r[4] < 0 && r[5] < 0))
+	{
+		return 0;
+	}
+	[unroll]
+	for (uint p = 0; p < TilePrimitiveNum; p++)
+	{
+		uint splitPlanes = TilePatternSplitPlanes[tilePattern*TileMaxPrimitiveNum + p];
+		bool inside = true;
+		[unroll]
+		for (uint k = 0; k < TileSplitPlaneNum; k++)
+		{
+			inside = inside && ((splitPlanes & (1u << k)) == 0 || r[6 + k] <= 0);
+		}
+		mask &= inside ? 0xffffffff : ~(1u << p);
+	}
+	return mask;
+}
 
-	return n;
+// Test a view-space light against the primitives of the tile, and return the mask of primitives whose lists get the light.
+uint TestLightPrimitives(uint i, float4 center, float radius, uint lightBins, uint tilePattern)
+{
+	float r[TilePlaneNum];
+	[unroll]
+	for (int j = 0; j < TilePlaneNum; j++)
+	{
+		r[j] = GetSignedDistanceFromPlane(center, ldsPlanes[j]);
+	}
+	// In the frustum, and inside its bounds?
+	[branch]
+	if (!(r[0] < radius && r[1] < radius && r[2] < radius && r[3] < radius && r[4] < radius && r[5] < radius &&
+		IsLightInTileBounds(center.xyz, radius)))
+	{
+		return 0;
+	}
+	uint mask = 0;
+	[unroll]
+	for (uint p = 0; p < TilePrimitiveNum; p++)
+	{
+		// Inside the split planes of the primitive, and overlapping its depth bins?
+		uint splitPlanes = TilePatternSplitPlanes[tilePattern*TileMaxPrimitiveNum + p];
+		bool inside = (lightBins & ldsDepthBin[p]) != 0;
+		[unroll]
+		for (uint k = 0; k < TileSplitPlaneNum; k++)
+		{
+			inside = inside && ((splitPlanes & (1u << k)) == 0 || r[6 + k] <= radius);
+		}
+		mask |= inside ? 1u << p : 0;
+	}
+	// Spot and capsule lights are tested by their shapes after their bounding spheres.
+	uint type = GetLightType(i);
+	[branch]
+	if (UseLightShapeTests && type != LightTypePoint && mask != 0)
+	{
+		mask = TestLightShapePrimitives(i, type, mask, tilePattern);
+	}
+	return mask;
 }
-// Point-plane distance.
-float GetSignedDistanceFromPlane(float4 p, float4 eqn)
+#ifndef LIGHT_COUNT_PASS
+// Store a light index (or a value of a split list header) in a slot of the packed light indexes. A 16-bit slot shares its
+// uint with a slot which another thread may store, so both halves are written with atomics.
+void StoreLightIndex(uint slot, uint value)
 {
-	return dot(eqn.xyz, p.xyz) + eqn.w;
+	[branch]
+	if (UseLightIndex16)
+	{
+		uint shift = (slot & 1) * 16;
+		InterlockedAnd(gDataUAV[slot / 2], ~(0xffffu << shift));
+		InterlockedOr(gDataUAV[slot / 2], value << shift);
+	}
+	else
+	{
+		gDataUAV[slot] = value;
+	}
+}
+
+// Append a light to the list of a primitive, lists over PerClusterMaxLight follow LightOverflowPolicy.
+void AppendLight(uint p, uint i, ClusteredList list, float radius, float3 center, uint lightBins)
+{
+	uint dstIdx = 0;
+	[branch]
+	if (list.lightNum & ClusteredListSplitBit)
+	{
+		// Near lights follow the header, and far lights are written backwards from the end of the list.
+		uint listSize = list.lightNum & ~ClusteredListSplitBit;
+		if (lightBins & SplitNearBins)
+		{
+			InterlockedAdd(ldsSplitCounter[p][0], 1, dstIdx);
+			StoreLightIndex(list.offset + ClusteredSplitHeaderSize + dstIdx, i);
+		}
+		if (lightBins & SplitFarBins)
+		{
+			InterlockedAdd(ldsSplitCounter[p][1], 1, dstIdx);
+			StoreLightIndex(list.offset + listSize - 1 - dstIdx, i);
+		}
+		return;
+	}
+	[branch]
+	if (ldsClampBucket[p] < LightImportanceBucketNum)
+	{
+		// Lights of higher buckets take the first slots, lights of the kept bucket fill the rest, and the others are dropped.
+		uint bucket = GetLightImportanceBucket(radius, length(center - ldsClusterCenter));
+		if (bucket > ldsClampBucket[p])
+		{
+			InterlockedAdd(ldsLightCounter[p], 1, dstIdx);
+		}
+		else if (bucket == ldsClampBucket[p])
+		{
+			InterlockedAdd(ldsClampLowCounter[p], 1, dstIdx);
+			dstIdx += ldsClampHighNum[p];
+		}
+		else
+		{
+			return;
+		}
+	}
+	else
+	{
+		// Lights after PerClusterMaxLight spill into the packed list.
+		InterlockedAdd(ldsLightCounter[p], 1, dstIdx);
+		if (dstIdx >= PerClusterMaxLight && dstIdx < list.lightNum)
+		{
+			StoreLightIndex(list.offset + dstIdx, i);
+		}
+	}
+	if (dstIdx < PerClusterMaxLight)
+	{
+		ldsLightIdx[p][dstIdx] = i;
+		// Clamped lists are sorted by type again when they are stored.
+		if (ldsClampBucket[p] < LightImportanceBucketNum)
+		{
+			InterlockedAdd(ldsClampTypeNum[p][GetLightType(i)], 1);
+		}
+	}
 }
+#endif
 
 [numthreads(NumThreadX, NumThreadY, 1)]
 void main(uint3 DTid : SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint3 GTid : SV_GroupThreadID, uint Gindex : SV_GroupIndex)
@@ -83,43 +340,181 @@ void main(uint3 DTid : SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint3 GTid :
 	{
 		ldsZMin = 0x7f7fffff;
 		ldsZMax = 0;
+		for (uint t = 0; t < LightTypeNum; t++)
+		{
+			ldsCandidateNum[t] = 0;
+		}
+		// Without 2.5D culling, all lights overlap the bins.
+		for (uint p = 0; p < TilePrimitiveNum; p++)
+		{
+			ldsDepthBin[p] = UseDepthBinCulling ? 0 : 0xffffffff;
+		}
+		for (uint k = 0; k < 4; k++)
+		{
+			ldsDiagZMin[k] = 0x7f7fffff;
+			ldsDiagZMax[k] = 0;
+		}
+		ldsTilePattern = TileSubdivision;
+		// The depth pyramid already has the depth range, the diagonal and the depth bins of the tile.
+		[branch]
+		if (UseDepthPyramid)
+		{
+			uint tileIdx = Gid.x + Gid.y*gCB.widthDim;
+			DepthBounds bounds = gDepthPyramidUAV[tileIdx];
+			ldsZMin = asuint(bounds.zMin);
+			ldsZMax = asuint(bounds.zMax);
+			for (uint b = 0; b < TilePrimitiveNum; b++)
+			{
+				ldsDepthBin[b] = gClusterDepthBinUAV[tileIdxFlattened * TilePrimitiveNum + b];
+			}
+			if (UseTileDiagonalBits)
+			{
+				ldsTilePattern = GetTileDiagonalPattern((gTileDiagonalUAV[tileIdx / 32] >> (tileIdx % 32)) & 0x1);
+			}
+		}
 	}
 
-	for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+	// Start at the first pixel whose center is in the tile, tiles are at most TileSize pixels (GetTileNum) so all of their
+	// pixels are loaded. With the depth pyramid, the culling shaders don't need the depth texels.
+	bool loadDepth = !UseDepthPyramid;
+	[branch]
+	if (loadDepth)
 	{
-		float tileThreadIdxY = i / TileSize;
-		float tileThreadIdxX = i %  TileSize;
-		ldsDepth[i] = gDepthBuffer[float2(x[0] + tileThreadIdxX, y[0] + tileThreadIdxY)].x;
+		for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+		{
+			float tileThreadIdxY = i / TileSize;
+			float tileThreadIdxX = i %  TileSize;
+			ldsDepth[i] = gDepthBuffer[float2(x[0] + 0.5f + tileThreadIdxX, y[0] + 0.5f + tileThreadIdxY)].x;
+		}
 	}
 	GroupMemoryBarrierWithGroupSync();
 
-	for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+	for (uint i = Gindex; i < TileSize*TileSize && loadDepth; i += NUM_THREADS_PER_TILE)
 	{
 		InterlockedMax(ldsZMax, asuint(ldsDepth[i]));
 		InterlockedMin(ldsZMin, asuint(ldsDepth[i]));
+		// The depth range of the triangles of both diagonals, loaded pixels outside of the tile belong to other tiles.
+		[branch]
+		if (UseTileDiagonalBits)
+		{
+			uint width, height;
+			gDepthBuffer.GetDimensions(width, height);
+			float2 uv = GetTilePixelUv(i, float2(x[0], y[0]), float2(gCB.tileSizeX, gCB.tileSizeY));
+			float2 texel = floor(float2(x[0] + 0.5f + i % TileSize, y[0] + 0.5f + i / TileSize));
+			if (all(uv >= 0.0f) && all(uv < 1.0f) && texel.x < width && texel.y < height)
+			{
+				[unroll]
+				for (uint c = 0; c < 2; c++)
+				{
+					uint idx = c * 2 + GetTilePrimitive(GetTileDiagonalPattern(c), uv.x, uv.y);
+					InterlockedMin(ldsDiagZMin[idx], asuint(ldsDepth[i]));
+					InterlockedMax(ldsDiagZMax[idx], asuint(ldsDepth[i]));
+				}
+			}
+		}
 	}
 	GroupMemoryBarrierWithGroupSync();
 
-	// Use 8 threads of a group thread to compute 8 different vertexes.
+	// Select the diagonal whose triangles have the smaller sum of view-space depth ranges, ties keep the default diagonal.
 	[branch]
-	if (Gindex < 8)
+	if (UseTileDiagonalBits && loadDepth)
 	{
-		// Create a projected position according to group index.
-		z[0] = asfloat(ldsZMin);
-		x[1] = gCB.tileSizeX*(Gid.x + 1);
-		y[1] = gCB.tileSizeY*(Gid.y + 1);
-		z[1] = asfloat(ldsZMax);
-		// Select a vertex of 8 vertexes.
-		uint xId = Gindex & 0x1;
-		uint yId = (Gindex & 0x2) >> 1;
-		uint zId = (Gindex & 0x4) >> 2;
-		uint uWindowWidthEvenlyDivisibleByTileRes = gCB.tileSizeX*gCB.widthDim;
-		uint uWindowHeightEvenlyDivisibleByTileRes = gCB.tileSizeY*gCB.heightDim;
-		float4 projPos = float4(x[xId] / (float)uWindowWidthEvenlyDivisibleByTileRes*2.f - 1.f,
-			(uWindowHeightEvenlyDivisibleByTileRes - y[yId]) / (float)uWindowHeightEvenlyDivisibleByTileRes*2.f - 1.f,
-			z[zId], 1.0f);
-		// Transform to the view-space.
-		ldsVertexes[Gindex] = ConvertProjToView(projPos);
+		if (Gindex == 0)
+		{
+			float cost[2] = { 0, 0 };
+			[unroll]
+			for (uint k = 0; k < 4; k++)
+			{
+				if (ldsDiagZMin[k] <= ldsDiagZMax[k])
+				{
+					cost[k / 2] += ConvertProjToView(float4(0, 0, asfloat(ldsDiagZMax[k]), 1)).z -
+						ConvertProjToView(float4(0, 0, asfloat(ldsDiagZMin[k]), 1)).z;
+				}
+			}
+			ldsTilePattern = cost[1] < cost[0] ? TileSubdivisionAntiDiagonal : TileSubdivisionDiagonal;
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+	uint tilePattern = ldsTilePattern;
+
+	// Clip the depth range of the tile by the depth slice (Gid.z) of the cluster.
+	z[0] = max(asfloat(ldsZMin), gDepthPlaneSRV[Gid.z]);
+	z[1] = min(asfloat(ldsZMax), gDepthPlaneSRV[Gid.z + 1]);
+	// If no pixel of the tile is in this slice, the cluster is empty.
+	uint lightNum = z[0] <= z[1] ? gCB.lightNum : 0;
+#ifndef LIGHT_COUNT_PASS
+	// Skip clusters without space in packed light indexes.
+	ClusteredList lists[TilePrimitiveNum];
+	uint storedNum = 0;
+	[unroll]
+	for (uint p = 0; p < TilePrimitiveNum; p++)
+	{
+		lists[p] = gLightListUAV[tileIdxFlattened * TilePrimitiveNum + p];
+		storedNum |= lists[p].lightNum;
+	}
+	lightNum = storedNum > 0 ? lightNum : 0;
+#endif
+
+	// 2.5D culling: mark the depth bins occupied by pixels of the cluster in each primitive (with the depth pyramid, the
+	// bins are already marked). Bins split the view-space depth range of the cluster evenly.
+	float binNearZ = ConvertProjToView(float4(0, 0, z[0], 1)).z;
+	float binFarZ = ConvertProjToView(float4(0, 0, z[1], 1)).z;
+	float invBinSize = binFarZ > binNearZ ? DepthBinNum / (binFarZ - binNearZ) : 0;
+#ifndef LIGHT_COUNT_PASS
+	// The split depth of split lists between the near and the far half of the bins, flat clusters only have near lights.
+	float splitZ = asfloat(0x7f7fffff);
+	if (invBinSize > 0)
+	{
+		float4 splitPos = mul(float4(0, 0, binNearZ + DepthBinNum / 2 / invBinSize, 1), gViewCB.Proj);
+		splitZ = splitPos.z / splitPos.w;
+	}
+	for (uint h = Gindex; h < TilePrimitiveNum*LightImportanceBucketNum; h += NUM_THREADS_PER_TILE)
+	{
+		ldsImportanceHist[h / LightImportanceBucketNum][h % LightImportanceBucketNum] = 0;
+	}
+#endif
+	[branch]
+	if (UseDepthBinCulling && loadDepth && lightNum > 0)
+	{
+		for (uint i = Gindex; i < TileSize*TileSize; i += NUM_THREADS_PER_TILE)
+		{
+			float depth = ldsDepth[i];
+			if (depth >= z[0] && depth <= z[1])
+			{
+				uint bin = 1u << GetDepthBin(ConvertProjToView(float4(0, 0, depth, 1)).z, binNearZ, invBinSize);
+				// Pixels near a diagonal mark the bins of the primitives of both sides.
+				float2 uv = GetTilePixelUv(i, float2(x[0], y[0]), float2(gCB.tileSizeX, gCB.tileSizeY));
+				uint sides = GetTileSplitSides(uv.x, uv.y, DepthBinDiagonalTolerance);
+				[unroll]
+				for (uint p = 0; p < TilePrimitiveNum; p++)
+				{
+					if ((TilePatternSplitPlanes[tilePattern*TileMaxPrimitiveNum + p] & ~sides) == 0)
+					{
+						InterlockedOr(ldsDepthBin[p], bin);
+					}
+				}
+			}
+		}
+	}
+
+	// Use 4 threads of a group thread to compute the 4 corner rays, and the near and far vertexes on them.
+	[branch]
+	if (Gindex < 4)
+	{
+		float3 corner;
+		[branch]
+		if (UseTilePlaneTable)
+		{
+			corner = gTilePlaneUAV[Gid.x + Gid.y*gCB.widthDim].corners[Gindex];
+		}
+		else
+		{
+			corner = GetTileCornerRay(Gid.xy, Gindex, float2(gCB.tileSizeX, gCB.tileSizeY), uint2(gCB.widthDim, gCB.heightDim), gViewCB.ProjInv);
+		}
+		// The vertexes are the corner rays at the view-space depth of both ends of the depth range.
+		ldsCorners[Gindex] = corner;
+		ldsVertexes[Gindex] = float4(corner*binNearZ, 1);
+		ldsVertexes[Gindex + 4] = float4(corner*binFarZ, 1);
 	}
 
 	GroupMemoryBarrierWithGroupSync();
@@ -129,8 +524,22 @@ void main(uint3 DTid : SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint3 GTid :
 	if (Gindex == 0)
 	{
 		// Initialize groupshared variables.
-		ldsTriDownLightCounter = 0;
-		ldsTriUpLightCounter = 0;
+		for (uint p = 0; p < TilePrimitiveNum; p++)
+		{
+			ldsLightCounter[p] = 0;
+#ifndef LIGHT_COUNT_PASS
+			ldsClampBucket[p] = LightImportanceBucketNum;
+			ldsClampHighNum[p] = 0;
+			ldsClampLowCounter[p] = 0;
+			ldsSplitCounter[p][0] = 0;
+			ldsSplitCounter[p][1] = 0;
+			for (uint t = 0; t < LightTypeNum; t++)
+			{
+				ldsClampTypeNum[p][t] = 0;
+				ldsClampTypeCursor[p][t] = 0;
+			}
+#endif
+		}
 
 		// Vertexes of a frustum.
 		//   4---5
@@ -138,85 +547,274 @@ void main(uint3 DTid : SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint3 GTid :
 		// 0---1 7
 		// |   |/
 		// 2---3
-		// Plane1: Up.
-		ldsPlanes[0] = CreatePlaneEquation(ldsVertexes[1], ldsVertexes[4], ldsVertexes[5]);
-		// Plane2: Front.
-		ldsPlanes[1] = CreatePlaneEquation(ldsVertexes[2], ldsVertexes[0], ldsVertexes[1]);
-		// Plane3: Right.
-		ldsPlanes[2] = CreatePlaneEquation(ldsVertexes[7], ldsVertexes[1], ldsVertexes[5]);
-		// Plane4: Down.
-		ldsPlanes[3] = CreatePlaneEquation(ldsVertexes[7], ldsVertexes[2], ldsVertexes[3]);
-		// Plane5: Left.
-		ldsPlanes[4] = CreatePlaneEquation(ldsVertexes[2], ldsVertexes[4], ldsVertexes[0]);
-		// Plane6: Back.
-		ldsPlanes[5] = CreatePlaneEquation(ldsVertexes[4], ldsVertexes[7], ldsVertexes[5]);
-		// Plane7: Up middle plane.
-		ldsPlanes[6] = CreatePlaneEquation(ldsVertexes[5], ldsVertexes[2], ldsVertexes[1]);
-		// Plane8: Down middle plane.
-		ldsPlanes[7] = CreatePlaneEquation(ldsVertexes[2], ldsVertexes[5], ldsVertexes[1]);
-		
+		// The sides pass through the camera, so they stay valid when the depth range is a single depth, and the front and
+		// back planes are the view-space depth range.
+		TilePlanes T;
+		[branch]
+		if (UseTilePlaneTable)
+		{
+			T = gTilePlaneUAV[Gid.x + Gid.y*gCB.widthDim];
+		}
+		else
+		{
+			float3 corners[4] = { ldsCorners[0], ldsCorners[1], ldsCorners[2], ldsCorners[3] };
+			T = CreateTilePlanes(corners);
+		}
+		ldsPlanes[0] = float4(T.sides[0], 0);	// Up.
+		ldsPlanes[1] = float4(0, 0, -1, binNearZ);	// Front.
+		ldsPlanes[2] = float4(T.sides[1], 0);	// Right.
+		ldsPlanes[3] = float4(T.sides[2], 0);	// Down.
+		ldsPlanes[4] = float4(T.sides[3], 0);	// Left.
+		ldsPlanes[5] = float4(0, 0, 1, -binFarZ);	// Back.
+		[unroll]
+		for (uint j = 0; j < TileSplitPlaneNum; j++)
+		{
+			ldsPlanes[6 + j] = float4(T.sides[4 + j], 0);	// The sides of the diagonal and the anti-diagonal.
+		}
+
+		// Bounds of the frustum for the tighter tile test: the AABB of the 8 vertexes, and the cone from the camera
+		// around the edges of the frustum (rays through the near vertexes).
+		ldsAabbMin = ldsVertexes[0].xyz;
+		ldsAabbMax = ldsVertexes[0].xyz;
+		float3 axis = 0;
+		for (uint v = 0; v < 8; v++)
+		{
+			ldsAabbMin = min(ldsAabbMin, ldsVertexes[v].xyz);
+			ldsAabbMax = max(ldsAabbMax, ldsVertexes[v].xyz);
+			axis += v < 4 ? normalize(ldsVertexes[v].xyz) : 0;
+		}
+		ldsConeAxis = normalize(axis);
+		float coneCos = 1;
+		for (uint e = 0; e < 4; e++)
+		{
+			coneCos = min(coneCos, dot(normalize(ldsVertexes[e].xyz), ldsConeAxis));
+		}
+		ldsConeCosSin = float2(coneCos, sqrt(max(1 - coneCos*coneCos, 0)));
+#ifndef LIGHT_COUNT_PASS
+		float3 center = 0;
+		for (uint c = 0; c < 8; c++)
+		{
+			center += ldsVertexes[c].xyz;
+		}
+		ldsClusterCenter = center / 8;
+#endif
 	}
 
 	GroupMemoryBarrierWithGroupSync();
 
-	// Use threads of a group to compute the intersections between lights and frustums.
-	// Every thread compute a different intersection, and
-	// loop offset is equal to the number of threads of a group.
-	float r[8];
-	for (uint i = Gindex; i < gCB.lightNum; i += NUM_THREADS_PER_TILE)
+	// The first light of every type, and the end of the candidates of every type.
+	uint lightOffsets[LightTypeNum + 1];
+	[unroll]
+	for (uint t = 0; t <= LightTypeNum; t++)
 	{
-		
-		[branch]
-		if (i < gCB.lightNum)
+		lightOffsets[t] = lightNum > 0 ? GetLightTypeOffset(gCB.lightNum, gCB.spotLightNum, gCB.capsuleLightNum, t) : 0;
+	}
+	// Scatter culling: collect the lights of the light mask of the tile (the same mask for all slices).
+	[branch]
+	if (UseLightScatter)
+	{
+		uint maskOffset = (Gid.x + Gid.y*gCB.widthDim)*TileLightMaskWordNum;
+		[unroll]
+		for (uint t = 0; t < LightTypeNum; t++)
 		{
-			// Transform lights to view-space.
-			PointLight L = gLightSRV[i];
-			float4 center = mul(float4(L.pos, 1), gViewCB.View);
-			center /= center.w;
-			// Determine the intersection between lights and planes.
-			[unroll]
-			for (int j = 0; j < 8; j++)
+			uint begin = lightOffsets[t];
+			uint end = lightOffsets[t + 1];
+			for (uint w = begin / 32 + Gindex; w < (end + 31) / 32; w += NUM_THREADS_PER_TILE)
 			{
-				r[j] = GetSignedDistanceFromPlane(center, ldsPlanes[j]);
+				// Only the bits of the lights of the type.
+				uint bits = gTileLightMaskUAV[maskOffset + w];
+				bits &= w == begin / 32 ? 0xffffffff << (begin % 32) : 0xffffffff;
+				bits &= w == end / 32 ? (1u << (end % 32)) - 1 : 0xffffffff;
+				uint dstIdx;
+				InterlockedAdd(ldsCandidateNum[t], countbits(bits), dstIdx);
+				dstIdx += begin;
+				while (bits != 0)
+				{
+					ldsCandidates[dstIdx++] = w * 32 + firstbitlow(bits);
+					bits &= bits - 1;
+				}
 			}
-			// In the frustum?
-			[branch]
-			if (r[0] < L.radius  && r[1] < L.radius  && r[2] < L.radius && r[3] < L.radius && r[4] < L.radius && r[5] < L.radius )
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+	uint candidateEnds[LightTypeNum];
+	[unroll]
+	for (uint t = 0; t < LightTypeNum; t++)
+	{
+		candidateEnds[t] = UseLightScatter ? lightOffsets[t] + ldsCandidateNum[t] : lightOffsets[t + 1];
+	}
+
+#ifndef LIGHT_COUNT_PASS
+	// LightOverflowClamp: clusters over PerClusterMaxLight count the importance buckets of their lights first,
+	// and keep the lights of the highest buckets.
+	[branch]
+	if (LightOverflowPolicy == LightOverflowClamp)
+	{
+		uint clampMask = 0;
+		[unroll]
+		for (uint p = 0; p < TilePrimitiveNum; p++)
+		{
+			clampMask |= (uint)gLightCounterUAV[tileIdxFlattened * TilePrimitiveNum + p] > PerClusterMaxLight ? 1u << p : 0;
+		}
+		[unroll]
+		for (uint t = 0; t < LightTypeNum; t++)
+		{
+			for (uint k = lightOffsets[t] + Gindex; k < candidateEnds[t] && clampMask != 0; k += NUM_THREADS_PER_TILE)
 			{
-					// Lower triangular prism?
-				   
-					if (r[7] <= L.radius) 
+				uint i = GetCandidateLight(k);
+				[branch]
+				if (IsLightVisible(i))
+				{
+					float4 center;
+					float radius;
+					LoadViewLight(i, center, radius);
+					uint mask = TestLightPrimitives(i, center, radius, GetLightDepthBins(center.z, radius, binNearZ, invBinSize), tilePattern);
+					uint bucket = GetLightImportanceBucket(radius, length(center.xyz - ldsClusterCenter));
+					[unroll]
+					for (uint p = 0; p < TilePrimitiveNum; p++)
 					{
-						uint dstIdx = 0;
-					InterlockedAdd(ldsTriDownLightCounter, 1, dstIdx);
-					ldsTriDownLightIdx[dstIdx] = i;
+						if (mask & clampMask & (1u << p))
+						{
+							InterlockedAdd(ldsImportanceHist[p][bucket], 1);
+						}
 					}
-					// Upper triangular prism?
-					if (r[6] <= L.radius) 
+				}
+			}
+		}
+		GroupMemoryBarrierWithGroupSync();
+		// The kept bucket is the highest bucket whose lights don't fit after the lights of higher buckets.
+		if (Gindex < TilePrimitiveNum && (clampMask & (1u << Gindex)))
+		{
+			uint highNum = 0;
+			uint bucket = LightImportanceBucketNum - 1;
+			while (bucket > 0 && highNum + ldsImportanceHist[Gindex][bucket] <= PerClusterMaxLight)
+			{
+				highNum += ldsImportanceHist[Gindex][bucket];
+				bucket--;
+			}
+			ldsClampBucket[Gindex] = bucket;
+			ldsClampHighNum[Gindex] = highNum;
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+#endif
+
+	// Use threads of a group to compute the intersections between lights and frustums.
+	// Every thread compute a different intersection, and
+	// loop offset is equal to the number of threads of a group.
+	// Lights of a type are appended after all lights of the previous type, so light lists are ordered by type.
+	[unroll]
+	for (uint t = 0; t < LightTypeNum; t++)
+	{
+		for (uint k = lightOffsets[t] + Gindex; k < candidateEnds[t]; k += NUM_THREADS_PER_TILE)
+		{
+			uint i = GetCandidateLight(k);
+			[branch]
+			if (IsLightVisible(i))
+			{
+				// Transform lights to view-space.
+				float4 center;
+				float radius;
+				LoadViewLight(i, center, radius);
+				// Depth bins overlapped by the light.
+				uint lightBins = GetLightDepthBins(center.z, radius, binNearZ, invBinSize);
+				uint mask = TestLightPrimitives(i, center, radius, lightBins, tilePattern);
+				[unroll]
+				for (uint p = 0; p < TilePrimitiveNum; p++)
+				{
+					if (mask & (1u << p))
 					{
-						 uint dstIdx = 0;
-					InterlockedAdd(ldsTriUpLightCounter, 1, dstIdx);
-					ldsTriUpLightIdx[dstIdx] = i;
+#ifdef LIGHT_COUNT_PASS
+						InterlockedAdd(ldsLightCounter[p], 1);
+#else
+						AppendLight(p, i, lists[p], radius, center.xyz, lightBins);
+#endif
 					}
+				}
 			}
-
-
 		}
-
+		GroupMemoryBarrierWithGroupSync();
 	}
-
-	GroupMemoryBarrierWithGroupSync();
-	// Store data into light indexed buffer.
+#ifdef LIGHT_COUNT_PASS
+	// Store light counters, LightListScanCS allocates light lists with them.
 	[branch]
 	if (Gindex == 0)
 	{
-
-		gDataUAV[tileIdxFlattened*2].lightIdxs = ldsTriUpLightIdx;
-		gDataUAV[tileIdxFlattened*2+1].lightIdxs = ldsTriDownLightIdx;
-
-		gLightCounterUAV[tileIdxFlattened * 2] = ldsTriUpLightCounter;
-		gLightCounterUAV[tileIdxFlattened * 2 + 1] = ldsTriDownLightCounter;
-
+		for (uint p = 0; p < TilePrimitiveNum; p++)
+		{
+			gLightCounterUAV[tileIdxFlattened * TilePrimitiveNum + p] = ldsLightCounter[p];
+		}
+		// Store the diagonal bit of the tile once (in the first slice), other tiles of the word write other bits.
+		// With the depth pyramid, DepthPyramidCS already stored it.
+		if (UseTileDiagonalBits && !UseDepthPyramid && Gid.z == 0)
+		{
+			uint tileIdx = Gid.x + Gid.y*gCB.widthDim;
+			uint mask = 1u << (tileIdx % 32);
+			if (tilePattern == TileSubdivisionAntiDiagonal)
+			{
+				InterlockedOr(gTileDiagonalUAV[tileIdx / 32], mask);
+			}
+			else
+			{
+				InterlockedAnd(gTileDiagonalUAV[tileIdx / 32], ~mask);
+			}
+		}
 	}
-
+#else
+	// Store data into packed light indexes, spilled lights are already stored.
+	// The lights of split lists are already stored too, and their header is written after the near/far counters are final.
+	[unroll]
+	for (uint p = 0; p < TilePrimitiveNum; p++)
+	{
+		[branch]
+		if (lists[p].lightNum & ClusteredListSplitBit)
+		{
+			if (Gindex == 0)
+			{
+				gDataUAV[GetLightIndexWord(lists[p].offset)] = asuint(splitZ);
+				StoreLightIndex(lists[p].offset + ClusteredSplitHeaderSize - 2, ldsSplitCounter[p][0]);
+				StoreLightIndex(lists[p].offset + ClusteredSplitHeaderSize - 1, ldsSplitCounter[p][1]);
+			}
+		}
+		else if (UseLightIndex16 && ldsClampBucket[p] >= LightImportanceBucketNum)
+		{
+			// A thread stores two lights as a uint, and the last uint of a list (shared with a spilled light) with atomics.
+			uint storeNum = min(lists[p].lightNum, PerClusterMaxLight);
+			for (uint k = Gindex * 2; k < storeNum; k += NUM_THREADS_PER_TILE * 2)
+			{
+				[branch]
+				if (k + 1 < storeNum)
+				{
+					gDataUAV[GetLightIndexWord(lists[p].offset + k)] = ldsLightIdx[p][k] | (ldsLightIdx[p][k + 1] << 16);
+				}
+				else
+				{
+					StoreLightIndex(lists[p].offset + k, ldsLightIdx[p][k]);
+				}
+			}
+		}
+		else
+		{
+			for (uint k = Gindex; k < min(lists[p].lightNum, PerClusterMaxLight); k += NUM_THREADS_PER_TILE)
+			{
+				uint i = ldsLightIdx[p][k];
+				uint dstIdx = k;
+				// Lights of higher buckets come before the lights of the kept bucket in clamped lists,
+				// so every light is moved after the lights of lower types.
+				[branch]
+				if (ldsClampBucket[p] < LightImportanceBucketNum)
+				{
+					uint type = GetLightType(i);
+					InterlockedAdd(ldsClampTypeCursor[p][type], 1, dstIdx);
+					[unroll]
+					for (uint t = 0; t < LightTypeNum; t++)
+					{
+						dstIdx += t < type ? ldsClampTypeNum[p][t] : 0;
+					}
+				}
+				StoreLightIndex(lists[p].offset + dstIdx, i);
+			}
+		}
+	}
+#endif
 }
\ No newline at end of file
@@ -6,9 +6,11 @@
 Profiler::Profiler()
 {
 	m_uAccumulateNum = 0;
+	m_uCounterNum = 0;
+	m_bCounterResolved = false;
 }
 
-void Profiler::Init(ID3D12Device * device, UINT maxNumber)
+void Profiler::Init(ID3D12Device * device, UINT maxNumber, UINT counterNumber)
 {
 #if defined(_PROFILING)
 	m_uMaxNum = maxNumber;
@@ -21,6 +23,28 @@ void Profiler::Init(ID3D12Device * device, UINT maxNumber)
 	HRESULT hr = m_d3ddevice->CreateQueryHeap(&heapDesc, IID_PPV_ARGS(m_queryHeap.GetAddressOf()));
 	
 	createReadBuffer();
+
+	m_uCounterNum = counterNumber;
+	if (m_uCounterNum > 0)
+	{
+		D3D12_HEAP_PROPERTIES heapProperty;
+		ZeroMemory(&heapProperty, sizeof(heapProperty));
+		heapProperty.Type = D3D12_HEAP_TYPE_READBACK;
+		heapProperty.CreationNodeMask = 1;
+		heapProperty.VisibleNodeMask = 1;
+
+		D3D12_RESOURCE_DESC resourceDesc;
+		ZeroMemory(&resourceDesc, sizeof(resourceDesc));
+		resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+		resourceDesc.SampleDesc.Count = 1;
+		resourceDesc.MipLevels = 1;
+		resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
+		resourceDesc.DepthOrArraySize = 1;
+		resourceDesc.Width = sizeof(UINT)*m_uCounterNum;
+		resourceDesc.Height = 1;
+		resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+		m_d3ddevice->CreateCommittedResource(&heapProperty, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(m_counterCopyBuffer.GetAddressOf()));
+	}
 #endif
 }
 
@@ -75,6 +99,48 @@ void Profiler::CopyTimeDelta(UINT64 tick)
 #endif
 }
 
+void Profiler::ResolveCounters(ID3D12GraphicsCommandList * commandList, ID3D12Resource * counterBuffer)
+{
+#if defined(_PROFILING)
+	if (m_uCounterNum > 0)
+	{
+		D3D12_RESOURCE_BARRIER barrier;
+		ZeroMemory(&barrier, sizeof(barrier));
+		barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+		barrier.Transition.pResource = counterBuffer;
+		barrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+		barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+		barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE;
+		commandList->ResourceBarrier(1, &barrier);
+		commandList->CopyBufferRegion(m_counterCopyBuffer.Get(), 0, counterBuffer, 0, sizeof(UINT)*m_uCounterNum);
+		barrier.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_SOURCE;
+		barrier.Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+		commandList->ResourceBarrier(1, &barrier);
+		m_bCounterResolved = true;
+	}
+#endif
+}
+
+void Profiler::CopyCounters()
+{
+#if defined(_PROFILING)
+	if (m_bCounterResolved)
+	{
+		void* mapped = nullptr;
+		D3D12_RANGE range = D3D12_RANGE{ 0, sizeof(UINT)*m_uCounterNum };
+		m_counterCopyBuffer->Map(0, &range, &mapped);
+		m_counterList.assign((const UINT*)mapped, (const UINT*)mapped + m_uCounterNum);
+		m_counterCopyBuffer->Unmap(0, nullptr);
+		m_bCounterResolved = false;
+	}
+#endif
+}
+
+UINT Profiler::GetCounter(UINT index) const
+{
+	return index < m_counterList.size() ? m_counterList[index] : 0;
+}
+
 void Profiler::StartTime(ID3D12GraphicsCommandList * commandList)
 {
 #if defined(_PROFILING)
@@ -2,6 +2,7 @@
 // File: Profiler.h
 //
 // A class for creating a query heap to record timestamps and for computing the delta between timestamps.
+// It also reads back UINT counters written by shaders (e.g. LightOverflowStats of light culling).
 //--------------------------------------------------------------------------------------
 #include <wrl/client.h>
 #include <d3d12.h>
@@ -11,7 +12,8 @@ class Profiler
 {
 public:
 	Profiler();
-	void Init(ID3D12Device* const device, UINT maxNumber);
+	// counterNumber is the number of UINT counters read back by ResolveCounters.
+	void Init(ID3D12Device* const device, UINT maxNumber, UINT counterNumber = 0);
 
 	double GetProfileTime(UINT index);
 
@@ -22,6 +24,12 @@ public:
 	void EndTime(ID3D12GraphicsCommandList*const commandList, const std::string name);
 	void ResolveTimeDelta(ID3D12GraphicsCommandList * const commandList);
 
+	// Copy counters from a buffer in D3D12_RESOURCE_STATE_UNORDERED_ACCESS, the buffer is in the same state after the copy.
+	void ResolveCounters(ID3D12GraphicsCommandList * const commandList, ID3D12Resource * const counterBuffer);
+	// Read counters after the command list of ResolveCounters is finished.
+	void CopyCounters();
+	UINT GetCounter(UINT index) const;
+
 private:
 	void createReadBuffer();
 
@@ -41,5 +49,10 @@ private:
 	Microsoft::WRL::ComPtr<ID3D12QueryHeap> m_queryHeap;
 	Microsoft::WRL::ComPtr<ID3D12Resource> m_copyBuffer;
 
+	UINT m_uCounterNum;
+	bool m_bCounterResolved;
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_counterCopyBuffer;
+	std::vector<UINT> m_counterList;
+
 	std::vector<double> m_profileTimeList;
 };
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "ScreenQuadRenderer.h"
 #include  "VertexStructures.h"
 #include "d3dx12.h"
+#include "TileMesh.h"
 #include <vector>
 
 void ScreenQuadRenderer::Init()
@@ -44,43 +45,25 @@ void ScreenQuadRenderer::Init()
 
 }
 
-void ScreenQuadRenderer::InitTiles(int iTileNumX, int iTileNumY)
+void ScreenQuadRenderer::InitTiles(int iTileNumX, int iTileNumY, uint uSubdivision)
 {
+	// Generate the mesh from the triangle tables of the subdivision pattern, like the clusters of light culling.
+	std::vector<TileMeshVertex> meshVertexes;
+	std::vector<UINT> IndexList;
+	BuildTileMesh(uSubdivision, iTileNumX, iTileNumY, meshVertexes, IndexList);
 
 	std::vector<ScreenQuadVertex> VertexList;
-	float invTileXNum = 1.0f / iTileNumX;
-	float invTileYNum = 1.0f / iTileNumY;
 	// Create vertex buffer.
-	for (int j = 0; j < iTileNumY + 1; j++)
+	for (const TileMeshVertex& meshVertex : meshVertexes)
 	{
-		float v = invTileYNum*j;
-		float y = -v * 2 + 1.0f;
-		for (int i = 0; i < iTileNumX + 1; i++)
-		{
-			float u = invTileXNum*i;
-			float x = u * 2 - 1.0f;
-			ScreenQuadVertex vertex = { { x,y, 0.0f,1.0f },{ u,v } };
-			VertexList.push_back(vertex);
-		}
-
+		float x = meshVertex.u * 2 - 1.0f;
+		float y = -meshVertex.v * 2 + 1.0f;
+		ScreenQuadVertex vertex = { { x,y, 0.0f,1.0f },{ meshVertex.u,meshVertex.v } };
+		VertexList.push_back(vertex);
 	}
 	CreateCommittedBufferResource<ScreenQuadVertex>(&VertexList[0], VertexList.size(), m_vertexBuffer);
 
-	std::vector<UINT> IndexList;
 	// Create index buffer.
-	for (int j = 0; j < iTileNumY; j++)
-	{
-		for (int i = 0; i < iTileNumX; i++)
-		{
-			IndexList.push_back(i + (iTileNumX + 1)*j);
-			IndexList.push_back(i + 1 + (iTileNumX + 1)*j);
-			IndexList.push_back((j + 1)*(iTileNumX + 1) + i);
-
-			IndexList.push_back(i + 1 + (iTileNumX + 1)*j);
-			IndexList.push_back((j + 1)*(iTileNumX + 1) + i + 1);
-			IndexList.push_back((j + 1)*(iTileNumX + 1) + i);
-		}
-	}
 	CreateCommittedBufferResource<UINT>(&IndexList[0], IndexList.size(), m_indexBuffer);
 
 	m_vbView.BufferLocation = m_vertexBuffer->GetGPUVirtualAddress();
@@ -5,13 +5,16 @@
 //--------------------------------------------------------------------------------------
 #pragma once
 #include "DirectxHelper.h"
+#include "ShaderTypeDefine.h"
+#include "ClusteredCommon.h"
 
 class ScreenQuadRenderer
 {
 public:
 
 	void Init();
-	void InitTiles(int iTileNumX, int iTileNumY);
+	// Create the tile mesh of a subdivision pattern (TileSubdivision*).
+	void InitTiles(int iTileNumX, int iTileNumY, uint uSubdivision = TileSubdivision);
 
 	void Render(ID3D12GraphicsCommandList* const commandList);
 	void RenderTiles(ID3D12GraphicsCommandList* const commandList, const UINT instanceNum = 1);
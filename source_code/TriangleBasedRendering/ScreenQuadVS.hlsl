@@ -11,6 +11,8 @@ gs_in  main(vs_in vIn)
 	gs_in vOut;
 	vOut.position = vIn.position;
 	vOut.texcoord = vIn.texcoord;
+	// The ray of the vertex is linear in screen space, so the pixels interpolate it exactly.
+	vOut.viewRay = UseViewSpaceLighting ? GetViewRay(vIn.position.xy) : 0;
 
 	return vOut;
 }
\ No newline at end of file
@@ -2,8 +2,26 @@
 // File: ShaderTypeDefine.h
 // 
 // Define equivalent data types for C++ and HLSL.
+// Without the Windows SDK (e.g. building the CPU culling reference on Linux),
+// plain structures with the same memory layout as DirectXMath are used.
 //--------------------------------------------------------------------------------------
+#ifndef SHADERTYPE_DEFINE
+#define SHADERTYPE_DEFINE
+#if defined(_WIN32)
 #include<DirectXMath.h>
 typedef DirectX::XMFLOAT3 float3;
-typedef UINT uint;
-typedef DirectX::XMFLOAT4X4 float4x4;
\ No newline at end of file
+typedef DirectX::XMFLOAT4X4 float4x4;
+#else
+struct float3
+{
+	float x;
+	float y;
+	float z;
+};
+struct float4x4
+{
+	float m[4][4];
+};
+#endif
+typedef unsigned int uint;
+#endif
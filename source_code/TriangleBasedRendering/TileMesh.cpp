@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------------
+// File: TileMesh.cpp
+//--------------------------------------------------------------------------------------
+#include "TileMesh.h"
+
+bool IsTileCenterUsed(uint uPattern)
+{
+	for (uint i = 0; i < TilePatternTriangleNum[uPattern] * 3; i++)
+	{
+		if (TilePatternTriangleCorners[uPattern*TileMaxPrimitiveNum * 3 + i] == 4)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void BuildTileMesh(uint uPattern, uint uTileNumX, uint uTileNumY, std::vector<TileMeshVertex>& vertexes, std::vector<uint>& indexes)
+{
+	float invTileXNum = 1.0f / uTileNumX;
+	float invTileYNum = 1.0f / uTileNumY;
+	bool bUseCenter = IsTileCenterUsed(uPattern);
+	uint uGridVertexNum = (uTileNumX + 1)*(uTileNumY + 1);
+
+	// Corners of tiles.
+	vertexes.clear();
+	for (uint j = 0; j < uTileNumY + 1; j++)
+	{
+		for (uint i = 0; i < uTileNumX + 1; i++)
+		{
+			TileMeshVertex vertex = { invTileXNum*i, invTileYNum*j };
+			vertexes.push_back(vertex);
+		}
+	}
+	// Centers of tiles.
+	if (bUseCenter)
+	{
+		for (uint j = 0; j < uTileNumY; j++)
+		{
+			for (uint i = 0; i < uTileNumX; i++)
+			{
+				TileMeshVertex vertex = { invTileXNum*(i + 0.5f), invTileYNum*(j + 0.5f) };
+				vertexes.push_back(vertex);
+			}
+		}
+	}
+
+	indexes.clear();
+	const uint* pCorners = &TilePatternTriangleCorners[uPattern*TileMaxPrimitiveNum * 3];
+	for (uint j = 0; j < uTileNumY; j++)
+	{
+		for (uint i = 0; i < uTileNumX; i++)
+		{
+			// Top-left, top-right, bottom-left, bottom-right and center.
+			uint cornerIdx[5] =
+			{
+				i + (uTileNumX + 1)*j,
+				i + 1 + (uTileNumX + 1)*j,
+				(j + 1)*(uTileNumX + 1) + i,
+				(j + 1)*(uTileNumX + 1) + i + 1,
+				uGridVertexNum + i + uTileNumX*j
+			};
+			for (uint k = 0; k < TilePatternTriangleNum[uPattern] * 3; k++)
+			{
+				indexes.push_back(cornerIdx[pCorners[k]]);
+			}
+		}
+	}
+}
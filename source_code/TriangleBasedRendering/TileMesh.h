@@ -0,0 +1,26 @@
+//--------------------------------------------------------------------------------------
+// File: TileMesh.h
+//
+// The screen-size tile mesh of the light pass, generated from the triangle tables of a tile subdivision pattern
+// (TilePatternTriangleCorners in ClusteredCommon.h), so the mesh always matches the clusters of light culling.
+// Vertexes are the corners of tiles in a grid, followed by the centers of tiles if the pattern uses them.
+// Triangles are stored tile by tile, so SV_PrimitiveID / TilePatternTriangleNum[pattern] is the tile of a triangle.
+// The mesh doesn't need D3D12, so the CPU culling benchmark can count the vertex cost of a pattern.
+//--------------------------------------------------------------------------------------
+#pragma once
+#include <vector>
+#include "ShaderTypeDefine.h"
+#include "ClusteredCommon.h"
+
+// A vertex of the tile mesh, (0, 0) is the top-left corner of the screen and (1, 1) is the bottom-right corner.
+struct TileMeshVertex
+{
+	float u;
+	float v;
+};
+
+// Does a pattern use the centers of tiles (corner 4)?
+bool IsTileCenterUsed(uint uPattern);
+
+// Create the vertexes and the triangle list of uTileNumX*uTileNumY tiles.
+void BuildTileMesh(uint uPattern, uint uTileNumX, uint uTileNumY, std::vector<TileMeshVertex>& vertexes, std::vector<uint>& indexes);
@@ -0,0 +1,44 @@
+//--------------------------------------------------------------------------------------
+// File: TilePlane.hlsli
+//
+// The sides and the split planes of a tile (TilePlanes), for the tile plane table (TilePlaneCS) and the culling shaders.
+// Both create them with the same math, so clusters have the same planes with and without UseTilePlaneTable.
+//--------------------------------------------------------------------------------------
+
+// The ray of a corner of a tile (0---1 over 2---3) at view-space z = 1, the corner of the near plane divided by its depth.
+float3 GetTileCornerRay(uint2 tile, uint corner, float2 tileSize, uint2 tileNum, float4x4 projInv)
+{
+	float x = tileSize.x*(tile.x + (corner & 0x1));
+	float y = tileSize.y*(tile.y + ((corner & 0x2) >> 1));
+	uint uWindowWidthEvenlyDivisibleByTileRes = tileSize.x*tileNum.x;
+	uint uWindowHeightEvenlyDivisibleByTileRes = tileSize.y*tileNum.y;
+	float4 projPos = float4(x / (float)uWindowWidthEvenlyDivisibleByTileRes*2.f - 1.f,
+		(uWindowHeightEvenlyDivisibleByTileRes - y) / (float)uWindowHeightEvenlyDivisibleByTileRes*2.f - 1.f,
+		0, 1.0f);
+	float4 vertex = mul(projPos, projInv);
+	vertex /= vertex.w;
+	return float3(vertex.xy / vertex.z, 1);
+}
+
+// The planes through the camera and the corner rays of a tile, a plane is its unit normal.
+TilePlanes CreateTilePlanes(float3 corners[4])
+{
+	// 0---1
+	// |   |
+	// 2---3
+	TilePlanes T;
+	T.sides[0] = normalize(cross(corners[0], corners[1]));	// Up.
+	T.sides[1] = normalize(cross(corners[1], corners[3]));	// Right.
+	T.sides[2] = normalize(cross(corners[3], corners[2]));	// Down.
+	T.sides[3] = normalize(cross(corners[2], corners[0]));	// Left.
+	T.sides[4] = normalize(cross(corners[1], corners[2]));	// Top-left side of the diagonal.
+	T.sides[5] = normalize(cross(corners[2], corners[1]));	// Bottom-right side of the diagonal.
+	T.sides[6] = normalize(cross(corners[3], corners[0]));	// Top-right side of the anti-diagonal.
+	T.sides[7] = normalize(cross(corners[0], corners[3]));	// Bottom-left side of the anti-diagonal.
+	[unroll]
+	for (uint i = 0; i < 4; i++)
+	{
+		T.corners[i] = corners[i];
+	}
+	return T;
+}
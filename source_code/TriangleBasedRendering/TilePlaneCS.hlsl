@@ -0,0 +1,32 @@
+//--------------------------------------------------------------------------------------
+// File: TilePlaneCS.hlsl
+//
+// A compute shader to build the tile plane table (UseTilePlaneTable), a thread per tile.
+// The table is built again after the window or the projection changes.
+//--------------------------------------------------------------------------------------
+#include "ClusteredCommon.h"
+#include "CameraCommon.h"
+#include "TilePlane.hlsli"
+
+ConstantBuffer<ClusteredData> gCB : register(b0);	// Light culling information.
+ConstantBuffer<ViewData> gViewCB : register(b1);	// Camera data.
+RWStructuredBuffer<TilePlanes> gTilePlaneUAV : register(u10);	// The tile plane table, an entry per tile.
+
+[numthreads(NumThreadX, NumThreadY, 1)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	[branch]
+	if (DTid.x >= gCB.widthDim || DTid.y >= gCB.heightDim)
+	{
+		return;
+	}
+
+	float3 corners[4];
+	[unroll]
+	for (uint i = 0; i < 4; i++)
+	{
+		corners[i] = GetTileCornerRay(DTid.xy, i, float2(gCB.tileSizeX, gCB.tileSizeY), uint2(gCB.widthDim, gCB.heightDim), gViewCB.ProjInv);
+	}
+	TilePlanes T = CreateTilePlanes(corners);
+	gTilePlaneUAV[DTid.x + DTid.y*gCB.widthDim] = T;
+}
@@ -5,6 +5,7 @@
 #include "windowsApp.h"
 #include "DirectxHelper.h"
 #include <stdio.h>
+#include <math.h>
 #include "FbxRender.h"
 #include "DeferredRender.h"
 #include "CameraManager.h"
@@ -92,6 +93,7 @@ private:
 	int m_iLightNumberInfo;
 	double m_dLightCullTimeInfo;
 	double m_dLightingTimeInfo;
+	LightOverflowStats m_overflowInfo = {};
 
 	// Create a string for debugging.
 	std::wstring  CreateInfoText()
@@ -114,6 +116,16 @@ private:
 		output.append(L"Light Pass:");
 		output.append(std::to_wstring(m_dLightingTimeInfo * 1000));
 		output.append(L"ms\n");
+
+		output.append(L"Overflow Clusters:");
+		output.append(std::to_wstring(m_overflowInfo.overflowClusters));
+		output.append(L" (max ");
+		output.append(std::to_wstring(m_overflowInfo.maxClusterLights));
+		output.append(L" lights)\n");
+
+		output.append(L"Dropped Lights:");
+		output.append(std::to_wstring(m_overflowInfo.droppedLights));
+		output.append(L"\n");
 		if (UseTriLightCulling)
 		{
 			output.append(L"Triangle-based culling\n");
@@ -240,6 +252,7 @@ private:
 
 		m_computeProfiler.EndTime(m_computeCommandList.Get(), "Build Light");
 		m_computeProfiler.ResolveTimeDelta(m_computeCommandList.Get());
+		m_computeProfiler.ResolveCounters(m_computeCommandList.Get(), m_clusteredManager.GetOverflowStatsBuffer());
 
 		m_computeCommandList->Close();
 		
@@ -256,9 +269,15 @@ private:
 		UINT64 freq;
 		m_computeEngine.GetCommandQueue()->GetTimestampFrequency(&freq);
 		m_computeProfiler.CopyTimeDelta(freq);
+		m_computeProfiler.CopyCounters();
 
 		// Save debug data.
 		m_dLightCullTimeInfo = m_computeProfiler.GetProfileTime(0);
+		UINT* pOverflowInfo = (UINT*)&m_overflowInfo;
+		for (UINT i = 0; i < sizeof(LightOverflowStats) / sizeof(UINT); i++)
+		{
+			pOverflowInfo[i] = m_computeProfiler.GetCounter(i);
+		}
 	}
 
 
@@ -383,9 +402,10 @@ private:
 		m_bundleAllocator.Init(D3D12_COMMAND_LIST_TYPE_BUNDLE, 1);
 		m_computeEngine.InitCommandList(D3D12_COMMAND_LIST_TYPE_DIRECT, m_computeCommandList);
 		m_computeCommandList->Close();
-		m_computeProfiler.Init(GetDeviceResources()->GetD3DDevice(), 16);
+		m_computeProfiler.Init(GetDeviceResources()->GetD3DDevice(), 16, sizeof(LightOverflowStats) / sizeof(UINT));
 		m_profiler.Init(GetDeviceResources()->GetD3DDevice(), 16);
 		m_lightManager.Init(MaxLight, sizeof(PointLight));
+		m_lightManager.SetMortonOrder(UseMortonLightOrder, offsetof(PointLight, pos));
 
 		// Create a white texture for my material manager.
 		// If it doesn't find a texture for a material, it can use the white texture.
@@ -415,9 +435,8 @@ private:
 		shaderLoader.join();
 #endif
 		// Initialize D3D12 techniques.
-		// Originally, a clustered lighting manager supports multi-depth. However, after I modified the light accumulation method,
-		// it doesn't support Depth>1.
-		m_clusteredManager.Init(TileSize, TileSize, 1); 
+		// Every triangle (or tile) is split into ClusteredDepthNum clusters by depth.
+		m_clusteredManager.Init(TileSize, TileSize, ClusteredDepthNum);
 		m_deferredTech.Init();
 		m_deferredTech.InitTraditionalTileBased();
 		m_lightPreviewer.Init();
@@ -447,15 +466,20 @@ private:
 
 		m_deferredTech.UpdateConstantBuffer(m_cameraData);
 
-		// Create the depth planes for the clustered manager, when the culling stage supports multi-depth.
+		// Create the depth planes for the clustered manager.
 		// For N depth, we need N+1 planes for light culling.
-		float planes[2];
-		DirectX::XMFLOAT4 vec(0.0f, 0.0f, m_camera.GetNearestPlane(), 1.0f);
-		DirectX::XMFLOAT4 plane = GMathVF4(XMVector4Transform(GMathFV(vec), XMMatrixTranspose(GMathFM(m_cameraData.Proj))));
-		planes[0] = plane.z / plane.w;
-		vec = DirectX::XMFLOAT4(0.0f, 0.0f, m_camera.GetFarthestPlane(), 1.0f);
-		plane = GMathVF4(XMVector4Transform(GMathFV(vec), XMMatrixTranspose(GMathFM(m_cameraData.Proj))));
-		planes[1] = plane.z / plane.w;
+		// Planes are distributed exponentially in view space (near*(far/near)^(i/N)), so slices have similar shapes
+		// and near slices don't cover long depth ranges.
+		float planes[ClusteredDepthNum + 1];
+		float fNear = m_camera.GetNearestPlane();
+		float fFar = m_camera.GetFarthestPlane();
+		for (int i = 0; i <= ClusteredDepthNum; i++)
+		{
+			float fViewZ = fNear*powf(fFar / fNear, (float)i / (float)ClusteredDepthNum);
+			DirectX::XMFLOAT4 vec(0.0f, 0.0f, fViewZ, 1.0f);
+			DirectX::XMFLOAT4 plane = GMathVF4(XMVector4Transform(GMathFV(vec), XMMatrixTranspose(GMathFM(m_cameraData.Proj))));
+			planes[i] = plane.z / plane.w;
+		}
 		m_clusteredManager.UpdateDepthPlanes(planes);
 
 		// Copy all upload D3D12 resources to default D3D12 resources .
@@ -468,12 +492,15 @@ private:
 		// Input camera and light data to the light culling manager.
 		m_clusteredManager.SetCameraCB(m_deferredTech.GetViewCbGpuHandle());
 		m_clusteredManager.SetLightBuffer(m_lightManager.GetLightBuffer().Get(), m_lightManager.GetSrvDesc(), m_lightManager.GetLightNum());
+		m_clusteredManager.SetLightShapeBuffer(m_lightManager.GetLightShapeBuffer().Get(), m_lightManager.GetShapeSrvDesc(),
+			m_lightManager.GetSpotLightNum(), m_lightManager.GetCapsuleLightNum());
 		m_clusteredManager.SetDepthBuffer(m_deferredTech.GetDepthResource(), m_deferredTech.GetDepthSrvDesc());
 
 		// Input material, light culling data and light buffer to the deferred renderer.
 		m_deferredTech.SetMaterials(m_materialManager);
 		m_deferredTech.SetLightCullingMgr(m_clusteredManager);
 		m_deferredTech.SetLightBuffer(m_lightManager.GetLightBuffer().Get());
+		m_deferredTech.SetLightShapeBuffer(m_lightManager.GetLightShapeBuffer().Get());
 
 		// Input camera and light data to the light previewer.
 		m_lightPreviewer.UpdateCameraBuffer(m_deferredTech.GetViewCbGpuHandle());
@@ -505,6 +532,16 @@ private:
 		auto commandQueue = GetDeviceResources()->GetCommandQueue();
 		PIXBeginEvent(commandQueue, 0, L"Render");
 		{
+			// Grow (or shrink) the packed light indexes for the lists of the last culling, after both queues are idle.
+			if (GetPackedIndexCapacity(m_clusteredManager.GetPackedIndexCapacity(), m_overflowInfo.requiredIndexes,
+				m_clusteredManager.GetClusterNum()) != m_clusteredManager.GetPackedIndexCapacity())
+			{
+				g_d3dObjects->WaitForGPU();
+				m_computeEngine.WaitForGPU();
+				m_clusteredManager.ResizePackedIndexes(m_overflowInfo.requiredIndexes);
+				m_deferredTech.SetLightCullingMgr(m_clusteredManager);
+			}
+
 			// Reset the command allocator.
 			ThrowIfFailed(g_d3dObjects->GetCommandAllocator()->Reset());
 			// Rest the pre-depth command list.
@@ -557,7 +594,7 @@ private:
 			// Convert GPU resources for the light accumulation stage.
 			m_deferredTech.RtvToSrv(m_commandList.Get());
 
-			AddResourceBarrier(m_commandList.Get(),m_clusteredManager.GetClusteredBuffer(),D3D12_RESOURCE_STATE_UNORDERED_ACCESS,D3D12_RESOURCE_STATE_GENERIC_READ);
+			AddResourceBarrier(m_commandList.Get(), { m_clusteredManager.GetClusteredBuffer(), m_clusteredManager.GetLightListBuffer(), m_clusteredManager.GetTileDiagonalBuffer() }, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ);
 			if (m_bDebugMode)
 			{
 				// Visualization of the number of lights.
@@ -600,7 +637,7 @@ private:
 			// End profiling light accumulation.
 			m_profiler.EndTime(m_commandList.Get(), "LightPass");
 			m_profiler.ResolveTimeDelta(m_commandList.Get());
-			AddResourceBarrier(m_commandList.Get(), m_clusteredManager.GetClusteredBuffer(), D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+			AddResourceBarrier(m_commandList.Get(), { m_clusteredManager.GetClusteredBuffer(), m_clusteredManager.GetLightListBuffer(), m_clusteredManager.GetTileDiagonalBuffer() }, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 
 			// Draw the positions of lights.
 			if (m_bLightDebugMode && !m_bDebugMode)
@@ -677,6 +714,8 @@ private:
 			{
 				m_lightManager.UpdateLightBuffer(&m_lights[0], sizeof(m_lights[0]), m_lights.size(), false);
 				m_clusteredManager.SetLightBuffer(m_lightManager.GetLightBuffer().Get(), m_lightManager.GetSrvDesc(), m_lightManager.GetLightNum());
+				m_clusteredManager.SetLightShapeBuffer(m_lightManager.GetLightShapeBuffer().Get(), m_lightManager.GetShapeSrvDesc(),
+					m_lightManager.GetSpotLightNum(), m_lightManager.GetCapsuleLightNum());
 				m_lightPreviewer.SetLightBuffer(m_lightManager.GetLightBuffer().Get(), m_lightManager.GetLightNum());
 				m_bEditLight = false;
 			}
@@ -687,6 +726,8 @@ private:
 				m_deferredTech.SetMaterials(m_materialManager);
 				RandomLight(m_fbxRender);
 				m_camera.Position(m_fbxRender.GetCenter());
+				// The depth buffer has new geometry.
+				m_clusteredManager.Invalidate();
 				m_bBundleEdit = true;
 				m_bSwitchSceneFinished = false;
 				m_bSwitchingScene = false;
@@ -701,6 +742,7 @@ private:
 			m_cameraData.Proj = m_camera.Proj();
 			m_cameraData.View = m_camera.View();
 			m_deferredTech.UpdateConstantBuffer(m_cameraData);
+			m_clusteredManager.UpdateViewData(m_cameraData);
 
 			// Save Debug data.
 			m_iLightNumberInfo = m_lights.size();